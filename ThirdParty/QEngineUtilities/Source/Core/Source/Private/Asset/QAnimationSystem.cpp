@@ -0,0 +1,140 @@
+#include "Asset/QAnimationSystem.h"
+#include "Asset/QSkeletalMesh.h"
+#include "QMutex"
+#include "QSemaphore"
+#include "QElapsedTimer"
+#include "tracy/Tracy.hpp"
+
+struct QAnimationSystemContext {
+	QMutex mutex;
+	bool enabled = true;
+	QVector<QSkeletalMesh*> meshes;
+	QAnimationSystem::Statistics statistics;
+	QElapsedTimer clock;
+	qint64 lastTickNsec = -1;
+};
+
+static QAnimationSystemContext& animationSystemContext() {
+	static QAnimationSystemContext context;
+	return context;
+}
+
+void QAnimationSystem::registerMesh(QSkeletalMesh* inMesh)
+{
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	if (!context.meshes.contains(inMesh))
+		context.meshes << inMesh;
+}
+
+void QAnimationSystem::unregisterMesh(QSkeletalMesh* inMesh)
+{
+	// Blocks while a tick is evaluating, so a destroyed mesh is never touched by a job
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	context.meshes.removeOne(inMesh);
+}
+
+void QAnimationSystem::tickLocked(float inDeltaSec)
+{
+	ZoneScopedN("QAnimationSystem::tick");
+	QAnimationSystemContext& context = animationSystemContext();
+	if (!context.clock.isValid())
+		context.clock.start();
+	context.lastTickNsec = context.clock.nsecsElapsed();
+	if (!context.enabled)
+		return;
+	QElapsedTimer timer;
+	timer.start();
+
+	// Clips are shared between meshes, binding compresses them on first use, so it happens here before any job starts
+	QVector<QSkeletalMesh*> playing;
+	for (QSkeletalMesh* mesh : context.meshes) {
+		if (mesh->isAnimationPlaying()) {
+			mesh->bindAnimations();
+			playing << mesh;
+		}
+	}
+
+	// Each mesh only touches its own playback state, scratch transforms and back pose buffer
+	QThreadPool* threadPool = evaluateThreadPool();
+	const int count = playing.size();
+	const int chunkCount = qBound(1, count / 8, qMax(1, threadPool->maxThreadCount()));
+	const int chunkSize = count > 0 ? (count + chunkCount - 1) / chunkCount : 0;
+	QVector<char> evaluated(count, 0);
+	auto evaluate = [&playing, &evaluated, inDeltaSec](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			evaluated[i] = playing[i]->advanceAnimation(inDeltaSec);
+		}
+	};
+	QSemaphore finished;
+	int started = 0;
+	for (int begin = chunkSize; begin < count; begin += chunkSize) {
+		const int end = qMin(begin + chunkSize, count);
+		threadPool->start([&evaluate, &finished, begin, end]() {
+			evaluate(begin, end);
+			finished.release();
+		});
+		started++;
+	}
+	evaluate(0, qMin(chunkSize, count));
+	finished.acquire(started);
+
+	quint32 bones = 0;
+	for (int i = 0; i < count; i++) {
+		if (!evaluated[i])
+			continue;
+		playing[i]->publishPoses();
+		bones += playing[i]->mSkeleton->mBoneOffsetMatrix.size();
+	}
+	context.statistics.frames++;
+	context.statistics.meshes = count;
+	context.statistics.bones = bones;
+	context.statistics.evaluateNanoseconds = timer.nsecsElapsed();
+	TracyPlot("AnimatedBones", int64_t(bones));
+}
+
+void QAnimationSystem::tick()
+{
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	// Every renderer ticks, so the step is measured from whichever tick came last rather than from the caller's own frame
+	float deltaSec = 0.0f;
+	if (context.clock.isValid() && context.lastTickNsec >= 0)
+		deltaSec = (context.clock.nsecsElapsed() - context.lastTickNsec) / 1e9f;
+	tickLocked(deltaSec);
+}
+
+void QAnimationSystem::tick(float inDeltaSec)
+{
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	tickLocked(inDeltaSec);
+}
+
+void QAnimationSystem::setEnabled(bool enabled)
+{
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	context.enabled = enabled;
+}
+
+bool QAnimationSystem::isEnabled()
+{
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	return context.enabled;
+}
+
+QAnimationSystem::Statistics QAnimationSystem::getStatistics()
+{
+	QAnimationSystemContext& context = animationSystemContext();
+	QMutexLocker locker(&context.mutex);
+	return context.statistics;
+}
+
+QThreadPool* QAnimationSystem::evaluateThreadPool()
+{
+	static QThreadPool threadPool;
+	return &threadPool;
+}
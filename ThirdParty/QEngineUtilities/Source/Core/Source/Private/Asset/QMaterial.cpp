@@ -5,7 +5,83 @@
 #include "assimp/scene.h"
 #include "QDir"
 #include "QImage"
+#include "QFuture"
+#include "QMutex"
+#include "QPromise"
+#include <memory>
 
+struct QTextureCacheContext {
+	QMutex mutex;
+	QHash<QString, std::weak_ptr<const QImage>> images;
+	QHash<QString, QFuture<QImage>> pendingDecodes;
+};
+
+static QTextureCacheContext& textureCacheContext() {
+	static QTextureCacheContext context;
+	return context;
+}
+
+static void releaseSharedImage(void* info)
+{
+	delete static_cast<std::shared_ptr<const QImage>*>(info);
+}
+
+// Every handed out image wraps the cached pixels and keeps them alive, writers detach into their own copy
+static QImage makeSharedImage(const std::shared_ptr<const QImage>& source)
+{
+	if (!source || source->isNull())
+		return QImage();
+	return QImage(source->constBits(), source->width(), source->height(), source->bytesPerLine(), source->format(), releaseSharedImage, new std::shared_ptr<const QImage>(source));
+}
+
+static QImage findCachedTexture(QTextureCacheContext& context, const QString& key)
+{
+	return makeSharedImage(context.images.value(key).lock());
+}
+
+static QFuture<QImage> loadTextureAsync(const QString& key, std::function<QImage()> decoder)
+{
+	QTextureCacheContext& context = textureCacheContext();
+	QMutexLocker locker(&context.mutex);
+	auto promise = std::make_shared<QPromise<QImage>>();
+	QFuture<QImage> future = promise->future();
+	promise->start();
+	QImage cached = findCachedTexture(context, key);
+	if (!cached.isNull()) {
+		promise->addResult(cached);
+		promise->finish();
+		return future;
+	}
+	auto pending = context.pendingDecodes.constFind(key);
+	if (pending != context.pendingDecodes.constEnd())
+		return pending.value();
+	context.pendingDecodes[key] = future;
+	QMaterial::textureDecodeThreadPool()->start([promise, key, decoder]() {
+		QImage image = decoder();
+		if (!image.isNull())
+			image.convertTo(QImage::Format_RGBA8888);
+		std::shared_ptr<const QImage> decoded = std::make_shared<const QImage>(std::move(image));
+		promise->addResult(makeSharedImage(decoded));
+		QTextureCacheContext& context = textureCacheContext();
+		QMutexLocker locker(&context.mutex);
+		if (!decoded->isNull())
+			context.images[key] = decoded;
+		context.pendingDecodes.remove(key);
+		promise->finish();
+	});
+	return future;
+}
+
+static QImage decodeTextureSource(const QMaterial::TextureSource& source)
+{
+	if (source.embeddedData.isEmpty())
+		return QImage(source.key);
+	if (source.embeddedSize.isValid())
+		return QImage((const uchar*)source.embeddedData.constData(), source.embeddedSize.width(), source.embeddedSize.height(), QImage::Format_ARGB32);
+	QImage image;
+	image.loadFromData(source.embeddedData, source.formatHint.isEmpty() ? nullptr : source.formatHint.constData());
+	return image;
+}
 
 QVector<QSharedPointer<QMaterial>> QMaterial::CreateFromScene(const aiScene* scene, QString modelPath) {
 	QDir modelDir = QFileInfo(modelPath).dir();
@@ -14,6 +90,9 @@ QVector<QSharedPointer<QMaterial>> QMaterial::CreateFromScene(const aiScene* sce
 		"BaseColor","NormalCamera","EmissionColor","Metallic","Roughness","AmbientOcclusion",
 		"Unknown","Sheen","ClearCoat","Transmission" };
 
+	// Embedded textures are copied out of the scene once, materials sharing one share the bytes
+	QHash<QString, TextureSource> embeddedSources;
+	const QString embeddedPrefix = QFileInfo(modelPath).absoluteFilePath() + "|";
 	for (uint i = 0; i < scene->mNumMaterials; i++) {
 		QSharedPointer<QMaterial> material = QSharedPointer<QMaterial>::create();
 		aiMaterial* rawMaterial = scene->mMaterials[i];
@@ -30,31 +109,74 @@ QVector<QSharedPointer<QMaterial>> QMaterial::CreateFromScene(const aiScene* sce
 					modelDir.setPath(newPath);
 				}
 				QString realPath = modelDir.filePath(path.C_Str());
-				QImage image;
+				QString slotName = TextureNameMap[i];
+				if (j != 0) {
+					slotName += QString::number(j);
+				}
+				TextureSource source;
 				if (QFile::exists(realPath)) {
-					image.load(realPath);
+					source.key = QFileInfo(realPath).absoluteFilePath();
 				}
-				else {
-					const aiTexture* embTexture = scene->GetEmbeddedTexture(path.C_Str());
-					if (embTexture != nullptr) {
+				else if (const aiTexture* embTexture = scene->GetEmbeddedTexture(path.C_Str())) {
+					source.key = embeddedPrefix + path.C_Str();
+					auto embedded = embeddedSources.constFind(source.key);
+					if (embedded == embeddedSources.constEnd()) {
 						if (embTexture->mHeight == 0) {
-							image.loadFromData((uchar*)embTexture->pcData, embTexture->mWidth, embTexture->achFormatHint);
+							source.embeddedData = QByteArray((const char*)embTexture->pcData, embTexture->mWidth);
+							source.formatHint = embTexture->achFormatHint;
 						}
 						else {
-							image = QImage((uchar*)embTexture->pcData, embTexture->mWidth, embTexture->mHeight, QImage::Format_ARGB32);
+							source.embeddedData = QByteArray((const char*)embTexture->pcData, embTexture->mWidth * embTexture->mHeight * sizeof(aiTexel));
+							source.embeddedSize = QSize(embTexture->mWidth, embTexture->mHeight);
 						}
+						embedded = embeddedSources.insert(source.key, source);
 					}
+					source = embedded.value();
 				}
-				QString slotName = TextureNameMap[i];
-				if (j != 0) {
-					slotName += QString::number(j);
-				}
-				if (!image.isNull()) {
-					material->mProperties[slotName] = image;
+				else {
+					continue;
 				}
+				material->mTextureSources[slotName] = source;
 			}
 		}
 		materialList << material;
 	}
+	ResolveTextures(materialList);
 	return materialList;
 }
+
+void QMaterial::ResolveTextures(const QVector<QSharedPointer<QMaterial>>& inMaterials)
+{
+	QHash<QString, QFuture<QImage>> decodes;
+	for (const auto& material : inMaterials) {
+		for (const auto& source : material->mTextureSources) {
+			if (!decodes.contains(source.key)) {
+				decodes[source.key] = loadTextureAsync(source.key, [source]() {
+					return decodeTextureSource(source);
+				});
+			}
+		}
+	}
+	for (const auto& material : inMaterials) {
+		for (const auto& slot : material->mTextureSources.asKeyValueRange()) {
+			QImage image = decodes[slot.second.key].result();
+			if (!image.isNull()) {
+				material->mProperties[slot.first] = image;
+			}
+		}
+	}
+}
+
+QImage QMaterial::LoadTexture(const QString& inFilePath)
+{
+	const QString key = QFileInfo(inFilePath).absoluteFilePath();
+	return loadTextureAsync(key, [inFilePath]() {
+		return QImage(inFilePath);
+	}).result();
+}
+
+QThreadPool* QMaterial::textureDecodeThreadPool()
+{
+	static QThreadPool threadPool;
+	return &threadPool;
+}
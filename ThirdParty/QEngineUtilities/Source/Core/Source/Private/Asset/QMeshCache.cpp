@@ -0,0 +1,468 @@
+#include "Asset/QMeshCache.h"
+#include "Asset/QStaticMesh.h"
+#include "Asset/QSkeletalMesh.h"
+#include "Asset/QMeshOptimizer.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+
+static const quint32 kMeshCacheMagic = 0x4853454D;	// "MESH"
+static const quint32 kMeshCacheVersion = 6;
+
+enum class MeshCacheKind : quint32 {
+	Static = 1,
+	Skeletal = 2
+};
+
+// Vertex and index blobs are stored as the in-memory layout, 16 byte aligned, followed by a QDataStream section for everything else
+struct MeshCacheHeader {
+	quint32 magic;
+	quint32 version;
+	quint32 kind;
+	quint32 vertexStride;
+	qint64 sourceSize;
+	qint64 sourceModified;
+	quint64 optimizerSettings;		// QMeshOptimizer::getSettingsKey() at import, the optimizer reorders vertices and builds the lods
+	quint64 vertexOffset;
+	quint64 vertexCount;
+	quint64 indexOffset;
+	quint64 indexCount;
+	quint64 metaOffset;
+	quint64 metaSize;
+};
+
+struct QMeshCacheContext {
+	QMutex mutex;
+	QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/MeshCache";
+	bool enabled = true;
+};
+
+static QMeshCacheContext& meshCacheContext() {
+	static QMeshCacheContext context;
+	return context;
+}
+
+static QString meshCacheFilePath(const QString& inSourcePath)
+{
+	QMeshCacheContext& context = meshCacheContext();
+	QMutexLocker locker(&context.mutex);
+	if (!context.enabled || context.directory.isEmpty())
+		return QString();
+	const QByteArray key = QCryptographicHash::hash(QFileInfo(inSourcePath).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+	return context.directory + "/" + key + ".qmesh";
+}
+
+static quint64 alignedOffset(quint64 offset)
+{
+	return (offset + 15) & ~quint64(15);
+}
+
+template<typename VertexType>
+static bool writeMeshCache(const QString& inSourcePath, MeshCacheKind kind, const QVector<VertexType>& vertices, const QVector<quint32>& indices, const QByteArray& meta)
+{
+	const QString filePath = meshCacheFilePath(inSourcePath);
+	const QFileInfo sourceInfo(inSourcePath);
+	if (filePath.isEmpty() || !sourceInfo.exists())
+		return false;
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = kMeshCacheMagic;
+	header.version = kMeshCacheVersion;
+	header.kind = (quint32)kind;
+	header.vertexStride = sizeof(VertexType);
+	header.sourceSize = sourceInfo.size();
+	header.sourceModified = sourceInfo.lastModified().toMSecsSinceEpoch();
+	header.optimizerSettings = QMeshOptimizer::getSettingsKey();
+	header.vertexOffset = alignedOffset(sizeof(MeshCacheHeader));
+	header.vertexCount = vertices.size();
+	header.indexOffset = alignedOffset(header.vertexOffset + header.vertexCount * sizeof(VertexType));
+	header.indexCount = indices.size();
+	header.metaOffset = alignedOffset(header.indexOffset + header.indexCount * sizeof(quint32));
+	header.metaSize = meta.size();
+
+	QDir().mkpath(QFileInfo(filePath).absolutePath());
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	auto writeAt = [&file](quint64 offset, const void* data, quint64 size) {
+		if ((quint64)file.pos() < offset)
+			file.write(QByteArray(offset - file.pos(), '\0'));
+		file.write((const char*)data, size);
+	};
+	writeAt(0, &header, sizeof(header));
+	writeAt(header.vertexOffset, vertices.constData(), header.vertexCount * sizeof(VertexType));
+	writeAt(header.indexOffset, indices.constData(), header.indexCount * sizeof(quint32));
+	writeAt(header.metaOffset, meta.constData(), header.metaSize);
+	return file.commit();
+}
+
+class QMappedMeshCache {
+public:
+	~QMappedMeshCache() {
+		if (mData)
+			mFile.unmap(mData);
+	}
+
+	bool open(const QString& inSourcePath, MeshCacheKind kind, quint32 vertexStride) {
+		const QString filePath = meshCacheFilePath(inSourcePath);
+		const QFileInfo sourceInfo(inSourcePath);
+		if (filePath.isEmpty() || !sourceInfo.exists())
+			return false;
+		mFile.setFileName(filePath);
+		if (!mFile.open(QIODevice::ReadOnly) || mFile.size() < (qint64)sizeof(MeshCacheHeader))
+			return false;
+		mData = mFile.map(0, mFile.size());
+		if (!mData)
+			return false;
+		memcpy(&mHeader, mData, sizeof(MeshCacheHeader));
+		const quint64 fileSize = mFile.size();
+		return mHeader.magic == kMeshCacheMagic
+			&& mHeader.version == kMeshCacheVersion
+			&& mHeader.kind == (quint32)kind
+			&& mHeader.vertexStride == vertexStride
+			&& mHeader.sourceSize == sourceInfo.size()
+			&& mHeader.sourceModified == sourceInfo.lastModified().toMSecsSinceEpoch()
+			&& mHeader.optimizerSettings == QMeshOptimizer::getSettingsKey()
+			&& mHeader.vertexOffset + mHeader.vertexCount * vertexStride <= fileSize
+			&& mHeader.indexOffset + mHeader.indexCount * sizeof(quint32) <= fileSize
+			&& mHeader.metaOffset + mHeader.metaSize <= fileSize;
+	}
+
+	template<typename VertexType>
+	void copyVertices(QVector<VertexType>& outVertices) const {
+		outVertices.resize(mHeader.vertexCount);
+		memcpy(outVertices.data(), mData + mHeader.vertexOffset, mHeader.vertexCount * sizeof(VertexType));
+	}
+
+	void copyIndices(QVector<quint32>& outIndices) const {
+		outIndices.resize(mHeader.indexCount);
+		memcpy(outIndices.data(), mData + mHeader.indexOffset, mHeader.indexCount * sizeof(quint32));
+	}
+
+	QByteArray meta() const {
+		return QByteArray::fromRawData((const char*)mData + mHeader.metaOffset, mHeader.metaSize);
+	}
+private:
+	QFile mFile;
+	uchar* mData = nullptr;
+	MeshCacheHeader mHeader;
+};
+
+static void writeBounds(QDataStream& stream, const MathUtils::AABB& bounds)
+{
+	stream << bounds.min << bounds.max;
+}
+
+static void readBounds(QDataStream& stream, MathUtils::AABB& bounds)
+{
+	stream >> bounds.min >> bounds.max;
+}
+
+// Textures are stored as their sources and resolved through the texture cache, the pixels are never encoded into the mesh cache
+static void writeMaterials(QDataStream& stream, const QVector<QSharedPointer<QMaterial>>& materials)
+{
+	stream << quint32(materials.size());
+	for (const auto& material : materials) {
+		QMap<QString, QVariant> properties = material->mProperties;
+		for (const QString& slotName : material->mTextureSources.keys())
+			properties.remove(slotName);
+		stream << properties << quint32(material->mTextureSources.size());
+		for (const auto& slot : material->mTextureSources.asKeyValueRange()) {
+			const QMaterial::TextureSource& source = slot.second;
+			stream << slot.first << source.key << source.embeddedData << source.formatHint << source.embeddedSize;
+		}
+	}
+}
+
+static void readMaterials(QDataStream& stream, QVector<QSharedPointer<QMaterial>>& materials)
+{
+	quint32 count = 0;
+	stream >> count;
+	for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+		QSharedPointer<QMaterial> material = QSharedPointer<QMaterial>::create();
+		quint32 sourceCount = 0;
+		stream >> material->mProperties >> sourceCount;
+		for (quint32 j = 0; j < sourceCount && stream.status() == QDataStream::Ok; j++) {
+			QString slotName;
+			QMaterial::TextureSource source;
+			stream >> slotName >> source.key >> source.embeddedData >> source.formatHint >> source.embeddedSize;
+			material->mTextureSources[slotName] = source;
+		}
+		materials << material;
+	}
+}
+
+template<typename MeshType>
+static bool hasValidRanges(const MeshType& mesh)
+{
+	for (const auto& submesh : mesh.mSubmeshes) {
+		if (quint64(submesh.verticesOffset) + submesh.verticesRange > quint64(mesh.mVertices.size())
+			|| quint64(submesh.indicesOffset) + submesh.indicesRange > quint64(mesh.mIndices.size())
+			|| submesh.materialIndex >= quint32(qMax<qsizetype>(mesh.mMaterials.size(), 1)))
+			return false;
+	}
+	return true;
+}
+
+static void writeMeshNode(QDataStream& stream, const QSkeleton::MeshNode* node)
+{
+	stream << node->name << node->localTransform << quint32(node->children.size());
+	for (const auto& child : node->children) {
+		writeMeshNode(stream, child.get());
+	}
+}
+
+static QSharedPointer<QSkeleton::MeshNode> readMeshNode(QDataStream& stream)
+{
+	QSharedPointer<QSkeleton::MeshNode> node = QSharedPointer<QSkeleton::MeshNode>::create();
+	quint32 childCount = 0;
+	stream >> node->name >> node->localTransform >> childCount;
+	for (quint32 i = 0; i < childCount && stream.status() == QDataStream::Ok; i++) {
+		node->children << readMeshNode(stream);
+	}
+	return node;
+}
+
+static void writeAnimationChannel(QDataStream& stream, const QSkeletalAnimation::Channel& channel)
+{
+	stream << channel.keyOffset << channel.keyCount << channel.rangeMin << channel.rangeExtent;
+}
+
+static void readAnimationChannel(QDataStream& stream, QSkeletalAnimation::Channel& channel)
+{
+	stream >> channel.keyOffset >> channel.keyCount >> channel.rangeMin >> channel.rangeExtent;
+}
+
+static bool hasValidKeys(const QSkeletalAnimation& animation, const QSkeletalAnimation::Channel& channel)
+{
+	return quint64(channel.keyOffset) + channel.keyCount <= quint64(animation.mKeyFrames.size());
+}
+
+// Clips are stored the way they are sampled, loading never touches the source keys or runs the compressor again
+static void writeAnimation(QDataStream& stream, const QSkeletalAnimation& animation)
+{
+	stream << animation.mDuration << animation.mTicksPerSecond << animation.mSampleRate;
+	stream << quint32(animation.mTracks.size());
+	for (const auto& track : animation.mTracks) {
+		stream << track.name;
+		writeAnimationChannel(stream, track.translation);
+		writeAnimationChannel(stream, track.rotation);
+		writeAnimationChannel(stream, track.scaling);
+		stream << track.referenceTranslation << track.referenceRotation << track.referenceScaling;
+	}
+	stream << animation.mKeyFrames << animation.mKeyData;
+	const QSkeletalAnimation::CompressionStatistics& statistics = animation.mCompressionStatistics;
+	stream << statistics.sourceKeys << statistics.compressedKeys << statistics.sourceBytes << statistics.compressedBytes;
+}
+
+static bool readAnimation(QDataStream& stream, QSkeletalAnimation& animation)
+{
+	quint32 trackCount = 0;
+	stream >> animation.mDuration >> animation.mTicksPerSecond >> animation.mSampleRate >> trackCount;
+	for (quint32 i = 0; i < trackCount && stream.status() == QDataStream::Ok; i++) {
+		QSkeletalAnimation::Track track;
+		stream >> track.name;
+		readAnimationChannel(stream, track.translation);
+		readAnimationChannel(stream, track.rotation);
+		readAnimationChannel(stream, track.scaling);
+		stream >> track.referenceTranslation >> track.referenceRotation >> track.referenceScaling;
+		animation.mTracks << track;
+	}
+	stream >> animation.mKeyFrames >> animation.mKeyData;
+	QSkeletalAnimation::CompressionStatistics& statistics = animation.mCompressionStatistics;
+	stream >> statistics.sourceKeys >> statistics.compressedKeys >> statistics.sourceBytes >> statistics.compressedBytes;
+	if (stream.status() != QDataStream::Ok || !animation.isCompressed() || animation.mKeyData.size() != animation.mKeyFrames.size() * 3)
+		return false;
+	for (const auto& track : animation.mTracks) {
+		if (!hasValidKeys(animation, track.translation) || !hasValidKeys(animation, track.rotation) || !hasValidKeys(animation, track.scaling))
+			return false;
+	}
+	return true;
+}
+
+void QMeshCache::setCacheDirectory(const QString& dir)
+{
+	QMeshCacheContext& context = meshCacheContext();
+	QMutexLocker locker(&context.mutex);
+	context.directory = dir;
+}
+
+QString QMeshCache::getCacheDirectory()
+{
+	QMeshCacheContext& context = meshCacheContext();
+	QMutexLocker locker(&context.mutex);
+	return context.directory;
+}
+
+void QMeshCache::setEnabled(bool enabled)
+{
+	QMeshCacheContext& context = meshCacheContext();
+	QMutexLocker locker(&context.mutex);
+	context.enabled = enabled;
+}
+
+bool QMeshCache::isEnabled()
+{
+	QMeshCacheContext& context = meshCacheContext();
+	QMutexLocker locker(&context.mutex);
+	return context.enabled;
+}
+
+QSharedPointer<QStaticMesh> QMeshCache::loadStaticMesh(const QString& inSourcePath)
+{
+	QMappedMeshCache cache;
+	if (!cache.open(inSourcePath, MeshCacheKind::Static, sizeof(QStaticMesh::Vertex)))
+		return nullptr;
+	QSharedPointer<QStaticMesh> staticMesh = QSharedPointer<QStaticMesh>::create();
+	cache.copyVertices(staticMesh->mVertices);
+	cache.copyIndices(staticMesh->mIndices);
+
+	QDataStream stream(cache.meta());
+	stream.setVersion(QDataStream::Qt_6_0);
+	quint32 submeshCount = 0;
+	stream >> submeshCount;
+	for (quint32 i = 0; i < submeshCount && stream.status() == QDataStream::Ok; i++) {
+		QStaticMesh::SubMeshData submesh;
+		stream >> submesh.verticesOffset >> submesh.verticesRange >> submesh.indicesOffset >> submesh.indicesRange >> submesh.materialIndex >> submesh.localTransfrom;
+		readBounds(stream, submesh.localBounds);
+		quint32 lodCount = 0;
+		stream >> lodCount;
+		for (quint32 j = 0; j < lodCount && stream.status() == QDataStream::Ok; j++) {
+			QStaticMesh::LodData lod;
+			stream >> lod.indicesOffset >> lod.indicesRange >> lod.error;
+			if (quint64(lod.indicesOffset) + lod.indicesRange > quint64(staticMesh->mIndices.size()))
+				return nullptr;
+			submesh.lods << lod;
+		}
+		staticMesh->mSubmeshes << submesh;
+	}
+	readMaterials(stream, staticMesh->mMaterials);
+	if (stream.status() != QDataStream::Ok || !hasValidRanges(*staticMesh))
+		return nullptr;
+	QMaterial::ResolveTextures(staticMesh->mMaterials);
+	return staticMesh;
+}
+
+bool QMeshCache::saveStaticMesh(const QString& inSourcePath, const QStaticMesh& inMesh)
+{
+	QByteArray meta;
+	QDataStream stream(&meta, QIODevice::WriteOnly);
+	stream.setVersion(QDataStream::Qt_6_0);
+	stream << quint32(inMesh.mSubmeshes.size());
+	for (const auto& submesh : inMesh.mSubmeshes) {
+		stream << submesh.verticesOffset << submesh.verticesRange << submesh.indicesOffset << submesh.indicesRange << submesh.materialIndex << submesh.localTransfrom;
+		writeBounds(stream, submesh.localBounds);
+		stream << quint32(submesh.lods.size());
+		for (const auto& lod : submesh.lods) {
+			stream << lod.indicesOffset << lod.indicesRange << lod.error;
+		}
+	}
+	writeMaterials(stream, inMesh.mMaterials);
+	if (stream.status() != QDataStream::Ok)
+		return false;
+	return writeMeshCache(inSourcePath, MeshCacheKind::Static, inMesh.mVertices, inMesh.mIndices, meta);
+}
+
+QSharedPointer<QSkeletalMesh> QMeshCache::loadSkeletalMesh(const QString& inSourcePath)
+{
+	QMappedMeshCache cache;
+	if (!cache.open(inSourcePath, MeshCacheKind::Skeletal, sizeof(QSkeletalMesh::Vertex)))
+		return nullptr;
+	QSharedPointer<QSkeletalMesh> skeletalMesh = QSharedPointer<QSkeletalMesh>::create();
+	cache.copyVertices(skeletalMesh->mVertices);
+	cache.copyIndices(skeletalMesh->mIndices);
+
+	QDataStream stream(cache.meta());
+	stream.setVersion(QDataStream::Qt_6_0);
+	quint32 submeshCount = 0;
+	stream >> submeshCount;
+	for (quint32 i = 0; i < submeshCount && stream.status() == QDataStream::Ok; i++) {
+		QSkeletalMesh::SubMeshData submesh;
+		stream >> submesh.verticesOffset >> submesh.verticesRange >> submesh.indicesOffset >> submesh.indicesRange >> submesh.materialIndex;
+		readBounds(stream, submesh.localBounds);
+		skeletalMesh->mSubmeshes << submesh;
+	}
+	readMaterials(stream, skeletalMesh->mMaterials);
+
+	skeletalMesh->mSkeleton = QSharedPointer<QSkeleton>::create();
+	skeletalMesh->mSkeleton->mMeshRoot = readMeshNode(stream);
+	quint32 boneCount = 0;
+	stream >> boneCount;
+	for (quint32 i = 0; i < boneCount && stream.status() == QDataStream::Ok; i++) {
+		QSharedPointer<QSkeleton::BoneNode> boneNode = QSharedPointer<QSkeleton::BoneNode>::create();
+		stream >> boneNode->index >> boneNode->name >> boneNode->transformOffset;
+		skeletalMesh->mSkeleton->mBoneMap[boneNode->name] = boneNode;
+	}
+	stream >> skeletalMesh->mSkeleton->mBoneOffsetMatrix;
+
+	quint32 animationCount = 0;
+	stream >> animationCount;
+	for (quint32 i = 0; i < animationCount && stream.status() == QDataStream::Ok; i++) {
+		QSharedPointer<QSkeletalAnimation> animation = QSharedPointer<QSkeletalAnimation>::create();
+		if (!readAnimation(stream, *animation))
+			return nullptr;
+		skeletalMesh->mAnimations << animation;
+	}
+	if (stream.status() != QDataStream::Ok || !hasValidRanges(*skeletalMesh))
+		return nullptr;
+	for (const auto& bone : skeletalMesh->mSkeleton->mBoneMap) {
+		if (bone->index >= skeletalMesh->mSkeleton->mBoneOffsetMatrix.size())
+			return nullptr;
+	}
+	QMaterial::ResolveTextures(skeletalMesh->mMaterials);
+	return skeletalMesh;
+}
+
+bool QMeshCache::saveSkeletalMesh(const QString& inSourcePath, const QSkeletalMesh& inMesh)
+{
+	if (inMesh.mSkeleton.isNull() || inMesh.mSkeleton->mMeshRoot.isNull())
+		return false;
+	QByteArray meta;
+	QDataStream stream(&meta, QIODevice::WriteOnly);
+	stream.setVersion(QDataStream::Qt_6_0);
+	stream << quint32(inMesh.mSubmeshes.size());
+	for (const auto& submesh : inMesh.mSubmeshes) {
+		stream << submesh.verticesOffset << submesh.verticesRange << submesh.indicesOffset << submesh.indicesRange << submesh.materialIndex;
+		writeBounds(stream, submesh.localBounds);
+	}
+	writeMaterials(stream, inMesh.mMaterials);
+
+	writeMeshNode(stream, inMesh.mSkeleton->mMeshRoot.get());
+	stream << quint32(inMesh.mSkeleton->mBoneMap.size());
+	for (const auto& bone : inMesh.mSkeleton->mBoneMap) {
+		stream << bone->index << bone->name << bone->transformOffset;
+	}
+	stream << inMesh.mSkeleton->mBoneOffsetMatrix;
+
+	stream << quint32(inMesh.mAnimations.size());
+	for (const auto& animation : inMesh.mAnimations) {
+		if (animation->isCompressed()) {
+			writeAnimation(stream, *animation);
+		}
+		else {
+			QSkeletalAnimation compressed = *animation;
+			compressed.compress();
+			writeAnimation(stream, compressed);
+		}
+	}
+	if (stream.status() != QDataStream::Ok)
+		return false;
+	return writeMeshCache(inSourcePath, MeshCacheKind::Skeletal, inMesh.mVertices, inMesh.mIndices, meta);
+}
+
+void QMeshCache::clear()
+{
+	const QString directory = getCacheDirectory();
+	if (directory.isEmpty())
+		return;
+	QDir dir(directory);
+	for (const QString& file : dir.entryList({ "*.qmesh" }, QDir::Files)) {
+		dir.remove(file);
+	}
+}
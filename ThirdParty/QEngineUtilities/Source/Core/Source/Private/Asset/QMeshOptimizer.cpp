@@ -0,0 +1,711 @@
+#include "Asset/QMeshOptimizer.h"
+#include "Asset/QSkeletalMesh.h"
+#include "QMutex"
+#include "QHash"
+#include "qfloat16.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+// Bump whenever the optimizer or the simplifier produce different output for the same input
+static const quint32 kMeshOptimizerRevision = 1;
+
+struct QMeshOptimizerContext {
+	QMutex mutex;
+	bool enabled = true;
+	QMeshOptimizer::LodSettings lodSettings;
+	QMeshOptimizer::Statistics statistics;
+};
+
+static QMeshOptimizerContext& meshOptimizerContext() {
+	static QMeshOptimizerContext context;
+	return context;
+}
+
+static const int kVertexCacheSize = 32;
+static const int kMaxValence = 32;
+
+// Forsyth's scoring: the last triangle's vertices get a flat bonus, the rest decay with cache age, low valence vertices are finished first
+struct QVertexScoreTable {
+	QVertexScoreTable() {
+		for (int i = 0; i < kVertexCacheSize; i++) {
+			cache[i] = i < 3 ? 0.75f : powf(1.0f - float(i - 3) / (kVertexCacheSize - 3), 1.5f);
+		}
+		valence[0] = 0.0f;
+		for (int i = 1; i <= kMaxValence; i++) {
+			valence[i] = 2.0f / sqrtf(float(i));
+		}
+	}
+	float cache[kVertexCacheSize];
+	float valence[kMaxValence + 1];
+};
+
+static float vertexScore(int inCachePosition, quint32 inLiveTriangles)
+{
+	static const QVertexScoreTable table;
+	if (inLiveTriangles == 0)
+		return -1.0f;
+	const float cacheScore = inCachePosition >= 0 && inCachePosition < kVertexCacheSize ? table.cache[inCachePosition] : 0.0f;
+	return cacheScore + table.valence[qMin<quint32>(inLiveTriangles, kMaxValence)];
+}
+
+void QMeshOptimizer::optimizeVertexCache(quint32* ioIndices, quint32 inIndexCount, quint32 inVertexCount)
+{
+	const quint32 triangleCount = inIndexCount / 3;
+	if (triangleCount < 2 || inVertexCount == 0)
+		return;
+
+	QVector<quint32> liveTriangles(inVertexCount, 0);
+	for (quint32 i = 0; i < triangleCount * 3; i++) {
+		liveTriangles[ioIndices[i]]++;
+	}
+	QVector<quint32> adjacencyOffsets(inVertexCount + 1, 0);
+	for (quint32 v = 0; v < inVertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	}
+	QVector<quint32> adjacency(triangleCount * 3);
+	QVector<quint32> adjacencyCursor(adjacencyOffsets.constBegin(), adjacencyOffsets.constEnd() - 1);
+	for (quint32 t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			adjacency[adjacencyCursor[ioIndices[t * 3 + k]]++] = t;
+		}
+	}
+
+	QVector<int> cachePositions(inVertexCount, -1);
+	QVector<float> vertexScores(inVertexCount);
+	for (quint32 v = 0; v < inVertexCount; v++) {
+		vertexScores[v] = vertexScore(-1, liveTriangles[v]);
+	}
+	QVector<bool> emitted(triangleCount, false);
+
+	QVector<quint32> output;
+	output.reserve(triangleCount * 3);
+	quint32 cache[kVertexCacheSize + 3];
+	int cacheCount = 0;
+	quint32 cursor = 0;
+	int bestTriangle = -1;
+	while (output.size() < int(triangleCount * 3)) {
+		if (bestTriangle < 0) {
+			while (cursor < triangleCount && emitted[cursor]) {
+				cursor++;
+			}
+			if (cursor == triangleCount)
+				break;
+			bestTriangle = cursor;
+		}
+		const quint32* triangle = ioIndices + bestTriangle * 3;
+		output << triangle[0] << triangle[1] << triangle[2];
+		emitted[bestTriangle] = true;
+
+		for (int k = 0; k < 3; k++) {
+			const quint32 vertex = triangle[k];
+			quint32* begin = adjacency.data() + adjacencyOffsets[vertex];
+			quint32* end = begin + liveTriangles[vertex];
+			quint32* found = std::find(begin, end, quint32(bestTriangle));
+			if (found != end) {
+				std::swap(*found, *(end - 1));
+				liveTriangles[vertex]--;
+			}
+		}
+
+		quint32 newCache[kVertexCacheSize + 3];
+		int newCacheCount = 0;
+		for (int k = 0; k < 3; k++) {
+			newCache[newCacheCount++] = triangle[k];
+		}
+		for (int i = 0; i < cacheCount; i++) {
+			const quint32 vertex = cache[i];
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+				newCache[newCacheCount++] = vertex;
+		}
+		for (int i = 0; i < newCacheCount; i++) {
+			const quint32 vertex = newCache[i];
+			cachePositions[vertex] = i < kVertexCacheSize ? i : -1;
+			vertexScores[vertex] = vertexScore(cachePositions[vertex], liveTriangles[vertex]);
+		}
+
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < newCacheCount; i++) {
+			const quint32 vertex = newCache[i];
+			const quint32* adjacentBegin = adjacency.constData() + adjacencyOffsets[vertex];
+			for (quint32 j = 0; j < liveTriangles[vertex]; j++) {
+				const quint32 t = adjacentBegin[j];
+				const float score = vertexScores[ioIndices[t * 3]] + vertexScores[ioIndices[t * 3 + 1]] + vertexScores[ioIndices[t * 3 + 2]];
+				if (i < kVertexCacheSize && score > bestScore) {
+					bestScore = score;
+					bestTriangle = t;
+				}
+			}
+		}
+		cacheCount = qMin(newCacheCount, kVertexCacheSize);
+		memcpy(cache, newCache, cacheCount * sizeof(quint32));
+	}
+	memcpy(ioIndices, output.constData(), output.size() * sizeof(quint32));
+}
+
+quint32 QMeshOptimizer::analyzeVertexCache(const quint32* inIndices, quint32 inIndexCount, quint32 inVertexCount, quint32 inCacheSize)
+{
+	QVector<quint32> cacheTimestamps(inVertexCount, 0);
+	quint32 timestamp = inCacheSize + 1;
+	quint32 misses = 0;
+	for (quint32 i = 0; i < inIndexCount; i++) {
+		const quint32 vertex = inIndices[i];
+		if (timestamp - cacheTimestamps[vertex] > inCacheSize) {
+			cacheTimestamps[vertex] = timestamp++;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+// Splits the cache optimised order into clusters and draws the most outward facing ones first, keeping the ACMR within the threshold
+void QMeshOptimizer::optimizeOverdraw(quint32* ioIndices, quint32 inIndexCount, const QVector3D* inPositions, quint32 inVertexCount, float inThreshold)
+{
+	const quint32 triangleCount = inIndexCount / 3;
+	if (triangleCount < 2 || inVertexCount == 0)
+		return;
+
+	const quint32 cacheSize = 16;
+	QVector<quint32> cacheTimestamps(inVertexCount, 0);
+	quint32 timestamp = cacheSize + 1;
+	QVector<quint8> triangleMisses(triangleCount);
+	quint32 totalMisses = 0;
+	for (quint32 t = 0; t < triangleCount; t++) {
+		quint8 misses = 0;
+		for (int k = 0; k < 3; k++) {
+			const quint32 vertex = ioIndices[t * 3 + k];
+			if (timestamp - cacheTimestamps[vertex] > cacheSize) {
+				cacheTimestamps[vertex] = timestamp++;
+				misses++;
+			}
+		}
+		triangleMisses[t] = misses;
+		totalMisses += misses;
+	}
+	const float meshAcmr = float(totalMisses) / triangleCount;
+
+	// Hard boundaries sit where the cache starts over, soft ones wherever the running ACMR from a cold cache is already good enough
+	QVector<quint32> clusterStarts;
+	quint32 clusterMisses = 0;
+	quint32 clusterTriangles = 0;
+	for (quint32 t = 0; t < triangleCount; t++) {
+		if (t == 0 || triangleMisses[t] == 3 || float(clusterMisses) <= inThreshold * meshAcmr * clusterTriangles) {
+			clusterStarts << t;
+			clusterMisses = 0;
+			clusterTriangles = 0;
+			timestamp += cacheSize + 1;
+		}
+		for (int k = 0; k < 3; k++) {
+			const quint32 vertex = ioIndices[t * 3 + k];
+			if (timestamp - cacheTimestamps[vertex] > cacheSize) {
+				cacheTimestamps[vertex] = timestamp++;
+				clusterMisses++;
+			}
+		}
+		clusterTriangles++;
+	}
+	const int clusterCount = clusterStarts.size();
+	if (clusterCount < 2)
+		return;
+	clusterStarts << triangleCount;
+
+	QVector3D meshCentroid;
+	float meshArea = 0.0f;
+	QVector<QVector3D> clusterCentroids(clusterCount);
+	QVector<QVector3D> clusterNormals(clusterCount);
+	for (int c = 0; c < clusterCount; c++) {
+		QVector3D centroid;
+		QVector3D normal;
+		float area = 0.0f;
+		for (quint32 t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+			const QVector3D& p0 = inPositions[ioIndices[t * 3]];
+			const QVector3D& p1 = inPositions[ioIndices[t * 3 + 1]];
+			const QVector3D& p2 = inPositions[ioIndices[t * 3 + 2]];
+			const QVector3D cross = QVector3D::crossProduct(p1 - p0, p2 - p0);
+			const float triangleArea = cross.length();
+			centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+			normal += cross;
+			area += triangleArea;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		clusterCentroids[c] = area > 0.0f ? centroid / area : centroid;
+		clusterNormals[c] = normal.normalized();
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	QVector<float> clusterSortKeys(clusterCount);
+	QVector<int> clusterOrder(clusterCount);
+	for (int c = 0; c < clusterCount; c++) {
+		clusterSortKeys[c] = QVector3D::dotProduct(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+		clusterOrder[c] = c;
+	}
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&clusterSortKeys](int a, int b) {
+		return clusterSortKeys[a] > clusterSortKeys[b];
+	});
+
+	QVector<quint32> output;
+	output.reserve(triangleCount * 3);
+	for (int c : clusterOrder) {
+		output.append(ioIndices + clusterStarts[c] * 3, (clusterStarts[c + 1] - clusterStarts[c]) * 3);
+	}
+	memcpy(ioIndices, output.constData(), output.size() * sizeof(quint32));
+}
+
+// Garland-Heckbert error quadric, symmetric 4x4 stored as its upper triangle plus the accumulated area weight
+struct QErrorQuadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+	double weight = 0;
+
+	void addPlane(const QVector3D& inNormal, double inDistance, double inWeight) {
+		const double a = inNormal.x(), b = inNormal.y(), c = inNormal.z(), d = inDistance;
+		a2 += a * a * inWeight; ab += a * b * inWeight; ac += a * c * inWeight; ad += a * d * inWeight;
+		b2 += b * b * inWeight; bc += b * c * inWeight; bd += b * d * inWeight;
+		c2 += c * c * inWeight; cd += c * d * inWeight;
+		d2 += d * d * inWeight;
+		weight += inWeight;
+	}
+	QErrorQuadric& operator+=(const QErrorQuadric& other) {
+		a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+		b2 += other.b2; bc += other.bc; bd += other.bd;
+		c2 += other.c2; cd += other.cd;
+		d2 += other.d2;
+		weight += other.weight;
+		return *this;
+	}
+	// Area weighted mean squared distance to the accumulated planes
+	double error(const QVector3D& inPoint) const {
+		const double x = inPoint.x(), y = inPoint.y(), z = inPoint.z();
+		const double sum = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2;
+		return weight > 0 ? qAbs(sum) / weight : 0.0;
+	}
+};
+
+struct QEdgeCollapse {
+	quint32 from;
+	quint32 to;
+	double error;
+};
+
+static quint64 edgeKey(quint32 a, quint32 b)
+{
+	return a < b ? (quint64(a) << 32) | b : (quint64(b) << 32) | a;
+}
+
+// Collapsing onto an existing vertex keeps the vertex buffer shared between all levels
+QVector<quint32> QMeshOptimizer::simplify(const quint32* inIndices, quint32 inIndexCount, const QVector3D* inPositions, quint32 inVertexCount, quint32 inTargetIndexCount, float* outError)
+{
+	QVector<quint32> indices(inIndices, inIndices + inIndexCount / 3 * 3);
+	double maxError = 0.0;
+	if (indices.isEmpty() || inVertexCount == 0) {
+		if (outError)
+			*outError = 0.0f;
+		return indices;
+	}
+
+	// Vertices split by uv or normal seams share a position, they and open borders stay where they are
+	QVector<quint32> positionIds(inVertexCount);
+	QVector<bool> locked(inVertexCount, false);
+	{
+		QHash<QByteArray, quint32> positionMap;
+		for (quint32 v = 0; v < inVertexCount; v++) {
+			const QByteArray key(reinterpret_cast<const char*>(&inPositions[v]), sizeof(QVector3D));
+			auto it = positionMap.constFind(key);
+			if (it == positionMap.constEnd()) {
+				positionMap.insert(key, v);
+				positionIds[v] = v;
+			}
+			else {
+				positionIds[v] = it.value();
+				locked[v] = true;
+				locked[it.value()] = true;
+			}
+		}
+		QHash<quint64, int> edgeUsage;
+		for (int i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				edgeUsage[edgeKey(positionIds[indices[i + k]], positionIds[indices[i + (k + 1) % 3]])]++;
+			}
+		}
+		for (int i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				const quint32 a = indices[i + k];
+				const quint32 b = indices[i + (k + 1) % 3];
+				if (edgeUsage.value(edgeKey(positionIds[a], positionIds[b])) == 1) {
+					locked[a] = true;
+					locked[b] = true;
+				}
+			}
+		}
+	}
+
+	QVector<QErrorQuadric> quadrics(inVertexCount);
+	for (int i = 0; i < indices.size(); i += 3) {
+		const QVector3D& p0 = inPositions[indices[i]];
+		const QVector3D& p1 = inPositions[indices[i + 1]];
+		const QVector3D& p2 = inPositions[indices[i + 2]];
+		const QVector3D cross = QVector3D::crossProduct(p1 - p0, p2 - p0);
+		const float area = cross.length();
+		if (area <= 0.0f)
+			continue;
+		const QVector3D normal = cross / area;
+		const double distance = -QVector3D::dotProduct(normal, p0);
+		for (int k = 0; k < 3; k++) {
+			quadrics[indices[i + k]].addPlane(normal, distance, area);
+		}
+	}
+
+	QVector<quint32> remap(inVertexCount);
+	QVector<bool> touched(inVertexCount);
+	QVector<quint32> adjacencyOffsets(inVertexCount + 1);
+	QVector<quint32> adjacency;
+	QVector<QEdgeCollapse> collapses;
+	while (quint32(indices.size()) > inTargetIndexCount) {
+		const quint32 triangleCount = indices.size() / 3;
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (quint32 index : indices) {
+			adjacencyOffsets[index + 1]++;
+		}
+		for (quint32 v = 0; v < inVertexCount; v++) {
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		}
+		adjacency.resize(indices.size());
+		QVector<quint32> cursor(adjacencyOffsets.constBegin(), adjacencyOffsets.constEnd() - 1);
+		for (quint32 t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				adjacency[cursor[indices[t * 3 + k]]++] = t;
+			}
+		}
+
+		collapses.clear();
+		for (quint32 t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				const quint32 a = indices[t * 3 + k];
+				const quint32 b = indices[t * 3 + (k + 1) % 3];
+				QErrorQuadric quadric = quadrics[a];
+				quadric += quadrics[b];
+				if (!locked[a])
+					collapses << QEdgeCollapse{ a, b, quadric.error(inPositions[b]) };
+				if (!locked[b])
+					collapses << QEdgeCollapse{ b, a, quadric.error(inPositions[a]) };
+			}
+		}
+		if (collapses.isEmpty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const QEdgeCollapse& lhs, const QEdgeCollapse& rhs) {
+			return lhs.error < rhs.error;
+		});
+
+		// Interior collapses remove two triangles each, the one-ring of a collapsed vertex waits for the next pass
+		const quint32 collapseGoal = qMax<quint32>(1, (triangleCount - inTargetIndexCount / 3 + 1) / 2);
+		for (quint32 v = 0; v < inVertexCount; v++) {
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+		quint32 collapseCount = 0;
+		for (const QEdgeCollapse& collapse : collapses) {
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+			bool flipped = false;
+			for (quint32 j = adjacencyOffsets[collapse.from]; j < adjacencyOffsets[collapse.from + 1] && !flipped; j++) {
+				const quint32* triangle = indices.constData() + adjacency[j] * 3;
+				quint32 corners[3] = { remap[triangle[0]], remap[triangle[1]], remap[triangle[2]] };
+				if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+					continue;
+				const QVector3D before = QVector3D::crossProduct(inPositions[corners[1]] - inPositions[corners[0]], inPositions[corners[2]] - inPositions[corners[0]]);
+				for (quint32& corner : corners) {
+					if (corner == collapse.from)
+						corner = collapse.to;
+				}
+				const QVector3D after = QVector3D::crossProduct(inPositions[corners[1]] - inPositions[corners[0]], inPositions[corners[2]] - inPositions[corners[0]]);
+				// Also rejects triangles that would turn edge-on to their old orientation
+				flipped = QVector3D::dotProduct(before, after) <= 0.25f * before.length() * after.length();
+			}
+			if (flipped)
+				continue;
+			remap[collapse.from] = collapse.to;
+			for (quint32 j = adjacencyOffsets[collapse.from]; j < adjacencyOffsets[collapse.from + 1]; j++) {
+				const quint32* triangle = indices.constData() + adjacency[j] * 3;
+				touched[triangle[0]] = true;
+				touched[triangle[1]] = true;
+				touched[triangle[2]] = true;
+			}
+			quadrics[collapse.to] += quadrics[collapse.from];
+			maxError = qMax(maxError, collapse.error);
+			if (++collapseCount >= collapseGoal)
+				break;
+		}
+		if (collapseCount == 0)
+			break;
+
+		int writeIndex = 0;
+		for (int i = 0; i < indices.size(); i += 3) {
+			const quint32 a = remap[indices[i]];
+			const quint32 b = remap[indices[i + 1]];
+			const quint32 c = remap[indices[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			indices[writeIndex++] = a;
+			indices[writeIndex++] = b;
+			indices[writeIndex++] = c;
+		}
+		indices.resize(writeIndex);
+	}
+	if (outError)
+		*outError = float(sqrt(maxError));
+	return indices;
+}
+
+// Collapses bitwise identical vertices, then reorders the survivors by first use
+template<typename VertexType>
+static QVector<VertexType> optimizeSubmesh(const VertexType* inVertices, quint32 inVertexCount, quint32* ioIndices, quint32 inIndexCount)
+{
+	QVector<quint32> remap(inVertexCount);
+	const quint32 tableSize = qNextPowerOfTwo(inVertexCount * 2);
+	QVector<quint32> table(tableSize, ~0u);
+	for (quint32 v = 0; v < inVertexCount; v++) {
+		quint32 slot = quint32(qHashBits(&inVertices[v], sizeof(VertexType))) & (tableSize - 1);
+		while (table[slot] != ~0u && memcmp(&inVertices[table[slot]], &inVertices[v], sizeof(VertexType)) != 0) {
+			slot = (slot + 1) & (tableSize - 1);
+		}
+		if (table[slot] == ~0u)
+			table[slot] = v;
+		remap[v] = table[slot];
+	}
+	for (quint32 i = 0; i < inIndexCount; i++) {
+		ioIndices[i] = remap[ioIndices[i]];
+	}
+
+	QMeshOptimizer::optimizeVertexCache(ioIndices, inIndexCount, inVertexCount);
+	QVector<QVector3D> positions(inVertexCount);
+	for (quint32 v = 0; v < inVertexCount; v++) {
+		positions[v] = inVertices[v].position;
+	}
+	QMeshOptimizer::optimizeOverdraw(ioIndices, inIndexCount, positions.constData(), inVertexCount);
+
+	QVector<VertexType> vertices;
+	vertices.reserve(inVertexCount);
+	QVector<quint32> fetchRemap(inVertexCount, ~0u);
+	for (quint32 i = 0; i < inIndexCount; i++) {
+		quint32& index = ioIndices[i];
+		if (fetchRemap[index] == ~0u) {
+			fetchRemap[index] = vertices.size();
+			vertices << inVertices[index];
+		}
+		index = fetchRemap[index];
+	}
+	return vertices;
+}
+
+template<typename MeshType>
+static QMeshOptimizer::Statistics optimizeMesh(MeshType& inMesh, quint32 inCompactBytesPerVertex)
+{
+	using VertexType = typename std::decay<decltype(inMesh.mVertices[0])>::type;
+	QMeshOptimizer::Statistics statistics;
+	statistics.bytesPerVertex = sizeof(VertexType);
+	statistics.compactBytesPerVertex = inCompactBytesPerVertex;
+	QVector<VertexType> vertices;
+	QVector<quint32> indices;
+	vertices.reserve(inMesh.mVertices.size());
+	indices.reserve(inMesh.mIndices.size());
+	for (auto& submesh : inMesh.mSubmeshes) {
+		QVector<quint32> submeshIndices(inMesh.mIndices.constBegin() + submesh.indicesOffset, inMesh.mIndices.constBegin() + submesh.indicesOffset + submesh.indicesRange);
+		const VertexType* submeshVertices = inMesh.mVertices.constData() + submesh.verticesOffset;
+		statistics.verticesBefore += submesh.verticesRange;
+		QVector<VertexType> optimizedVertices;
+		if (submesh.indicesRange % 3 == 0) {
+			statistics.triangles += submesh.indicesRange / 3;
+			statistics.cacheMissesBefore += QMeshOptimizer::analyzeVertexCache(submeshIndices.constData(), submeshIndices.size(), submesh.verticesRange);
+			optimizedVertices = optimizeSubmesh(submeshVertices, submesh.verticesRange, submeshIndices.data(), submeshIndices.size());
+			statistics.cacheMissesAfter += QMeshOptimizer::analyzeVertexCache(submeshIndices.constData(), submeshIndices.size(), optimizedVertices.size());
+		}
+		else {
+			optimizedVertices = QVector<VertexType>(submeshVertices, submeshVertices + submesh.verticesRange);
+		}
+		submesh.verticesOffset = vertices.size();
+		submesh.verticesRange = optimizedVertices.size();
+		submesh.indicesOffset = indices.size();
+		statistics.verticesAfter += optimizedVertices.size();
+		vertices << optimizedVertices;
+		indices << submeshIndices;
+	}
+	inMesh.mVertices = vertices;
+	inMesh.mIndices = indices;
+
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	context.statistics.triangles += statistics.triangles;
+	context.statistics.verticesBefore += statistics.verticesBefore;
+	context.statistics.verticesAfter += statistics.verticesAfter;
+	context.statistics.cacheMissesBefore += statistics.cacheMissesBefore;
+	context.statistics.cacheMissesAfter += statistics.cacheMissesAfter;
+	context.statistics.bytesPerVertex = statistics.bytesPerVertex;
+	context.statistics.compactBytesPerVertex = statistics.compactBytesPerVertex;
+	return statistics;
+}
+
+QMeshOptimizer::Statistics QMeshOptimizer::optimize(QStaticMesh& inMesh)
+{
+	// Level ranges point into the old index layout, regenerate them afterwards
+	for (auto& submesh : inMesh.mSubmeshes) {
+		submesh.lods.clear();
+	}
+	return optimizeMesh(inMesh, sizeof(QStaticMesh::CompactVertex));
+}
+
+QMeshOptimizer::Statistics QMeshOptimizer::optimize(QSkeletalMesh& inMesh)
+{
+	return optimizeMesh(inMesh, 0);
+}
+
+static quint32 packSnorm2x16(float inX, float inY)
+{
+	const qint16 x = qint16(qRound(qBound(-1.0f, inX, 1.0f) * 32767.0f));
+	const qint16 y = qint16(qRound(qBound(-1.0f, inY, 1.0f) * 32767.0f));
+	return quint32(quint16(x)) | (quint32(quint16(y)) << 16);
+}
+
+static quint32 packHalf2x16(float inX, float inY)
+{
+	const qfloat16 x(inX);
+	const qfloat16 y(inY);
+	quint16 xBits, yBits;
+	memcpy(&xBits, &x, sizeof(xBits));
+	memcpy(&yBits, &y, sizeof(yBits));
+	return quint32(xBits) | (quint32(yBits) << 16);
+}
+
+static quint32 packOctahedral(const QVector3D& inDirection)
+{
+	const float length = qAbs(inDirection.x()) + qAbs(inDirection.y()) + qAbs(inDirection.z());
+	if (length <= 0.0f)
+		return packSnorm2x16(0.0f, 0.0f);
+	float x = inDirection.x() / length;
+	float y = inDirection.y() / length;
+	if (inDirection.z() < 0.0f) {
+		const float foldedX = (1.0f - qAbs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		const float foldedY = (1.0f - qAbs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+	return packSnorm2x16(x, y);
+}
+
+QVector<QStaticMesh::CompactVertex> QMeshOptimizer::buildCompactVertices(const QStaticMesh& inMesh)
+{
+	QVector<QStaticMesh::CompactVertex> compactVertices(inMesh.mVertices.size());
+	for (const auto& submesh : inMesh.mSubmeshes) {
+		const QVector3D center = submesh.localBounds.center();
+		QVector3D extent = submesh.localBounds.extent();
+		extent = QVector3D(qMax(extent.x(), FLT_EPSILON), qMax(extent.y(), FLT_EPSILON), qMax(extent.z(), FLT_EPSILON));
+		for (quint32 i = submesh.verticesOffset; i < submesh.verticesOffset + submesh.verticesRange; i++) {
+			const QStaticMesh::Vertex& vertex = inMesh.mVertices[i];
+			QStaticMesh::CompactVertex& compactVertex = compactVertices[i];
+			const QVector3D position = (vertex.position - center) / extent;
+			const float bitangentSign = QVector3D::dotProduct(QVector3D::crossProduct(vertex.normal, vertex.tangent), vertex.bitangent) < 0.0f ? -1.0f : 1.0f;
+			compactVertex.position[0] = packSnorm2x16(position.x(), position.y());
+			compactVertex.position[1] = packSnorm2x16(position.z(), bitangentSign);
+			compactVertex.normal = packOctahedral(vertex.normal);
+			compactVertex.tangent = packOctahedral(vertex.tangent);
+			compactVertex.uv = packHalf2x16(vertex.uv.x(), vertex.uv.y());
+		}
+	}
+	return compactVertices;
+}
+
+void QMeshOptimizer::generateLods(QStaticMesh& inMesh, int inMaxLevels, float inReduction)
+{
+	const quint32 minTriangles = 16;
+	for (auto& submesh : inMesh.mSubmeshes) {
+		submesh.lods.clear();
+		if (submesh.indicesRange % 3 != 0)
+			continue;
+		QVector<QVector3D> positions(submesh.verticesRange);
+		for (quint32 v = 0; v < submesh.verticesRange; v++) {
+			positions[v] = inMesh.mVertices[submesh.verticesOffset + v].position;
+		}
+		QVector<quint32> source(inMesh.mIndices.constBegin() + submesh.indicesOffset, inMesh.mIndices.constBegin() + submesh.indicesOffset + submesh.indicesRange);
+		float error = 0.0f;
+		for (int level = 0; level < inMaxLevels; level++) {
+			const quint32 targetIndexCount = quint32(source.size() / 3 * inReduction) * 3;
+			if (targetIndexCount < minTriangles * 3)
+				break;
+			float levelError = 0.0f;
+			QVector<quint32> lod = simplify(source.constData(), source.size(), positions.constData(), positions.size(), targetIndexCount, &levelError);
+			// Stop once locked borders and seams keep the simplifier from making real progress
+			if (lod.isEmpty() || lod.size() > source.size() * 9 / 10)
+				break;
+			optimizeVertexCache(lod.data(), lod.size(), positions.size());
+			error += levelError;
+			QStaticMesh::LodData lodData;
+			lodData.indicesOffset = inMesh.mIndices.size();
+			lodData.indicesRange = lod.size();
+			lodData.error = error;
+			inMesh.mIndices << lod;
+			submesh.lods << lodData;
+			source = lod;
+		}
+	}
+}
+
+void QMeshOptimizer::setEnabled(bool enabled)
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	context.enabled = enabled;
+}
+
+bool QMeshOptimizer::isEnabled()
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	return context.enabled;
+}
+
+void QMeshOptimizer::setLodSettings(const LodSettings& inSettings)
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	context.lodSettings = inSettings;
+}
+
+QMeshOptimizer::LodSettings QMeshOptimizer::getLodSettings()
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	return context.lodSettings;
+}
+
+quint64 QMeshOptimizer::getSettingsKey()
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	if (!context.enabled)
+		return 0;
+	quint32 reductionBits = 0;
+	memcpy(&reductionBits, &context.lodSettings.reduction, sizeof(reductionBits));
+	return (quint64(kMeshOptimizerRevision) << 48) | (quint64(context.lodSettings.maxLevels & 0xFFFF) << 32) | reductionBits;
+}
+
+QMeshOptimizer::Statistics QMeshOptimizer::getStatistics()
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	return context.statistics;
+}
+
+void QMeshOptimizer::resetStatistics()
+{
+	QMeshOptimizerContext& context = meshOptimizerContext();
+	QMutexLocker locker(&context.mutex);
+	context.statistics = Statistics();
+}
@@ -6,6 +6,21 @@
 #include "imgui.h"
 #include "ImGuizmo.h"
 #include "Render/RHI/Vulkan/QRhiVulkanExHelper.h"
+#include "QSemaphore"
+#include "QElapsedTimer"
+#include "QtMath"
+#include "tracy/Tracy.hpp"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define QENGINE_PARTICLE_SSE
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#define QENGINE_PARTICLE_AVX
+#endif
 
 int IParticleEmitter::getNumOfSpawnPerFrame() const {
 	return mNumOfSpawnPerFrame;
@@ -32,55 +47,269 @@ void IParticleEmitter::onTick(QRhiCommandBuffer* inCmdBuffer) {
 }
 
 QCpuParticleEmitter::QCpuParticleEmitter() {
-	mCurrentParticles.reserve(CPU_PARTICLE_MAX_SIZE);
 }
 
-void QCpuParticleEmitter::onTick(QRhiCommandBuffer* inCmdBuffer) {
-	IParticleEmitter::onTick(inCmdBuffer);
+QThreadPool* QCpuParticleEmitter::updateThreadPool() {
+	static QThreadPool threadPool;
+	return &threadPool;
+}
 
-	if (mTransfromBuffer.isNull()) {
-		mTransfromBuffer.reset(mRhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UsageFlag::VertexBuffer, sizeof(MathUtils::Mat4) * CPU_PARTICLE_MAX_SIZE));
-		mTransfromBuffer->setName("TransfromBuffer");
-		mTransfromBuffer->create();
+// Splits [0, count) into chunks for the update pool, the calling thread takes the first one
+template<typename Func>
+static int parallelChunks(int count, int grain, const Func& func) {
+	QThreadPool* threadPool = QCpuParticleEmitter::updateThreadPool();
+	const int chunkCount = qBound(1, (count + grain - 1) / grain, qMax(1, threadPool->maxThreadCount()));
+	const int chunkSize = (count + chunkCount - 1) / chunkCount;
+	QSemaphore finished;
+	int started = 0;
+	for (int chunk = 1; chunk < chunkCount; chunk++) {
+		const int begin = chunk * chunkSize;
+		const int end = qMin(begin + chunkSize, count);
+		if (begin >= end)
+			break;
+		threadPool->start([&func, &finished, chunk, begin, end]() {
+			func(chunk, begin, end);
+			finished.release();
+		});
+		started++;
 	}
+	func(0, 0, qMin(chunkSize, count));
+	finished.acquire(started);
+	return started + 1;
+}
 
-	{	// spawn
-		int numOfSpawn = qMin(CPU_PARTICLE_MAX_SIZE - mCurrentParticles.size(), mNumOfSpawnPerFrame);
-		QVector<IParticleEmitter::Particle> newParticles(numOfSpawn);
-		for (int i = 0; i < newParticles.size(); i++) {
-			onSpawn(newParticles[i]);
+// Moves the live particles of [begin, end) to its front and returns how many there are
+static int compactParticles(QCpuParticleEmitter::ParticleBatch& ioBatch, int inBegin, int inEnd) {
+	float* const* streams = ioBatch.streams;
+	const float* age = streams[QCpuParticleEmitter::Age];
+	const float* lifetime = streams[QCpuParticleEmitter::Lifetime];
+	int outIndex = inBegin;
+	int inIndex = inBegin;
+#ifdef QENGINE_PARTICLE_SSE
+	// Runs of four live particles that are already in place are skipped without touching the other streams
+	for (; inIndex + 4 <= inEnd && outIndex == inIndex; inIndex += 4, outIndex += 4) {
+		if (_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(age + inIndex), _mm_loadu_ps(lifetime + inIndex))) != 0xF)
+			break;
+	}
+#endif
+	for (; inIndex < inEnd; inIndex++) {
+		if (!(age[inIndex] < lifetime[inIndex]))
+			continue;
+		if (outIndex != inIndex) {
+			for (int stream = 0; stream < QCpuParticleEmitter::StreamCount; stream++) {
+				streams[stream][outIndex] = streams[stream][inIndex];
+			}
+		}
+		outIndex++;
+	}
+	return outIndex - inBegin;
+}
+
+static void integrateParticles(QCpuParticleEmitter::ParticleBatch& ioBatch, float inDeltaSec) {
+	float* position[3] = { ioBatch.streams[QCpuParticleEmitter::PositionX], ioBatch.streams[QCpuParticleEmitter::PositionY], ioBatch.streams[QCpuParticleEmitter::PositionZ] };
+	const float* velocity[3] = { ioBatch.streams[QCpuParticleEmitter::VelocityX], ioBatch.streams[QCpuParticleEmitter::VelocityY], ioBatch.streams[QCpuParticleEmitter::VelocityZ] };
+	float* age = ioBatch.streams[QCpuParticleEmitter::Age];
+	const int count = ioBatch.count;
+	int i = 0;
+#if defined(QENGINE_PARTICLE_AVX)
+	const __m256 delta8 = _mm256_set1_ps(inDeltaSec);
+	for (; i + 8 <= count; i += 8) {
+		for (int axis = 0; axis < 3; axis++) {
+			_mm256_storeu_ps(position[axis] + i, _mm256_add_ps(_mm256_loadu_ps(position[axis] + i), _mm256_loadu_ps(velocity[axis] + i)));
 		}
-		mCurrentParticles.append(newParticles);
+		_mm256_storeu_ps(age + i, _mm256_add_ps(_mm256_loadu_ps(age + i), delta8));
+	}
+#endif
+#if defined(QENGINE_PARTICLE_SSE)
+	const __m128 delta4 = _mm_set1_ps(inDeltaSec);
+	for (; i + 4 <= count; i += 4) {
+		for (int axis = 0; axis < 3; axis++) {
+			_mm_storeu_ps(position[axis] + i, _mm_add_ps(_mm_loadu_ps(position[axis] + i), _mm_loadu_ps(velocity[axis] + i)));
+		}
+		_mm_storeu_ps(age + i, _mm_add_ps(_mm_loadu_ps(age + i), delta4));
+	}
+#endif
+	for (; i < count; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			position[axis][i] += velocity[axis][i];
+		}
+		age[i] += inDeltaSec;
+	}
+}
+
+// translate(position) * rotate(x) * rotate(y) * rotate(z) * scale(scaling), written column major like QGenericMatrix
+static void buildTransforms(const QCpuParticleEmitter::ParticleBatch& inBatch, MathUtils::Mat4* outTransforms) {
+	float* const* streams = inBatch.streams;
+	for (int i = 0; i < inBatch.count; i++) {
+		const float ax = qDegreesToRadians(streams[QCpuParticleEmitter::RotationX][i]);
+		const float ay = qDegreesToRadians(streams[QCpuParticleEmitter::RotationY][i]);
+		const float az = qDegreesToRadians(streams[QCpuParticleEmitter::RotationZ][i]);
+		const float sa = std::sin(ax), ca = std::cos(ax);
+		const float sb = std::sin(ay), cb = std::cos(ay);
+		const float sc = std::sin(az), cc = std::cos(az);
+		const float sx = streams[QCpuParticleEmitter::ScalingX][i];
+		const float sy = streams[QCpuParticleEmitter::ScalingY][i];
+		const float sz = streams[QCpuParticleEmitter::ScalingZ][i];
+		float* m = outTransforms[i].data();
+		m[0] = cb * cc * sx;
+		m[1] = (sa * sb * cc + ca * sc) * sx;
+		m[2] = (-ca * sb * cc + sa * sc) * sx;
+		m[3] = 0.0f;
+		m[4] = -cb * sc * sy;
+		m[5] = (-sa * sb * sc + ca * cc) * sy;
+		m[6] = (ca * sb * sc + sa * cc) * sy;
+		m[7] = 0.0f;
+		m[8] = sb * sz;
+		m[9] = -sa * cb * sz;
+		m[10] = ca * cb * sz;
+		m[11] = 0.0f;
+		m[12] = streams[QCpuParticleEmitter::PositionX][i];
+		m[13] = streams[QCpuParticleEmitter::PositionY][i];
+		m[14] = streams[QCpuParticleEmitter::PositionZ][i];
+		m[15] = 1.0f;
+	}
+}
+
+static QCpuParticleEmitter::ParticleBatch subBatch(const QCpuParticleEmitter::ParticleBatch& inBatch, int inBegin, int inCount) {
+	QCpuParticleEmitter::ParticleBatch batch;
+	for (int stream = 0; stream < QCpuParticleEmitter::StreamCount; stream++) {
+		batch.streams[stream] = inBatch.streams[stream] + inBegin;
+	}
+	batch.count = inCount;
+	return batch;
+}
+
+QCpuParticleEmitter::ParticleBatch QCpuParticleEmitter::batchAt(int inBegin, int inCount) {
+	ParticleBatch batch;
+	for (int stream = 0; stream < StreamCount; stream++) {
+		batch.streams[stream] = mStreams[stream].data() + inBegin;
 	}
+	batch.count = inCount;
+	return batch;
+}
+
+void QCpuParticleEmitter::resizeStreams(int inSize) {
+	for (auto& stream : mStreams) {
+		if (stream.capacity() < inSize)
+			stream.reserve(qMin<int>(CPU_PARTICLE_MAX_SIZE, qMax<int>(inSize, stream.capacity() * 2)));
+		stream.resize(inSize);
+	}
+}
+
+void QCpuParticleEmitter::onSpawnBatch(ParticleBatch& ioBatch) {
+	for (int i = 0; i < ioBatch.count; i++) {
+		Particle particle;
+		onSpawn(particle);
+		float* const* streams = ioBatch.streams;
+		streams[PositionX][i] = particle.position.x(); streams[PositionY][i] = particle.position.y(); streams[PositionZ][i] = particle.position.z();
+		streams[RotationX][i] = particle.rotation.x(); streams[RotationY][i] = particle.rotation.y(); streams[RotationZ][i] = particle.rotation.z();
+		streams[ScalingX][i] = particle.scaling.x(); streams[ScalingY][i] = particle.scaling.y(); streams[ScalingZ][i] = particle.scaling.z();
+		streams[VelocityX][i] = particle.velocity.x(); streams[VelocityY][i] = particle.velocity.y(); streams[VelocityZ][i] = particle.velocity.z();
+		streams[Age][i] = particle.age;
+		streams[Lifetime][i] = particle.lifetime;
+	}
+}
+
+void QCpuParticleEmitter::onUpdateBatch(ParticleBatch& ioBatch, float inDeltaSec) {
+	float* const* streams = ioBatch.streams;
+	for (int i = 0; i < ioBatch.count; i++) {
+		Particle particle;
+		particle.position = QVector3D(streams[PositionX][i], streams[PositionY][i], streams[PositionZ][i]);
+		particle.rotation = QVector3D(streams[RotationX][i], streams[RotationY][i], streams[RotationZ][i]);
+		particle.scaling = QVector3D(streams[ScalingX][i], streams[ScalingY][i], streams[ScalingZ][i]);
+		particle.velocity = QVector3D(streams[VelocityX][i], streams[VelocityY][i], streams[VelocityZ][i]);
+		particle.age = streams[Age][i];
+		particle.lifetime = streams[Lifetime][i];
+		onUpdate(particle);
+		streams[PositionX][i] = particle.position.x(); streams[PositionY][i] = particle.position.y(); streams[PositionZ][i] = particle.position.z();
+		streams[RotationX][i] = particle.rotation.x(); streams[RotationY][i] = particle.rotation.y(); streams[RotationZ][i] = particle.rotation.z();
+		streams[ScalingX][i] = particle.scaling.x(); streams[ScalingY][i] = particle.scaling.y(); streams[ScalingZ][i] = particle.scaling.z();
+		streams[VelocityX][i] = particle.velocity.x(); streams[VelocityY][i] = particle.velocity.y(); streams[VelocityZ][i] = particle.velocity.z();
+		streams[Age][i] = particle.age;
+		streams[Lifetime][i] = particle.lifetime;
+	}
+}
+
+void QCpuParticleEmitter::onTick(QRhiCommandBuffer* inCmdBuffer) {
+	ZoneScopedN("QCpuParticleEmitter::onTick");
+	IParticleEmitter::onTick(inCmdBuffer);
+	QElapsedTimer timer;
+	timer.start();
 
-	{	//update
-		int outIndex = 0;
-		for (int inIndex = 0; inIndex < mCurrentParticles.size(); inIndex++) {
-			Particle particle = mCurrentParticles[inIndex];
-			if (particle.age < particle.lifetime) {
-				onUpdate(particle);
-				particle.age += mDeltaSec;
-				particle.position += particle.velocity;
-				mCurrentParticles[outIndex] = particle;
-				++outIndex;
+	{	// spawn
+		const int numOfSpawn = qBound(0, qMin(CPU_PARTICLE_MAX_SIZE - mNumOfParticles, mNumOfSpawnPerFrame), CPU_PARTICLE_MAX_SIZE);
+		resizeStreams(mNumOfParticles + numOfSpawn);
+		ParticleBatch spawnBatch = batchAt(mNumOfParticles, numOfSpawn);
+		onSpawnBatch(spawnBatch);
+		mNumOfParticles += numOfSpawn;
+	}
+
+	const int grain = 16384;
+	int threads = 1;
+	{	// update, every chunk is compacted in place and the survivors are moved down afterwards
+		QVector<int> chunkBegins(qMax(1, updateThreadPool()->maxThreadCount()), 0);
+		QVector<int> chunkSurvivors(chunkBegins.size(), 0);
+		const float deltaSec = mDeltaSec;
+		ParticleBatch all = batchAt(0, mNumOfParticles);
+		threads = parallelChunks(mNumOfParticles, grain, [&](int chunk, int begin, int end) {
+			const int survivors = compactParticles(all, begin, end);
+			if (bParallelUpdate) {
+				ParticleBatch batch = subBatch(all, begin, survivors);
+				onUpdateBatch(batch, deltaSec);
+				integrateParticles(batch, deltaSec);
+			}
+			chunkBegins[chunk] = begin;
+			chunkSurvivors[chunk] = survivors;
+		});
+		int outIndex = chunkSurvivors[0];
+		for (int chunk = 1; chunk < threads; chunk++) {
+			if (chunkBegins[chunk] != outIndex) {
+				for (auto& stream : mStreams) {
+					memmove(stream.data() + outIndex, stream.constData() + chunkBegins[chunk], chunkSurvivors[chunk] * sizeof(float));
+				}
 			}
+			outIndex += chunkSurvivors[chunk];
+		}
+		mNumOfParticles = outIndex;
+		resizeStreams(mNumOfParticles);
+
+		// Overrides that have not opted in see every survivor in one batch on this thread, only the integration is split up
+		if (!bParallelUpdate) {
+			ParticleBatch survivors = batchAt(0, mNumOfParticles);
+			onUpdateBatch(survivors, deltaSec);
+			parallelChunks(mNumOfParticles, grain, [&](int, int begin, int end) {
+				ParticleBatch batch = subBatch(survivors, begin, end - begin);
+				integrateParticles(batch, deltaSec);
+			});
 		}
-		mCurrentParticles.resize(outIndex);
 	}
-	QVector<MathUtils::Mat4> transforms(mCurrentParticles.size());
-	for (int i = 0; i < mCurrentParticles.size(); i++) {
-		const Particle& particle = mCurrentParticles[i];
-		QMatrix4x4 mat;
-		mat.translate(particle.position);
-		mat.rotate(particle.rotation.x(), QVector3D(1, 0, 0));
-		mat.rotate(particle.rotation.y(), QVector3D(0, 1, 0));
-		mat.rotate(particle.rotation.z(), QVector3D(0, 0, 1));
-		mat.scale(particle.scaling);
-		transforms[i] = mat.toGenericMatrix<4, 4>();
+	const quint64 updateNanoseconds = timer.nsecsElapsed();
+
+	// The staging array and the dynamic buffer only ever grow, doubling up to the cap
+	if (mTransforms.size() < mNumOfParticles)
+		mTransforms.resize(qMin(CPU_PARTICLE_MAX_SIZE, qMax(mNumOfParticles, int(mTransforms.size()) * 2)));
+	const ParticleBatch all = batchAt(0, mNumOfParticles);
+	MathUtils::Mat4* transforms = mTransforms.data();
+	parallelChunks(mNumOfParticles, grain, [&](int, int begin, int end) {
+		buildTransforms(subBatch(all, begin, end - begin), transforms + begin);
+	});
+	mStatistics.particles = mNumOfParticles;
+	mStatistics.threads = threads;
+	mStatistics.updateNanoseconds = updateNanoseconds;
+	mStatistics.transformNanoseconds = timer.nsecsElapsed() - updateNanoseconds;
+	TracyPlot("CpuParticles", int64_t(mNumOfParticles));
+
+	if (mTransfromBuffer.isNull() || mTransformCapacity < mTransforms.size()) {
+		mTransformCapacity = qMax<int>(1, mTransforms.size());
+		mTransfromBuffer.reset(mRhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UsageFlag::VertexBuffer, sizeof(MathUtils::Mat4) * mTransformCapacity));
+		mTransfromBuffer->setName("TransfromBuffer");
+		mTransfromBuffer->create();
+	}
+	if (mNumOfParticles > 0) {
+		QRhiResourceUpdateBatch* batch = mRhi->nextResourceUpdateBatch();
+		batch->updateDynamicBuffer(mTransfromBuffer.get(), 0, sizeof(MathUtils::Mat4) * mNumOfParticles, mTransforms.constData());
+		inCmdBuffer->resourceUpdate(batch);
 	}
-	QRhiResourceUpdateBatch* batch = mRhi->nextResourceUpdateBatch();
-	batch->updateDynamicBuffer(mTransfromBuffer.get(), 0, sizeof(MathUtils::Mat4) * transforms.size(), transforms.data());
-	inCmdBuffer->resourceUpdate(batch);
 }
 
 
@@ -5,8 +5,13 @@
 #include "assimp/scene.h"
 #include "assimp/matrix4x4.h"
 #include "QQueue"
-#include "QVariantAnimation"
+#include "QAnimationSystem.h"
 #include "AssetUtils.h"
+#include "QMeshCache.h"
+#include "QMeshOptimizer.h"
+#include "tracy/Tracy.hpp"
+#include <cmath>
+#include <type_traits>
 
 QSharedPointer<QSkeleton::MeshNode> processSkeletonMeshNode(aiNode* node) {
 	QSharedPointer<QSkeleton::MeshNode> boneNode = QSharedPointer<QSkeleton::MeshNode>::create();
@@ -19,7 +24,13 @@ QSharedPointer<QSkeleton::MeshNode> processSkeletonMeshNode(aiNode* node) {
 }
 
 QSharedPointer<QSkeletalMesh> QSkeletalMesh::CreateFromFile(const QString& inFilePath) {
-	QSharedPointer<QSkeletalMesh> skeletalMesh;
+	QSharedPointer<QSkeletalMesh> skeletalMesh = QMeshCache::loadSkeletalMesh(inFilePath);
+	if (skeletalMesh) {
+		skeletalMesh->resetPoses();
+		skeletalMesh->bindAnimations();
+		skeletalMesh->playAnimation(0);
+		return skeletalMesh;
+	}
 	Assimp::Importer importer;
 	const aiScene* scene = importer.ReadFile(inFilePath.toUtf8().constData(), aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals | aiProcess_CalcTangentSpace);
 	if (!scene) {
@@ -57,11 +68,14 @@ QSharedPointer<QSkeletalMesh> QSkeletalMesh::CreateFromFile(const QString& inFil
 			meshInfo.indicesOffset = skeletalMesh->mIndices.size();
 			meshInfo.indicesRange = 0;
 			for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-				aiFace face = mesh->mFaces[i];
-				for (unsigned int j = 0; j < face.mNumIndices; j++) {
-					skeletalMesh->mIndices.push_back(face.mIndices[j]);
-					meshInfo.indicesRange++;
-				}
+				meshInfo.indicesRange += mesh->mFaces[i].mNumIndices;
+			}
+			skeletalMesh->mIndices.resize(meshInfo.indicesOffset + meshInfo.indicesRange);
+			Index* indices = skeletalMesh->mIndices.data() + meshInfo.indicesOffset;
+			for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+				const aiFace& face = mesh->mFaces[i];
+				memcpy(indices, face.mIndices, face.mNumIndices * sizeof(Index));
+				indices += face.mNumIndices;
 			}
 
 			for (unsigned int i = 0; i < mesh->mNumBones; i++) {
@@ -100,6 +114,9 @@ QSharedPointer<QSkeletalMesh> QSkeletalMesh::CreateFromFile(const QString& inFil
 			qNode.push_back({ node.first->mChildren[i] ,node.second * node.first->mChildren[i]->mTransformation });
 		}
 	}
+	if (QMeshOptimizer::isEnabled())
+		QMeshOptimizer::optimize(*skeletalMesh);
+	skeletalMesh->updateBounds();
 	skeletalMesh->resetPoses();
 
 	for (uint i = 0; i < scene->mNumAnimations; i++) {
@@ -125,70 +142,636 @@ QSharedPointer<QSkeletalMesh> QSkeletalMesh::CreateFromFile(const QString& inFil
 		}
 		skeletalMesh->mAnimations << skeletalAnim;
 	}
+	for (const auto& animation : skeletalMesh->mAnimations) {
+		animation->compress();
+	}
+	QMeshCache::saveSkeletalMesh(inFilePath, *skeletalMesh);
+	skeletalMesh->bindAnimations();
 	skeletalMesh->playAnimation(0);
 	return skeletalMesh;
 }
 
+QSkeletalMesh::~QSkeletalMesh() {
+	QAnimationSystem::unregisterMesh(this);
+}
+
 void QSkeletalMesh::resetPoses() {
-	mCurrentPosesMatrix.resize(mSkeleton->mBoneOffsetMatrix.size());
-	QQueue<QPair<QSharedPointer<QSkeleton::MeshNode>, QMatrix4x4>> qNode;
-	qNode.push_back({ mSkeleton->mMeshRoot ,QMatrix4x4() });
-	while (!qNode.isEmpty()) {
-		QPair<QSharedPointer<QSkeleton::MeshNode>, QMatrix4x4> node = qNode.takeFirst();
-		QMatrix4x4 nodeMat = node.first->localTransform;
-		QMatrix4x4 globalMatrix = node.second * nodeMat;
-		auto boneIter = mSkeleton->mBoneMap.find(node.first->name);
-		if (boneIter != mSkeleton->mBoneMap.end()) {
-			const int& index = (*boneIter)->index;
-			mCurrentPosesMatrix[index] = (globalMatrix * QMatrix4x4(mSkeleton->mBoneOffsetMatrix[index])).toGenericMatrix<4, 4>();
-		}
-		for (unsigned int i = 0; i < node.first->children.size(); i++) {
-			qNode.push_back({ node.first->children[i] ,globalMatrix });
-		}
+	mSkeleton->flatten();
+	mLocalTransforms = mSkeleton->mNodeLocalTransforms;
+	mGlobalTransforms.resize(mLocalTransforms.size());
+	QMutexLocker locker(&mPoseMutex);
+	for (auto& poses : mPoseBuffers) {
+		poses.resize(mSkeleton->mBoneOffsetMatrix.size());
+		mSkeleton->computePoses(mLocalTransforms.constData(), mGlobalTransforms.data(), poses.data());
 	}
 }
 
+void QSkeletalMesh::bindAnimations() {
+	if (mSkeleton.isNull())
+		return;
+	mAnimationBindings.resize(mAnimations.size());
+	for (int i = 0; i < mAnimations.size(); i++) {
+		if (isAnimationBound(i))
+			continue;
+		QSkeletalAnimation* animation = mAnimations[i].get();
+		if (!animation->isCompressed())
+			animation->compress();
+		AnimationBinding& binding = mAnimationBindings[i];
+		binding.skeleton = mSkeleton.get();
+		binding.animation = animation;
+		binding.nodeTracks = animation->buildNodeTracks(*mSkeleton);
+	}
+}
+
+bool QSkeletalMesh::isAnimationBound(int inAnimIndex) const {
+	if (inAnimIndex < 0 || inAnimIndex >= mAnimationBindings.size() || inAnimIndex >= mAnimations.size() || mSkeleton.isNull())
+		return false;
+	const AnimationBinding& binding = mAnimationBindings[inAnimIndex];
+	return binding.skeleton == mSkeleton.get() && binding.animation == mAnimations[inAnimIndex].get() && binding.nodeTracks.size() == mSkeleton->mNodeNames.size();
+}
+
 void QSkeletalMesh::playAnimation(int inAnimIndex) {
 	if (inAnimIndex >= 0 && inAnimIndex < mAnimations.size()) {
-		auto animation = mAnimations[inAnimIndex];
-		if (!mAnimPlayer)
-			mAnimPlayer.reset(new QVariantAnimation);
-		if (mAnimPlayer->state() == QAbstractAnimation::Running) {
-			mAnimPlayer->stop();
-			mAnimPlayer->disconnect();
-		}
-		QObject::connect(mAnimPlayer.get(), &QVariantAnimation::valueChanged, [this, inAnimIndex](QVariant var) {
-			processBoneTransform(mAnimations[inAnimIndex].get(), var.toDouble());
-		});
-		mAnimPlayer->setStartValue(0.0);
-		mAnimPlayer->setEndValue(animation->mDuration / animation->mTicksPerSecond);
-		mAnimPlayer->setDuration(animation->mDuration / animation->mTicksPerSecond * 1000.0f);
-		mAnimPlayer->setLoopCount(-1);
-		mAnimPlayer->start();
-	}
-}
-
-void QSkeletalMesh::processBoneTransform(QSkeletalAnimation* inAnim, double inTimeMs) {
-	inTimeMs = fmod(inTimeMs, inAnim->mDuration / inAnim->mTicksPerSecond);
-	mCurrentPosesMatrix.resize(mSkeleton->mBoneOffsetMatrix.size());
-	QQueue<QPair<QSharedPointer<QSkeleton::MeshNode>, QMatrix4x4>> qNode;
-	qNode.push_back({ mSkeleton->mMeshRoot ,QMatrix4x4() });
-	while (!qNode.isEmpty()) {
-		QPair<QSharedPointer<QSkeleton::MeshNode>, QMatrix4x4> node = qNode.takeFirst();
-		QMatrix4x4 nodeMat = node.first->localTransform;
-		auto animNodeIter = inAnim->mAnimNode.find(node.first->name);
-		if (animNodeIter != inAnim->mAnimNode.end()) {
-			nodeMat = animNodeIter->getMatrix(inTimeMs);
+		AnimationCommand command{ AnimationCommand::Play };
+		command.desc.animIndex = inAnimIndex;
+		postAnimationCommand(command);
+	}
+}
+
+void QSkeletalMesh::crossFade(int inAnimIndex, float inDurationSec) {
+	if (inAnimIndex >= 0 && inAnimIndex < mAnimations.size()) {
+		AnimationCommand command{ AnimationCommand::CrossFade };
+		command.desc.animIndex = inAnimIndex;
+		command.fadeDuration = inDurationSec;
+		postAnimationCommand(command);
+	}
+}
+
+void QSkeletalMesh::setAnimationLayer(int inLayer, const AnimationLayer& inDesc) {
+	if (inLayer >= 0) {
+		AnimationCommand command{ AnimationCommand::SetLayer };
+		command.layer = inLayer;
+		command.desc = inDesc;
+		postAnimationCommand(command);
+	}
+}
+
+void QSkeletalMesh::removeAnimationLayer(int inLayer) {
+	AnimationCommand command{ AnimationCommand::RemoveLayer };
+	command.layer = inLayer;
+	postAnimationCommand(command);
+}
+
+void QSkeletalMesh::stopAnimation() {
+	postAnimationCommand(AnimationCommand{ AnimationCommand::Stop });
+}
+
+void QSkeletalMesh::postAnimationCommand(const AnimationCommand& inCommand) {
+	{
+		QMutexLocker locker(&mAnimationCommandMutex);
+		mAnimationCommands << inCommand;
+	}
+	QAnimationSystem::registerMesh(this);
+}
+
+bool QSkeletalMesh::isAnimationPlaying() const {
+	QMutexLocker locker(&mAnimationCommandMutex);
+	return !mAnimationCommands.isEmpty() || mActiveLayerCount.loadAcquire() > 0;
+}
+
+void QSkeletalMesh::setPlaybackSpeed(float inSpeed) {
+	mPlaybackSpeed = inSpeed;
+}
+
+float QSkeletalMesh::getPlaybackSpeed() const {
+	return mPlaybackSpeed;
+}
+
+QVector<MathUtils::Mat4> QSkeletalMesh::getCurrentPoses() const {
+	QMutexLocker locker(&mPoseMutex);
+	return mPoseBuffers[mFrontPoseBuffer];
+}
+
+static double wrapAnimationTime(double inTime, const QSkeletalAnimation& inAnim) {
+	const double duration = inAnim.durationSeconds();
+	if (duration <= 0.0)
+		return 0.0;
+	inTime = fmod(inTime, duration);
+	return inTime < 0.0 ? inTime + duration : inTime;
+}
+
+bool QSkeletalMesh::advanceAnimation(float inDeltaSec) {
+	QVector<AnimationCommand> commands;
+	{
+		QMutexLocker locker(&mAnimationCommandMutex);
+		commands.swap(mAnimationCommands);
+	}
+	auto isValidAnim = [this](int animIndex) {
+		return animIndex >= 0 && animIndex < mAnimations.size();
+	};
+	auto restartLayer = [](LayerState& layer, const AnimationLayer& desc) {
+		layer.desc = desc;
+		layer.time = 0.0;
+		layer.cursors.clear();
+		layer.fadeFromAnimIndex = -1;
+		layer.bJustStarted = true;
+	};
+	for (const AnimationCommand& command : commands) {
+		if (command.type == AnimationCommand::Stop) {
+			mLayers.clear();
+			continue;
+		}
+		if (mLayers.size() <= command.layer)
+			mLayers.resize(command.layer + 1);
+		LayerState& layer = mLayers[command.layer];
+		switch (command.type) {
+		case AnimationCommand::Play:
+			restartLayer(layer, command.desc);
+			break;
+		case AnimationCommand::CrossFade:
+			if (isValidAnim(layer.desc.animIndex) && command.fadeDuration > 0.0f && layer.desc.animIndex != command.desc.animIndex) {
+				// The outgoing clip keeps playing underneath until the fade completes
+				layer.fadeFromAnimIndex = layer.desc.animIndex;
+				layer.fadeFromTime = layer.time;
+				layer.fadeFromCursors.swap(layer.cursors);
+				layer.fadeElapsed = 0.0f;
+				layer.fadeDuration = command.fadeDuration;
+				layer.desc.animIndex = command.desc.animIndex;
+				layer.time = 0.0;
+				layer.cursors.clear();
+				layer.bJustStarted = true;
+			}
+			else {
+				AnimationLayer desc = layer.desc;
+				desc.animIndex = command.desc.animIndex;
+				restartLayer(layer, desc);
+			}
+			break;
+		case AnimationCommand::SetLayer:
+			if (layer.desc.animIndex != command.desc.animIndex)
+				restartLayer(layer, command.desc);
+			else
+				layer.desc = command.desc;
+			break;
+		case AnimationCommand::RemoveLayer:
+			restartLayer(layer, AnimationLayer());
+			break;
+		default:
+			break;
+		}
+	}
+	while (!mLayers.isEmpty() && !isValidAnim(mLayers.back().desc.animIndex)) {
+		mLayers.removeLast();
+	}
+
+	int activeLayerCount = 0;
+	for (LayerState& layer : mLayers) {
+		if (!isValidAnim(layer.desc.animIndex))
+			continue;
+		activeLayerCount++;
+		if (layer.bJustStarted) {
+			layer.bJustStarted = false;
+			continue;
+		}
+		const double delta = double(inDeltaSec) * mPlaybackSpeed;
+		layer.time = wrapAnimationTime(layer.time + delta * layer.desc.speed, *mAnimations[layer.desc.animIndex]);
+		if (isValidAnim(layer.fadeFromAnimIndex)) {
+			layer.fadeElapsed += inDeltaSec;
+			if (layer.fadeElapsed >= layer.fadeDuration)
+				layer.fadeFromAnimIndex = -1;
+			else
+				layer.fadeFromTime = wrapAnimationTime(layer.fadeFromTime + delta * layer.desc.speed, *mAnimations[layer.fadeFromAnimIndex]);
+		}
+	}
+	mActiveLayerCount.storeRelease(activeLayerCount);
+	if (activeLayerCount == 0)
+		return false;
+	evaluateLayers();
+	return true;
+}
+
+void QSkeletalMesh::publishPoses() {
+	QMutexLocker locker(&mPoseMutex);
+	mFrontPoseBuffer = 1 - mFrontPoseBuffer;
+}
+
+void QSkeletalMesh::evaluateLayers() {
+	ZoneScopedN("QSkeletalMesh::evaluateLayers");
+	// Runs on a job, the bindings were made by QAnimationSystem before the jobs started
+	auto prepare = [this](int animIndex, QVector<quint32>& cursors) -> const QVector<int>& {
+		const QSkeletalAnimation* anim = mAnimations[animIndex].get();
+		if (cursors.size() != qsizetype(anim->cursorCount()))
+			cursors.fill(0, anim->cursorCount());
+		return mAnimationBindings[animIndex].nodeTracks;
+	};
+	mPose.copyFrom(mSkeleton->mBindPose);
+	for (LayerState& layer : mLayers) {
+		if (!isAnimationBound(layer.desc.animIndex) || layer.desc.weight <= 0.0f)
+			continue;
+		const QSkeletalAnimation* animation = mAnimations[layer.desc.animIndex].get();
+		const QVector<int>& nodeTracks = prepare(layer.desc.animIndex, layer.cursors);
+		if (layer.desc.mode == BlendMode::Additive) {
+			animation->sampleAdditive(nodeTracks, layer.time, layer.cursors.data(), mPose, layer.desc.weight);
+		}
+		else if (isAnimationBound(layer.fadeFromAnimIndex)) {
+			const QSkeletalAnimation* fadeFrom = mAnimations[layer.fadeFromAnimIndex].get();
+			const QVector<int>& fadeFromNodeTracks = prepare(layer.fadeFromAnimIndex, layer.fadeFromCursors);
+			const float alpha = layer.fadeDuration > 0.0f ? qBound(0.0f, layer.fadeElapsed / layer.fadeDuration, 1.0f) : 1.0f;
+			mFadePose.copyFrom(mPose);
+			fadeFrom->sample(fadeFromNodeTracks, layer.fadeFromTime, layer.fadeFromCursors.data(), mFadePose);
+			animation->sample(nodeTracks, layer.time, layer.cursors.data(), mFadePose, alpha);
+			mPose.blend(mFadePose, layer.desc.weight);
+		}
+		else {
+			animation->sample(nodeTracks, layer.time, layer.cursors.data(), mPose, layer.desc.weight);
+		}
+	}
+	// Only publishPoses() on the ticking thread changes the front index, after every job has finished
+	QVector<MathUtils::Mat4>& poses = mPoseBuffers[1 - mFrontPoseBuffer];
+	poses.resize(mSkeleton->mBoneOffsetMatrix.size());
+	mLocalTransforms.resize(mPose.size());
+	mGlobalTransforms.resize(mPose.size());
+	mPose.toMatrices(mLocalTransforms.data());
+	mSkeleton->computePoses(mLocalTransforms.constData(), mGlobalTransforms.data(), poses.data());
+}
+
+void QSkeletalPose::copyFrom(const QSkeletalPose& inOther) {
+	// Assigning would share and then detach on the first write, copying into place keeps the storage
+	translations.resize(inOther.translations.size());
+	rotations.resize(inOther.rotations.size());
+	scalings.resize(inOther.scalings.size());
+	std::copy(inOther.translations.constBegin(), inOther.translations.constEnd(), translations.begin());
+	std::copy(inOther.rotations.constBegin(), inOther.rotations.constEnd(), rotations.begin());
+	std::copy(inOther.scalings.constBegin(), inOther.scalings.constEnd(), scalings.begin());
+}
+
+void QSkeletalPose::blend(const QSkeletalPose& inTarget, float inWeight) {
+	if (inWeight >= 1.0f) {
+		copyFrom(inTarget);
+		return;
+	}
+	for (int i = 0; i < size(); i++) {
+		translations[i] += (inTarget.translations[i] - translations[i]) * inWeight;
+		rotations[i] = QQuaternion::nlerp(rotations[i], inTarget.rotations[i], inWeight);
+		scalings[i] += (inTarget.scalings[i] - scalings[i]) * inWeight;
+	}
+}
+
+void QSkeletalPose::toMatrices(QMatrix4x4* outLocalTransforms) const {
+	for (int i = 0; i < size(); i++) {
+		// translation * rotation * scaling, written directly instead of three QMatrix4x4 multiplications
+		const QQuaternion& q = rotations[i];
+		const QVector3D& t = translations[i];
+		const QVector3D& s = scalings[i];
+		const float xx = q.x() * q.x(), yy = q.y() * q.y(), zz = q.z() * q.z();
+		const float xy = q.x() * q.y(), xz = q.x() * q.z(), yz = q.y() * q.z();
+		const float wx = q.scalar() * q.x(), wy = q.scalar() * q.y(), wz = q.scalar() * q.z();
+		outLocalTransforms[i] = QMatrix4x4(
+			(1.0f - 2.0f * (yy + zz)) * s.x(), 2.0f * (xy - wz) * s.y(), 2.0f * (xz + wy) * s.z(), t.x(),
+			2.0f * (xy + wz) * s.x(), (1.0f - 2.0f * (xx + zz)) * s.y(), 2.0f * (yz - wx) * s.z(), t.y(),
+			2.0f * (xz - wy) * s.x(), 2.0f * (yz + wx) * s.y(), (1.0f - 2.0f * (xx + yy)) * s.z(), t.z(),
+			0.0f, 0.0f, 0.0f, 1.0f);
+	}
+}
+
+void QSkeleton::flatten() {
+	mNodeNames.clear();
+	mNodeParents.clear();
+	mNodeBones.clear();
+	mNodeLocalTransforms.clear();
+	mNodeBoneOffsets.clear();
+	mNodeIndexMap.clear();
+	mBindPose = QSkeletalPose();
+	if (mMeshRoot.isNull())
+		return;
+	QVector<QPair<const MeshNode*, int>> queue;
+	queue.push_back({ mMeshRoot.get(), -1 });
+	for (int head = 0; head < queue.size(); head++) {
+		const MeshNode* node = queue[head].first;
+		const int index = mNodeNames.size();
+		mNodeNames << node->name;
+		mNodeParents << queue[head].second;
+		mNodeLocalTransforms << node->localTransform;
+		auto boneIter = mBoneMap.constFind(node->name);
+		if (boneIter != mBoneMap.constEnd() && (*boneIter)->index < mBoneOffsetMatrix.size()) {
+			mNodeBones << (*boneIter)->index;
+			mNodeBoneOffsets << QMatrix4x4(mBoneOffsetMatrix[(*boneIter)->index]);
 		}
-		QMatrix4x4 globalMatrix = node.second * nodeMat;
-		auto boneIter = mSkeleton->mBoneMap.find(node.first->name);
-		if (boneIter != mSkeleton->mBoneMap.end()) {
-			const int& index = (*boneIter)->index;
-			mCurrentPosesMatrix[index] = (globalMatrix * QMatrix4x4(mSkeleton->mBoneOffsetMatrix[index])).toGenericMatrix<4, 4>();
+		else {
+			mNodeBones << -1;
+			mNodeBoneOffsets << QMatrix4x4();
 		}
-		for (unsigned int i = 0; i < node.first->children.size(); i++) {
-			qNode.push_back({ node.first->children[i] ,globalMatrix });
+		if (!mNodeIndexMap.contains(node->name))
+			mNodeIndexMap.insert(node->name, index);
+		for (const auto& child : node->children) {
+			queue.push_back({ child.get(), index });
 		}
+
+		const QMatrix4x4& local = node->localTransform;
+		QVector3D scaling(local.column(0).toVector3D().length(), local.column(1).toVector3D().length(), local.column(2).toVector3D().length());
+		if (local.determinant() < 0.0)
+			scaling.setX(-scaling.x());
+		QMatrix3x3 rotation;
+		for (int row = 0; row < 3; row++) {
+			for (int col = 0; col < 3; col++) {
+				rotation(row, col) = scaling[col] != 0.0f ? local(row, col) / scaling[col] : (row == col ? 1.0f : 0.0f);
+			}
+		}
+		mBindPose.translations << local.column(3).toVector3D();
+		mBindPose.rotations << QQuaternion::fromRotationMatrix(rotation).normalized();
+		mBindPose.scalings << scaling;
+	}
+}
+
+int QSkeleton::findNode(const QString& inName) const {
+	return mNodeIndexMap.value(inName, -1);
+}
+
+void QSkeleton::computePoses(const QMatrix4x4* inLocalTransforms, QMatrix4x4* outGlobalTransforms, MathUtils::Mat4* outPoses) const {
+	const int nodeCount = mNodeParents.size();
+	for (int i = 0; i < nodeCount; i++) {
+		const int parent = mNodeParents[i];
+		outGlobalTransforms[i] = parent < 0 ? inLocalTransforms[i] : outGlobalTransforms[parent] * inLocalTransforms[i];
+		const int bone = mNodeBones[i];
+		if (bone >= 0)
+			outPoses[bone] = (outGlobalTransforms[i] * mNodeBoneOffsets[i]).toGenericMatrix<4, 4>();
+	}
+}
+
+static QVector3D interpolateKey(const QVector3D& start, const QVector3D& end, float factor) {
+	return start + (end - start) * factor;
+}
+
+static QQuaternion interpolateKey(const QQuaternion& start, const QQuaternion& end, float factor) {
+	return QQuaternion::nlerp(start, end, factor);
+}
+
+// Same clamping and interpolation as AnimNode::getMatrix, used to resample the source keys onto the fixed grid
+template<typename ValueType>
+static ValueType sampleSourceKeys(const QMap<double, ValueType>& inKeys, double inTime, const ValueType& inDefault) {
+	if (inKeys.isEmpty())
+		return inDefault;
+	auto end = inKeys.upperBound(inTime);
+	if (end == inKeys.cbegin())
+		return end.value();
+	auto start = std::prev(end);
+	if (end == inKeys.cend())
+		return start.value();
+	const double deltaTime = end.key() - start.key();
+	return interpolateKey(start.value(), end.value(), deltaTime > 0 ? float((inTime - start.key()) / deltaTime) : 0.0f);
+}
+
+static constexpr float kSmallestThreeRange = 0.70710678f;
+
+static void packQuaternion(QQuaternion inRotation, quint16* outWords) {
+	const QVector4D q = inRotation.normalized().toVector4D();
+	int largest = 0;
+	for (int i = 1; i < 4; i++) {
+		if (qAbs(q[i]) > qAbs(q[largest]))
+			largest = i;
+	}
+	const float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+	quint64 bits = quint64(largest);
+	int shift = 2;
+	for (int i = 0; i < 4; i++) {
+		if (i == largest)
+			continue;
+		const float normalized = qBound(-1.0f, sign * q[i] / kSmallestThreeRange, 1.0f) * 0.5f + 0.5f;
+		bits |= quint64(qRound(normalized * 32767.0f)) << shift;
+		shift += 15;
+	}
+	outWords[0] = quint16(bits);
+	outWords[1] = quint16(bits >> 16);
+	outWords[2] = quint16(bits >> 32);
+}
+
+static QQuaternion unpackQuaternion(const quint16* inWords) {
+	const quint64 bits = quint64(inWords[0]) | (quint64(inWords[1]) << 16) | (quint64(inWords[2]) << 32);
+	const int largest = int(bits & 3);
+	float q[4];
+	float sum = 0.0f;
+	int shift = 2;
+	for (int i = 0; i < 4; i++) {
+		if (i == largest)
+			continue;
+		q[i] = ((float((bits >> shift) & 0x7FFF) / 32767.0f) * 2.0f - 1.0f) * kSmallestThreeRange;
+		sum += q[i] * q[i];
+		shift += 15;
+	}
+	q[largest] = std::sqrt(qMax(0.0f, 1.0f - sum));
+	return QQuaternion(q[3], q[0], q[1], q[2]);
+}
+
+static void packVector(const QVector3D& inValue, const QVector3D& inMin, const QVector3D& inExtent, quint16* outWords) {
+	for (int i = 0; i < 3; i++) {
+		outWords[i] = inExtent[i] > 0.0f ? quint16(qRound(qBound(0.0f, (inValue[i] - inMin[i]) / inExtent[i], 1.0f) * 65535.0f)) : 0;
+	}
+}
+
+static QVector3D unpackVector(const quint16* inWords, const QVector3D& inMin, const QVector3D& inExtent) {
+	return inMin + QVector3D(inWords[0], inWords[1], inWords[2]) * (1.0f / 65535.0f) * inExtent;
+}
+
+static float keyDistance(const QVector3D& a, const QVector3D& b) {
+	return (a - b).length();
+}
+
+static float keyDistance(const QQuaternion& a, const QQuaternion& b) {
+	// q and -q are the same rotation
+	return qMin((a.toVector4D() - b.toVector4D()).length(), (a.toVector4D() + b.toVector4D()).length());
+}
+
+// Keeps the fewest grid frames whose linear interpolation stays within inTolerance of every dropped frame
+template<typename ValueType>
+static QVector<int> reduceKeys(const QVector<ValueType>& inFrames, float inTolerance) {
+	QVector<int> kept{ 0 };
+	const int frameCount = inFrames.size();
+	bool bConstant = true;
+	for (int i = 1; i < frameCount && bConstant; i++) {
+		bConstant = keyDistance(inFrames[i], inFrames[0]) <= inTolerance;
+	}
+	if (bConstant)
+		return kept;
+	auto segmentFits = [&](int begin, int end) {
+		for (int i = begin + 1; i < end; i++) {
+			const ValueType value = interpolateKey(inFrames[begin], inFrames[end], float(i - begin) / float(end - begin));
+			if (keyDistance(value, inFrames[i]) > inTolerance)
+				return false;
+		}
+		return true;
+	};
+	int begin = 0;
+	while (begin < frameCount - 1) {
+		int end = begin + 1;
+		while (end + 1 < frameCount && segmentFits(begin, end + 1)) {
+			end++;
+		}
+		kept << end;
+		begin = end;
+	}
+	return kept;
+}
+
+template<typename ValueType>
+static void compressChannel(const QMap<double, ValueType>& inKeys, const ValueType& inDefault, int inFrameCount, float inSampleRate, float inTolerance, QSkeletalAnimation& ioAnim, QSkeletalAnimation::Channel& outChannel) {
+	outChannel.keyOffset = ioAnim.mKeyFrames.size();
+	outChannel.keyCount = 0;
+	if (inKeys.isEmpty())
+		return;
+	QVector<ValueType> frames(inFrameCount);
+	for (int i = 0; i < inFrameCount; i++) {
+		frames[i] = sampleSourceKeys(inKeys, i / double(inSampleRate), inDefault);
+	}
+	float tolerance = inTolerance;
+	if constexpr (std::is_same_v<ValueType, QVector3D>) {
+		QVector3D rangeMin = frames[0], rangeMax = frames[0];
+		for (const QVector3D& frame : frames) {
+			rangeMin = QVector3D(qMin(rangeMin.x(), frame.x()), qMin(rangeMin.y(), frame.y()), qMin(rangeMin.z(), frame.z()));
+			rangeMax = QVector3D(qMax(rangeMax.x(), frame.x()), qMax(rangeMax.y(), frame.y()), qMax(rangeMax.z(), frame.z()));
+		}
+		outChannel.rangeMin = rangeMin;
+		outChannel.rangeExtent = rangeMax - rangeMin;
+		tolerance = inTolerance * outChannel.rangeExtent.length();
+	}
+	const QVector<int> kept = reduceKeys(frames, tolerance);
+	outChannel.keyCount = kept.size();
+	for (int frame : kept) {
+		quint16 words[3];
+		if constexpr (std::is_same_v<ValueType, QQuaternion>)
+			packQuaternion(frames[frame], words);
+		else
+			packVector(frames[frame], outChannel.rangeMin, outChannel.rangeExtent, words);
+		ioAnim.mKeyFrames << quint16(frame);
+		ioAnim.mKeyData << words[0] << words[1] << words[2];
+	}
+	ioAnim.mCompressionStatistics.sourceKeys += inKeys.size();
+	ioAnim.mCompressionStatistics.sourceBytes += inKeys.size() * (sizeof(double) + sizeof(ValueType));
+	ioAnim.mCompressionStatistics.compressedKeys += kept.size();
+}
+
+void QSkeletalAnimation::compress(const CompressionSettings& inSettings) {
+	ZoneScopedN("QSkeletalAnimation::compress");
+	mTracks.clear();
+	mKeyFrames.clear();
+	mKeyData.clear();
+	mCompressionStatistics = CompressionStatistics();
+	mSampleRate = qMax(1.0f, inSettings.sampleRate);
+	const int frameCount = qBound(1, int(std::ceil(durationSeconds() * mSampleRate)) + 1, 65536);
+	for (auto it = mAnimNode.cbegin(); it != mAnimNode.cend(); ++it) {
+		Track track;
+		track.name = it.key();
+		compressChannel(it->translation, QVector3D(), frameCount, mSampleRate, inSettings.translationTolerance, *this, track.translation);
+		compressChannel(it->rotation, QQuaternion(), frameCount, mSampleRate, inSettings.rotationTolerance, *this, track.rotation);
+		compressChannel(it->scaling, QVector3D(1, 1, 1), frameCount, mSampleRate, inSettings.scalingTolerance, *this, track.scaling);
+		if (track.translation.keyCount)
+			track.referenceTranslation = unpackVector(mKeyData.constData() + track.translation.keyOffset * 3, track.translation.rangeMin, track.translation.rangeExtent);
+		if (track.rotation.keyCount)
+			track.referenceRotation = unpackQuaternion(mKeyData.constData() + track.rotation.keyOffset * 3);
+		if (track.scaling.keyCount)
+			track.referenceScaling = unpackVector(mKeyData.constData() + track.scaling.keyOffset * 3, track.scaling.rangeMin, track.scaling.rangeExtent);
+		mTracks << track;
+	}
+	mCompressionStatistics.compressedBytes = mKeyFrames.size() * sizeof(quint16) + mKeyData.size() * sizeof(quint16) + mTracks.size() * sizeof(Track);
+	if (inSettings.bReleaseSource)
+		mAnimNode.clear();
+}
+
+QVector<int> QSkeletalAnimation::buildNodeTracks(const QSkeleton& inSkeleton) const {
+	QHash<QString, int> trackIndexMap;
+	for (int i = 0; i < mTracks.size(); i++) {
+		trackIndexMap.insert(mTracks[i].name, i);
+	}
+	QVector<int> nodeTracks(inSkeleton.mNodeNames.size());
+	for (int i = 0; i < nodeTracks.size(); i++) {
+		nodeTracks[i] = trackIndexMap.value(inSkeleton.mNodeNames[i], -1);
+	}
+	return nodeTracks;
+}
+
+// Playback mostly moves forward by less than a key per frame, so the search starts from the previous key and only rewinds on loops
+static inline bool findKeys(const QSkeletalAnimation::Channel& inChannel, const quint16* inFrames, float inFrame, quint32& ioCursor, quint32& outKey, float& outFactor) {
+	if (inChannel.keyCount == 0)
+		return false;
+	const quint16* frames = inFrames + inChannel.keyOffset;
+	quint32 cursor = ioCursor < inChannel.keyCount && frames[ioCursor] <= inFrame ? ioCursor : 0;
+	while (cursor + 1 < inChannel.keyCount && frames[cursor + 1] <= inFrame) {
+		cursor++;
+	}
+	ioCursor = cursor;
+	outKey = inChannel.keyOffset + cursor;
+	outFactor = 0.0f;
+	if (cursor + 1 < inChannel.keyCount && inFrame > frames[cursor])
+		outFactor = qMin(1.0f, (inFrame - frames[cursor]) / float(frames[cursor + 1] - frames[cursor]));
+	return true;
+}
+
+static inline QVector3D sampleVector(const QSkeletalAnimation::Channel& inChannel, const QSkeletalAnimation& inAnim, float inFrame, quint32& ioCursor, const QVector3D& inDefault) {
+	quint32 key;
+	float factor;
+	if (!findKeys(inChannel, inAnim.mKeyFrames.constData(), inFrame, ioCursor, key, factor))
+		return inDefault;
+	const quint16* data = inAnim.mKeyData.constData() + key * 3;
+	const QVector3D start = unpackVector(data, inChannel.rangeMin, inChannel.rangeExtent);
+	if (factor <= 0.0f)
+		return start;
+	return interpolateKey(start, unpackVector(data + 3, inChannel.rangeMin, inChannel.rangeExtent), factor);
+}
+
+static inline QQuaternion sampleRotation(const QSkeletalAnimation::Channel& inChannel, const QSkeletalAnimation& inAnim, float inFrame, quint32& ioCursor, const QQuaternion& inDefault) {
+	quint32 key;
+	float factor;
+	if (!findKeys(inChannel, inAnim.mKeyFrames.constData(), inFrame, ioCursor, key, factor))
+		return inDefault;
+	const quint16* data = inAnim.mKeyData.constData() + key * 3;
+	const QQuaternion start = unpackQuaternion(data);
+	if (factor <= 0.0f)
+		return start;
+	return QQuaternion::nlerp(start, unpackQuaternion(data + 3), factor);
+}
+
+void QSkeletalAnimation::sample(const QVector<int>& inNodeTracks, double inTimeSec, quint32* ioCursors, QSkeletalPose& ioPose, float inWeight) const {
+	const float frame = float(inTimeSec * mSampleRate);
+	for (int node = 0; node < inNodeTracks.size(); node++) {
+		const int trackIndex = inNodeTracks[node];
+		if (trackIndex < 0)
+			continue;
+		const Track& track = mTracks[trackIndex];
+		quint32* cursors = ioCursors + trackIndex * 3;
+		const QVector3D translation = sampleVector(track.translation, *this, frame, cursors[0], QVector3D());
+		const QQuaternion rotation = sampleRotation(track.rotation, *this, frame, cursors[1], QQuaternion());
+		const QVector3D scaling = sampleVector(track.scaling, *this, frame, cursors[2], QVector3D(1, 1, 1));
+		if (inWeight >= 1.0f) {
+			ioPose.translations[node] = translation;
+			ioPose.rotations[node] = rotation;
+			ioPose.scalings[node] = scaling;
+		}
+		else {
+			ioPose.translations[node] += (translation - ioPose.translations[node]) * inWeight;
+			ioPose.rotations[node] = QQuaternion::nlerp(ioPose.rotations[node], rotation, inWeight);
+			ioPose.scalings[node] += (scaling - ioPose.scalings[node]) * inWeight;
+		}
+	}
+}
+
+void QSkeletalAnimation::sampleAdditive(const QVector<int>& inNodeTracks, double inTimeSec, quint32* ioCursors, QSkeletalPose& ioPose, float inWeight) const {
+	const float frame = float(inTimeSec * mSampleRate);
+	for (int node = 0; node < inNodeTracks.size(); node++) {
+		const int trackIndex = inNodeTracks[node];
+		if (trackIndex < 0)
+			continue;
+		const Track& track = mTracks[trackIndex];
+		quint32* cursors = ioCursors + trackIndex * 3;
+		const QVector3D translation = sampleVector(track.translation, *this, frame, cursors[0], track.referenceTranslation);
+		const QQuaternion rotation = sampleRotation(track.rotation, *this, frame, cursors[1], track.referenceRotation);
+		const QVector3D scaling = sampleVector(track.scaling, *this, frame, cursors[2], track.referenceScaling);
+		const QQuaternion deltaRotation = rotation * track.referenceRotation.conjugated();
+		QVector3D deltaScaling;
+		for (int i = 0; i < 3; i++) {
+			deltaScaling[i] = track.referenceScaling[i] != 0.0f ? scaling[i] / track.referenceScaling[i] : 1.0f;
+		}
+		ioPose.translations[node] += (translation - track.referenceTranslation) * inWeight;
+		ioPose.rotations[node] = (QQuaternion::nlerp(QQuaternion(), deltaRotation, inWeight) * ioPose.rotations[node]).normalized();
+		ioPose.scalings[node] *= QVector3D(1, 1, 1) + (deltaScaling - QVector3D(1, 1, 1)) * inWeight;
 	}
 }
 
@@ -228,3 +811,20 @@ QMatrix4x4 QSkeletalAnimation::AnimNode::getMatrix(const double& timeMs) {
 		mat.scale(startScaling.value());
 	return mat;
 }
+
+void QSkeletalMesh::updateBounds() {
+	// Bind pose bounds, inflated since animated poses can reach outside of them
+	for (auto& submesh : mSubmeshes) {
+		MathUtils::AABB bounds;
+		for (uint32_t i = 0; i < submesh.verticesRange; i++) {
+			bounds.extend(mVertices[submesh.verticesOffset + i].position);
+		}
+		if (bounds.isValid()) {
+			QVector3D center = bounds.center();
+			QVector3D extent = QVector3D(1, 1, 1) * bounds.radius();
+			bounds.min = center - extent;
+			bounds.max = center + extent;
+		}
+		submesh.localBounds = bounds;
+	}
+}
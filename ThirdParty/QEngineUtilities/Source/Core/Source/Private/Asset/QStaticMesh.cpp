@@ -4,6 +4,8 @@
 #include "assimp/scene.h"
 #include "assimp/matrix4x4.h"
 #include "AssetUtils.h"
+#include "QMeshCache.h"
+#include "QMeshOptimizer.h"
 #include <QDir>
 #include <QQueue>
 #include <QFontMetrics>
@@ -12,7 +14,10 @@
 #include <private/qtriangulator_p.h>
 
 QSharedPointer<QStaticMesh> QStaticMesh::CreateFromFile(const QString& inFilePath) {
-	QSharedPointer<QStaticMesh> staticMesh;
+	QSharedPointer<QStaticMesh> staticMesh = QMeshCache::loadStaticMesh(inFilePath);
+	if (staticMesh) {
+		return staticMesh;
+	}
 	Assimp::Importer importer;
 	const aiScene* scene = importer.ReadFile(inFilePath.toUtf8().constData(), aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals | aiProcess_CalcTangentSpace);
 	if (!scene) {
@@ -49,11 +54,14 @@ QSharedPointer<QStaticMesh> QStaticMesh::CreateFromFile(const QString& inFilePat
 			meshInfo.indicesOffset = staticMesh->mIndices.size();
 			meshInfo.indicesRange = 0;
 			for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-				aiFace face = mesh->mFaces[i];
-				for (unsigned int j = 0; j < face.mNumIndices; j++) {
-					staticMesh->mIndices.push_back(face.mIndices[j]);
-					meshInfo.indicesRange++;
-				}
+				meshInfo.indicesRange += mesh->mFaces[i].mNumIndices;
+			}
+			staticMesh->mIndices.resize(meshInfo.indicesOffset + meshInfo.indicesRange);
+			Index* indices = staticMesh->mIndices.data() + meshInfo.indicesOffset;
+			for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+				const aiFace& face = mesh->mFaces[i];
+				memcpy(indices, face.mIndices, face.mNumIndices * sizeof(Index));
+				indices += face.mNumIndices;
 			}
 			staticMesh->mSubmeshes << meshInfo;
 		}
@@ -61,6 +69,13 @@ QSharedPointer<QStaticMesh> QStaticMesh::CreateFromFile(const QString& inFilePat
 			qNode.push_back({ node.first->mChildren[i] ,node.second * node.first->mChildren[i]->mTransformation });
 		}
 	}
+	if (QMeshOptimizer::isEnabled()) {
+		QMeshOptimizer::optimize(*staticMesh);
+		const QMeshOptimizer::LodSettings lodSettings = QMeshOptimizer::getLodSettings();
+		QMeshOptimizer::generateLods(*staticMesh, lodSettings.maxLevels, lodSettings.reduction);
+	}
+	staticMesh->updateBounds();
+	QMeshCache::saveStaticMesh(inFilePath, *staticMesh);
 	return staticMesh;
 }
 
@@ -99,6 +114,7 @@ QSharedPointer<QStaticMesh> QStaticMesh::CreateFromImage(QImage image)
 	submesh.materialIndex = 0;
 	staticMesh->mMaterials << material;
 	staticMesh->mSubmeshes << submesh;
+	staticMesh->updateBounds();
 	return staticMesh;
 }
 
@@ -127,6 +143,7 @@ QSharedPointer<QStaticMesh> QStaticMesh::CreateFromShape(Shape shape)
 	submesh.materialIndex = 0;
 	staticMesh->mMaterials << material;
 	staticMesh->mSubmeshes << submesh;
+	staticMesh->updateBounds();
 	return staticMesh;
 }
 
@@ -225,6 +242,16 @@ QSharedPointer<QStaticMesh> QStaticMesh::CreateFromText(const QString& inText, c
 	submesh.materialIndex = 0;
 	staticMesh->mMaterials << material;
 	staticMesh->mSubmeshes << submesh;
+	staticMesh->updateBounds();
 	return staticMesh;
 }
 
+
+void QStaticMesh::updateBounds() {
+	for (auto& submesh : mSubmeshes) {
+		submesh.localBounds = MathUtils::AABB();
+		for (uint32_t i = 0; i < submesh.verticesRange; i++) {
+			submesh.localBounds.extend(mVertices[submesh.verticesOffset + i].position);
+		}
+	}
+}
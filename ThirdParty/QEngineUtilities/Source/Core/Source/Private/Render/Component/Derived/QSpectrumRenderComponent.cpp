@@ -6,8 +6,7 @@ QSpectrumRenderComponent::QSpectrumRenderComponent() {
 	mSpectruomProvider = mAudioProvider->createSpectrumProvider();
 	mTimer = new QTimer(this);
 	connect(mTimer, &QTimer::timeout, [this]() {
-		QMutexLocker locker(&mMutex);
-		mSpectrum = mSpectruomProvider->calculateSpectrum();
+		mSpectruomProvider->calculateSpectrum();
 	});
 	mTimer->setInterval(10);
 
@@ -36,19 +35,19 @@ void QSpectrumRenderComponent::onRebuildResource() {
 }
 
 void QSpectrumRenderComponent::onUpdateVertices(QVector<Vertex>& vertices) {
-	QMutexLocker locker(&mMutex);
-	vertices.resize(mSpectrum.size() * 6);
-	float width = 2.0 / mSpectrum.size();
+	const QVector<float>& spectrum = mSpectruomProvider->getLatestSpectrum();
+	vertices.resize(spectrum.size() * 6);
+	float width = 2.0 / spectrum.size();
 	float startX = -1;
-	for (int i = 0; i < mSpectrum.size(); i++) {
+	for (int i = 0; i < spectrum.size(); i++) {
 		Vertex a, b, c, d;
 
 		a.position = QVector3D(startX, 0, 0);
-		b.position = QVector3D(startX, mSpectrum[i], 0);
+		b.position = QVector3D(startX, spectrum[i], 0);
 
 		startX += width;
 		c.position = QVector3D(startX, 0, 0);
-		d.position = QVector3D(startX, mSpectrum[i], 0);
+		d.position = QVector3D(startX, spectrum[i], 0);
 
 		a.normal = b.normal = c.normal = d.normal = QVector3D(0, 0, 1);
 		a.tangent = b.tangent = c.tangent = d.tangent = QVector3D(1, 0, 0);
@@ -12,9 +12,11 @@ void QDynamicMeshRenderComponent::onRebuildResource() {
 	mVertexBuffer->create();
 
 	mRenderProxy = newPrimitiveRenderProxy();
-	mRenderProxy->addUniformBlock(QRhiShaderStage::Vertex, "Transform")
+	QRhiUniformBlock* transform = mRenderProxy->addUniformBlock(QRhiShaderStage::Vertex, "Transform")
 		->addParam("MVP", QGenericMatrix<4, 4, float>())
 		->addParam("M", QGenericMatrix<4, 4, float>());
+	QRhiUniformBlock::ParamHandle mvpHandle = transform->getParamHandle("MVP");
+	QRhiUniformBlock::ParamHandle mHandle = transform->getParamHandle("M");
 
 	mRenderProxy->setInputBindings({
 		QRhiVertexInputBindingEx(mVertexBuffer.get(),sizeof(Vertex))
@@ -61,7 +63,7 @@ void QDynamicMeshRenderComponent::onRebuildResource() {
 		.arg(hasColorAttachment("Roughness") ? QString("Roughness = %1;").arg(materialDesc->getOrCreateRoughnessExpression()) : "")
 		.toLocal8Bit()
 	);
-	mRenderProxy->setOnUpdate([this](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
+	mRenderProxy->setOnUpdate([this, transform, mvpHandle, mHandle](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
 		onUpdateVertices(mVertices);
 		if (!mVertices.isEmpty()) {
 			if (mVertices.size() * sizeof(Vertex) != mVertexBuffer->size()) {
@@ -72,8 +74,8 @@ void QDynamicMeshRenderComponent::onRebuildResource() {
 		}
 		QMatrix4x4 M = getModelMatrix() ;
 		QMatrix4x4 MVP = ctx.projectionMatrixWithCorr * ctx.viewMatrix * M;
-		blocks["Transform"]->setParamValue("MVP", QVariant::fromValue(MVP.toGenericMatrix<4, 4>()));
-		blocks["Transform"]->setParamValue("M", QVariant::fromValue(M.toGenericMatrix<4, 4>()));
+		transform->setParamValue(mvpHandle, MVP.toGenericMatrix<4, 4>());
+		transform->setParamValue(mHandle, M.toGenericMatrix<4, 4>());
 	});
 
 	mRenderProxy->setOnDraw([this](QRhiCommandBuffer* cmdBuffer) {
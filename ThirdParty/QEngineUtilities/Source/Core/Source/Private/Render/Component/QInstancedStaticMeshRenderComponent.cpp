@@ -0,0 +1,254 @@
+#include "Render/Component/QInstancedStaticMeshRenderComponent.h"
+#include "Render/Component/QStaticMeshRenderComponent.h"
+#include "QEngineObjectManager.h"
+#include <cstring>
+
+QInstancedStaticMeshRenderComponent::QInstancedStaticMeshRenderComponent() {
+}
+
+void QInstancedStaticMeshRenderComponent::setStaticMesh(QSharedPointer<QStaticMesh> val) {
+	mStaticMesh = val;
+	if (mStaticMesh) {
+		mMaterialGroup.reset(new QRhiMaterialGroup(mStaticMesh->mMaterials));
+		mSigRebuildResource.request();
+	}
+}
+
+QSharedPointer<QStaticMesh> QInstancedStaticMeshRenderComponent::getStaticMesh() const
+{
+	return mStaticMesh;
+}
+
+QRhiMaterialGroup* QInstancedStaticMeshRenderComponent::getMaterialGroup()
+{
+	return mMaterialGroup.get();
+}
+
+void QInstancedStaticMeshRenderComponent::addInstance(const QMatrix4x4& inTransform) {
+	mInstances << inTransform;
+	setInstances(mInstances);
+}
+
+void QInstancedStaticMeshRenderComponent::setInstances(const QVector<QMatrix4x4>& inTransforms) {
+	mInstances = inTransforms;
+	mInstancesVersion++;
+	if (mInstanceBuffer && mStaticMesh && mInstances.size() <= mInstanceCapacity) {
+		updateInstanceBounds();
+	}
+	else {
+		mSigRebuildResource.request();
+	}
+}
+
+void QInstancedStaticMeshRenderComponent::setLodErrorThreshold(float val)
+{
+	mLodErrorThreshold = val;
+}
+
+float QInstancedStaticMeshRenderComponent::getLodErrorThreshold() const
+{
+	return mLodErrorThreshold;
+}
+
+int QInstancedStaticMeshRenderComponent::getInstanceLod(int submeshIndex, int instanceIndex) const
+{
+	if (submeshIndex < 0 || submeshIndex >= mSubmeshInstanceLods.size())
+		return 0;
+	return mSubmeshInstanceLods[submeshIndex].instanceLods.value(instanceIndex);
+}
+
+void QInstancedStaticMeshRenderComponent::updateInstanceBounds() {
+	if (mStaticMesh.isNull())
+		return;
+	for (int i = 0; i < mProxies.size(); i++) {
+		const QStaticMesh::SubMeshData& subMesh = mStaticMesh->mSubmeshes[i];
+		MathUtils::AABB bounds;
+		for (const auto& instance : mInstances) {
+			MathUtils::AABB instanceBounds = subMesh.localBounds.transformed(instance * subMesh.localTransfrom);
+			if (instanceBounds.isValid()) {
+				bounds.extend(instanceBounds.min);
+				bounds.extend(instanceBounds.max);
+			}
+		}
+		mProxies[i]->setLocalBounds(bounds);
+	}
+}
+
+void QInstancedStaticMeshRenderComponent::onRebuildResource() {
+	if (mStaticMesh.isNull())
+		return;
+
+	mVertexBuffer.reset(mRhi->newBuffer(QRhiBuffer::Type::Static, QRhiBuffer::VertexBuffer, sizeof(QStaticMesh::Vertex) * mStaticMesh->mVertices.size()));
+	mVertexBuffer->create();
+	mIndexBuffer.reset(mRhi->newBuffer(QRhiBuffer::Type::Static, QRhiBuffer::IndexBuffer, sizeof(QStaticMesh::Index) * mStaticMesh->mIndices.size()));
+	mIndexBuffer->create();
+	// Grow geometrically, adding instances only rebuilds the proxies when the count outgrows the capacity
+	mInstanceCapacity = qMax(mInstanceCapacity, 16);
+	while (mInstanceCapacity < mInstances.size())
+		mInstanceCapacity *= 2;
+	mInstanceBuffer.reset(mRhi->newBuffer(QRhiBuffer::Type::Dynamic, QRhiBuffer::VertexBuffer, sizeof(float) * 16 * mInstanceCapacity * qMax(1, mStaticMesh->mSubmeshes.size())));
+	mInstanceBuffer->create();
+
+	mProxies.clear();
+	mSubmeshInstanceLods.clear();
+	mSubmeshInstanceLods.resize(mStaticMesh->mSubmeshes.size());
+	for (int submeshIndex = 0; submeshIndex < mStaticMesh->mSubmeshes.size(); submeshIndex++) {
+		const QStaticMesh::SubMeshData& subMesh = mStaticMesh->mSubmeshes[submeshIndex];
+		QSharedPointer<QPrimitiveRenderProxy> proxy = newPrimitiveRenderProxy();
+		mProxies << proxy;
+
+		QRhiUniformBlock* transform = proxy->addUniformBlock(QRhiShaderStage::Vertex, "Transform")
+			->addParam("VP", QGenericMatrix<4, 4, float>())
+			->addParam("M", QGenericMatrix<4, 4, float>())
+			->addParam("Local", QGenericMatrix<4, 4, float>());
+		QRhiUniformBlock::ParamHandle vpHandle = transform->getParamHandle("VP");
+		QRhiUniformBlock::ParamHandle mHandle = transform->getParamHandle("M");
+		QRhiUniformBlock::ParamHandle localHandle = transform->getParamHandle("Local");
+
+		proxy->setInputBindings({
+			QRhiVertexInputBindingEx(mVertexBuffer.get(),sizeof(QStaticMesh::Vertex)),
+			QRhiVertexInputBindingEx(mInstanceBuffer.get(),sizeof(float) * 16, 0, QRhiVertexInputBinding::Classification::PerInstance)
+		});
+
+		proxy->setInputAttribute({
+			QRhiVertexInputAttributeEx("inPosition"	,0, 0, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,position)),
+			QRhiVertexInputAttributeEx("inNormal"	,0, 1, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,normal)),
+			QRhiVertexInputAttributeEx("inTangent"	,0, 2, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,tangent)),
+			QRhiVertexInputAttributeEx("inBitangent",0, 3, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,bitangent)),
+			QRhiVertexInputAttributeEx("inUV"		,0, 4, QRhiVertexInputAttribute::Float2, offsetof(QStaticMesh::Vertex,uv)),
+
+			QRhiVertexInputAttributeEx("inInstTransform", 1, 5, QRhiVertexInputAttribute::Float4, 0,0),
+			QRhiVertexInputAttributeEx("inInstTransform", 1, 6, QRhiVertexInputAttribute::Float4, 4 * sizeof(float),1),
+			QRhiVertexInputAttributeEx("inInstTransform", 1, 7, QRhiVertexInputAttribute::Float4, 8 * sizeof(float),2),
+			QRhiVertexInputAttributeEx("inInstTransform", 1, 8, QRhiVertexInputAttribute::Float4, 12 * sizeof(float),3),
+		});
+
+		proxy->setShaderMainCode(QRhiShaderStage::Vertex, R"(
+				layout(location = 0) out vec2 vUV;
+				layout(location = 1) out vec3 vWorldPosition;
+				layout(location = 2) out mat3 vTangentBasis;
+				void main(){
+					mat4 model = Transform.M * inInstTransform * Transform.Local;
+					gl_Position = Transform.VP * model * vec4(inPosition,1.0f);
+					vUV = inUV;
+					vWorldPosition = vec3(model * vec4(inPosition,1.0f));
+					vTangentBasis = mat3(model) * mat3(inTangent, inBitangent, inNormal);
+				}
+		)");
+
+		auto materialDesc = mMaterialGroup->getMaterialDesc(subMesh.materialIndex);
+		proxy->addMaterial(materialDesc);
+
+		proxy->setShaderMainCode(QRhiShaderStage::Fragment, QString(R"(
+			layout(location = 0) in vec2 vUV;
+			layout(location = 1) in vec3 vWorldPosition;
+			layout(location = 2) in mat3 vTangentBasis;
+			void main(){
+				%1
+				%2
+				%3
+				%4
+				%5
+				%6
+			})")
+			.arg(QString("BaseColor = %1;").arg(materialDesc->getOrCreateBaseColorExpression()))
+			.arg(hasColorAttachment("Position")	? "Position = vec4(vWorldPosition  ,1);" : "")
+			.arg(hasColorAttachment("Normal")	? QString("Normal    = vec4(normalize(vTangentBasis * %1 ),1.0f);").arg(materialDesc->getNormalExpression()) : "")
+			.arg(hasColorAttachment("Specular")	? QString("Specular  = %1;").arg(materialDesc->getOrCreateSpecularExpression()) : "")
+			.arg(hasColorAttachment("Metallic")	? QString("Metallic  = %1;").arg(materialDesc->getOrCreateMetallicExpression()) : "")
+			.arg(hasColorAttachment("Roughness") ? QString("Roughness = %1;").arg(materialDesc->getOrCreateRoughnessExpression()) : "")
+			.toLocal8Bit()
+		);
+
+		proxy->setOnUpload([this](QRhiResourceUpdateBatch* batch) {
+			if (mVertexBuffer) {
+				batch->uploadStaticBuffer(mVertexBuffer.get(), mStaticMesh->mVertices.constData());
+				batch->uploadStaticBuffer(mIndexBuffer.get(), mStaticMesh->mIndices.constData());
+			}
+		});
+
+		proxy->setOnUpdate([this, subMesh, submeshIndex, transform, vpHandle, mHandle, localHandle](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
+			updateInstanceLods(batch, submeshIndex, ctx);
+			QMatrix4x4 VP = ctx.projectionMatrixWithCorr * ctx.viewMatrix;
+			transform->setParamValue(vpHandle, VP.toGenericMatrix<4, 4>());
+			transform->setParamValue(mHandle, getModelMatrix().toGenericMatrix<4, 4>());
+			transform->setParamValue(localHandle, subMesh.localTransfrom.toGenericMatrix<4, 4>());
+		});
+
+		proxy->setOnDraw([this, submeshIndex](QRhiCommandBuffer* cmdBuffer) {
+			drawInstanceLods(cmdBuffer, submeshIndex);
+		});
+	}
+	updateInstanceBounds();
+}
+
+void QInstancedStaticMeshRenderComponent::updateInstanceLods(QRhiResourceUpdateBatch* batch, int submeshIndex, const QPrimitiveRenderProxy::UpdateContext& ctx) {
+	const QStaticMesh::SubMeshData& subMesh = mStaticMesh->mSubmeshes[submeshIndex];
+	SubmeshInstanceLods& state = mSubmeshInstanceLods[submeshIndex];
+	const int instanceCount = mInstances.size();
+	if (instanceCount > mInstanceCapacity)		// outgrown, the rebuild is already requested
+		return;
+	bool bDirty = state.uploadedVersion != mInstancesVersion;
+	if (bDirty) {
+		state.instanceLods.fill(0, instanceCount);
+		state.instanceCount = instanceCount;
+		state.uploadedVersion = mInstancesVersion;
+	}
+
+	// Each instance picks its own level, the same way a standalone static mesh would
+	if (!subMesh.lods.isEmpty() && mLodErrorThreshold > 0.0f && !ctx.viewportSize.isEmpty()) {
+		const QMatrix4x4 M = getModelMatrix();
+		const QVector3D cameraPosition = ctx.viewMatrix.inverted().column(3).toVector3D();
+		const float pixelsPerUnit = qAbs(ctx.projectionMatrix(1, 1)) * ctx.viewportSize.height() * 0.5f;
+		for (int i = 0; i < instanceCount; i++) {
+			const int lod = QStaticMeshRenderComponent::selectLod(subMesh, M * mInstances[i] * subMesh.localTransfrom, cameraPosition, pixelsPerUnit, mLodErrorThreshold, state.instanceLods[i]);
+			if (lod != state.instanceLods[i]) {
+				state.instanceLods[i] = lod;
+				bDirty = true;
+			}
+		}
+	}
+	else if (state.instanceLods.count(0) != instanceCount) {
+		// Selection is off, levels picked while it was on must not stay uploaded
+		state.instanceLods.fill(0);
+		bDirty = true;
+	}
+	if (!bDirty || instanceCount == 0)
+		return;
+
+	// Counting sort by level, the region is only re-uploaded when an instance changes level
+	state.levelOffsets.fill(0, subMesh.lods.size() + 2);
+	for (int lod : state.instanceLods)
+		state.levelOffsets[lod + 1]++;
+	for (int level = 1; level < state.levelOffsets.size(); level++)
+		state.levelOffsets[level] += state.levelOffsets[level - 1];
+	QVector<int> cursors = state.levelOffsets;
+	QVector<float> instanceData(instanceCount * 16);
+	for (int i = 0; i < instanceCount; i++) {
+		memcpy(instanceData.data() + cursors[state.instanceLods[i]]++ * 16, mInstances[i].constData(), sizeof(float) * 16);
+	}
+	batch->updateDynamicBuffer(mInstanceBuffer.get(), submeshIndex * mInstanceCapacity * sizeof(float) * 16, instanceData.size() * sizeof(float), instanceData.constData());
+}
+
+void QInstancedStaticMeshRenderComponent::drawInstanceLods(QRhiCommandBuffer* cmdBuffer, int submeshIndex) {
+	const QStaticMesh::SubMeshData& subMesh = mStaticMesh->mSubmeshes[submeshIndex];
+	const SubmeshInstanceLods& state = mSubmeshInstanceLods[submeshIndex];
+	if (state.instanceCount == 0 || state.levelOffsets.isEmpty())
+		return;
+	const quint32 regionOffset = submeshIndex * mInstanceCapacity * sizeof(float) * 16;
+	for (int lod = 0; lod + 1 < state.levelOffsets.size(); lod++) {
+		const int count = state.levelOffsets[lod + 1] - state.levelOffsets[lod];
+		if (count == 0)
+			continue;
+		const quint32 indicesOffset = lod > 0 ? subMesh.lods[lod - 1].indicesOffset : subMesh.indicesOffset;
+		const quint32 indicesRange = lod > 0 ? subMesh.lods[lod - 1].indicesRange : subMesh.indicesRange;
+		const QRhiCommandBuffer::VertexInput vertexBindings[] = {
+			{ mVertexBuffer.get(), quint32(subMesh.verticesOffset * sizeof(QStaticMesh::Vertex)) },
+			{ mInstanceBuffer.get(), quint32(regionOffset + state.levelOffsets[lod] * sizeof(float) * 16) }
+		};
+		cmdBuffer->setVertexInput(0, 2, vertexBindings, mIndexBuffer.get(), indicesOffset * sizeof(QStaticMesh::Index), QRhiCommandBuffer::IndexUInt32);
+		cmdBuffer->drawIndexed(indicesRange, count);
+	}
+}
+
+QENGINE_REGISTER_CLASS(QInstancedStaticMeshRenderComponent)
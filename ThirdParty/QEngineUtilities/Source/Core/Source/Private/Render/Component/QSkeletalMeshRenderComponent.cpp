@@ -26,12 +26,14 @@ void QSkeletalMeshRenderComponent::onRebuildResource() {
 	mUniformBlock->setObjectName("Transform");
 	mUniformBlock->addParam("MVP", MathUtils::Mat4())
 		->addParam("M", MathUtils::Mat4())
-		->addParam("Bone", mSkeletalMesh->mCurrentPosesMatrix);
+		->addParam("Bone", mSkeletalMesh->getCurrentPoses());
 
-	mUniformBlock->create(mRhi);
+	QRhiUniformBlock::ParamHandle mvpHandle = mUniformBlock->getParamHandle("MVP");
+	QRhiUniformBlock::ParamHandle mHandle = mUniformBlock->getParamHandle("M");
 	for (auto& mesh : mSkeletalMesh->mSubmeshes) {
 		QSharedPointer<QPrimitiveRenderProxy> proxy = newPrimitiveRenderProxy();
 		mPipelines << proxy;
+		proxy->setLocalBounds(mesh.localBounds);
 		proxy->addUniformBlock(QRhiShaderStage::Vertex, mUniformBlock);
 		proxy->setInputBindings({
 			QRhiVertexInputBindingEx(mVertexBuffer.get(),sizeof(QSkeletalMesh::Vertex))
@@ -88,12 +90,12 @@ void QSkeletalMeshRenderComponent::onRebuildResource() {
 				batch->uploadStaticBuffer(mIndexBuffer.get(), mSkeletalMesh->mIndices.constData());
 			}
 		});
-		proxy->setOnUpdate([this](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
+		proxy->setOnUpdate([this, mvpHandle, mHandle](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
 			QMatrix4x4 M = getModelMatrix();
 			QMatrix4x4 MVP = ctx.projectionMatrixWithCorr * ctx.viewMatrix * M;
-			blocks["Transform"]->setParamValue("MVP", QVariant::fromValue(MVP.toGenericMatrix<4, 4>()));
-			blocks["Transform"]->setParamValue("M", QVariant::fromValue(M.toGenericMatrix<4, 4>()));
-			blocks["Transform"]->setParamValue("Bone", mSkeletalMesh->mCurrentPosesMatrix);
+			mUniformBlock->setParamValue(mvpHandle, MVP.toGenericMatrix<4, 4>());
+			mUniformBlock->setParamValue(mHandle, M.toGenericMatrix<4, 4>());
+			mUniformBlock->setParamValue("Bone", mSkeletalMesh->getCurrentPoses());
 		});
 		proxy->setOnDraw([this, mesh](QRhiCommandBuffer* cmdBuffer) {
 			const QRhiCommandBuffer::VertexInput vertexBindings(mVertexBuffer.get(), mesh.verticesOffset * sizeof(QSkeletalMesh::Vertex));
@@ -1,5 +1,6 @@
 #include "Render/Component/QStaticMeshRenderComponent.h"
 #include "Utils/MathUtils.h"
+#include "Asset/QMeshOptimizer.h"
 #include "QEngineObjectManager.h"
 
 QStaticMeshRenderComponent::QStaticMeshRenderComponent() {
@@ -17,33 +18,75 @@ void QStaticMeshRenderComponent::onRebuildResource() {
 	if (mStaticMesh.isNull())
 		return;
 
-	mVertexBuffer.reset(mRhi->newBuffer(QRhiBuffer::Type::Static, QRhiBuffer::VertexBuffer, sizeof(QStaticMesh::Vertex) * mStaticMesh->mVertices.size()));
+	if (bCompactVertexLayout)
+		mCompactVertices = QMeshOptimizer::buildCompactVertices(*mStaticMesh);
+	else
+		mCompactVertices.clear();
+	const quint32 vertexStride = bCompactVertexLayout ? sizeof(QStaticMesh::CompactVertex) : sizeof(QStaticMesh::Vertex);
+	mVertexBuffer.reset(mRhi->newBuffer(QRhiBuffer::Type::Static, QRhiBuffer::VertexBuffer, vertexStride * mStaticMesh->mVertices.size()));
 	mVertexBuffer->create();
 	mIndexBuffer.reset(mRhi->newBuffer(QRhiBuffer::Type::Static, QRhiBuffer::IndexBuffer, sizeof(QStaticMesh::Index) * mStaticMesh->mIndices.size()));
 	mIndexBuffer->create();
 
 	mProxies.clear();
-	for (auto& subMesh : mStaticMesh->mSubmeshes) {
+	mSubmeshLods.fill(0, mStaticMesh->mSubmeshes.size());
+	for (int submeshIndex = 0; submeshIndex < mStaticMesh->mSubmeshes.size(); submeshIndex++) {
+		const QStaticMesh::SubMeshData& subMesh = mStaticMesh->mSubmeshes[submeshIndex];
 		QSharedPointer<QPrimitiveRenderProxy> proxy = newPrimitiveRenderProxy();
 		mProxies << proxy;
+		proxy->setLocalBounds(subMesh.localBounds, subMesh.localTransfrom);
 
-		proxy->addUniformBlock(QRhiShaderStage::Vertex, "Transform")
+		QRhiUniformBlock* transform = proxy->addUniformBlock(QRhiShaderStage::Vertex, "Transform")
 			->addParam("MVP", QGenericMatrix<4, 4, float>())
 			->addParam("M", QGenericMatrix<4, 4, float>());
+		QRhiUniformBlock::ParamHandle mvpHandle = transform->getParamHandle("MVP");
+		QRhiUniformBlock::ParamHandle mHandle = transform->getParamHandle("M");
 
 		proxy->setInputBindings({
-			QRhiVertexInputBindingEx(mVertexBuffer.get(),sizeof(QStaticMesh::Vertex))
+			QRhiVertexInputBindingEx(mVertexBuffer.get(), vertexStride)
 		});
 
-		proxy->setInputAttribute({
-			QRhiVertexInputAttributeEx("inPosition"	,0, 0, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,position)),
-			QRhiVertexInputAttributeEx("inNormal"	,0, 1, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,normal)),
-			QRhiVertexInputAttributeEx("inTangent"	,0, 2, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,tangent)),
-			QRhiVertexInputAttributeEx("inBitangent",0, 3, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,bitangent)),
-			QRhiVertexInputAttributeEx("inUV"		,0, 4, QRhiVertexInputAttribute::Float2, offsetof(QStaticMesh::Vertex,uv))
-		});
-
-		proxy->setShaderMainCode(QRhiShaderStage::Vertex, R"(
+		if (bCompactVertexLayout) {
+			transform->addParam("PositionOffset", QVector4D(subMesh.localBounds.center(), 0.0f));
+			transform->addParam("PositionScale", QVector4D(subMesh.localBounds.extent(), 0.0f));
+			proxy->setInputAttribute({
+				QRhiVertexInputAttributeEx("inPosition"	,0, 0, QRhiVertexInputAttribute::UInt2, offsetof(QStaticMesh::CompactVertex,position)),
+				QRhiVertexInputAttributeEx("inNormal"	,0, 1, QRhiVertexInputAttribute::UInt, offsetof(QStaticMesh::CompactVertex,normal)),
+				QRhiVertexInputAttributeEx("inTangent"	,0, 2, QRhiVertexInputAttribute::UInt, offsetof(QStaticMesh::CompactVertex,tangent)),
+				QRhiVertexInputAttributeEx("inUV"		,0, 3, QRhiVertexInputAttribute::UInt, offsetof(QStaticMesh::CompactVertex,uv))
+			});
+			proxy->setShaderMainCode(QRhiShaderStage::Vertex, R"(
+				layout(location = 0) out vec2 vUV;
+				layout(location = 1) out vec3 vWorldPosition;
+				layout(location = 2) out mat3 vTangentBasis;
+				vec3 decodeOctahedral(vec2 e){
+					vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+					float t = max(-n.z, 0.0);
+					n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+					return normalize(n);
+				}
+				void main(){
+					vec2 positionZW = unpackSnorm2x16(inPosition.y);
+					vec3 position = Transform.PositionOffset.xyz + Transform.PositionScale.xyz * vec3(unpackSnorm2x16(inPosition.x), positionZW.x);
+					vec3 normal = decodeOctahedral(unpackSnorm2x16(inNormal));
+					vec3 tangent = decodeOctahedral(unpackSnorm2x16(inTangent));
+					vec3 bitangent = cross(normal, tangent) * positionZW.y;
+					gl_Position = Transform.MVP * vec4(position,1.0f);
+					vUV = unpackHalf2x16(inUV);
+					vWorldPosition = vec3(Transform.M * vec4(position,1.0f));
+					vTangentBasis = mat3(Transform.M) * mat3(tangent, bitangent, normal);
+				}
+			)");
+		}
+		else {
+			proxy->setInputAttribute({
+				QRhiVertexInputAttributeEx("inPosition"	,0, 0, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,position)),
+				QRhiVertexInputAttributeEx("inNormal"	,0, 1, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,normal)),
+				QRhiVertexInputAttributeEx("inTangent"	,0, 2, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,tangent)),
+				QRhiVertexInputAttributeEx("inBitangent",0, 3, QRhiVertexInputAttribute::Float3, offsetof(QStaticMesh::Vertex,bitangent)),
+				QRhiVertexInputAttributeEx("inUV"		,0, 4, QRhiVertexInputAttribute::Float2, offsetof(QStaticMesh::Vertex,uv))
+			});
+			proxy->setShaderMainCode(QRhiShaderStage::Vertex, R"(
 				layout(location = 0) out vec2 vUV;
 				layout(location = 1) out vec3 vWorldPosition;
 				layout(location = 2) out mat3 vTangentBasis;
@@ -53,7 +96,8 @@ void QStaticMeshRenderComponent::onRebuildResource() {
 					vWorldPosition = vec3(Transform.M * vec4(inPosition,1.0f));
 					vTangentBasis = mat3(Transform.M) * mat3(inTangent, inBitangent, inNormal);
 				}
-		)");
+			)");
+		}
 
 		auto materialDesc = mMaterialGroup->getMaterialDesc(subMesh.materialIndex);
 		proxy->addMaterial(materialDesc);
@@ -81,22 +125,29 @@ void QStaticMeshRenderComponent::onRebuildResource() {
 
 		proxy->setOnUpload([this](QRhiResourceUpdateBatch* batch) {
 			if (mVertexBuffer) {
-				batch->uploadStaticBuffer(mVertexBuffer.get(), mStaticMesh->mVertices.constData());
+				if (bCompactVertexLayout)
+					batch->uploadStaticBuffer(mVertexBuffer.get(), mCompactVertices.constData());
+				else
+					batch->uploadStaticBuffer(mVertexBuffer.get(), mStaticMesh->mVertices.constData());
 				batch->uploadStaticBuffer(mIndexBuffer.get(), mStaticMesh->mIndices.constData());
 			}
 		});
 
-		proxy->setOnUpdate([this, subMesh](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
+		proxy->setOnUpdate([this, subMesh, submeshIndex, transform, mvpHandle, mHandle](QRhiResourceUpdateBatch* batch, const QPrimitiveRenderProxy::UniformBlocks& blocks, const QPrimitiveRenderProxy::UpdateContext& ctx) {
 			QMatrix4x4 M = getModelMatrix() * subMesh.localTransfrom;
 			QMatrix4x4 MVP = ctx.projectionMatrixWithCorr * ctx.viewMatrix * M;
-			blocks["Transform"]->setParamValue("MVP", QVariant::fromValue(MVP.toGenericMatrix<4, 4>()));
-			blocks["Transform"]->setParamValue("M", QVariant::fromValue(M.toGenericMatrix<4, 4>()));
+			transform->setParamValue(mvpHandle, MVP.toGenericMatrix<4, 4>());
+			transform->setParamValue(mHandle, M.toGenericMatrix<4, 4>());
+			mSubmeshLods[submeshIndex] = selectLod(subMesh, M, ctx, mSubmeshLods[submeshIndex]);
 		});
 
-		proxy->setOnDraw([this, subMesh](QRhiCommandBuffer* cmdBuffer) {
-			const QRhiCommandBuffer::VertexInput vertexBindings(mVertexBuffer.get(), subMesh.verticesOffset * sizeof(QStaticMesh::Vertex));
-			cmdBuffer->setVertexInput(0, 1, &vertexBindings, mIndexBuffer.get(), subMesh.indicesOffset * sizeof(QStaticMesh::Index), QRhiCommandBuffer::IndexUInt32);
-			cmdBuffer->drawIndexed(subMesh.indicesRange);
+		proxy->setOnDraw([this, subMesh, submeshIndex, vertexStride](QRhiCommandBuffer* cmdBuffer) {
+			const int lod = mSubmeshLods.value(submeshIndex);
+			const quint32 indicesOffset = lod > 0 ? subMesh.lods[lod - 1].indicesOffset : subMesh.indicesOffset;
+			const quint32 indicesRange = lod > 0 ? subMesh.lods[lod - 1].indicesRange : subMesh.indicesRange;
+			const QRhiCommandBuffer::VertexInput vertexBindings(mVertexBuffer.get(), subMesh.verticesOffset * vertexStride);
+			cmdBuffer->setVertexInput(0, 1, &vertexBindings, mIndexBuffer.get(), indicesOffset * sizeof(QStaticMesh::Index), QRhiCommandBuffer::IndexUInt32);
+			cmdBuffer->drawIndexed(indicesRange);
 		});
 	}
 }
@@ -111,4 +162,63 @@ QRhiMaterialGroup* QStaticMeshRenderComponent::getMaterialGroup()
 	return mMaterialGroup.get();
 }
 
+void QStaticMeshRenderComponent::setCompactVertexLayout(bool val)
+{
+	bCompactVertexLayout = val;
+	mSigRebuildResource.request();
+}
+
+bool QStaticMeshRenderComponent::getCompactVertexLayout() const
+{
+	return bCompactVertexLayout;
+}
+
+void QStaticMeshRenderComponent::setLodErrorThreshold(float val)
+{
+	mLodErrorThreshold = val;
+}
+
+float QStaticMeshRenderComponent::getLodErrorThreshold() const
+{
+	return mLodErrorThreshold;
+}
+
+int QStaticMeshRenderComponent::getSubmeshLod(int submeshIndex) const
+{
+	return mSubmeshLods.value(submeshIndex);
+}
+
+int QStaticMeshRenderComponent::selectLod(const QStaticMesh::SubMeshData& subMesh, const QMatrix4x4& M, const QPrimitiveRenderProxy::UpdateContext& ctx, int currentLod) const
+{
+	if (subMesh.lods.isEmpty() || mLodErrorThreshold <= 0.0f || ctx.viewportSize.isEmpty())
+		return 0;
+	const QVector3D cameraPosition = ctx.viewMatrix.inverted().column(3).toVector3D();
+	const float pixelsPerUnit = qAbs(ctx.projectionMatrix(1, 1)) * ctx.viewportSize.height() * 0.5f;
+	return selectLod(subMesh, M, cameraPosition, pixelsPerUnit, mLodErrorThreshold, currentLod);
+}
+
+int QStaticMeshRenderComponent::selectLod(const QStaticMesh::SubMeshData& subMesh, const QMatrix4x4& M, const QVector3D& cameraPosition, float pixelsPerUnit, float errorThreshold, int currentLod)
+{
+	if (subMesh.lods.isEmpty() || errorThreshold <= 0.0f || pixelsPerUnit <= 0.0f)
+		return 0;
+
+	// Object space error scaled by the largest axis of the model matrix, projected at the nearest point of the bounds
+	const float modelScale = qMax(qMax(M.column(0).toVector3D().length(), M.column(1).toVector3D().length()), M.column(2).toVector3D().length());
+	const MathUtils::AABB bounds = subMesh.localBounds.transformed(M);
+	const float distance = qMax((bounds.center() - cameraPosition).length() - bounds.radius(), 1e-4f);
+	const float projectedScale = pixelsPerUnit * modelScale / distance;
+	auto levelPixels = [&](int level) {
+		return level > 0 ? subMesh.lods[level - 1].error * projectedScale : 0.0f;
+	};
+
+	// Hysteresis keeps objects sitting on a threshold from popping between levels every frame
+	const float hysteresis = 0.2f;
+	int lod = qBound(0, currentLod, int(subMesh.lods.size()));
+	while (lod > 0 && levelPixels(lod) > errorThreshold * (1.0f + hysteresis))
+		lod--;
+	while (lod < subMesh.lods.size() && levelPixels(lod + 1) <= errorThreshold * (1.0f - hysteresis))
+		lod++;
+	return lod;
+}
+
 QENGINE_REGISTER_CLASS(QStaticMeshRenderComponent)
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "QRhiCamera.h"
 #include "IRenderComponent.h"
 #include "Render/RenderGraph/QRenderGraphBuilder.h"
+#include "Asset/QAnimationSystem.h"
 #include "tracy/Tracy.hpp"
 
 class QRenderThreadWorkder : public QObject {
@@ -33,13 +34,19 @@ public:
 		const QRhiDepthStencilClearValue dsClearValue = { 1.0f,0 };
 		mRenderer->mGraphBuilder->setMainRenderTarget(renderTarget);
 
+		QAnimationSystem::tick();
 		{
 			ZoneScopedN("Setup");
 			mRenderer->setupGraph(*mRenderer->mGraphBuilder.get());
 		}
 		{
 			ZoneScopedN("Compile");
-			mRenderer->mGraphBuilder->compile();
+			if (!mRenderer->mGraphBuilder->compile()) {
+				ZoneScopedN("Resetup");
+				mRenderer->mGraphBuilder->resetGraph();
+				mRenderer->setupGraph(*mRenderer->mGraphBuilder.get());
+				mRenderer->mGraphBuilder->compile();
+			}
 		}
 		{
 			ZoneScopedN("Execute");
@@ -126,6 +133,21 @@ QThread* IRenderer::renderThread()
 	return mRenderThreadWorker->mThread;
 }
 
+void IRenderer::requestRender()
+{
+	QMetaObject::invokeMethod(mRenderThreadWorker.get(), &QRenderThreadWorkder::render);
+}
+
+void IRenderer::renderFrame()
+{
+	QMetaObject::invokeMethod(mRenderThreadWorker.get(), &QRenderThreadWorkder::render, Qt::BlockingQueuedConnection);
+}
+
+IRendererSurface* IRenderer::surface()
+{
+	return mSurface.get();
+}
+
 QWindow* IRenderer::maybeWindow()
 {
 	return mSurface->maybeWindow();
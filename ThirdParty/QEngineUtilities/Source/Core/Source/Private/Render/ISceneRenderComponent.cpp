@@ -8,18 +8,22 @@ QMatrix4x4 ISceneRenderComponent::getModelMatrix() {
 
 void ISceneRenderComponent::setTranslate(QVector3D translate) {
 	MathUtils::setMatTranslate(mTransform, translate);
+	mTransformVersion++;
 }
 
 void ISceneRenderComponent::setRotation(QVector3D rotation) {
 	MathUtils::setMatRotation(mTransform, rotation);
+	mTransformVersion++;
 }
 
 void ISceneRenderComponent::setScale3D(QVector3D scale3D) {
 	MathUtils::setMatScale3D(mTransform, scale3D);
+	mTransformVersion++;
 }
 
 void ISceneRenderComponent::setTransform(QMatrix4x4 transform) {
 	mTransform = transform;
+	mTransformVersion++;
 }
 
 QVector3D ISceneRenderComponent::getTranslate() {
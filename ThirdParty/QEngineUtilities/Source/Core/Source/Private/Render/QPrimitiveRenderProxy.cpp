@@ -1,6 +1,10 @@
 #include "Render/QPrimitiveRenderProxy.h"
 #include "IRenderComponent.h"
+#include "Render/ISceneRenderComponent.h"
 #include "IRenderer.h"
+#include "Render/RenderGraph/QRGRhiResourcePool.h"
+#include "Render/RenderGraph/QRenderGraphBuilder.h"
+#include "Render/RHI/QRhiSharedPipelines.h"
 
 QPrimitiveRenderProxy::QPrimitiveRenderProxy(IRenderComponent* inRenderComponent)
 	: mRenderComponent(inRenderComponent)
@@ -12,7 +16,13 @@ QPrimitiveRenderProxy::QPrimitiveRenderProxy(IRenderComponent* inRenderComponent
 
 QPrimitiveRenderProxy::~QPrimitiveRenderProxy()
 {
-	mRenderComponent->getRenderer()->unregisterPipeline(this);
+	mSubPipelineMap.clear();
+	mPipeline.reset();
+	mShaderBindings.reset();
+	IRenderer* renderer = mRenderComponent->getRenderer();
+	renderer->unregisterPipeline(this);
+	if (QRenderGraphBuilder* graphBuilder = renderer->getRenderGraphBuilder())
+		graphBuilder->getSharedPipelines()->prune();
 }
 
 void QPrimitiveRenderProxy::setShaderMainCode(QRhiShaderStage::Type inStage, QByteArray inCode) {
@@ -115,10 +125,10 @@ void QPrimitiveRenderProxy::addMaterial(QSharedPointer<QRhiMaterialDesc> inDesc)
 
 void QPrimitiveRenderProxy::addTexture2D(QRhiShaderStage::Type inStage, const QString& inName, const QImage& inImage, QRhiSampler::Filter magFilter, QRhiSampler::Filter minFilter, QRhiSampler::Filter mipmapMode, QRhiSampler::AddressMode addressU, QRhiSampler::AddressMode addressV, QRhiSampler::AddressMode addressW) {
 	QSharedPointer<QRhiTextureDesc> textureInfo = QSharedPointer<QRhiTextureDesc>::create();
+	QRhiTextureProcessor::Options options;
+	options.generateMips = mipmapMode != QRhiSampler::Filter::None;
 	textureInfo->Name = inName;
-	textureInfo->ImageCache = inImage.convertedTo(QImage::Format_RGBA8888);
-	textureInfo->Size = inImage.size();
-	textureInfo->Format = QRhiTexture::RGBA8;
+	textureInfo->setImage(inImage, options);
 	textureInfo->GlslTypeName = "sampler2D";
 	textureInfo->MagFilter = magFilter;
 	textureInfo->MinFilter = minFilter;
@@ -126,9 +136,6 @@ void QPrimitiveRenderProxy::addTexture2D(QRhiShaderStage::Type inStage, const QS
 	textureInfo->AddressU = addressU;
 	textureInfo->AddressV = addressV;
 	textureInfo->AddressW = addressW;
-	textureInfo->UploadDesc = QRhiTextureUploadDescription({
-		QRhiTextureUploadEntry(0,0,QRhiTextureSubresourceUploadDescription(textureInfo->ImageCache))
-	});
 	addTextureDesc(inStage, textureInfo);
 }
 
@@ -189,9 +196,13 @@ void QPrimitiveRenderProxy::setTexture(const QString& inName, const QImage& inIm
 	for (auto& stageInfo : mStageInfos) {
 		for (auto& textureInfo : stageInfo.textureDescs) {
 			if (textureInfo->Name == inName) {
-				textureInfo->UploadDesc.setEntries({
-					QRhiTextureUploadEntry(0,0,QRhiTextureSubresourceUploadDescription(inImage))
-				});
+				const QRhiTexture::Format lastFormat = textureInfo->Format;
+				const QSize lastSize = textureInfo->Size;
+				QRhiTextureProcessor::Options options;
+				options.generateMips = textureInfo->Flags.testFlag(QRhiTexture::MipMapped);
+				textureInfo->setImage(inImage, options);
+				if (textureInfo->Format != lastFormat || textureInfo->Size != lastSize)
+					mSigRebuild.request();
 				textureInfo->sigUpdate.request();
 				return;
 			}
@@ -213,11 +224,51 @@ QRhiShaderResourceBindings* QPrimitiveRenderProxy::getShaderResourceBindings() c
 	return mShaderBindings.get();
 }
 
+void QPrimitiveRenderProxy::bindShaderResources(QRhiCommandBuffer* cmdBuffer)
+{
+	cmdBuffer->setShaderResources(mShaderBindings.get(), mDynamicOffsets.size(), mDynamicOffsets.constData());
+}
+
+QRhiUniformRing* QPrimitiveRenderProxy::getUniformRing() const
+{
+	return mRenderComponent->getRenderer()->getRenderGraphBuilder()->getUniformRing();
+}
+
+QRhiSharedPipelines* QPrimitiveRenderProxy::getSharedPipelines() const
+{
+	return mRenderComponent->getRenderer()->getRenderGraphBuilder()->getSharedPipelines();
+}
+
 QRhiGraphicsPipeline* QPrimitiveRenderProxy::getGraphicsPipeline() const
 {
 	return mPipeline.get();
 }
 
+bool QPrimitiveRenderProxy::isPipelineReady() const
+{
+	return mPipeline != nullptr;
+}
+
+void QPrimitiveRenderProxy::setLocalBounds(const MathUtils::AABB& bounds, const QMatrix4x4& localTransform)
+{
+	mLocalBounds = bounds;
+	mLocalTransform = localTransform;
+	mWorldBoundsVersion = 0;
+}
+
+const MathUtils::AABB& QPrimitiveRenderProxy::getWorldBounds()
+{
+	ISceneRenderComponent* sceneComponent = qobject_cast<ISceneRenderComponent*>(mRenderComponent);
+	if (!sceneComponent || !mLocalBounds.isValid()) {
+		mWorldBounds = MathUtils::AABB();
+	}
+	else if (mWorldBoundsVersion != sceneComponent->getTransformVersion()) {
+		mWorldBounds = mLocalBounds.transformed(sceneComponent->getModelMatrix() * mLocalTransform);
+		mWorldBoundsVersion = sceneComponent->getTransformVersion();
+	}
+	return mWorldBounds;
+}
+
 IRenderComponent* QPrimitiveRenderProxy::getRenderComponent() const
 {
 	return mRenderComponent;
@@ -227,42 +278,17 @@ void QPrimitiveRenderProxy::tryCreate(QRhiTextureRenderTarget* renderTarget)
 {
 	if (mSigRebuild.ensure()) {
 		mBlendStates.resize(renderTarget->description().colorAttachmentCount());
-		QRhi* rhi = renderTarget->rhi();
-		mPipeline.reset(rhi->newGraphicsPipeline());
-		mPipeline->setTopology(mTopology);
-		mPipeline->setCullMode(mCullMode);
-		mPipeline->setFrontFace(mFrontFace);
-		mPipeline->setLineWidth(mLineWidth);
-		mPipeline->setTargetBlends(mBlendStates.begin(), mBlendStates.end());
-		mPipeline->setDepthTest(bEnableDepthTest);
-		mPipeline->setDepthWrite(bEnableDepthWrite);
-		mPipeline->setDepthOp(mDepthTestOp);
-		mPipeline->setStencilTest(bEnableStencilTest);
-		mPipeline->setStencilFront(mStencilFrontOp);
-		mPipeline->setStencilBack(mStencilBackOp);
-		mPipeline->setStencilReadMask(mStencilReadMask);
-		mPipeline->setStencilWriteMask(mStencilWriteMask);
-		mPipeline->setSampleCount(renderTarget->sampleCount());
-		mPipeline->setDepthBias(mDepthBias);
-		mPipeline->setSlopeScaledDepthBias(mSlopeScaledDepthBias);
-		mPipeline->setPatchControlPointCount(mPatchControlPointCount);
-		mPipeline->setPolygonMode(mPolygonMode);
-		mPipeline->setVertexInputLayout(mVertexInputLayout);
-		mPipeline->setRenderPassDescriptor(renderTarget->renderPassDescriptor());
-
-		recreateShaderBindings(renderTarget, rhi);
-
-		QVector<QRhiShaderStage> stages;
-		for (const auto& stage : mStageInfos.asKeyValueRange()) {
-			QShader shader = QRhiHelper::newShaderFromCode((QShader::Stage)stage.first, stage.second.versionCode + stage.second.defineCode + stage.second.mainCode);
-			stages << QRhiShaderStage(stage.first, shader);
-		}
-		mPipeline->setShaderStages(stages.begin(), stages.end());
-		mPipeline->setShaderResourceBindings(mShaderBindings.get());
-		mPipeline->create();
 
+		// The old pipelines reference the bindings being replaced, so the proxy stops drawing until the new shaders are baked
+		mPipeline.reset();
 		for (auto& employee : mSubPipelineMap) {
-			recreateSubPipeline(employee);
+			employee.pipeline.reset();
+		}
+		recreateShaderBindings(renderTarget, renderTarget->rhi());
+
+		mPendingShaders.clear();
+		for (const auto& stage : mStageInfos.asKeyValueRange()) {
+			mPendingShaders << qMakePair(stage.first, QRhiHelper::newShaderFromCodeAsync((QShader::Stage)stage.first, stage.second.versionCode + stage.second.defineCode + stage.second.mainCode));
 		}
 
 		for (const auto& stage : mStageInfos) {
@@ -271,6 +297,47 @@ void QPrimitiveRenderProxy::tryCreate(QRhiTextureRenderTarget* renderTarget)
 			}
 		}
 	}
+	if (mPendingShaders.isEmpty())
+		return;
+	for (const auto& pending : mPendingShaders) {
+		if (!pending.second.isFinished())
+			return;
+	}
+
+	QRhi* rhi = renderTarget->rhi();
+	QRhiGraphicsPipeline* pipeline = rhi->newGraphicsPipeline();
+	pipeline->setTopology(mTopology);
+	pipeline->setCullMode(mCullMode);
+	pipeline->setFrontFace(mFrontFace);
+	pipeline->setLineWidth(mLineWidth);
+	pipeline->setTargetBlends(mBlendStates.begin(), mBlendStates.end());
+	pipeline->setDepthTest(bEnableDepthTest);
+	pipeline->setDepthWrite(bEnableDepthWrite);
+	pipeline->setDepthOp(mDepthTestOp);
+	pipeline->setStencilTest(bEnableStencilTest);
+	pipeline->setStencilFront(mStencilFrontOp);
+	pipeline->setStencilBack(mStencilBackOp);
+	pipeline->setStencilReadMask(mStencilReadMask);
+	pipeline->setStencilWriteMask(mStencilWriteMask);
+	pipeline->setSampleCount(renderTarget->sampleCount());
+	pipeline->setDepthBias(mDepthBias);
+	pipeline->setSlopeScaledDepthBias(mSlopeScaledDepthBias);
+	pipeline->setPatchControlPointCount(mPatchControlPointCount);
+	pipeline->setPolygonMode(mPolygonMode);
+	pipeline->setVertexInputLayout(mVertexInputLayout);
+	pipeline->setRenderPassDescriptor(renderTarget->renderPassDescriptor());
+
+	QVector<QRhiShaderStage> stages;
+	for (const auto& pending : mPendingShaders) {
+		stages << QRhiShaderStage(pending.first, pending.second.result());
+	}
+	mPendingShaders.clear();
+	pipeline->setShaderStages(stages.begin(), stages.end());
+	mPipeline = getSharedPipelines()->findOrCreatePipeline(pipeline, mShaderBindings);
+
+	for (auto& employee : mSubPipelineMap) {
+		recreateSubPipeline(employee);
+	}
 }
 
 void QPrimitiveRenderProxy::tryUpload(QRhiResourceUpdateBatch* batch)
@@ -296,9 +363,17 @@ void QPrimitiveRenderProxy::update(QRhiResourceUpdateBatch* batch, const UpdateC
 				mSigRebuild.request();
 				break;
 			}
-			uniformBlock->updateResource(batch);
 		}
 	}
+	if (mDynamicUniformBlocks.isEmpty())
+		return;
+	QRhiUniformRing* uniformRing = getUniformRing();
+	for (int i = 0; i < mDynamicUniformBlocks.size(); i++) {
+		mDynamicOffsets[i].second = mDynamicUniformBlocks[i]->updateResource(uniformRing);
+		// The ring is full until it grows next frame, skip this proxy rather than bind an offset past the buffer
+		if (mDynamicOffsets[i].second == QRhiUniformRing::InvalidOffset)
+			bCulled = true;
+	}
 }
 
 void QPrimitiveRenderProxy::draw(QRhiCommandBuffer* cmdBuffer)
@@ -322,7 +397,6 @@ QRhiGraphicsPipeline* QPrimitiveRenderProxy::createSubPipeline(const QString& in
 	SubPipeline employee;
 	employee.renderTarget = renderTarget;
 	employee.postSetup = postSetup;
-	employee.pipeline.reset(mRenderComponent->getRhi()->newGraphicsPipeline());
 	recreateSubPipeline(employee);
 	mSubPipelineMap.insert(inName, employee);
 	return employee.pipeline.get();
@@ -330,41 +404,43 @@ QRhiGraphicsPipeline* QPrimitiveRenderProxy::createSubPipeline(const QString& in
 
 void QPrimitiveRenderProxy::recreateSubPipeline(SubPipeline& inSubPipeline)
 {
+	if (!mPipeline) {
+		inSubPipeline.pipeline.reset();
+		return;
+	}
 	QRhi* rhi = inSubPipeline.renderTarget->rhi();
-	inSubPipeline.pipeline.reset(rhi->newGraphicsPipeline());
-	inSubPipeline.pipeline->setTopology(mTopology);
-	inSubPipeline.pipeline->setCullMode(mCullMode);
-	inSubPipeline.pipeline->setFrontFace(mFrontFace);
-	inSubPipeline.pipeline->setLineWidth(mLineWidth);
+	QRhiGraphicsPipeline* pipeline = rhi->newGraphicsPipeline();
+	pipeline->setTopology(mTopology);
+	pipeline->setCullMode(mCullMode);
+	pipeline->setFrontFace(mFrontFace);
+	pipeline->setLineWidth(mLineWidth);
 
 	QVector<QRhiGraphicsPipeline::TargetBlend> blendStates(inSubPipeline.renderTarget->description().colorAttachmentCount());
-	inSubPipeline.pipeline->setTargetBlends(blendStates.begin(), blendStates.end());
-	inSubPipeline.pipeline->setDepthTest(bEnableDepthTest);
-	inSubPipeline.pipeline->setDepthWrite(bEnableDepthWrite);
-	inSubPipeline.pipeline->setDepthOp(mDepthTestOp);
-	inSubPipeline.pipeline->setStencilTest(bEnableStencilTest);
-	inSubPipeline.pipeline->setStencilFront(mStencilFrontOp);
-	inSubPipeline.pipeline->setStencilBack(mStencilBackOp);
-	inSubPipeline.pipeline->setStencilReadMask(mStencilReadMask);
-	inSubPipeline.pipeline->setStencilWriteMask(mStencilWriteMask);
-	inSubPipeline.pipeline->setSampleCount(inSubPipeline.renderTarget->sampleCount());
-	inSubPipeline.pipeline->setDepthBias(mDepthBias);
-	inSubPipeline.pipeline->setSlopeScaledDepthBias(mSlopeScaledDepthBias);
-	inSubPipeline.pipeline->setPatchControlPointCount(mPatchControlPointCount);
-	inSubPipeline.pipeline->setPolygonMode(mPolygonMode);
-	inSubPipeline.pipeline->setVertexInputLayout(mVertexInputLayout);
-	inSubPipeline.pipeline->setRenderPassDescriptor(inSubPipeline.renderTarget->renderPassDescriptor());
+	pipeline->setTargetBlends(blendStates.begin(), blendStates.end());
+	pipeline->setDepthTest(bEnableDepthTest);
+	pipeline->setDepthWrite(bEnableDepthWrite);
+	pipeline->setDepthOp(mDepthTestOp);
+	pipeline->setStencilTest(bEnableStencilTest);
+	pipeline->setStencilFront(mStencilFrontOp);
+	pipeline->setStencilBack(mStencilBackOp);
+	pipeline->setStencilReadMask(mStencilReadMask);
+	pipeline->setStencilWriteMask(mStencilWriteMask);
+	pipeline->setSampleCount(inSubPipeline.renderTarget->sampleCount());
+	pipeline->setDepthBias(mDepthBias);
+	pipeline->setSlopeScaledDepthBias(mSlopeScaledDepthBias);
+	pipeline->setPatchControlPointCount(mPatchControlPointCount);
+	pipeline->setPolygonMode(mPolygonMode);
+	pipeline->setVertexInputLayout(mVertexInputLayout);
+	pipeline->setRenderPassDescriptor(inSubPipeline.renderTarget->renderPassDescriptor());
 
 	QVector<QRhiShaderStage> stages(mPipeline->shaderStageCount());
 	for (int i = 0; i < mPipeline->shaderStageCount(); i++) {
 		stages[i] = *mPipeline->shaderStageAt(i);
 	}
-	inSubPipeline.pipeline->setShaderStages(stages.cbegin(),stages.cend());
-	inSubPipeline.pipeline->setShaderResourceBindings(mShaderBindings.get());
+	pipeline->setShaderStages(stages.cbegin(),stages.cend());
+	inSubPipeline.postSetup(pipeline);
 
-	inSubPipeline.postSetup(inSubPipeline.pipeline.get());
-
-	inSubPipeline.pipeline->create();
+	inSubPipeline.pipeline = getSharedPipelines()->findOrCreatePipeline(pipeline, mShaderBindings);
 }
 
 void QPrimitiveRenderProxy::recreateShaderBindings(QRhiTextureRenderTarget* inRenderTarget, QRhi* inRhi) {
@@ -390,6 +466,9 @@ void QPrimitiveRenderProxy::recreateShaderBindings(QRhiTextureRenderTarget* inRe
 	mStageInfos[QRhiShaderStage::Vertex].defineCode = vertexInputCode.toLocal8Bit();
 
 	QVector<QRhiShaderResourceBinding> bindings;
+	QRhiUniformRing* uniformRing = getUniformRing();
+	mDynamicUniformBlocks.clear();
+	mDynamicOffsets.clear();
 	int bindingOffset = 0;
 	for (const auto& stage : mStageInfos.asKeyValueRange()) {
 		QString uniformDefineCode;
@@ -411,8 +490,15 @@ void QPrimitiveRenderProxy::recreateShaderBindings(QRhiTextureRenderTarget* inRe
 				mSamplerList << textureDesc->Sampler;
 				textureDesc->Sampler->create();
 			}
+			if (!inRhi->isTextureFormatSupported(textureDesc->Format, textureDesc->Flags) && !textureDesc->ImageCache.isNull()) {
+				// Block compressed levels are rebuilt uncompressed on backends without BC support
+				QRhiTextureProcessor::Options options;
+				options.generateMips = textureDesc->Flags.testFlag(QRhiTexture::MipMapped);
+				textureDesc->setImage(textureDesc->ImageCache, options);
+			}
 			if (textureDesc->Texture.isNull()
 				|| textureDesc->Texture->format() != textureDesc->Format 
+				|| textureDesc->Texture->pixelSize() != textureDesc->Size 
 				|| textureDesc->Texture->sampleCount() != 1 
 				|| textureDesc->Texture->flags() != textureDesc->Flags) {
 				textureDesc->Texture.reset(inRhi->newTexture(textureDesc->Format, textureDesc->Size, 1, textureDesc->Flags));
@@ -428,8 +514,10 @@ void QPrimitiveRenderProxy::recreateShaderBindings(QRhiTextureRenderTarget* inRe
 		}
 		for (const auto& uniformBlock : stage.second.uniformBlocks) {
 			if (!uniformBlock->isEmpty()) {
-				uniformBlock->create(inRhi);
-				bindings << QRhiShaderResourceBinding::uniformBuffer(bindingOffset, (QRhiShaderResourceBinding::StageFlag)(1 << (int)stage.first), uniformBlock->getUniformBlock());
+				uniformBlock->create(uniformRing);
+				bindings << QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(bindingOffset, (QRhiShaderResourceBinding::StageFlag)(1 << (int)stage.first), uniformRing->getBuffer(), uniformBlock->getDataByteSize());
+				mDynamicUniformBlocks << uniformBlock.get();
+				mDynamicOffsets << QRhiCommandBuffer::DynamicOffset(bindingOffset, 0);
 				uniformDefineCode += uniformBlock->createDefineCode(bindingOffset);
 				bindingOffset++;
 			}
@@ -444,7 +532,5 @@ void QPrimitiveRenderProxy::recreateShaderBindings(QRhiTextureRenderTarget* inRe
 		fragOutputCode += QString::asprintf("layout(location = %d) out %s %s;\n", i, slotType.data(), slotName.data());
 	}
 	mStageInfos[QRhiShaderStage::Fragment].defineCode += fragOutputCode.toLocal8Bit();
-	mShaderBindings.reset(inRhi->newShaderResourceBindings());
-	mShaderBindings->setBindings(bindings.begin(), bindings.end());
-	mShaderBindings->create();
+	mShaderBindings = getSharedPipelines()->findOrCreateBindings(bindings);
 }
\ No newline at end of file
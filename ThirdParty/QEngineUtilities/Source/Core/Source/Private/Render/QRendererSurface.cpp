@@ -1,6 +1,8 @@
 #include "QRendererSurface.h"
 #include <QPlatformSurfaceEvent>
 #include <QGuiApplication>
+#include <QPromise>
+#include "tracy/Tracy.hpp"
 
 QRendererWindowSurface::QRendererWindowSurface(QRhi::Implementation impl, QSize size)
 {
@@ -153,33 +155,54 @@ void QRendererWindowSurface::endFrame()
 
 QRendererOffscreenSurface::QRendererOffscreenSurface(QSize size)
 {
+	// One worker keeps the callbacks in frame order
+	mDeliveryThreadPool.setMaxThreadCount(1);
 	mRequestSize = size;
 	resize(size);
 }
 
-void QRendererOffscreenSurface::resize(const QSize& size)
+void QRendererOffscreenSurface::setFrameCallback(FrameCallback inCallback)
 {
-	if (mRhi) {
-		mColorAttachment.reset(mRhi->newTexture(QRhiTexture::RGBA32F, mRequestSize, mRequestSampleCount, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
-		mColorAttachment->create();
-		mDepthStencilAttachment.reset(mRhi->newTexture(QRhiTexture::D24S8, mRequestSize, mRequestSampleCount, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
-		mDepthStencilAttachment->create();
+	QMutexLocker locker(&mMutex);
+	mFrameCallback = inCallback;
+}
 
-		QRhiTextureRenderTargetDescription RTDesc;
-		RTDesc.setColorAttachments({ QRhiColorAttachment(mColorAttachment.get()) });
+QRendererOffscreenSurface::Statistics QRendererOffscreenSurface::getStatistics() const
+{
+	QMutexLocker locker(&mMutex);
+	return mStatistics;
+}
 
-		RTDesc.setDepthTexture(mDepthStencilAttachment.get());
-		mRenderTarget.reset(mRhi->newTextureRenderTarget(RTDesc));
-		mRenderPassDesc.reset(mRenderTarget->newCompatibleRenderPassDescriptor());
-		mRenderTarget->setRenderPassDescriptor(mRenderPassDesc.get());
-		mRenderTarget->create();
-	}
+int QRendererOffscreenSurface::getFramesInFlight() const
+{
+	return mRequestFramesInFlight;
+}
+
+void QRendererOffscreenSurface::resize(const QSize& size)
+{
+	mRequestSize = size;
+	if (!mRhi)
+		return;
+	releaseResources();
+	mColorAttachment.reset(mRhi->newTexture(QRhiTexture::RGBA32F, mRequestSize, mRequestSampleCount, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
+	mColorAttachment->create();
+	mDepthStencilAttachment.reset(mRhi->newTexture(QRhiTexture::D24S8, mRequestSize, mRequestSampleCount, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
+	mDepthStencilAttachment->create();
+
+	QRhiTextureRenderTargetDescription RTDesc;
+	RTDesc.setColorAttachments({ QRhiColorAttachment(mColorAttachment.get()) });
+	RTDesc.setDepthTexture(mDepthStencilAttachment.get());
+	mRenderTarget.reset(mRhi->newTextureRenderTarget(RTDesc));
+	mRenderPassDesc.reset(mRenderTarget->newCompatibleRenderPassDescriptor());
+	mRenderTarget->setRenderPassDescriptor(mRenderPassDesc.get());
+	mRenderTarget->create();
 }
 
 void QRendererOffscreenSurface::initialize(QRhi* rhi, QRhiHelper::InitParams initParams)
 {
 	mRhi = rhi;
 	mRequestSampleCount = initParams.sampleCount;
+	mRequestFramesInFlight = qBound(1, initParams.offscreenFramesInFlight, 8);
 	mBeginFrameFlags = initParams.beginFrameFlags;
 	mEndFrameFlags = initParams.endFrameFlags;
 	resize(mRequestSize);
@@ -187,19 +210,87 @@ void QRendererOffscreenSurface::initialize(QRhi* rhi, QRhiHelper::InitParams ini
 
 void QRendererOffscreenSurface::destroy()
 {
-	mColorAttachment.reset();
-	mDepthStencilAttachment.reset();
+	releaseResources();
+}
+
+void QRendererOffscreenSurface::releaseResources()
+{
+	mDeliveryThreadPool.waitForDone();
+	mDeliveries.clear();
 	mRenderTarget.reset();
 	mRenderPassDesc.reset();
+	mDepthStencilAttachment.reset();
+	mColorAttachment.reset();
 }
 
 bool QRendererOffscreenSurface::beginFrame(QRhiCommandBuffer** outCmdBuffer, QRhiRenderTarget** outRenderTarget)
 {
+	if (!mRenderTarget)
+		return false;
+	while (!mDeliveries.isEmpty() && mDeliveries.head().isFinished())
+		mDeliveries.dequeue();
+	if (mDeliveries.size() >= mRequestFramesInFlight) {
+		// The callback is mRequestFramesInFlight frames behind, hold the render thread until the oldest one is delivered
+		ZoneScopedN("OffscreenDeliveryStall");
+		mDeliveries.dequeue().waitForFinished();
+		QMutexLocker locker(&mMutex);
+		mStatistics.stalls++;
+	}
+	if (mRhi->beginOffscreenFrame(outCmdBuffer, mBeginFrameFlags) != QRhi::FrameOpSuccess)
+		return false;
+	mCmdBuffer = *outCmdBuffer;
 	*outRenderTarget = mRenderTarget.get();
-	return mRhi->beginOffscreenFrame(outCmdBuffer, mBeginFrameFlags) == QRhi::FrameOpSuccess;
+	return true;
 }
 
 void QRendererOffscreenSurface::endFrame()
 {
+	FrameCallback callback;
+	{
+		QMutexLocker locker(&mMutex);
+		callback = mFrameCallback;
+		mStatistics.framesSubmitted++;
+	}
+	if (callback && mRequestSampleCount == 1) {
+		mReadback = QRhiReadbackResult();
+		const quint64 frameIndex = mFrameIndex;
+		// QRhi completes offscreen readbacks inside endOffscreenFrame, conversion and delivery are what overlaps the next frames
+		mReadback.completed = [this, callback, frameIndex]() {
+			auto promise = std::make_shared<QPromise<void>>();
+			mDeliveries.enqueue(promise->future());
+			promise->start();
+			const QSize size = mReadback.pixelSize;
+			QByteArray* data = new QByteArray(std::move(mReadback.data));
+			mDeliveryThreadPool.start([this, promise, callback, frameIndex, size, data]() {
+				ZoneScopedN("OffscreenFrameDelivery");
+				// The image owns the readback bytes, the callback may keep it without another copy
+				QImage image;
+				if (data->size() >= qint64(size.width()) * size.height() * 16 && !size.isEmpty()) {
+					image = QImage(reinterpret_cast<const uchar*>(data->constData()), size.width(), size.height(), QImage::Format_RGBA32FPx4, [](void* info) {
+						delete static_cast<QByteArray*>(info);
+					}, data);
+				}
+				else {
+					delete data;
+				}
+				callback(frameIndex, image);
+				{
+					QMutexLocker locker(&mMutex);
+					mStatistics.framesRetired++;
+				}
+				promise->finish();
+			});
+		};
+		QRhiResourceUpdateBatch* batch = mRhi->nextResourceUpdateBatch();
+		batch->readBackTexture(QRhiReadbackDescription(mColorAttachment.get()), &mReadback);
+		mCmdBuffer->resourceUpdate(batch);
+	}
 	mRhi->endOffscreenFrame(mEndFrameFlags);
+	mCmdBuffer = nullptr;
+	mFrameIndex++;
+	int inFlight = 0;
+	for (const QFuture<void>& delivery : mDeliveries)
+		inFlight += delivery.isFinished() ? 0 : 1;
+	QMutexLocker locker(&mMutex);
+	mStatistics.maxFramesInFlight = qMax(mStatistics.maxFramesInFlight, inFlight);
 }
@@ -1,5 +1,13 @@
 #include "QRhiHelper.h"
 #include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QMutex>
+#include <QCache>
+#include <QPromise>
+#include <QStandardPaths>
+#include <QCryptographicHash>
 
 #ifndef QT_NO_OPENGL
 #include <QOffscreenSurface>
@@ -95,24 +103,70 @@ QSharedPointer<QRhi> QRhiHelper::create(QRhi::Implementation inBackend, QRhi::Fl
 	return rhi;
 }
 
-QShader QRhiHelper::newShaderFromCode(QShader::Stage stage, QByteArray code, QByteArray preamble)
+// Bump whenever the hlsl workaround below changes, so stale blobs on disk are ignored
+static const char* kShaderCacheVersion = "QEngineShaderCache.2";
+
+// Every target a baked shader carries, the cache key is derived from the same list
+static const QShaderBaker::GeneratedShader kShaderTargets[] = {
+	{ QShader::Source::SpirvShader, QShaderVersion(100) },
+	{ QShader::Source::GlslShader, QShaderVersion(450) },
+	{ QShader::Source::MslShader, QShaderVersion(20) },
+	{ QShader::Source::HlslShader, QShaderVersion(50) },
+};
+
+struct QShaderCacheContext {
+	QMutex mutex;
+	QCache<QByteArray, QShader> memoryCache{ 64 * 1024 * 1024 };	// cost is the serialized size
+	QHash<QByteArray, QFuture<QShader>> pendingBakes;
+	QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/ShaderCache";
+	QRhiHelper::ShaderCacheStats stats;
+};
+
+static QShaderCacheContext& shaderCacheContext() {
+	static QShaderCacheContext context;
+	return context;
+}
+
+static QByteArray shaderCacheKey(QShader::Stage stage, const QByteArray& code, const QByteArray& preamble)
+{
+	QCryptographicHash hasher(QCryptographicHash::Sha1);
+	hasher.addData(kShaderCacheVersion);
+	hasher.addData(QT_VERSION_STR);
+	hasher.addData(QByteArray::number(stage));
+	for (const auto& target : kShaderTargets) {
+		hasher.addData(QByteArray::number(int(target.first)));
+		hasher.addData(QByteArray::number(target.second.version()));
+		hasher.addData(QByteArray::number(target.second.flags().toInt()));
+	}
+	hasher.addData(QByteArray::number(preamble.size()));
+	hasher.addData(preamble);
+	hasher.addData(code);
+	return hasher.result().toHex();
+}
+
+static QShader bakeShader(QShader::Stage stage, QByteArray code, QByteArray preamble)
 {
 	ZoneScopedN("CompileShader");
+	// hlsl has no imageCube, it is baked separately from a patched source
+	QList<QShaderBaker::GeneratedShader> generatedShaders;
+	QList<QShaderBaker::GeneratedShader> hlslShaders;
+	for (const auto& target : kShaderTargets) {
+		if (target.first == QShader::Source::HlslShader)
+			hlslShaders << target;
+		else
+			generatedShaders << target;
+	}
+
 	QShaderBaker baker;
 	baker.setGeneratedShaderVariants({ QShader::StandardShader });
 	baker.setSourceString(code, stage);
 	baker.setPreamble(preamble);
-
-	QList<QShaderBaker::GeneratedShader> generatedShaders;
-	generatedShaders << QShaderBaker::GeneratedShader{ QShader::Source::SpirvShader,QShaderVersion(100) };
-	generatedShaders << QShaderBaker::GeneratedShader{ QShader::Source::GlslShader,QShaderVersion(450) };
-	generatedShaders << QShaderBaker::GeneratedShader{ QShader::Source::MslShader,QShaderVersion(20) };
 	baker.setGeneratedShaders(generatedShaders);
 
 	QShaderBaker hlslBaker;
 	hlslBaker.setGeneratedShaderVariants({ QShader::StandardShader });
 	hlslBaker.setPreamble(preamble);
-	hlslBaker.setGeneratedShaders({ QShaderBaker::GeneratedShader(QShader::Source::HlslShader,QShaderVersion(50)) });
+	hlslBaker.setGeneratedShaders(hlslShaders);
 	code = QString(code).replace("imageCube", "image2DArray").toLocal8Bit();
 	hlslBaker.setSourceString(code, stage);
 
@@ -133,11 +187,147 @@ QShader QRhiHelper::newShaderFromCode(QShader::Stage stage, QByteArray code, QBy
 		qWarning(hlslBaker.errorMessage().toLocal8Bit());
 	}
 	//shader.setDescription(hlslShader.description());
-	shader.setResourceBindingMap(QShaderKey(QShader::Source::HlslShader, QShaderVersion(50)), hlslShader.nativeResourceBindingMap(QShaderKey(QShader::Source::HlslShader, QShaderVersion(50))));
-	shader.setShader(QShaderKey(QShader::Source::HlslShader, QShaderVersion(50)), hlslShader.shader(QShaderKey(QShader::Source::HlslShader, QShaderVersion(50))));
+	for (const auto& target : hlslShaders) {
+		const QShaderKey key(target.first, target.second);
+		if (!hlslShader.shader(key).shader().isEmpty()) {
+			shader.setResourceBindingMap(key, hlslShader.nativeResourceBindingMap(key));
+			shader.setShader(key, hlslShader.shader(key));
+		}
+	}
 	return shader;
 }
 
+static bool hasEveryShaderTarget(const QShader& shader)
+{
+	for (const auto& target : kShaderTargets) {
+		if (shader.shader(QShaderKey(target.first, target.second)).shader().isEmpty())
+			return false;
+	}
+	return true;
+}
+
+QShader QRhiHelper::newShaderFromCode(QShader::Stage stage, QByteArray code, QByteArray preamble)
+{
+	ZoneScopedN("LoadShader");
+	QShaderCacheContext& context = shaderCacheContext();
+	const QByteArray key = shaderCacheKey(stage, code, preamble);
+	QString filePath;
+	{
+		QMutexLocker locker(&context.mutex);
+		if (const QShader* cached = context.memoryCache.object(key)) {
+			context.stats.memoryHits++;
+			return *cached;
+		}
+		if (!context.directory.isEmpty())
+			filePath = context.directory + "/" + key + ".qsb";
+	}
+	if (!filePath.isEmpty()) {
+		QFile file(filePath);
+		if (file.open(QIODevice::ReadOnly)) {
+			QByteArray blob = file.readAll();
+			QShader shader = QShader::fromSerialized(blob);
+			if (shader.isValid()) {
+				QMutexLocker locker(&context.mutex);
+				context.memoryCache.insert(key, new QShader(shader), blob.size());
+				context.stats.diskHits++;
+				return shader;
+			}
+		}
+	}
+	QShader shader = bakeShader(stage, code, preamble);
+	QByteArray blob = shader.isValid() ? shader.serialized() : QByteArray();
+	{
+		QMutexLocker locker(&context.mutex);
+		context.stats.misses++;
+		if (!blob.isEmpty())
+			context.memoryCache.insert(key, new QShader(shader), blob.size());
+	}
+	// A target that failed to bake would otherwise stay missing on disk until the cache version is bumped
+	if (!blob.isEmpty() && !filePath.isEmpty() && hasEveryShaderTarget(shader) && QDir().mkpath(QFileInfo(filePath).absolutePath())) {
+		QSaveFile file(filePath);
+		if (file.open(QIODevice::WriteOnly)) {
+			file.write(blob);
+			file.commit();
+		}
+	}
+	return shader;
+}
+
+QFuture<QShader> QRhiHelper::newShaderFromCodeAsync(QShader::Stage stage, QByteArray code, QByteArray preamble)
+{
+	// Identical sources requested while a bake is in flight share its future instead of baking twice
+	QShaderCacheContext& context = shaderCacheContext();
+	const QByteArray key = shaderCacheKey(stage, code, preamble);
+	QMutexLocker locker(&context.mutex);
+	if (const QShader* cached = context.memoryCache.object(key)) {
+		// Already baked, hand back a finished future without a round trip through the pool
+		context.stats.memoryHits++;
+		QPromise<QShader> promise;
+		promise.start();
+		promise.addResult(*cached);
+		promise.finish();
+		return promise.future();
+	}
+	auto pending = context.pendingBakes.constFind(key);
+	if (pending != context.pendingBakes.constEnd())
+		return pending.value();
+	auto promise = std::make_shared<QPromise<QShader>>();
+	QFuture<QShader> future = promise->future();
+	promise->start();
+	context.pendingBakes[key] = future;
+	shaderCompileThreadPool()->start([promise, key, stage, code, preamble]() {
+		promise->addResult(newShaderFromCode(stage, code, preamble));
+		QShaderCacheContext& context = shaderCacheContext();
+		QMutexLocker locker(&context.mutex);
+		context.pendingBakes.remove(key);
+		promise->finish();
+	});
+	return future;
+}
+
+QThreadPool* QRhiHelper::shaderCompileThreadPool()
+{
+	static QThreadPool threadPool;
+	return &threadPool;
+}
+
+void QRhiHelper::setShaderCacheDirectory(const QString& dir)
+{
+	QShaderCacheContext& context = shaderCacheContext();
+	QMutexLocker locker(&context.mutex);
+	context.directory = dir;
+}
+
+QString QRhiHelper::getShaderCacheDirectory()
+{
+	QShaderCacheContext& context = shaderCacheContext();
+	QMutexLocker locker(&context.mutex);
+	return context.directory;
+}
+
+void QRhiHelper::setShaderMemoryCacheLimit(qint64 bytes)
+{
+	QShaderCacheContext& context = shaderCacheContext();
+	QMutexLocker locker(&context.mutex);
+	context.memoryCache.setMaxCost(bytes);
+}
+
+QRhiHelper::ShaderCacheStats QRhiHelper::getShaderCacheStats()
+{
+	QShaderCacheContext& context = shaderCacheContext();
+	QMutexLocker locker(&context.mutex);
+	return context.stats;
+}
+
+void QRhiHelper::clearShaderCache(bool removeFromDisk)
+{
+	QShaderCacheContext& context = shaderCacheContext();
+	QMutexLocker locker(&context.mutex);
+	context.memoryCache.clear();
+	if (removeFromDisk && !context.directory.isEmpty())
+		QDir(context.directory).removeRecursively();
+}
+
 QShader QRhiHelper::newShaderFromQSBFile(const char* filename)
 {
 	QFile f(filename);
@@ -35,21 +35,18 @@ void QRhiMaterialGroup::addMaterial(QSharedPointer<QMaterial> inMaterial) {
 		}
 		else if (pair.second.metaType() == QMetaType::fromType<QImage>()) {
 			QSharedPointer<QRhiTextureDesc> textureDesc = QSharedPointer<QRhiTextureDesc>::create();
-			QImage image = pair.second.value<QImage>().convertedTo(QImage::Format_RGBA8888);
+			QRhiTextureProcessor::Options options = QRhiTextureProcessor::getMaterialOptions();
+			if (options.compression == QRhiTextureProcessor::Compression::Auto && pair.first == "Normal")
+				options.compression = QRhiTextureProcessor::Compression::BC5;
 			textureDesc->Name = pair.first;
-			textureDesc->ImageCache = image;
-			textureDesc->Size = image.size();
-			textureDesc->Format = QRhiTexture::RGBA8;
+			textureDesc->setImage(pair.second.value<QImage>(), options);
 			textureDesc->GlslTypeName = "sampler2D";
 			textureDesc->MagFilter = QRhiSampler::Filter::Linear;
-			textureDesc->MinFilter = QRhiSampler::Filter::Nearest;
-			textureDesc->MipmapMode = QRhiSampler::Filter::None;
+			textureDesc->MinFilter = QRhiSampler::Filter::Linear;
+			textureDesc->MipmapMode = textureDesc->Flags.testFlag(QRhiTexture::MipMapped) ? QRhiSampler::Filter::Linear : QRhiSampler::Filter::None;
 			textureDesc->AddressU = QRhiSampler::AddressMode::Mirror;
 			textureDesc->AddressV = QRhiSampler::AddressMode::Mirror;
 			textureDesc->AddressW = QRhiSampler::AddressMode::Mirror;
-			textureDesc->UploadDesc = QRhiTextureUploadDescription({
-				QRhiTextureUploadEntry(0,0,QRhiTextureSubresourceUploadDescription(textureDesc->ImageCache))
-			});
 			desc->textureDescs << textureDesc;
 		}
 	}
@@ -57,6 +54,15 @@ void QRhiMaterialGroup::addMaterial(QSharedPointer<QMaterial> inMaterial) {
 	mDescList << desc;
 }
 
+void QRhiTextureDesc::setImage(const QImage& inImage, const QRhiTextureProcessor::Options& inOptions) {
+	ImageCache = inImage.convertedTo(QImage::Format_RGBA8888);
+	QRhiTextureProcessor::Result result = QRhiTextureProcessor::process(ImageCache, inOptions);
+	Size = ImageCache.size();
+	Format = result.format;
+	Flags.setFlag(QRhiTexture::MipMapped, result.levels.size() > 1);
+	UploadDesc = result.uploadDescription();
+}
+
 QSharedPointer<QRhiMaterialDesc> QRhiMaterialGroup::getMaterialDesc(int inIndex) {
 	return mDescList.value(inIndex);
 }
@@ -121,6 +127,9 @@ QString QRhiMaterialDesc::getOrCreateRoughnessExpression() {
 
 QString QRhiMaterialDesc::getNormalExpression() {
 	if (auto param = getTexture("Normal")) {
+		// BC5 only keeps x and y, z is rebuilt in the same [0,1] encoding
+		if (param->Format == QRhiTexture::BC5)
+			return "vec3(texture(uNormal,vUV).rg, 0.5 + 0.5 * sqrt(max(0.0, 1.0 - dot(texture(uNormal,vUV).rg * 2.0 - 1.0, texture(uNormal,vUV).rg * 2.0 - 1.0))))";
 		return "texture(uNormal,vUV).rgb";
 	}
 	return "vec3(1)";
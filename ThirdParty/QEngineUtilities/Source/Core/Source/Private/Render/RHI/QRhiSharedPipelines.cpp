@@ -0,0 +1,109 @@
+#include "Render/RHI/QRhiSharedPipelines.h"
+
+static size_t bindingsLayoutHash(QRhiShaderResourceBindings* bindings)
+{
+	size_t seed = 0;
+	QtPrivate::QHashCombine hasher;
+	for (auto it = bindings->cbeginBindings(); it != bindings->cendBindings(); ++it) {
+		const QRhiShaderResourceBinding::Data* data = (const QRhiShaderResourceBinding::Data*)it;
+		seed = hasher(seed, data->binding);
+		seed = hasher(seed, data->stage);
+		seed = hasher(seed, data->type);
+	}
+	return seed;
+}
+
+static bool isBindingsLayoutEqual(QRhiShaderResourceBindings* a, QRhiShaderResourceBindings* b)
+{
+	return std::equal(a->cbeginBindings(), a->cendBindings(), b->cbeginBindings(), b->cendBindings(),
+		[](const QRhiShaderResourceBinding& lhs, const QRhiShaderResourceBinding& rhs) {
+			const QRhiShaderResourceBinding::Data* l = (const QRhiShaderResourceBinding::Data*)&lhs;
+			const QRhiShaderResourceBinding::Data* r = (const QRhiShaderResourceBinding::Data*)&rhs;
+			return l->binding == r->binding && l->stage == r->stage && l->type == r->type;
+		});
+}
+
+QRhiSharedPipelines::QRhiSharedPipelines(QRhi* inRhi)
+	: mRhi(inRhi)
+{
+}
+
+QRhiGraphicsPipelineRef QRhiSharedPipelines::findOrCreatePipeline(QRhiGraphicsPipeline* candidate, const std::shared_ptr<QRhiShaderResourceBindings>& bindings)
+{
+	candidate->setShaderResourceBindings(bindings.get());
+	QRhiGraphicsPipelineState state = QRhiGraphicsPipelineState::createFrom(candidate);
+	state.shaderResourceBindings = nullptr;
+	QtPrivate::QHashCombine hasher;
+	const size_t hashCode = hasher(QRGRhiResourcePool::hash(state), bindingsLayoutHash(bindings.get()));
+	QMutexLocker locker(&mMutex);
+	for (auto it = mPipelines.find(hashCode); it != mPipelines.end() && it.key() == hashCode; ++it) {
+		QRhiGraphicsPipelineRef pipeline = it->pipeline.lock();
+		if (pipeline && it->state == state && isBindingsLayoutEqual(it->layoutBindings.get(), bindings.get())) {
+			delete candidate;
+			return pipeline;
+		}
+	}
+	pruneLocked();
+	QRhiGraphicsPipelineRef pipeline(candidate);
+	pipeline->create();
+	mPipelines.insert(hashCode, { pipeline, state, bindings });
+	return pipeline;
+}
+
+std::shared_ptr<QRhiShaderResourceBindings> QRhiSharedPipelines::findOrCreateBindings(const QVector<QRhiShaderResourceBinding>& bindings)
+{
+	const size_t hashCode = QRGRhiResourcePool::hash(bindings);
+	QMutexLocker locker(&mMutex);
+	if (std::shared_ptr<QRhiShaderResourceBindings> srb = mBindings.value(hashCode).lock()) {
+		if (std::equal(srb->cbeginBindings(), srb->cendBindings(), bindings.cbegin(), bindings.cend()))
+			return srb;
+	}
+	pruneLocked();
+	std::shared_ptr<QRhiShaderResourceBindings> srb(mRhi->newShaderResourceBindings());
+	srb->setBindings(bindings.cbegin(), bindings.cend());
+	srb->create();
+	mBindings[hashCode] = srb;
+	return srb;
+}
+
+void QRhiSharedPipelines::prune()
+{
+	QMutexLocker locker(&mMutex);
+	pruneLocked();
+}
+
+void QRhiSharedPipelines::clear()
+{
+	QMutexLocker locker(&mMutex);
+	mPipelines.clear();
+	mBindings.clear();
+}
+
+int QRhiSharedPipelines::getPipelineCount() const
+{
+	QMutexLocker locker(&mMutex);
+	return mPipelines.size();
+}
+
+int QRhiSharedPipelines::getBindingsCount() const
+{
+	QMutexLocker locker(&mMutex);
+	return mBindings.size();
+}
+
+void QRhiSharedPipelines::pruneLocked()
+{
+	// Pipelines first, they are what keeps their layout srb alive
+	for (auto it = mPipelines.begin(); it != mPipelines.end();) {
+		if (it->pipeline.expired())
+			it = mPipelines.erase(it);
+		else
+			++it;
+	}
+	for (auto it = mBindings.begin(); it != mBindings.end();) {
+		if (it->expired())
+			it = mBindings.erase(it);
+		else
+			++it;
+	}
+}
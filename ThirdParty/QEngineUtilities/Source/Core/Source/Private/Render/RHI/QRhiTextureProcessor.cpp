@@ -0,0 +1,916 @@
+#include "Render/RHI/QRhiTextureProcessor.h"
+#include "tracy/Tracy.hpp"
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSemaphore>
+#include <QStandardPaths>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+
+using Compression = QRhiTextureProcessor::Compression;
+using Quality = QRhiTextureProcessor::Quality;
+
+static const quint32 kTextureCacheMagic = 0x58455451;	// "QTEX"
+static const quint32 kTextureCacheVersion = 1;
+
+// Identifies one QImage revision, cacheKey() changes whenever the pixels are written
+struct QTextureMemoryCacheKey {
+	qint64 imageKey;
+	bool generateMips;
+	Compression compression;
+	Quality quality;
+
+	bool operator==(const QTextureMemoryCacheKey& other) const {
+		return imageKey == other.imageKey && generateMips == other.generateMips && compression == other.compression && quality == other.quality;
+	}
+};
+
+static size_t qHash(const QTextureMemoryCacheKey& key, size_t seed = 0)
+{
+	return qHashMulti(seed, key.imageKey, key.generateMips, int(key.compression), int(key.quality));
+}
+
+struct QTextureProcessorContext {
+	QTextureProcessorContext() {
+		materialOptions.generateMips = true;
+		materialOptions.compression = Compression::Auto;
+		memoryCache.setMaxCost(256 * 1024 * 1024);
+	}
+	QMutex mutex;
+	QCache<QTextureMemoryCacheKey, QRhiTextureProcessor::Result> memoryCache;		// cost in bytes, results share their levels with every caller
+	QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/TextureCache";
+	bool enabled = true;
+	QRhiTextureProcessor::Options materialOptions;
+	QRhiTextureProcessor::Statistics statistics;
+};
+
+static QTextureProcessorContext& textureProcessorContext() {
+	static QTextureProcessorContext context;
+	return context;
+}
+
+// Splits [0, count) into chunks for the encode pool, the calling thread takes the first one
+template<typename Func>
+static void parallelFor(int count, int grain, const Func& func)
+{
+	QThreadPool* threadPool = QRhiTextureProcessor::encodeThreadPool();
+	const int chunkCount = qBound(1, (count + grain - 1) / grain, qMax(1, threadPool->maxThreadCount()));
+	if (chunkCount == 1) {
+		func(0, count);
+		return;
+	}
+	const int chunkSize = (count + chunkCount - 1) / chunkCount;
+	QSemaphore finished;
+	int started = 0;
+	for (int begin = chunkSize; begin < count; begin += chunkSize) {
+		const int end = qMin(begin + chunkSize, count);
+		threadPool->start([&func, &finished, begin, end]() {
+			func(begin, end);
+			finished.release();
+		});
+		started++;
+	}
+	func(0, qMin(chunkSize, count));
+	finished.acquire(started);
+}
+
+// Scalar per texel, only the rows are split across the encode pool
+static QImage downsample(const QImage& inImage, Quality inQuality)
+{
+	const int srcWidth = inImage.width();
+	const int srcHeight = inImage.height();
+	const int dstWidth = qMax(1, srcWidth / 2);
+	const int dstHeight = qMax(1, srcHeight / 2);
+	QImage image(dstWidth, dstHeight, QImage::Format_RGBA8888);
+	const uchar* srcBits = inImage.constBits();
+	const qsizetype srcStride = inImage.bytesPerLine();
+	uchar* dstBits = image.bits();
+	const qsizetype dstStride = image.bytesPerLine();
+
+	parallelFor(dstHeight, 64, [&](int begin, int end) {
+		for (int y = begin; y < end; y++) {
+			uchar* dst = dstBits + y * dstStride;
+			if (inQuality == Quality::Fast) {
+				const uchar* row0 = srcBits + qMin(2 * y, srcHeight - 1) * srcStride;
+				const uchar* row1 = srcBits + qMin(2 * y + 1, srcHeight - 1) * srcStride;
+				for (int x = 0; x < dstWidth; x++) {
+					const int x0 = qMin(2 * x, srcWidth - 1) * 4;
+					const int x1 = qMin(2 * x + 1, srcWidth - 1) * 4;
+					for (int c = 0; c < 4; c++) {
+						dst[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+					}
+				}
+			}
+			else {
+				static const int kWeights[4] = { 1, 3, 3, 1 };
+				const uchar* rows[4];
+				for (int i = 0; i < 4; i++) {
+					rows[i] = srcBits + qBound(0, 2 * y - 1 + i, srcHeight - 1) * srcStride;
+				}
+				for (int x = 0; x < dstWidth; x++) {
+					int columns[4];
+					for (int i = 0; i < 4; i++) {
+						columns[i] = qBound(0, 2 * x - 1 + i, srcWidth - 1) * 4;
+					}
+					for (int c = 0; c < 4; c++) {
+						int sum = 0;
+						for (int j = 0; j < 4; j++) {
+							const int rowSum = rows[j][columns[0] + c] + 3 * rows[j][columns[1] + c] + 3 * rows[j][columns[2] + c] + rows[j][columns[3] + c];
+							sum += kWeights[j] * rowSum;
+						}
+						dst[x * 4 + c] = (sum + 32) >> 6;
+					}
+				}
+			}
+		}
+	});
+	return image;
+}
+
+static void fetchBlock(const uchar* inBits, qsizetype inStride, int inWidth, int inHeight, int inBlockX, int inBlockY, uchar outBlock[16][4])
+{
+	for (int y = 0; y < 4; y++) {
+		const uchar* row = inBits + qMin(inBlockY * 4 + y, inHeight - 1) * inStride;
+		for (int x = 0; x < 4; x++) {
+			memcpy(outBlock[y * 4 + x], row + qMin(inBlockX * 4 + x, inWidth - 1) * 4, 4);
+		}
+	}
+}
+
+static quint16 packRgb565(const float inColor[3])
+{
+	const int r = qBound(0, int(inColor[0] * 31.0f / 255.0f + 0.5f), 31);
+	const int g = qBound(0, int(inColor[1] * 63.0f / 255.0f + 0.5f), 63);
+	const int b = qBound(0, int(inColor[2] * 31.0f / 255.0f + 0.5f), 31);
+	return quint16((r << 11) | (g << 5) | b);
+}
+
+static void unpackRgb565(quint16 inColor, int outColor[3])
+{
+	const int r = (inColor >> 11) & 31;
+	const int g = (inColor >> 5) & 63;
+	const int b = inColor & 31;
+	outColor[0] = (r << 3) | (r >> 2);
+	outColor[1] = (g << 2) | (g >> 4);
+	outColor[2] = (b << 3) | (b >> 2);
+}
+
+// Picks the nearest of the four palette entries per texel, returns the summed squared error
+static int fitColorIndices(const uchar inBlock[16][4], quint16 inColor0, quint16 inColor1, quint32& outIndices)
+{
+	int palette[4][3];
+	unpackRgb565(inColor0, palette[0]);
+	unpackRgb565(inColor1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	int error = 0;
+	outIndices = 0;
+	for (int i = 0; i < 16; i++) {
+		int bestIndex = 0;
+		int bestDistance = INT_MAX;
+		for (int p = 0; p < 4; p++) {
+			const int dr = inBlock[i][0] - palette[p][0];
+			const int dg = inBlock[i][1] - palette[p][1];
+			const int db = inBlock[i][2] - palette[p][2];
+			const int distance = dr * dr + dg * dg + db * db;
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				bestIndex = p;
+			}
+		}
+		error += bestDistance;
+		outIndices |= quint32(bestIndex) << (2 * i);
+	}
+	return error;
+}
+
+static void computeColorEndpoints(const uchar inBlock[16][4], Quality inQuality, float outMax[3], float outMin[3])
+{
+	float minColor[3] = { 255, 255, 255 };
+	float maxColor[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			minColor[c] = qMin(minColor[c], float(inBlock[i][c]));
+			maxColor[c] = qMax(maxColor[c], float(inBlock[i][c]));
+		}
+	}
+	if (inQuality == Quality::Fast) {
+		for (int c = 0; c < 3; c++) {
+			const float inset = (maxColor[c] - minColor[c]) / 16.0f;
+			outMax[c] = maxColor[c] - inset;
+			outMin[c] = minColor[c] + inset;
+		}
+		return;
+	}
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			mean[c] += inBlock[i][c] / 16.0f;
+		}
+	}
+	float covariance[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		const float r = inBlock[i][0] - mean[0];
+		const float g = inBlock[i][1] - mean[1];
+		const float b = inBlock[i][2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+	float axis[3] = { maxColor[0] - minColor[0], maxColor[1] - minColor[1], maxColor[2] - minColor[2] };
+	for (int iteration = 0; iteration < 4; iteration++) {
+		const float x = axis[0] * covariance[0] + axis[1] * covariance[1] + axis[2] * covariance[2];
+		const float y = axis[0] * covariance[1] + axis[1] * covariance[3] + axis[2] * covariance[4];
+		const float z = axis[0] * covariance[2] + axis[1] * covariance[4] + axis[2] * covariance[5];
+		const float length = qMax(qMax(qAbs(x), qAbs(y)), qAbs(z));
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+	const float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	if (axisLengthSquared < 1e-6f) {
+		memcpy(outMax, maxColor, sizeof(maxColor));
+		memcpy(outMin, minColor, sizeof(minColor));
+		return;
+	}
+	float minProjection = FLT_MAX;
+	float maxProjection = -FLT_MAX;
+	for (int i = 0; i < 16; i++) {
+		const float projection = ((inBlock[i][0] - mean[0]) * axis[0] + (inBlock[i][1] - mean[1]) * axis[1] + (inBlock[i][2] - mean[2]) * axis[2]) / axisLengthSquared;
+		minProjection = qMin(minProjection, projection);
+		maxProjection = qMax(maxProjection, projection);
+	}
+	for (int c = 0; c < 3; c++) {
+		outMax[c] = qBound(0.0f, mean[c] + axis[c] * maxProjection, 255.0f);
+		outMin[c] = qBound(0.0f, mean[c] + axis[c] * minProjection, 255.0f);
+	}
+}
+
+// Solves the endpoints that minimise the error for the current index assignment
+static bool refineColorEndpoints(const uchar inBlock[16][4], quint32 inIndices, float outMax[3], float outMin[3])
+{
+	static const float kWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float alpha2 = 0, beta2 = 0, alphaBeta = 0;
+	float alphaX[3] = { 0, 0, 0 };
+	float betaX[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		const float alpha = kWeights[(inIndices >> (2 * i)) & 3];
+		const float beta = 1.0f - alpha;
+		alpha2 += alpha * alpha;
+		beta2 += beta * beta;
+		alphaBeta += alpha * beta;
+		for (int c = 0; c < 3; c++) {
+			alphaX[c] += alpha * inBlock[i][c];
+			betaX[c] += beta * inBlock[i][c];
+		}
+	}
+	const float determinant = alpha2 * beta2 - alphaBeta * alphaBeta;
+	if (qAbs(determinant) < 1e-6f)
+		return false;
+	for (int c = 0; c < 3; c++) {
+		outMax[c] = qBound(0.0f, (alphaX[c] * beta2 - betaX[c] * alphaBeta) / determinant, 255.0f);
+		outMin[c] = qBound(0.0f, (betaX[c] * alpha2 - alphaX[c] * alphaBeta) / determinant, 255.0f);
+	}
+	return true;
+}
+
+static void writeColorBlock(uchar* outData, quint16 inColor0, quint16 inColor1, quint32 inIndices)
+{
+	outData[0] = inColor0 & 0xFF;
+	outData[1] = inColor0 >> 8;
+	outData[2] = inColor1 & 0xFF;
+	outData[3] = inColor1 >> 8;
+	for (int i = 0; i < 4; i++) {
+		outData[4 + i] = (inIndices >> (8 * i)) & 0xFF;
+	}
+}
+
+// Always four colour mode, which is also how BC3 interprets its colour half
+static void encodeColorBlock(const uchar inBlock[16][4], Quality inQuality, uchar* outData)
+{
+	float maxColor[3], minColor[3];
+	computeColorEndpoints(inBlock, inQuality, maxColor, minColor);
+	quint16 color0 = packRgb565(maxColor);
+	quint16 color1 = packRgb565(minColor);
+	if (color0 == color1) {
+		writeColorBlock(outData, color0, color1, 0);
+		return;
+	}
+	if (color0 < color1)
+		std::swap(color0, color1);
+	quint32 indices = 0;
+	int error = fitColorIndices(inBlock, color0, color1, indices);
+	if (inQuality == Quality::High && error > 0 && refineColorEndpoints(inBlock, indices, maxColor, minColor)) {
+		quint16 refinedColor0 = packRgb565(maxColor);
+		quint16 refinedColor1 = packRgb565(minColor);
+		if (refinedColor0 != refinedColor1) {
+			if (refinedColor0 < refinedColor1)
+				std::swap(refinedColor0, refinedColor1);
+			quint32 refinedIndices = 0;
+			const int refinedError = fitColorIndices(inBlock, refinedColor0, refinedColor1, refinedIndices);
+			if (refinedError < error) {
+				color0 = refinedColor0;
+				color1 = refinedColor1;
+				indices = refinedIndices;
+			}
+		}
+	}
+	writeColorBlock(outData, color0, color1, indices);
+}
+
+// BC4 layout in eight value mode, shared by the BC3 alpha half and both BC5 channels
+static void encodeChannelBlock(const uchar inBlock[16][4], int inChannel, uchar* outData)
+{
+	int lo = 255;
+	int hi = 0;
+	for (int i = 0; i < 16; i++) {
+		lo = qMin(lo, int(inBlock[i][inChannel]));
+		hi = qMax(hi, int(inBlock[i][inChannel]));
+	}
+	outData[0] = hi;
+	outData[1] = lo;
+	quint64 indices = 0;
+	if (hi != lo) {
+		int palette[8];
+		palette[0] = hi;
+		palette[1] = lo;
+		for (int i = 2; i < 8; i++) {
+			palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+		}
+		for (int i = 0; i < 16; i++) {
+			int bestIndex = 0;
+			int bestDistance = INT_MAX;
+			for (int p = 0; p < 8; p++) {
+				const int distance = qAbs(inBlock[i][inChannel] - palette[p]);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= quint64(bestIndex) << (3 * i);
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		outData[2 + i] = (indices >> (8 * i)) & 0xFF;
+	}
+}
+
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit each, 4 bit indices
+static const int kBC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Endpoints {
+	int color[2][4];
+	int pbit[2];
+};
+
+static int fitBC7Indices(const uchar inBlock[16][4], const BC7Endpoints& inEndpoints, uchar outIndices[16])
+{
+	int endpoints[2][4];
+	for (int e = 0; e < 2; e++) {
+		for (int c = 0; c < 4; c++) {
+			endpoints[e][c] = (inEndpoints.color[e][c] << 1) | inEndpoints.pbit[e];
+		}
+	}
+	int palette[16][4];
+	for (int p = 0; p < 16; p++) {
+		for (int c = 0; c < 4; c++) {
+			palette[p][c] = ((64 - kBC7Weights[p]) * endpoints[0][c] + kBC7Weights[p] * endpoints[1][c] + 32) >> 6;
+		}
+	}
+	int error = 0;
+	for (int i = 0; i < 16; i++) {
+		int bestIndex = 0;
+		int bestDistance = INT_MAX;
+		for (int p = 0; p < 16; p++) {
+			int distance = 0;
+			for (int c = 0; c < 4; c++) {
+				const int d = inBlock[i][c] - palette[p][c];
+				distance += d * d;
+			}
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				bestIndex = p;
+			}
+		}
+		error += bestDistance;
+		outIndices[i] = bestIndex;
+	}
+	return error;
+}
+
+static void computeBC7Endpoints(const uchar inBlock[16][4], Quality inQuality, float outEndpoints[2][4])
+{
+	float minColor[4] = { 255, 255, 255, 255 };
+	float maxColor[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			minColor[c] = qMin(minColor[c], float(inBlock[i][c]));
+			maxColor[c] = qMax(maxColor[c], float(inBlock[i][c]));
+		}
+	}
+	if (inQuality == Quality::Fast) {
+		for (int c = 0; c < 4; c++) {
+			const float inset = (maxColor[c] - minColor[c]) / 32.0f;
+			outEndpoints[0][c] = minColor[c] + inset;
+			outEndpoints[1][c] = maxColor[c] - inset;
+		}
+		return;
+	}
+	float mean[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			mean[c] += inBlock[i][c] / 16.0f;
+		}
+	}
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		float delta[4];
+		for (int c = 0; c < 4; c++) {
+			delta[c] = inBlock[i][c] - mean[c];
+		}
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) {
+				covariance[r][c] += delta[r] * delta[c];
+			}
+		}
+	}
+	float axis[4];
+	for (int c = 0; c < 4; c++) {
+		axis[c] = maxColor[c] - minColor[c];
+	}
+	for (int iteration = 0; iteration < 4; iteration++) {
+		float next[4] = { 0, 0, 0, 0 };
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) {
+				next[r] += covariance[r][c] * axis[c];
+			}
+		}
+		const float length = qMax(qMax(qAbs(next[0]), qAbs(next[1])), qMax(qAbs(next[2]), qAbs(next[3])));
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < 4; c++) {
+			axis[c] = next[c] / length;
+		}
+	}
+	const float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+	if (axisLengthSquared < 1e-6f) {
+		memcpy(outEndpoints[0], minColor, sizeof(minColor));
+		memcpy(outEndpoints[1], maxColor, sizeof(maxColor));
+		return;
+	}
+	float minProjection = FLT_MAX;
+	float maxProjection = -FLT_MAX;
+	for (int i = 0; i < 16; i++) {
+		float projection = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			projection += (inBlock[i][c] - mean[c]) * axis[c];
+		}
+		projection /= axisLengthSquared;
+		minProjection = qMin(minProjection, projection);
+		maxProjection = qMax(maxProjection, projection);
+	}
+	for (int c = 0; c < 4; c++) {
+		outEndpoints[0][c] = qBound(0.0f, mean[c] + axis[c] * minProjection, 255.0f);
+		outEndpoints[1][c] = qBound(0.0f, mean[c] + axis[c] * maxProjection, 255.0f);
+	}
+}
+
+static bool refineBC7Endpoints(const uchar inBlock[16][4], const uchar inIndices[16], float outEndpoints[2][4])
+{
+	float alpha2 = 0, beta2 = 0, alphaBeta = 0;
+	float alphaX[4] = { 0, 0, 0, 0 };
+	float betaX[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		const float beta = kBC7Weights[inIndices[i]] / 64.0f;
+		const float alpha = 1.0f - beta;
+		alpha2 += alpha * alpha;
+		beta2 += beta * beta;
+		alphaBeta += alpha * beta;
+		for (int c = 0; c < 4; c++) {
+			alphaX[c] += alpha * inBlock[i][c];
+			betaX[c] += beta * inBlock[i][c];
+		}
+	}
+	const float determinant = alpha2 * beta2 - alphaBeta * alphaBeta;
+	if (qAbs(determinant) < 1e-6f)
+		return false;
+	for (int c = 0; c < 4; c++) {
+		outEndpoints[0][c] = qBound(0.0f, (alphaX[c] * beta2 - betaX[c] * alphaBeta) / determinant, 255.0f);
+		outEndpoints[1][c] = qBound(0.0f, (betaX[c] * alpha2 - alphaX[c] * alphaBeta) / determinant, 255.0f);
+	}
+	return true;
+}
+
+// Fast derives each shared bit from its endpoint, High tries all four combinations
+static void searchBC7Endpoints(const uchar inBlock[16][4], const float inEndpoints[2][4], Quality inQuality, BC7Endpoints& ioBest, uchar ioIndices[16], int& ioError)
+{
+	for (int combination = 0; combination < 4; combination++) {
+		BC7Endpoints candidate;
+		for (int e = 0; e < 2; e++) {
+			if (inQuality == Quality::Fast) {
+				int oddCount = 0;
+				for (int c = 0; c < 4; c++) {
+					oddCount += int(inEndpoints[e][c] + 0.5f) & 1;
+				}
+				candidate.pbit[e] = oddCount >= 2 ? 1 : 0;
+			}
+			else {
+				candidate.pbit[e] = (combination >> e) & 1;
+			}
+			for (int c = 0; c < 4; c++) {
+				candidate.color[e][c] = qBound(0, int((inEndpoints[e][c] - candidate.pbit[e]) / 2.0f + 0.5f), 127);
+			}
+		}
+		uchar indices[16];
+		const int error = fitBC7Indices(inBlock, candidate, indices);
+		if (error < ioError) {
+			ioError = error;
+			ioBest = candidate;
+			memcpy(ioIndices, indices, 16);
+		}
+		if (inQuality == Quality::Fast)
+			break;
+	}
+}
+
+static void writeBC7Block(uchar* outData, BC7Endpoints inEndpoints, uchar inIndices[16])
+{
+	// The first index drops its top bit, so it has to sit in the lower half of the palette
+	if (inIndices[0] & 8) {
+		for (int c = 0; c < 4; c++) {
+			std::swap(inEndpoints.color[0][c], inEndpoints.color[1][c]);
+		}
+		std::swap(inEndpoints.pbit[0], inEndpoints.pbit[1]);
+		for (int i = 0; i < 16; i++) {
+			inIndices[i] = 15 - inIndices[i];
+		}
+	}
+	quint64 bits[2] = { 0, 0 };
+	int position = 0;
+	auto writeBits = [&bits, &position](quint32 value, int count) {
+		for (int i = 0; i < count; i++, position++) {
+			bits[position >> 6] |= quint64((value >> i) & 1) << (position & 63);
+		}
+	};
+	writeBits(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writeBits(inEndpoints.color[0][c], 7);
+		writeBits(inEndpoints.color[1][c], 7);
+	}
+	writeBits(inEndpoints.pbit[0], 1);
+	writeBits(inEndpoints.pbit[1], 1);
+	writeBits(inIndices[0], 3);
+	for (int i = 1; i < 16; i++) {
+		writeBits(inIndices[i], 4);
+	}
+	for (int i = 0; i < 16; i++) {
+		outData[i] = (bits[i >> 3] >> (8 * (i & 7))) & 0xFF;
+	}
+}
+
+static void encodeBC7Block(const uchar inBlock[16][4], Quality inQuality, uchar* outData)
+{
+	float endpoints[2][4];
+	computeBC7Endpoints(inBlock, inQuality, endpoints);
+	BC7Endpoints best = {};
+	uchar indices[16];
+	int error = INT_MAX;
+	searchBC7Endpoints(inBlock, endpoints, inQuality, best, indices, error);
+	if (inQuality == Quality::High && error > 0 && refineBC7Endpoints(inBlock, indices, endpoints)) {
+		searchBC7Endpoints(inBlock, endpoints, inQuality, best, indices, error);
+	}
+	writeBC7Block(outData, best, indices);
+}
+
+static int blockByteSize(Compression inCompression)
+{
+	return inCompression == Compression::BC1 ? 8 : 16;
+}
+
+static QByteArray encodeLevel(const QImage& inImage, Compression inCompression, Quality inQuality)
+{
+	const int blocksX = (inImage.width() + 3) / 4;
+	const int blocksY = (inImage.height() + 3) / 4;
+	const int blockBytes = blockByteSize(inCompression);
+	QByteArray data(qsizetype(blocksX) * blocksY * blockBytes, Qt::Uninitialized);
+	uchar* outBits = reinterpret_cast<uchar*>(data.data());
+	const uchar* srcBits = inImage.constBits();
+	const qsizetype srcStride = inImage.bytesPerLine();
+	parallelFor(blocksY, 8, [&](int begin, int end) {
+		uchar block[16][4];
+		for (int by = begin; by < end; by++) {
+			uchar* out = outBits + qsizetype(by) * blocksX * blockBytes;
+			for (int bx = 0; bx < blocksX; bx++, out += blockBytes) {
+				fetchBlock(srcBits, srcStride, inImage.width(), inImage.height(), bx, by, block);
+				switch (inCompression) {
+				case Compression::BC1:
+					encodeColorBlock(block, inQuality, out);
+					break;
+				case Compression::BC3:
+					encodeChannelBlock(block, 3, out);
+					encodeColorBlock(block, inQuality, out + 8);
+					break;
+				case Compression::BC5:
+					encodeChannelBlock(block, 0, out);
+					encodeChannelBlock(block, 1, out + 8);
+					break;
+				case Compression::BC7:
+					encodeBC7Block(block, inQuality, out);
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	});
+	return data;
+}
+
+static bool hasTranslucentTexels(const QImage& inImage)
+{
+	for (int y = 0; y < inImage.height(); y++) {
+		const uchar* row = inImage.constScanLine(y);
+		for (int x = 0; x < inImage.width(); x++) {
+			if (row[x * 4 + 3] != 255)
+				return true;
+		}
+	}
+	return false;
+}
+
+static QRhiTexture::Format textureFormat(Compression inCompression)
+{
+	switch (inCompression) {
+	case Compression::BC1:
+		return QRhiTexture::BC1;
+	case Compression::BC3:
+		return QRhiTexture::BC3;
+	case Compression::BC5:
+		return QRhiTexture::BC5;
+	case Compression::BC7:
+		return QRhiTexture::BC7;
+	default:
+		break;
+	}
+	return QRhiTexture::RGBA8;
+}
+
+static QString textureCacheFilePath(const QImage& inImage, const QRhiTextureProcessor::Options& inOptions, Compression inCompression)
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QString directory;
+	{
+		QMutexLocker locker(&context.mutex);
+		if (!context.enabled || context.directory.isEmpty())
+			return QString();
+		directory = context.directory;
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	const qint32 key[5] = { inImage.width(), inImage.height(), inOptions.generateMips, (qint32)inCompression, (qint32)inOptions.quality };
+	hash.addData(QByteArrayView(reinterpret_cast<const char*>(key), sizeof(key)));
+	hash.addData(QByteArrayView(reinterpret_cast<const char*>(inImage.constBits()), inImage.sizeInBytes()));
+	return directory + "/" + hash.result().toHex() + ".qtex";
+}
+
+static bool readTextureCache(const QString& inFilePath, QRhiTextureProcessor::Result& outResult)
+{
+	QFile file(inFilePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_6_0);
+	quint32 magic = 0, version = 0;
+	qint32 format = 0, levelCount = 0;
+	QSize size;
+	stream >> magic >> version;
+	if (magic != kTextureCacheMagic || version != kTextureCacheVersion)
+		return false;
+	stream >> format >> size >> levelCount;
+	if (levelCount <= 0 || levelCount > 32)
+		return false;
+	QList<QByteArray> levels(levelCount);
+	for (auto& level : levels) {
+		stream >> level;
+	}
+	if (stream.status() != QDataStream::Ok || levels.isEmpty())
+		return false;
+	outResult.format = (QRhiTexture::Format)format;
+	outResult.size = size;
+	outResult.levels = levels;
+	return true;
+}
+
+static bool writeTextureCache(const QString& inFilePath, const QRhiTextureProcessor::Result& inResult)
+{
+	QDir().mkpath(QFileInfo(inFilePath).absolutePath());
+	QSaveFile file(inFilePath);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_6_0);
+	stream << kTextureCacheMagic << kTextureCacheVersion << (qint32)inResult.format << inResult.size << (qint32)inResult.levels.size();
+	for (const auto& level : inResult.levels) {
+		stream << level;
+	}
+	return stream.status() == QDataStream::Ok && file.commit();
+}
+
+QRhiTextureProcessor::Result QRhiTextureProcessor::process(const QImage& inImage, const Options& inOptions)
+{
+	ZoneScopedN("QRhiTextureProcessor::process");
+	Result result;
+	if (inImage.isNull())
+		return result;
+
+	// Material groups sharing a texture hit this before converting or hashing a single texel
+	QTextureProcessorContext& context = textureProcessorContext();
+	const QTextureMemoryCacheKey memoryKey = { inImage.cacheKey(), inOptions.generateMips, inOptions.compression, inOptions.quality };
+	{
+		QMutexLocker locker(&context.mutex);
+		if (const Result* cached = context.memoryCache.object(memoryKey)) {
+			context.statistics.processedTextures++;
+			context.statistics.memoryCacheHits++;
+			return *cached;
+		}
+	}
+	auto storeInMemory = [&context, &memoryKey](const Result& inResult) {
+		qsizetype bytes = 0;
+		for (const auto& level : inResult.levels)
+			bytes += level.size();
+		QMutexLocker locker(&context.mutex);
+		context.memoryCache.insert(memoryKey, new Result(inResult), bytes);
+	};
+
+	const QImage image = inImage.convertedTo(QImage::Format_RGBA8888);
+	Compression compression = inOptions.compression;
+	if (compression == Compression::Auto)
+		compression = hasTranslucentTexels(image) ? (inOptions.quality == Quality::High ? Compression::BC7 : Compression::BC3) : Compression::BC1;
+	// D3D requires block compressed top levels to be whole blocks
+	if (image.width() % 4 != 0 || image.height() % 4 != 0)
+		compression = Compression::None;
+
+	result.format = textureFormat(compression);
+	result.size = image.size();
+	if (!inOptions.generateMips && compression == Compression::None) {
+		result.levels << QByteArray(reinterpret_cast<const char*>(image.constBits()), image.sizeInBytes());
+		return result;
+	}
+
+	const QString cacheFilePath = textureCacheFilePath(image, inOptions, compression);
+	if (!cacheFilePath.isEmpty() && readTextureCache(cacheFilePath, result)) {
+		storeInMemory(result);
+		QMutexLocker locker(&context.mutex);
+		context.statistics.processedTextures++;
+		context.statistics.cacheHits++;
+		return result;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	quint64 encodedBytes = 0;
+	QImage level = image;
+	while (true) {
+		if (compression == Compression::None) {
+			result.levels << QByteArray(reinterpret_cast<const char*>(level.constBits()), level.sizeInBytes());
+		}
+		else {
+			result.levels << encodeLevel(level, compression, inOptions.quality);
+			encodedBytes += level.sizeInBytes();
+		}
+		if (!inOptions.generateMips || (level.width() == 1 && level.height() == 1))
+			break;
+		level = downsample(level, inOptions.quality);
+	}
+	const quint64 elapsed = timer.nsecsElapsed();
+
+	Statistics statistics;
+	{
+		QMutexLocker locker(&context.mutex);
+		context.statistics.processedTextures++;
+		context.statistics.encodedBytes += encodedBytes;
+		context.statistics.encodeNanoseconds += elapsed;
+		statistics = context.statistics;
+	}
+	TracyPlot("Texture Encode MB/s", statistics.encodeThroughputMBs());
+
+	if (!cacheFilePath.isEmpty())
+		writeTextureCache(cacheFilePath, result);
+	storeInMemory(result);
+	return result;
+}
+
+QRhiTextureUploadDescription QRhiTextureProcessor::Result::uploadDescription() const
+{
+	QList<QRhiTextureUploadEntry> entries;
+	for (int i = 0; i < levels.size(); i++) {
+		entries << QRhiTextureUploadEntry(0, i, QRhiTextureSubresourceUploadDescription(levels[i]));
+	}
+	QRhiTextureUploadDescription desc;
+	desc.setEntries(entries.cbegin(), entries.cend());
+	return desc;
+}
+
+double QRhiTextureProcessor::Statistics::encodeThroughputMBs() const
+{
+	if (encodeNanoseconds == 0)
+		return 0.0;
+	return (encodedBytes / (1024.0 * 1024.0)) / (encodeNanoseconds / 1e9);
+}
+
+void QRhiTextureProcessor::setMaterialOptions(const Options& inOptions)
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	context.materialOptions = inOptions;
+}
+
+QRhiTextureProcessor::Options QRhiTextureProcessor::getMaterialOptions()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	return context.materialOptions;
+}
+
+void QRhiTextureProcessor::setCacheDirectory(const QString& dir)
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	context.directory = dir;
+}
+
+QString QRhiTextureProcessor::getCacheDirectory()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	return context.directory;
+}
+
+void QRhiTextureProcessor::setMemoryCacheBudget(qsizetype bytes)
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	context.memoryCache.setMaxCost(bytes);
+}
+
+qsizetype QRhiTextureProcessor::getMemoryCacheBudget()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	return context.memoryCache.maxCost();
+}
+
+void QRhiTextureProcessor::clearMemoryCache()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	context.memoryCache.clear();
+}
+
+void QRhiTextureProcessor::setCacheEnabled(bool enabled)
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	context.enabled = enabled;
+}
+
+bool QRhiTextureProcessor::isCacheEnabled()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	return context.enabled;
+}
+
+QRhiTextureProcessor::Statistics QRhiTextureProcessor::getStatistics()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	return context.statistics;
+}
+
+void QRhiTextureProcessor::resetStatistics()
+{
+	QTextureProcessorContext& context = textureProcessorContext();
+	QMutexLocker locker(&context.mutex);
+	context.statistics = Statistics();
+}
+
+QThreadPool* QRhiTextureProcessor::encodeThreadPool()
+{
+	static QThreadPool threadPool;
+	return &threadPool;
+}
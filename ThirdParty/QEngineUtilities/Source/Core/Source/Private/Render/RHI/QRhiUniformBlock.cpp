@@ -1,5 +1,6 @@
 ﻿#include "Render/RHI/QRhiUniformBlock.h"
 #include "Render/IRenderComponent.h"
+#include "Render/RHI/QRhiUniformRing.h"
 
 QRhiUniformBlock::QRhiUniformBlock(QObject* inParent)
 	: QObject(inParent)
@@ -14,6 +15,30 @@ void QRhiUniformBlock::setParamValue(const QString& name, QVariant value) {
 	}
 }
 
+QRhiUniformBlock::ParamHandle QRhiUniformBlock::getParamHandle(const QString& inName) const {
+	ParamHandle handle;
+	handle.desc = mParamNameMap.value(inName).get();
+	return handle;
+}
+
+void QRhiUniformBlock::writeStaging(UniformParamDescBase* inDesc, const void* inData, uint32_t inSize) {
+	uint32_t begin = inDesc->mOffsetInByte;
+	uint32_t end = begin + inSize;
+	if (end > (uint32_t)mStagingData.size()) {
+		inDesc->sigUpdate.request();				// not laid out yet, picked up after create
+		return;
+	}
+	memcpy(mStagingData.data() + begin, inData, inSize);
+	if (mDirtyBegin == mDirtyEnd) {
+		mDirtyBegin = begin;
+		mDirtyEnd = end;
+	}
+	else {
+		mDirtyBegin = qMin(mDirtyBegin, begin);
+		mDirtyEnd = qMax(mDirtyEnd, end);
+	}
+}
+
 void QRhiUniformBlock::removeParam(const QString& name)
 {
 	auto iter = mParamNameMap.find(name);
@@ -62,6 +87,8 @@ void QRhiUniformBlock::updateLayout() {
 		paramDesc->sigUpdate.request();
 		mDataByteSize = paramDesc->mOffsetInByte + paramDesc->mSizeInByteAligned;
 	}
+	mStagingData.fill(0, mDataByteSize);
+	mDirtyBegin = mDirtyEnd = 0;
 }
 
 void QRhiUniformBlock::create(QRhi* inRhi) {
@@ -76,16 +103,50 @@ void QRhiUniformBlock::create(QRhi* inRhi) {
 	}
 }
 
-void QRhiUniformBlock::updateResource(QRhiResourceUpdateBatch* batch) {
+void QRhiUniformBlock::create(QRhiUniformRing* inRing) {
+	Q_UNUSED(inRing);
+	updateLayout();
+	mUniformBlock.reset();
+	mRingFrameIndex = 0;
+	for (auto& dataParam : mParamList) {
+		dataParam->sigRecreate.ensure();
+	}
+}
+
+bool QRhiUniformBlock::stageParamUpdates() {
 	for (auto& dataParam : mParamList) {
 		if (dataParam->sigRecreate.ensure()) {
 			sigRecreateBuffer.request();
-			return;
+			return false;
 		}
 		if (dataParam->sigUpdate.ensure()) {
-			batch->updateDynamicBuffer(mUniformBlock.get(), dataParam->mOffsetInByte, dataParam->mSizeInByte, dataParam->dataPtr());
+			writeStaging(dataParam.get(), dataParam->dataPtr(), dataParam->mSizeInByte);
 		}
 	}
+	return true;
+}
+
+void QRhiUniformBlock::updateResource(QRhiResourceUpdateBatch* batch) {
+	if (!stageParamUpdates())
+		return;
+	if (mDirtyEnd > mDirtyBegin) {
+		batch->updateDynamicBuffer(mUniformBlock.get(), mDirtyBegin, mDirtyEnd - mDirtyBegin, mStagingData.constData() + mDirtyBegin);
+		mDirtyBegin = mDirtyEnd = 0;
+	}
+}
+
+quint32 QRhiUniformBlock::updateResource(QRhiUniformRing* inRing) {
+	if (!stageParamUpdates())
+		return mRingOffset;
+	// Blocks shared by several proxies are copied once per frame, and again only if written in between
+	if (mRingFrameIndex != inRing->getFrameIndex() || mDirtyEnd > mDirtyBegin) {
+		mRingOffset = inRing->allocate(mStagingData.constData(), mDataByteSize);
+		if (mRingOffset == QRhiUniformRing::InvalidOffset)
+			return mRingOffset;
+		mRingFrameIndex = inRing->getFrameIndex();
+		mDirtyBegin = mDirtyEnd = 0;
+	}
+	return mRingOffset;
 }
 
 QSharedPointer<UniformParamDescBase> QRhiUniformBlock::getParamDesc(const QString& inName) {
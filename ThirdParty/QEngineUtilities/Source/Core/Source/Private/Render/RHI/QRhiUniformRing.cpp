@@ -0,0 +1,63 @@
+#include "Render/RHI/QRhiUniformRing.h"
+#include "tracy/Tracy.hpp"
+#include <cstring>
+
+QRhiUniformRing::QRhiUniformRing(QRhi* inRhi, quint32 inInitialSize)
+	: mRhi(inRhi)
+	, mAlignment(qMax(1, inRhi->ubufAlignment()))
+{
+	mBuffer.reset(mRhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, inInitialSize));
+	mBuffer->setName("UniformRing");
+	mBuffer->create();
+	mFrameData.resize(inInitialSize);
+	mStatistics.bufferAllocations++;
+	mStatistics.capacity = inInitialSize;
+}
+
+quint32 QRhiUniformRing::allocate(const void* inData, quint32 inSize)
+{
+	mRequestedBytes = (mRequestedBytes + mAlignment - 1) / mAlignment * mAlignment + inSize;
+	const quint32 offset = (mCursor + mAlignment - 1) / mAlignment * mAlignment;
+	if (offset + inSize > (quint32)mFrameData.size()) {
+		mStatistics.frameOverflows++;
+		return InvalidOffset;
+	}
+	memcpy(mFrameData.data() + offset, inData, inSize);
+	mCursor = offset + inSize;
+	mStatistics.frameAllocations++;
+	mStatistics.frameBytes += inSize;
+	return offset;
+}
+
+void QRhiUniformRing::flush(QRhiResourceUpdateBatch* batch)
+{
+	if (mCursor == mFlushedCursor)
+		return;
+	batch->updateDynamicBuffer(mBuffer.get(), mFlushedCursor, mCursor - mFlushedCursor, mFrameData.constData() + mFlushedCursor);
+	mFlushedCursor = mCursor;
+	mStatistics.frameUploads++;
+}
+
+void QRhiUniformRing::nextFrame()
+{
+	TracyPlot("UniformRing Allocations", (int64_t)mStatistics.frameAllocations);
+	TracyPlot("UniformRing Bytes", (int64_t)mStatistics.frameBytes);
+	if (mRequestedBytes > (quint32)mFrameData.size()) {
+		// Draws recorded this frame still reference the old buffer, QRhi defers its release and bindings pick up the new generation
+		const quint32 size = qNextPowerOfTwo(mRequestedBytes);
+		mBuffer->destroy();
+		mBuffer->setSize(size);
+		mBuffer->create();
+		mFrameData.resize(size);
+		mStatistics.bufferAllocations++;
+		mStatistics.capacity = size;
+	}
+	mCursor = 0;
+	mFlushedCursor = 0;
+	mRequestedBytes = 0;
+	mFrameIndex++;
+	mStatistics.frameAllocations = 0;
+	mStatistics.frameOverflows = 0;
+	mStatistics.frameUploads = 0;
+	mStatistics.frameBytes = 0;
+}
@@ -231,6 +231,15 @@ void ImGuiPainter::setup(QRenderGraphBuilder& builder, QRhiRenderTarget* rt)
 		});
 	}
 
+	// The draw list is built before the graph compiles, so the textures it samples this frame are the ones declared
+	{
+		QMutexLocker locker(&mMutex);
+		bFrameBuilt = false;
+		buildFrame();
+		for (QRhiTexture* texture : mExternalTextures)
+			builder.declareExternalRead(texture);
+	}
+
 	auto& FontImage = mRegisterImages["ImGuiFontTexture"];
 
 	QRhiGraphicsPipelineState PSO;
@@ -255,16 +264,33 @@ void ImGuiPainter::setup(QRenderGraphBuilder& builder, QRhiRenderTarget* rt)
 	builder.setupGraphicsPipeline(mPipeline, "ImGuiHPipeline", PSO);
 }
 
-void ImGuiPainter::resourceUpdate(QRhiResourceUpdateBatch* batch, QRhi* rhi) {
-	QMutexLocker locker(&mMutex);
-	if (!mWindow)
+void ImGuiPainter::buildFrame()
+{
+	if (bFrameBuilt)
 		return;
+	bFrameBuilt = true;
 	ImGui::SetCurrentContext(mImGuiContext);
 	ImGui::NewFrame();
 	if (mPaintFunctor)
 		mPaintFunctor(mImGuiContext);
 	ImGui::EndFrame();
 	ImGui::Render();
+	mExternalTextures.clear();
+	ImDrawData* draw_data = ImGui::GetDrawData();
+	for (int i = 0; draw_data && i < draw_data->CmdListsCount; i++) {
+		for (const ImDrawCmd& cmd : draw_data->CmdLists[i]->CmdBuffer) {
+			QRhiTexture* texPtr = static_cast<QRhiTexture*>(cmd.GetTexID());
+			if (texPtr && !mRegisterImages.contains(texPtr->name()))
+				mExternalTextures.insert(texPtr);
+		}
+	}
+}
+
+void ImGuiPainter::resourceUpdate(QRhiResourceUpdateBatch* batch, QRhi* rhi) {
+	QMutexLocker locker(&mMutex);
+	if (!mWindow)
+		return;
+	buildFrame();
 	ImDrawData* draw_data = ImGui::GetDrawData();
 	int64_t vertexBufferOffset = 0;
 	int64_t indexBufferOffset = 0;
@@ -298,6 +324,7 @@ void ImGuiPainter::paint(QRhiCommandBuffer* cmdBuffer, QRhiRenderTarget* renderT
 		return;
 	int64_t vertexBufferOffset = 0;
 	int64_t indexBufferOffset = 0;
+	bFrameBuilt = false;
 	cmdBuffer->setGraphicsPipeline(mPipeline.get());
 	for (int i = 0; i < draw_data->CmdListsCount; i++) {
 		const ImDrawList* cmd_list = draw_data->CmdLists[i];
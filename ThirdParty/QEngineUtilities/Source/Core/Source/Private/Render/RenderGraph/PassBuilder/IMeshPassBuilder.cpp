@@ -1,6 +1,37 @@
 #include "IMeshPassBuilder.h"
 #include "Render/IRenderer.h"
 #include "Render/IRenderComponent.h"
+#include "Render/ISceneRenderComponent.h"
+#include "tracy/Tracy.hpp"
+#include <cstring>
+
+static quint64 sortKeyId(QHash<const void*, quint64>& ids, const void* ptr, int bits)
+{
+	auto it = ids.constFind(ptr);
+	if (it != ids.constEnd())
+		return it.value();
+	quint64 id = qMin<quint64>(ids.size(), (1ull << bits) - 1);
+	ids.insert(ptr, id);
+	return id;
+}
+
+static quint64 sortKeyDepth(float depth)
+{
+	// Positive floats order the same as their bit patterns, the top 24 bits are plenty for sorting
+	depth = qMax(depth, 0.0f);
+	quint32 bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits >> 8;
+}
+
+static bool isTranslucent(QPrimitiveRenderProxy* proxy)
+{
+	for (const auto& blend : proxy->getBlendStates()) {
+		if (blend.enable)
+			return true;
+	}
+	return false;
+}
 
 void IMeshPassBuilder::setup(QRenderGraphBuilder& builder)
 {
@@ -24,21 +55,99 @@ void IMeshPassBuilder::execute(QRhiCommandBuffer* cmdBuffer)
 	context.projectionMatrix = mRenderer->getCamera()->getProjectionMatrix();
 	context.projectionMatrixWithCorr = mRenderer->getCamera()->getProjectionMatrixWithCorr();
 	context.viewMatrix = mRenderer->getCamera()->getViewMatrix();
+	context.viewportSize = renderTarget()->pixelSize();
+
+	const QVector<QPrimitiveRenderProxy*>& proxies = mRenderer->getRenderProxies();
+	QVector<MathUtils::AABB> worldBounds(proxies.size());
+	for (int i = 0; i < proxies.size(); i++) {
+		worldBounds[i] = proxies[i]->getWorldBounds();
+	}
+	mVisibility.resize(proxies.size());
+	MathUtils::Frustum frustum = MathUtils::Frustum::fromMatrix(context.projectionMatrix * context.viewMatrix);
+	frustum.intersects(worldBounds.constData(), worldBounds.size(), mVisibility.data());
 
+	// Culled proxies still get created so they are ready once they come into view, but skip uniform updates and draws
+	mDrawStats = DrawStats();
 	QRhiResourceUpdateBatch* batch = cmdBuffer->rhi()->nextResourceUpdateBatch();
-	for (auto& pipeline : mRenderer->getRenderProxies()) {
+	for (int i = 0; i < proxies.size(); i++) {
+		QPrimitiveRenderProxy* pipeline = proxies[i];
 		pipeline->tryCreate(renderTarget());
 		pipeline->tryUpload(batch);
+		pipeline->setCulled(!mVisibility[i]);
+		if (!mVisibility[i]) {
+			mDrawStats.culledCount++;
+			continue;
+		}
+		mDrawStats.visibleCount++;
 		pipeline->update(batch, context);
 	}
+	mRenderer->getRenderGraphBuilder()->getUniformRing()->flush(batch);
+
+	// Opaque: [pipeline:15][vertex buffer:12][depth:24][bindings:12], front to back within a state bucket
+	// Translucent: [1][inverted depth:24][pipeline:15][bindings:12][vertex buffer:12], back to front
+	mDrawList.clear();
+	QHash<const void*, quint64> pipelineIds, bindingsIds, vertexBufferIds;
+	for (int i = 0; i < proxies.size(); i++) {
+		QPrimitiveRenderProxy* pipeline = proxies[i];
+		if (pipeline->isCulled() || !pipeline->isPipelineReady())
+			continue;
+		DrawItem item;
+		item.proxy = pipeline;
+		quint64 pipelineId = sortKeyId(pipelineIds, pipeline->getGraphicsPipeline(), 15);
+		quint64 bindingsId = sortKeyId(bindingsIds, pipeline->getShaderResourceBindings(), 12);
+		QVector<QRhiCommandBuffer::VertexInput> vertexInputs = pipeline->getVertexInputs();
+		quint64 vertexBufferId = sortKeyId(vertexBufferIds, vertexInputs.isEmpty() ? nullptr : vertexInputs.first().first, 12);
+		float depth = 0.0f;
+		if (worldBounds[i].isValid()) {
+			depth = -(context.viewMatrix.map(worldBounds[i].center())).z();
+		}
+		else if (ISceneRenderComponent* sceneComponent = qobject_cast<ISceneRenderComponent*>(pipeline->getRenderComponent())) {
+			depth = -(context.viewMatrix.map(sceneComponent->getTranslate())).z();
+		}
+		quint64 depthKey = sortKeyDepth(depth);
+		if (isTranslucent(pipeline)) {
+			item.sortKey = (1ull << 63) | ((~depthKey & 0xFFFFFF) << 39) | (pipelineId << 24) | (bindingsId << 12) | vertexBufferId;
+		}
+		else {
+			item.sortKey = (pipelineId << 48) | (vertexBufferId << 36) | (depthKey << 12) | bindingsId;
+		}
+		mDrawList << item;
+	}
+	std::sort(mDrawList.begin(), mDrawList.end(), [](const DrawItem& a, const DrawItem& b) {
+		return a.sortKey < b.sortKey;
+	});
 
 	cmdBuffer->beginPass(renderTarget(), QColor::fromRgbF(0.0f, 0.0f, 0.0f, 0.0f), { 1.0f, 0 }, batch,QRhiCommandBuffer::BeginPassFlag::ExternalContent);
 	QRhiViewport viewport(0, 0, renderTarget()->pixelSize().width(), renderTarget()->pixelSize().height());
-	for (auto& pipeline : mRenderer->getRenderProxies()) {
-		cmdBuffer->setGraphicsPipeline(pipeline->getGraphicsPipeline());
-		cmdBuffer->setViewport(viewport);
-		cmdBuffer->setShaderResources();
-		pipeline->draw(cmdBuffer);
+	QRhiGraphicsPipeline* currentPipeline = nullptr;
+	QRhiShaderResourceBindings* currentBindings = nullptr;
+	const QVector<QRhiCommandBuffer::DynamicOffset>* currentOffsets = nullptr;
+	for (const auto& item : mDrawList) {
+		QRhiGraphicsPipeline* pipeline = item.proxy->getGraphicsPipeline();
+		if (pipeline != currentPipeline) {
+			cmdBuffer->setGraphicsPipeline(pipeline);
+			cmdBuffer->setViewport(viewport);
+			currentPipeline = pipeline;
+			currentBindings = nullptr;
+			currentOffsets = nullptr;
+			mDrawStats.pipelineSwitches++;
+		}
+		// Proxies sharing an srb still rebind when their ring offsets differ
+		QRhiShaderResourceBindings* bindings = item.proxy->getShaderResourceBindings();
+		const QVector<QRhiCommandBuffer::DynamicOffset>& offsets = item.proxy->getDynamicOffsets();
+		if (bindings != currentBindings || !currentOffsets || offsets != *currentOffsets) {
+			item.proxy->bindShaderResources(cmdBuffer);
+			currentBindings = bindings;
+			currentOffsets = &offsets;
+			mDrawStats.bindingSwitches++;
+		}
+		item.proxy->draw(cmdBuffer);
+		mDrawStats.drawCount++;
 	}
 	cmdBuffer->endPass();
-}
\ No newline at end of file
+	TracyPlot("MeshPass Draws", (int64_t)mDrawStats.drawCount);
+	TracyPlot("MeshPass Pipeline Switches", (int64_t)mDrawStats.pipelineSwitches);
+	TracyPlot("MeshPass Binding Switches", (int64_t)mDrawStats.bindingSwitches);
+	TracyPlot("MeshPass Visible", (int64_t)mDrawStats.visibleCount);
+	TracyPlot("MeshPass Culled", (int64_t)mDrawStats.culledCount);
+}
@@ -1,7 +1,8 @@
 #include "QMousePickingPassBuilder.h"
+#include <QtEndian>
 #include "Render/IRenderer.h"
 #include "Render/IRenderComponent.h"
-#include "qvulkanfunctions.h"
+#include "tracy/Tracy.hpp"
 
 QMousePickingPassBuilder::QMousePickingPassBuilder()
 {
@@ -19,144 +20,177 @@ void QMousePickingPassBuilder::requestPick(QPoint point)
 	mSigPick.request();
 }
 
-void QMousePickingPassBuilder::setup(QRenderGraphBuilder& builder)
+static QColor encodePickId(quint32 id)
 {
-	builder.setupTexture(mOutput.SelectMask, "SelectMask", QRhiTexture::Format::R8, builder.getMainRenderTarget()->pixelSize(), 1, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource);
-	builder.setupTexture(mDSTexture, "DepthStencil", QRhiTexture::Format::D24S8, builder.getMainRenderTarget()->pixelSize(), 1, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource);
-	builder.setupRenderTarget(mRenderTarget, "MousePickingPass", QRhiTextureRenderTargetDescription(mOutput.SelectMask.get(), mDSTexture.get()));
-	builder.setupBuffer(mReadbackBuffer, "ReadbackBuffer", QRhiBuffer::Static, QRhiBuffer::UsageFlag::StorageBuffer, 1);	
-
-	builder.setupShaderResourceBindings(mSelectMaskBindings, "SelectMaskBindings", {});
-
-	QRhiGraphicsPipelineState PSO;
-	PSO.shaderResourceBindings = mSelectMaskBindings.get();
-	PSO.sampleCount = mRenderTarget->sampleCount();
-	PSO.renderPassDesc = mRenderTarget->renderPassDescriptor();
-	PSO.shaderStages = {
-		QRhiShaderStage(QRhiShaderStage::Vertex, builder.getFullScreenVS()),
-		QRhiShaderStage(QRhiShaderStage::Fragment, mSelectMaskFS)
-	};
-	PSO.flags = QRhiGraphicsPipeline::Flag::UsesStencilRef;
+	return QColor(id & 0xFF, (id >> 8) & 0xFF, (id >> 16) & 0xFF, (id >> 24) & 0xFF);
+}
 
-	PSO.stencilTest = true;
-	PSO.stencilFront.compareOp = QRhiGraphicsPipeline::Equal;
-	PSO.stencilFront.passOp = QRhiGraphicsPipeline::Replace;
-	PSO.stencilFront.depthFailOp = QRhiGraphicsPipeline::Keep;
-	PSO.stencilFront.failOp = QRhiGraphicsPipeline::Keep;
-	PSO.stencilBack = PSO.stencilFront;
-	builder.setupGraphicsPipeline(mSelectMaskPipeline, "SelectMaskPipeline", PSO);
+static void replaceFragmentStage(QRhiGraphicsPipeline* pipeline, const QShader& fragmentShader)
+{
+	for (int i = 0; i < pipeline->shaderStageCount(); i++) {
+		const QRhiShaderStage* stage = pipeline->shaderStageAt(i);
+		if (stage->type() == QRhiShaderStage::Vertex) {
+			pipeline->setShaderStages({ *stage, QRhiShaderStage(QRhiShaderStage::Fragment, fragmentShader) });
+			break;
+		}
+	}
+}
 
+void QMousePickingPassBuilder::setup(QRenderGraphBuilder& builder)
+{
+	const QSize pixelSize = builder.getMainRenderTarget()->pixelSize();
+
+	// The mask is tested against the scene depth so hidden parts of the selection stay unmasked, without a scene depth the whole object is masked
+	builder.setupTexture(mOutput.SelectMask, "SelectMask", QRhiTexture::Format::R8, pixelSize, 1, QRhiTexture::RenderTarget);
+	bMaskDepthTested = mInput._SceneDepth != nullptr;
+	if (bMaskDepthTested)
+		builder.setupRenderTarget(mRenderTarget, "MousePickingPass", QRhiTextureRenderTargetDescription(mOutput.SelectMask.get(), mInput._SceneDepth.get()), QRhiTextureRenderTarget::PreserveDepthStencilContents);
+	else
+		builder.setupRenderTarget(mRenderTarget, "MousePickingPass", QRhiTextureRenderTargetDescription(mOutput.SelectMask.get()));
+
+	// Object ids are packed into RGBA8 by the blend constant on every backend, so all components share one id pipeline per proxy. 0 is the background
+	builder.setupTexture(mIdTexture, "PickId", QRhiTexture::Format::RGBA8, pixelSize, 1, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource);
+	builder.setupRenderBuffer(mIdDepthStencil, "PickIdDepthStencil", QRhiRenderBuffer::DepthStencil, pixelSize, 1);
+	builder.setupRenderTarget(mIdRenderTarget, "MousePickingIdPass", QRhiTextureRenderTargetDescription(mIdTexture.get(), mIdDepthStencil.get()));
+	for (int i = 0; i < ReadbackRingSize; i++) {
+		builder.setupTexture(mReadbacks[i].texture, "PickReadback" + QByteArray::number(i), QRhiTexture::Format::RGBA8, QSize(1, 1), 1, QRhiTexture::UsedAsTransferSource);
+	}
+	builder.declareSideEffect();
 }
 
 void QMousePickingPassBuilder::execute(QRhiCommandBuffer* cmdBuffer)
 {
-	for (auto& pipeline : mRenderer->getRenderProxies()) {
-		if (!pipeline->hasSubPipeline("DebugId")) {
-			pipeline->createSubPipeline("DebugId", mRenderTarget.get(), [](QRhiGraphicsPipeline* pipeline) {
-				pipeline->setFlags(QRhiGraphicsPipeline::Flag::UsesStencilRef);
-				pipeline->setStencilTest(true);
-				QRhiGraphicsPipeline::StencilOpState stencil;
-				stencil.compareOp = QRhiGraphicsPipeline::Always;
-				stencil.depthFailOp = QRhiGraphicsPipeline::Keep;
-				stencil.passOp = QRhiGraphicsPipeline::Replace;
-				stencil.failOp = QRhiGraphicsPipeline::Keep;
-				pipeline->setStencilFront(stencil);
-				pipeline->setStencilBack(stencil);
-				for (int i = 0; i < pipeline->shaderStageCount(); i++) {
-					const QRhiShaderStage* stage = pipeline->shaderStageAt(i);
-					if (stage->type() == QRhiShaderStage::Vertex) {
-						pipeline->setShaderStages({ *stage });
-						break;
-					}
-				}
-			});
+	auto pipelines = mRenderer->getRenderProxies();
+	QRhiViewport viewport(0, 0, mRenderTarget->pixelSize().width(), mRenderTarget->pixelSize().height());
+	IRenderComponent* currentObject = mRenderer->getCurrentObject();
+
+	PickReadback* readback = nullptr;
+	if (mSigPick.peek()) {
+		for (auto& slot : mReadbacks) {
+			if (!slot.bInFlight) {
+				readback = &slot;
+				break;
+			}
 		}
+		if (readback)	// otherwise every slot is still waiting on the GPU, keep the request for a later frame
+			mSigPick.ensure();
 	}
 
-	static const quint32 INVALID_INDEX = 255;
+	// The id pass only runs on frames that resolve a click
+	if (readback) {
+		ZoneScopedN("MousePickingId");
+		cmdBuffer->beginPass(mIdRenderTarget.get(), QColor::fromRgbF(0.0f, 0.0f, 0.0f, 0.0f), { 1.0f, 0 });
+		for (auto& proxy : pipelines) {
+			if (proxy->isCulled())
+				continue;
+			if (!proxy->hasSubPipeline("PickId")) {
+				proxy->createSubPipeline("PickId", mIdRenderTarget.get(), [this](QRhiGraphicsPipeline* pipeline) {
+					pipeline->setFlags(QRhiGraphicsPipeline::Flag::UsesBlendConstants);
+					pipeline->setDepthTest(true);
+					pipeline->setDepthWrite(true);
+					pipeline->setDepthOp(QRhiGraphicsPipeline::Less);
+					QRhiGraphicsPipeline::TargetBlend blend;
+					blend.enable = true;
+					blend.srcColor = QRhiGraphicsPipeline::ConstantColor;
+					blend.dstColor = QRhiGraphicsPipeline::Zero;
+					blend.srcAlpha = QRhiGraphicsPipeline::ConstantAlpha;
+					blend.dstAlpha = QRhiGraphicsPipeline::Zero;
+					pipeline->setTargetBlends({ blend });
+					replaceFragmentStage(pipeline, mSelectMaskFS);
+				});
+			}
+			QRhiGraphicsPipeline* employee = proxy->gerSubPipeline("PickId");
+			if (!employee)
+				continue;
+			cmdBuffer->setGraphicsPipeline(employee);
+			cmdBuffer->setViewport(viewport);
+			proxy->bindShaderResources(cmdBuffer);
+			cmdBuffer->setBlendConstants(encodePickId(getPickId(proxy->getRenderComponent())));
+			proxy->draw(cmdBuffer);
+		}
+		cmdBuffer->endPass();
+	}
 
-	cmdBuffer->beginPass(mRenderTarget.get(), QColor::fromRgbF(0.0f, 0.0f, 0.0f, 0.0f), { 1.0f, INVALID_INDEX }, nullptr, QRhiCommandBuffer::BeginPassFlag::ExternalContent);
-	QRhiViewport viewport(0, 0, mRenderTarget->pixelSize().width(), mRenderTarget->pixelSize().height());
-	auto pipelines = mRenderer->getRenderProxies();
-	auto components = mRenderer->getRenderComponents();
-	for (int i = 0; i < pipelines.size(); i++) {
-		QRhiGraphicsPipeline* employee = pipelines[i]->gerSubPipeline("DebugId");
+	// Only the current object is drawn, the scene depth is loaded but never written
+	const char* maskPipelineName = bMaskDepthTested ? "SelectMask" : "SelectMaskUnoccluded";
+	cmdBuffer->beginPass(mRenderTarget.get(), QColor::fromRgbF(0.0f, 0.0f, 0.0f, 0.0f), { 1.0f, 0 });
+	for (auto& proxy : pipelines) {
+		if (!currentObject || proxy->getRenderComponent() != currentObject || proxy->isCulled())
+			continue;
+		if (!proxy->hasSubPipeline(maskPipelineName)) {
+			proxy->createSubPipeline(maskPipelineName, mRenderTarget.get(), [this](QRhiGraphicsPipeline* pipeline) {
+				pipeline->setDepthTest(bMaskDepthTested);
+				pipeline->setDepthWrite(false);
+				pipeline->setDepthOp(QRhiGraphicsPipeline::LessOrEqual);
+				replaceFragmentStage(pipeline, mSelectMaskFS);
+			});
+		}
+		QRhiGraphicsPipeline* employee = proxy->gerSubPipeline(maskPipelineName);
+		if (!employee)
+			continue;
 		cmdBuffer->setGraphicsPipeline(employee);
 		cmdBuffer->setViewport(viewport);
-		cmdBuffer->setShaderResources();
-		cmdBuffer->setStencilRef(components.indexOf(pipelines[i]->getRenderComponent()));
-		pipelines[i]->draw(cmdBuffer);
+		proxy->bindShaderResources(cmdBuffer);
+		proxy->draw(cmdBuffer);
 	}
+	cmdBuffer->endPass();
 
-	qsizetype currentIndex = components.indexOf(mRenderer->getCurrentObject());
-	if (currentIndex == -1)
-		currentIndex = INVALID_INDEX;
+	if (!readback)
+		return;
+	readback->bInFlight = true;
+	readback->serial = ++mPickSerial;
+	readback->result.data.clear();
+	readback->result.pixelSize = QSize();
+	readback->result.completed = [this, readback]() {
+		resolvePick(*readback);
+	};
 
-	cmdBuffer->setGraphicsPipeline(mSelectMaskPipeline.get());
-	cmdBuffer->setViewport(viewport);
-	cmdBuffer->setShaderResources();
-	cmdBuffer->setStencilRef(currentIndex);
-	cmdBuffer->draw(4);
-	cmdBuffer->endPass();
+	// Only the texel under the cursor leaves the GPU, completion is reported by QRhi once the frame's fence signals
+	const QSize idSize = mIdTexture->pixelSize();
+	QPoint point(qBound(0, mReadPoint.x(), idSize.width() - 1), qBound(0, mReadPoint.y(), idSize.height() - 1));
+	if (cmdBuffer->rhi()->isYUpInFramebuffer())
+		point.setY(idSize.height() - 1 - point.y());
+	QRhiTextureCopyDescription copyDesc;
+	copyDesc.setPixelSize(QSize(1, 1));
+	copyDesc.setSourceTopLeft(point);
+	QRhiResourceUpdateBatch* batch = cmdBuffer->rhi()->nextResourceUpdateBatch();
+	batch->copyTexture(readback->texture.get(), mIdTexture.get(), copyDesc);
+	batch->readBackTexture(QRhiReadbackDescription(readback->texture.get()), &readback->result);
+	cmdBuffer->resourceUpdate(batch);
+}
 
-	if (mSigPick.ensure()) {
-		makeCopyTextureToBufferCommand(cmdBuffer);
-		mReadbackResult.completed = [this, components]() {
-			const uchar* p = reinterpret_cast<const uchar*>(mReadbackResult.data.constData());
-			IRenderComponent* renderComponent = components.value(*p);
-			Q_EMIT componentSelected(renderComponent);
-		};
-		QRhiResourceUpdateBatch* batch = cmdBuffer->rhi()->nextResourceUpdateBatch();
-		batch->readBackBuffer(mReadbackBuffer.get(), 0, 1, &mReadbackResult);
-		cmdBuffer->resourceUpdate(batch);
-		cmdBuffer->rhi()->finish();
+quint32 QMousePickingPassBuilder::getPickId(IRenderComponent* component)
+{
+	auto it = mPickIds.constFind(component);
+	if (it != mPickIds.constEnd()) {
+		if (mPickComponents.value(*it))
+			return *it;
+		mPickComponents.remove(*it);	// the address belongs to a new component now
 	}
+	const quint32 id = mNextPickId++;
+	mPickIds[component] = id;
+	mPickComponents[id] = component;
+	return id;
 }
 
-void QMousePickingPassBuilder::makeCopyTextureToBufferCommand(QRhiCommandBuffer* cmdBuffer)
+void QMousePickingPassBuilder::resolvePick(PickReadback& readback)
 {
-	if (cmdBuffer->rhi()->backend() == QRhi::Vulkan) {
-		cmdBuffer->beginExternal();
-		QRhiVulkan* rhi = *(QRhiVulkan**)(cmdBuffer->rhi());
-		QVkTexture* texD = QRHI_RES(QVkTexture, mDSTexture.get());
-		QVkBuffer* bufferD = QRHI_RES(QVkBuffer, mReadbackBuffer.get());
-		QVkCommandBuffer* cbD = QRHI_RES(QVkCommandBuffer, cmdBuffer);
-		QVulkanDeviceFunctions* df = rhi->df;
-
-		VkImageMemoryBarrier barrier;
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.srcAccessMask = texD->usageState.access;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.image = texD->image;
-		barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = -1;
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-		barrier.pNext = nullptr;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		df->vkCmdPipelineBarrier(cbD->cb, texD->usageState.stage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-		VkBufferImageCopy copyDesc = {};
-		copyDesc.bufferOffset = 0;
-		copyDesc.imageSubresource.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
-		copyDesc.imageSubresource.mipLevel = 0;
-		copyDesc.imageSubresource.baseArrayLayer = 0;
-		copyDesc.imageSubresource.layerCount = 1;
-		copyDesc.imageOffset.x = qBound(0, mReadPoint.x(), mDSTexture->pixelSize().width() - 1);
-		copyDesc.imageOffset.y = qBound(0, mReadPoint.y(), mDSTexture->pixelSize().height() - 1);
-		copyDesc.imageExtent.width = 1;
-		copyDesc.imageExtent.height = 1;
-		copyDesc.imageExtent.depth = 1;
-		df->vkCmdCopyImageToBuffer(cbD->cb, texD->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, bufferD->buffers[0], 1, &copyDesc);
-
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = texD->usageState.access;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = texD->usageState.layout;
-		df->vkCmdPipelineBarrier(cbD->cb, VK_PIPELINE_STAGE_TRANSFER_BIT, texD->usageState.stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-		cmdBuffer->endExternal();
+	readback.bInFlight = false;
+	if (readback.serial != mPickSerial)	// a newer click superseded this one
+		return;
+	// The blend packed RGBA8 texel holds the id as a little endian 32 bit word
+	quint32 id = 0;
+	if (readback.result.data.size() >= int(sizeof(quint32)))
+		id = qFromLittleEndian<quint32>(readback.result.data.constData());
+	IRenderComponent* renderComponent = id ? mPickComponents.value(id).data() : nullptr;
+	for (auto it = mPickComponents.begin(); it != mPickComponents.end();) {
+		if (it->isNull()) {
+			mPickIds.remove(mPickIds.key(it.key()));
+			it = mPickComponents.erase(it);
+		}
+		else {
+			++it;
+		}
 	}
+	Q_EMIT componentSelected(renderComponent);
 }
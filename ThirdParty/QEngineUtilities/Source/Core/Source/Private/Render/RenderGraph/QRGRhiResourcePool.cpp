@@ -1,4 +1,5 @@
 #include "QRGRhiResourcePool.h"
+#include "tracy/Tracy.hpp"
 
 QRhiGraphicsPipelineState QRhiGraphicsPipelineState::createFrom(QRhiGraphicsPipeline* pipeline)
 {
@@ -56,6 +57,45 @@ void QRhiGraphicsPipelineState::assignTo(QRhiGraphicsPipeline* pipeline) const
 	pipeline->setRenderPassDescriptor(renderPassDesc);
 }
 
+static bool isTargetBlendEqual(const QRhiGraphicsPipeline::TargetBlend& a, const QRhiGraphicsPipeline::TargetBlend& b)
+{
+	return a.enable == b.enable && a.colorWrite == b.colorWrite
+		&& a.srcColor == b.srcColor && a.dstColor == b.dstColor && a.opColor == b.opColor
+		&& a.srcAlpha == b.srcAlpha && a.dstAlpha == b.dstAlpha && a.opAlpha == b.opAlpha;
+}
+
+static bool isStencilOpEqual(const QRhiGraphicsPipeline::StencilOpState& a, const QRhiGraphicsPipeline::StencilOpState& b)
+{
+	return a.failOp == b.failOp && a.depthFailOp == b.depthFailOp && a.passOp == b.passOp && a.compareOp == b.compareOp;
+}
+
+bool QRhiGraphicsPipelineState::operator==(const QRhiGraphicsPipelineState& other) const
+{
+	return flags == other.flags
+		&& topology == other.topology
+		&& cullMode == other.cullMode
+		&& frontFace == other.frontFace
+		&& std::equal(targetBlends.cbegin(), targetBlends.cend(), other.targetBlends.cbegin(), other.targetBlends.cend(), isTargetBlendEqual)
+		&& depthTest == other.depthTest
+		&& depthWrite == other.depthWrite
+		&& depthOp == other.depthOp
+		&& stencilTest == other.stencilTest
+		&& isStencilOpEqual(stencilFront, other.stencilFront)
+		&& isStencilOpEqual(stencilBack, other.stencilBack)
+		&& stencilReadMask == other.stencilReadMask
+		&& stencilWriteMask == other.stencilWriteMask
+		&& sampleCount == other.sampleCount
+		&& lineWidth == other.lineWidth
+		&& depthBias == other.depthBias
+		&& slopeScaledDepthBias == other.slopeScaledDepthBias
+		&& patchControlPointCount == other.patchControlPointCount
+		&& polygonMode == other.polygonMode
+		&& std::equal(shaderStages.cbegin(), shaderStages.cend(), other.shaderStages.cbegin(), other.shaderStages.cend())
+		&& vertexInputLayout == other.vertexInputLayout
+		&& shaderResourceBindings == other.shaderResourceBindings
+		&& renderPassDesc == other.renderPassDesc;
+}
+
 QRhiComputePipelineState QRhiComputePipelineState::createFrom(QRhiComputePipeline* pipeline)
 {
 	QRhiComputePipelineState state;
@@ -219,18 +259,79 @@ size_t QRGRhiResourcePool::hash(const QRhiComputePipelineState& state)
 	return seed;
 }
 
+quint64 QRGRhiResourcePool::byteSize(QRhiTexture::Format format, const QSize& pixelSize, int sampleCount, QRhiTexture::Flags flags)
+{
+	quint64 bitsPerPixel = 32;
+	switch (format) {
+	case QRhiTexture::R8:
+	case QRhiTexture::RED_OR_ALPHA8:
+		bitsPerPixel = 8;
+		break;
+	case QRhiTexture::RG8:
+	case QRhiTexture::R16:
+	case QRhiTexture::R16F:
+	case QRhiTexture::D16:
+		bitsPerPixel = 16;
+		break;
+	case QRhiTexture::RG16:
+	case QRhiTexture::R32F:
+	case QRhiTexture::RGB10A2:
+	case QRhiTexture::D24:
+	case QRhiTexture::D24S8:
+	case QRhiTexture::D32F:
+		bitsPerPixel = 32;
+		break;
+	case QRhiTexture::RGBA16F:
+		bitsPerPixel = 64;
+		break;
+	case QRhiTexture::RGBA32F:
+		bitsPerPixel = 128;
+		break;
+	case QRhiTexture::BC1:
+	case QRhiTexture::BC4:
+	case QRhiTexture::ETC2_RGB8:
+	case QRhiTexture::ETC2_RGB8A1:
+		bitsPerPixel = 4;
+		break;
+	case QRhiTexture::BC2:
+	case QRhiTexture::BC3:
+	case QRhiTexture::BC5:
+	case QRhiTexture::BC6H:
+	case QRhiTexture::BC7:
+	case QRhiTexture::ETC2_RGBA8:
+		bitsPerPixel = 8;
+		break;
+	default:
+		break;
+	}
+	quint64 bytes = quint64(pixelSize.width()) * pixelSize.height() * bitsPerPixel / 8 * qMax(sampleCount, 1);
+	if (flags.testFlag(QRhiTexture::MipMapped))
+		bytes = bytes * 4 / 3;
+	if (flags.testFlag(QRhiTexture::CubeMap))
+		bytes *= 6;
+	return bytes;
+}
+
+quint64 QRGRhiResourcePool::byteSize(QRhiRenderBuffer::Type type, const QSize& pixelSize, int sampleCount, QRhiTexture::Format backingFormatHint)
+{
+	if (type == QRhiRenderBuffer::Color && backingFormatHint != QRhiTexture::UnknownFormat)
+		return byteSize(backingFormatHint, pixelSize, sampleCount, {});
+	return byteSize(QRhiTexture::D24S8, pixelSize, sampleCount, {});
+}
+
 QRhiBufferRef QRGRhiResourcePool::findOrNew(QRhiBuffer::Type type, QRhiBuffer::UsageFlags usage, quint32 size)
 {
 	size_t hashCode = hash(type, usage, size);
 	for (auto it = mBufferPool.find(hashCode); it != mBufferPool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
 	QRhiBufferRef newRes(mRhi->newBuffer(type, usage, size));
 	mBufferPool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, size);
 	return newRes;
 }
 
@@ -239,13 +340,14 @@ QRhiTextureRef QRGRhiResourcePool::findOrNew(QRhiTexture::Format format, const Q
 	size_t hashCode = hash(format, pixelSize, sampleCount, flags);
 	for (auto it = mTexturePool.find(hashCode); it != mTexturePool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
 	QRhiTextureRef newRes(mRhi->newTexture(format, pixelSize, sampleCount, flags));
 	mTexturePool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, byteSize(format, pixelSize, sampleCount, flags));
 	return newRes;
 }
 
@@ -254,13 +356,14 @@ QRhiSamplerRef QRGRhiResourcePool::findOrNew(QRhiSampler::Filter magFilter, QRhi
 	size_t hashCode = hash(magFilter, minFilter, mipmapMode, addressU, addressV, addressW);
 	for (auto it = mSamplerPool.find(hashCode); it != mSamplerPool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
 	QRhiSamplerRef newRes(mRhi->newSampler(magFilter, minFilter, mipmapMode, addressU, addressV, addressW));
 	mSamplerPool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, 0);
 	return newRes;
 }
 
@@ -269,6 +372,7 @@ QRhiShaderResourceBindingsRef QRGRhiResourcePool::findOrNew(QVector<QRhiShaderRe
 	size_t hashCode = hash(bindings);
 	for (auto it = mBindingsPool.find(hashCode); it != mBindingsPool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
@@ -276,7 +380,7 @@ QRhiShaderResourceBindingsRef QRGRhiResourcePool::findOrNew(QVector<QRhiShaderRe
 	newRes->setBindings(bindings.begin(),bindings.end());
 	mBindingsPool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, 0);
 	return newRes;
 }
 
@@ -285,13 +389,14 @@ QRhiRenderBufferRef QRGRhiResourcePool::findOrNew(QRhiRenderBuffer::Type type, c
 	size_t hashCode = hash(type,pixelSize, sampleCount, flags, backingFormatHint);
 	for (auto it = mRenderBufferPool.find(hashCode); it != mRenderBufferPool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
 	QRhiRenderBufferRef newRes(mRhi->newRenderBuffer(type, pixelSize, sampleCount, flags, backingFormatHint));
 	mRenderBufferPool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, byteSize(type, pixelSize, sampleCount, backingFormatHint));
 	return newRes;
 }
 
@@ -300,6 +405,7 @@ QRhiTextureRenderTargetRef QRGRhiResourcePool::findOrNew(const QRhiTextureRender
 	size_t hashCode = hash(desc, flags);
 	for (auto it = mRenderTargetPool.find(hashCode); it != mRenderTargetPool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
@@ -309,7 +415,7 @@ QRhiTextureRenderTargetRef QRGRhiResourcePool::findOrNew(const QRhiTextureRender
 	mRenderPassDescPool[newRes.get()].reset(newRes->newCompatibleRenderPassDescriptor());
 	newRes->setRenderPassDescriptor(mRenderPassDescPool[newRes.get()].get());
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, 0);
 	return newRes;
 }
 
@@ -318,6 +424,7 @@ QRhiGraphicsPipelineRef QRGRhiResourcePool::findOrNew(const QRhiGraphicsPipeline
 	size_t hashCode = hash(state);
 	for (auto it = mGraphicsPipelinePool.find(hashCode); it != mGraphicsPipelinePool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
@@ -325,7 +432,7 @@ QRhiGraphicsPipelineRef QRGRhiResourcePool::findOrNew(const QRhiGraphicsPipeline
 	state.assignTo(newRes.get());
 	mGraphicsPipelinePool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, 0);
 	return newRes;
 }
 
@@ -334,6 +441,7 @@ QRhiComputePipelineRef QRGRhiResourcePool::findOrNew(const QRhiComputePipelineSt
 	size_t hashCode = hash(state);
 	for (auto it = mComputePipelinePool.find(hashCode); it != mComputePipelinePool.end() && it.key() == hashCode; it++) {
 		if (it.value().use_count() == 1) {
+			markHit(it.value().get());
 			return it.value();
 		}
 	}
@@ -341,17 +449,18 @@ QRhiComputePipelineRef QRGRhiResourcePool::findOrNew(const QRhiComputePipelineSt
 	state.assignTo(newRes.get());
 	mComputePipelinePool.insert(hashCode, newRes);
 	newRes->create();
-	mRhiHashMap[newRes.get()] = hashCode;
+	registerResource(newRes.get(), hashCode, 0);
 	return newRes;
 }
 
 bool QRGRhiResourcePool::checkValidity(QRhiBufferRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(res->type(),res->usage(),res->size());
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
+		updateByteSize(res.get(), res->size());
 		mBufferToRecreate.push_back(res.get());
 		return false;
 	}
@@ -361,10 +470,11 @@ bool QRGRhiResourcePool::checkValidity(QRhiBufferRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiTextureRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(res->format(), res->pixelSize(), res->sampleCount(), res->flags());
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
+		updateByteSize(res.get(), byteSize(res->format(), res->pixelSize(), res->sampleCount(), res->flags()));
 		mTextureToRecreate.push_back(res.get());
 		return false;
 	}
@@ -374,7 +484,7 @@ bool QRGRhiResourcePool::checkValidity(QRhiTextureRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiSamplerRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(res->magFilter(), res->minFilter(), res->mipmapMode(), res->addressU(), res->addressV(), res->addressW());
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
@@ -387,7 +497,7 @@ bool QRGRhiResourcePool::checkValidity(QRhiSamplerRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiShaderResourceBindingsRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	QVector<QRhiShaderResourceBinding> bindings(res->cbeginBindings(), res->cendBindings());
 	size_t currHash = hash(bindings);
 	if (lastHash != currHash) {
@@ -443,10 +553,11 @@ bool QRGRhiResourcePool::checkValidity(QRhiShaderResourceBindingsRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiRenderBufferRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(res->type(),res->pixelSize(),res->sampleCount(),res->flags(),res->backingFormat());
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
+		updateByteSize(res.get(), byteSize(res->type(), res->pixelSize(), res->sampleCount(), res->backingFormat()));
 		mRenderBufferToRecreate.push_back(res.get());
 		return false;
 	}
@@ -456,7 +567,7 @@ bool QRGRhiResourcePool::checkValidity(QRhiRenderBufferRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiTextureRenderTargetRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(res->description(),res->flags());
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
@@ -469,7 +580,7 @@ bool QRGRhiResourcePool::checkValidity(QRhiTextureRenderTargetRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiGraphicsPipelineRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(QRhiGraphicsPipelineState::createFrom(res.get()));
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
@@ -482,7 +593,7 @@ bool QRGRhiResourcePool::checkValidity(QRhiGraphicsPipelineRef res)
 bool QRGRhiResourcePool::checkValidity(QRhiComputePipelineRef res)
 {
 	Q_ASSERT(res);
-	size_t lastHash = mRhiHashMap.value(res.get());
+	size_t lastHash = mResourceInfoMap.value(res.get()).hashCode;
 	size_t currHash = hash(QRhiComputePipelineState::createFrom(res.get()));
 	if (lastHash != currHash) {
 		fixupResHash(res.get(), currHash);
@@ -569,7 +680,7 @@ void QRGRhiResourcePool::recreateComputePipelines()
 bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 {
 	Q_ASSERT(res);
-	size_t oldHash = mRhiHashMap.value(res);
+	size_t oldHash = mResourceInfoMap.value(res).hashCode;
 	if (res->resourceType() ==QRhiResource::Buffer) {
 		for (auto it = mBufferPool.find(oldHash); it != mBufferPool.end() && it.key() == oldHash; it++) {
 			if (it->get() == res) {
@@ -577,7 +688,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiBufferRef buffer = it.value();
 					mBufferPool.remove(it.key(), it.value());
 					mBufferPool.insert(newHash, buffer);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -590,7 +701,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiTextureRef value = it.value();
 					mTexturePool.remove(it.key(), it.value());
 					mTexturePool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -603,7 +714,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiSamplerRef value = it.value();
 					mSamplerPool.remove(it.key(), it.value());
 					mSamplerPool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -616,7 +727,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiShaderResourceBindingsRef value = it.value();
 					mBindingsPool.remove(it.key(), it.value());
 					mBindingsPool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -629,7 +740,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiRenderBufferRef value = it.value();
 					mRenderBufferPool.remove(it.key(), it.value());
 					mRenderBufferPool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -642,7 +753,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiTextureRenderTargetRef value = it.value();
 					mRenderTargetPool.remove(it.key(), it.value());
 					mRenderTargetPool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -655,7 +766,7 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 					QRhiGraphicsPipelineRef value = it.value();
 					mGraphicsPipelinePool.remove(it.key(), it.value());
 					mGraphicsPipelinePool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -664,12 +775,11 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 	else if (res->resourceType() == QRhiResource::ComputePipeline) {
 		for (auto it = mComputePipelinePool.find(oldHash); it != mComputePipelinePool.end() && it.key() == oldHash; it++) {
 			if (it->get() == res) {
-				size_t newHash = 0;
 				if (newHash != oldHash) {
 					QRhiComputePipelineRef value = it.value();
 					mComputePipelinePool.remove(it.key(), it.value());
 					mComputePipelinePool.insert(newHash, value);
-					mRhiHashMap[res] = newHash;
+					mResourceInfoMap[res].hashCode = newHash;
 					return true;
 				}
 			}
@@ -677,3 +787,275 @@ bool QRGRhiResourcePool::fixupResHash(QRhiResource* res, size_t newHash)
 	}
 	return false;
 }
+
+void QRGRhiResourcePool::registerResource(QRhiResource* res, size_t hashCode, quint64 byteSize)
+{
+	ResourceInfo& info = mResourceInfoMap[res];
+	info.type = res->resourceType();
+	info.hashCode = hashCode;
+	info.byteSize = byteSize;
+	info.lastUsedFrame = mFrameIndex;
+	Statistics& stats = mStatistics[info.type];
+	stats.misses++;
+	stats.liveCount++;
+	stats.bytes += byteSize;
+}
+
+void QRGRhiResourcePool::updateByteSize(QRhiResource* res, quint64 byteSize)
+{
+	auto it = mResourceInfoMap.find(res);
+	if (it == mResourceInfoMap.end())
+		return;
+	Statistics& stats = mStatistics[it->type];
+	stats.bytes = stats.bytes - it->byteSize + byteSize;
+	it->byteSize = byteSize;
+}
+
+void QRGRhiResourcePool::markHit(QRhiResource* res)
+{
+	ResourceInfo& info = mResourceInfoMap[res];
+	info.lastUsedFrame = mFrameIndex;
+	mStatistics[info.type].hits++;
+}
+
+template<typename Ref>
+void QRGRhiResourcePool::stampUsage(const QMultiHash<size_t, Ref>& pool, int& idleCount, quint64& oldestIdleFrame)
+{
+	for (const Ref& res : pool) {
+		ResourceInfo& info = mResourceInfoMap[res.get()];
+		if (res.use_count() > 1) {
+			info.lastUsedFrame = mFrameIndex;
+		}
+		else {
+			idleCount++;
+			oldestIdleFrame = qMin(oldestIdleFrame, info.lastUsedFrame);
+		}
+	}
+}
+
+template<typename Ref>
+void QRGRhiResourcePool::collectIdle(const QMultiHash<size_t, Ref>& pool, QSet<QRhiResource*>& idle) const
+{
+	for (const Ref& res : pool) {
+		if (res.use_count() == 1)
+			idle.insert(res.get());
+	}
+}
+
+template<typename Ref>
+void QRGRhiResourcePool::evictFrom(QMultiHash<size_t, Ref>& pool, const QSet<QRhiResource*>& evictSet)
+{
+	for (auto it = pool.begin(); it != pool.end();) {
+		QRhiResource* res = it.value().get();
+		if (evictSet.contains(res)) {
+			Statistics& stats = mStatistics[res->resourceType()];
+			stats.evictions++;
+			stats.liveCount--;
+			stats.bytes -= mResourceInfoMap.value(res).byteSize;
+			mResourceInfoMap.remove(res);
+			it = pool.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+static QList<QRhiResource*> referencedResources(QRhiShaderResourceBindings* bindings)
+{
+	QList<QRhiResource*> refs;
+	for (auto it = bindings->cbeginBindings(); it != bindings->cendBindings(); ++it) {
+		const QRhiShaderResourceBinding::Data* data = (const QRhiShaderResourceBinding::Data*)it;
+		switch (data->type) {
+		case QRhiShaderResourceBinding::SampledTexture:
+		case QRhiShaderResourceBinding::Texture:
+		case QRhiShaderResourceBinding::Sampler:
+			for (int i = 0; i < data->u.stex.count; i++) {
+				refs << data->u.stex.texSamplers[i].tex << data->u.stex.texSamplers[i].sampler;
+			}
+			break;
+		case QRhiShaderResourceBinding::UniformBuffer:
+		case QRhiShaderResourceBinding::BufferLoad:
+		case QRhiShaderResourceBinding::BufferStore:
+		case QRhiShaderResourceBinding::BufferLoadStore:
+			refs << data->u.sbuf.buf;
+			break;
+		case QRhiShaderResourceBinding::ImageLoad:
+		case QRhiShaderResourceBinding::ImageStore:
+		case QRhiShaderResourceBinding::ImageLoadStore:
+			refs << data->u.simage.tex;
+			break;
+		default:
+			break;
+		}
+	}
+	return refs;
+}
+
+static QList<QRhiResource*> referencedResources(QRhiTextureRenderTarget* renderTarget)
+{
+	QList<QRhiResource*> refs;
+	const QRhiTextureRenderTargetDescription& desc = renderTarget->description();
+	for (auto it = desc.cbeginColorAttachments(); it != desc.cendColorAttachments(); ++it) {
+		refs << it->texture() << it->renderBuffer() << it->resolveTexture();
+	}
+	refs << desc.depthStencilBuffer() << desc.depthTexture();
+	return refs;
+}
+
+void QRGRhiResourcePool::collectGarbage()
+{
+	ZoneScopedN("QRGRhiResourcePool::collectGarbage");
+	mFrameIndex++;
+
+	// Anything only held by the pool is idle, everything else was used this frame and is stamped in place
+	int idleCount = 0;
+	quint64 oldestIdleFrame = mFrameIndex;
+	stampUsage(mBufferPool, idleCount, oldestIdleFrame);
+	stampUsage(mTexturePool, idleCount, oldestIdleFrame);
+	stampUsage(mSamplerPool, idleCount, oldestIdleFrame);
+	stampUsage(mBindingsPool, idleCount, oldestIdleFrame);
+	stampUsage(mRenderBufferPool, idleCount, oldestIdleFrame);
+	stampUsage(mRenderTargetPool, idleCount, oldestIdleFrame);
+	stampUsage(mGraphicsPipelinePool, idleCount, oldestIdleFrame);
+	stampUsage(mComputePipelinePool, idleCount, oldestIdleFrame);
+	if (idleCount == 0)
+		return;
+
+	// Live bytes are kept up to date as resources come and go, so the common frame with nothing to evict stops here
+	bool bNeedEvict = mMaxIdleFrames >= 0 && mFrameIndex - oldestIdleFrame > quint64(mMaxIdleFrames);
+	for (auto budget = mBudgets.cbegin(); !bNeedEvict && budget != mBudgets.cend(); ++budget)
+		bNeedEvict = mStatistics.value(budget.key()).bytes > budget.value();
+	if (!bNeedEvict)
+		return;
+
+	QSet<QRhiResource*> idle;
+	collectIdle(mBufferPool, idle);
+	collectIdle(mTexturePool, idle);
+	collectIdle(mSamplerPool, idle);
+	collectIdle(mBindingsPool, idle);
+	collectIdle(mRenderBufferPool, idle);
+	collectIdle(mRenderTargetPool, idle);
+	collectIdle(mGraphicsPipelinePool, idle);
+	collectIdle(mComputePipelinePool, idle);
+
+	// Idle resources still referenced by a kept pipeline, binding or render target must survive
+	QHash<QRhiRenderPassDescriptor*, QRhiResource*> renderTargetOfDesc;
+	for (auto it = mRenderPassDescPool.cbegin(); it != mRenderPassDescPool.cend(); ++it) {
+		renderTargetOfDesc[it.value().get()] = it.key();
+	}
+	QSet<QRhiResource*> retained;
+	auto isKept = [&](QRhiResource* res) {
+		return !idle.contains(res) || retained.contains(res);
+	};
+	for (const auto& pipeline : mGraphicsPipelinePool) {
+		if (isKept(pipeline.get())) {
+			retained << pipeline->shaderResourceBindings();
+			retained << renderTargetOfDesc.value(pipeline->renderPassDescriptor());
+		}
+	}
+	for (const auto& pipeline : mComputePipelinePool) {
+		if (isKept(pipeline.get()))
+			retained << pipeline->shaderResourceBindings();
+	}
+	for (const auto& bindings : mBindingsPool) {
+		if (isKept(bindings.get())) {
+			for (QRhiResource* ref : referencedResources(bindings.get()))
+				retained << ref;
+		}
+	}
+	for (const auto& renderTarget : mRenderTargetPool) {
+		if (isKept(renderTarget.get())) {
+			for (QRhiResource* ref : referencedResources(renderTarget.get()))
+				retained << ref;
+		}
+	}
+
+	// Age out long idle resources, then trim the least recently used ones until each class fits its budget
+	QSet<QRhiResource*> evictSet;
+	QMap<QRhiResource::Type, QList<QRhiResource*>> candidates;
+	for (QRhiResource* res : idle) {
+		if (retained.contains(res))
+			continue;
+		const ResourceInfo& info = mResourceInfoMap[res];
+		if (mMaxIdleFrames >= 0 && mFrameIndex - info.lastUsedFrame > quint64(mMaxIdleFrames))
+			evictSet << res;
+		else
+			candidates[info.type] << res;
+	}
+	for (auto budget = mBudgets.cbegin(); budget != mBudgets.cend(); ++budget) {
+		quint64 bytes = mStatistics.value(budget.key()).bytes;
+		for (QRhiResource* res : evictSet) {
+			const ResourceInfo& info = mResourceInfoMap[res];
+			if (info.type == budget.key())
+				bytes -= info.byteSize;
+		}
+		if (bytes <= budget.value())
+			continue;
+		QList<QRhiResource*>& lru = candidates[budget.key()];
+		std::sort(lru.begin(), lru.end(), [this](QRhiResource* a, QRhiResource* b) {
+			return mResourceInfoMap[a].lastUsedFrame < mResourceInfoMap[b].lastUsedFrame;
+		});
+		for (QRhiResource* res : lru) {
+			if (bytes <= budget.value())
+				break;
+			evictSet << res;
+			bytes -= mResourceInfoMap[res].byteSize;
+		}
+	}
+	if (evictSet.isEmpty())
+		return;
+
+	// Idle dependents of evicted resources would dangle, so they go too
+	auto referencesEvicted = [&](const QList<QRhiResource*>& refs) {
+		for (QRhiResource* ref : refs) {
+			if (ref && evictSet.contains(ref))
+				return true;
+		}
+		return false;
+	};
+	for (const auto& renderTarget : mRenderTargetPool) {
+		if (idle.contains(renderTarget.get()) && referencesEvicted(referencedResources(renderTarget.get())))
+			evictSet << renderTarget.get();
+	}
+	for (const auto& bindings : mBindingsPool) {
+		if (idle.contains(bindings.get()) && referencesEvicted(referencedResources(bindings.get())))
+			evictSet << bindings.get();
+	}
+	for (const auto& pipeline : mGraphicsPipelinePool) {
+		if (idle.contains(pipeline.get()) && referencesEvicted({ pipeline->shaderResourceBindings(), renderTargetOfDesc.value(pipeline->renderPassDescriptor()) }))
+			evictSet << pipeline.get();
+	}
+	for (const auto& pipeline : mComputePipelinePool) {
+		if (idle.contains(pipeline.get()) && referencesEvicted({ pipeline->shaderResourceBindings() }))
+			evictSet << pipeline.get();
+	}
+
+	evictFrom(mGraphicsPipelinePool, evictSet);
+	evictFrom(mComputePipelinePool, evictSet);
+	evictFrom(mBindingsPool, evictSet);
+	evictFrom(mRenderTargetPool, evictSet);
+	for (auto it = mRenderPassDescPool.begin(); it != mRenderPassDescPool.end();) {
+		if (evictSet.contains(it.key()))
+			it = mRenderPassDescPool.erase(it);
+		else
+			++it;
+	}
+	evictFrom(mSamplerPool, evictSet);
+	evictFrom(mRenderBufferPool, evictSet);
+	evictFrom(mTexturePool, evictSet);
+	evictFrom(mBufferPool, evictSet);
+}
+
+QRGRhiResourcePool::Statistics QRGRhiResourcePool::getStatistics(QRhiResource::Type type) const
+{
+	return mStatistics.value(type);
+}
+
+void QRGRhiResourcePool::setBudget(QRhiResource::Type type, quint64 bytes)
+{
+	if (bytes == 0)
+		mBudgets.remove(type);
+	else
+		mBudgets[type] = bytes;
+}
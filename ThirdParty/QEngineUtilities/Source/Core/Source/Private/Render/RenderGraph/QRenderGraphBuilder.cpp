@@ -1,12 +1,15 @@
 #include "QRenderGraphBuilder.h"
 #include "IRenderPassBuilder.h"
 #include "IRenderer.h"
+#include "tracy/Tracy.hpp"
 
 QRenderGraphBuilder::QRenderGraphBuilder(IRenderer* renderer)
 {
 	mRhi = renderer->rhi();
 	mRenderer = renderer;
 	mResourcePool.reset(new QRGRhiResourcePool(mRhi));
+	mUniformRing.reset(new QRhiUniformRing(mRhi));
+	mSharedPipelines.reset(new QRhiSharedPipelines(mRhi));
 
 	mFullScreenVertexShader = QRhiHelper::newShaderFromCode( QShader::VertexStage, R"(#version 450
 		layout (location = 0) out vec2 vUV;
@@ -41,6 +44,16 @@ void QRenderGraphBuilder::setupBuffer(QRhiBufferRef& buffer, const QByteArray& n
 
 void QRenderGraphBuilder::setupTexture(QRhiTextureRef& texture, const QByteArray& name, QRhiTexture::Format format, const QSize& pixelSize, int sampleCount, QRhiTexture::Flags flags)
 {
+	const QString key = transientKey(name);
+	const size_t descHash = QRGRhiResourcePool::hash(format, pixelSize, sampleCount, flags);
+	const bool bTransient = flags.testFlag(QRhiTexture::RenderTarget)
+		&& !(flags & (QRhiTexture::CubeMap | QRhiTexture::MipMapped | QRhiTexture::ThreeDimensional | QRhiTexture::TextureArray));
+	if (std::shared_ptr<QRhiResource> aliased = bTransient ? findAliasedResource(key, descHash) : nullptr) {
+		texture = std::static_pointer_cast<QRhiTexture>(aliased);
+	}
+	else if (texture && mSharedResources.contains(texture.get())) {
+		texture.reset();
+	}
 	if (texture) {
 		texture->setFormat(format);
 		texture->setPixelSize(pixelSize);
@@ -52,6 +65,9 @@ void QRenderGraphBuilder::setupTexture(QRhiTextureRef& texture, const QByteArray
 		texture = mResourcePool->findOrNew(format, pixelSize, sampleCount, flags);
 	}
 	texture->setName(name);
+	if (bTransient) {
+		registerTransient(key, texture, descHash, QRGRhiResourcePool::byteSize(format, pixelSize, sampleCount, flags));
+	}
 }
 
 void QRenderGraphBuilder::setupSampler(QRhiSamplerRef& sampler, const QByteArray& name, QRhiSampler::Filter magFilter, QRhiSampler::Filter minFilter, QRhiSampler::Filter mipmapMode, QRhiSampler::AddressMode addressU, QRhiSampler::AddressMode addressV, QRhiSampler::AddressMode addressW)
@@ -73,6 +89,7 @@ void QRenderGraphBuilder::setupSampler(QRhiSamplerRef& sampler, const QByteArray
 
 void QRenderGraphBuilder::setupShaderResourceBindings(QRhiShaderResourceBindingsRef& bindings, const QByteArray& name, QVector<QRhiShaderResourceBinding> binds)
 {
+	trackBindings(binds);
 	if (bindings) {
 		bindings->setBindings(binds.begin(),binds.end());
 		mResourcePool->checkValidity(bindings);
@@ -85,6 +102,14 @@ void QRenderGraphBuilder::setupShaderResourceBindings(QRhiShaderResourceBindings
 
 void QRenderGraphBuilder::setupRenderBuffer(QRhiRenderBufferRef& renderBuffer, const QByteArray& name, QRhiRenderBuffer::Type type, const QSize& pixelSize, int sampleCount, QRhiRenderBuffer::Flags flags, QRhiTexture::Format backingFormatHint)
 {
+	const QString key = transientKey(name);
+	const size_t descHash = QRGRhiResourcePool::hash(type, pixelSize, sampleCount, flags, backingFormatHint);
+	if (std::shared_ptr<QRhiResource> aliased = findAliasedResource(key, descHash)) {
+		renderBuffer = std::static_pointer_cast<QRhiRenderBuffer>(aliased);
+	}
+	else if (renderBuffer && mSharedResources.contains(renderBuffer.get())) {
+		renderBuffer.reset();
+	}
 	if (renderBuffer && renderBuffer->backingFormat() == backingFormatHint) {
 		renderBuffer->setType(type);
 		renderBuffer->setPixelSize(pixelSize);
@@ -96,6 +121,7 @@ void QRenderGraphBuilder::setupRenderBuffer(QRhiRenderBufferRef& renderBuffer, c
 		renderBuffer = mResourcePool->findOrNew(type, pixelSize, sampleCount, flags, backingFormatHint);
 	}
 	renderBuffer->setName(name);
+	registerTransient(key, renderBuffer, descHash, QRGRhiResourcePool::byteSize(type, pixelSize, sampleCount, backingFormatHint));
 }
 
 void QRenderGraphBuilder::setupRenderTarget(QRhiTextureRenderTargetRef& renderTarget, const QByteArray& name, const QRhiTextureRenderTargetDescription& desc, QRhiTextureRenderTarget::Flags flags)
@@ -111,6 +137,19 @@ void QRenderGraphBuilder::setupRenderTarget(QRhiTextureRenderTargetRef& renderTa
 	renderTarget->setName(name);
 
 	mActivatedRenderTargets << renderTarget.get();
+
+	for (int i = 0; i < desc.colorAttachmentCount(); i++) {
+		const QRhiColorAttachment* colorAttach = desc.colorAttachmentAt(i);
+		QRhiResource* attachment = colorAttach->texture() ? static_cast<QRhiResource*>(colorAttach->texture()) : colorAttach->renderBuffer();
+		if (flags.testFlag(QRhiTextureRenderTarget::PreserveColorContents))
+			declareRead(attachment);
+		declareWrite(attachment);
+		declareWrite(colorAttach->resolveTexture());
+	}
+	QRhiResource* depthAttachment = desc.depthTexture() ? static_cast<QRhiResource*>(desc.depthTexture()) : desc.depthStencilBuffer();
+	if (flags.testFlag(QRhiTextureRenderTarget::PreserveDepthStencilContents))
+		declareRead(depthAttachment);
+	declareWrite(depthAttachment);
 }
 
 void QRenderGraphBuilder::setupGraphicsPipeline(QRhiGraphicsPipelineRef& pipeline, const QByteArray& name, const QRhiGraphicsPipelineState& state)
@@ -146,7 +185,38 @@ void QRenderGraphBuilder::setupComputePipeline(QRhiComputePipelineRef& pipeline,
 
 void QRenderGraphBuilder::addPass(std::function<void(QRhiCommandBuffer*)> executor)
 {
-	mExecutors << executor;
+	PassNode pass;
+	pass.executor = executor;
+	pass.bHasSideEffect = true;
+	mPasses << pass;
+}
+
+void QRenderGraphBuilder::declareRead(QRhiResource* resource)
+{
+	if (PassNode* pass = currentPass()) {
+		if (resource)
+			pass->reads.insert(resource);
+	}
+}
+
+void QRenderGraphBuilder::declareWrite(QRhiResource* resource)
+{
+	if (PassNode* pass = currentPass()) {
+		if (resource)
+			pass->writes.insert(resource);
+	}
+}
+
+void QRenderGraphBuilder::declareSideEffect()
+{
+	if (PassNode* pass = currentPass())
+		pass->bHasSideEffect = true;
+}
+
+void QRenderGraphBuilder::declareExternalRead(QRhiResource* resource)
+{
+	if (resource)
+		mExternalReads.insert(resource);
 }
 
 QRhi* QRenderGraphBuilder::getRhi() const
@@ -189,8 +259,59 @@ QRhiRenderTarget* QRenderGraphBuilder::getMainRenderTarget() const
 	return mMainRenderTarget;
 }
 
-void QRenderGraphBuilder::compile()
+const QRenderGraphBuilder::CompileStats& QRenderGraphBuilder::getCompileStats() const
+{
+	return mCompileStats;
+}
+
+QRGRhiResourcePool* QRenderGraphBuilder::getResourcePool() const
 {
+	return mResourcePool.get();
+}
+
+QRhiUniformRing* QRenderGraphBuilder::getUniformRing() const
+{
+	return mUniformRing.get();
+}
+
+QRhiSharedPipelines* QRenderGraphBuilder::getSharedPipelines() const
+{
+	return mSharedPipelines.get();
+}
+
+void QRenderGraphBuilder::beginPassSetup(IRenderPassBuilder* passBuilder)
+{
+	PassNode pass;
+	pass.builder = passBuilder;
+	mPassStack.push_back(pass);
+}
+
+void QRenderGraphBuilder::endPassSetup(std::function<void(QRhiCommandBuffer*)> executor)
+{
+	Q_ASSERT(!mPassStack.isEmpty());
+	PassNode pass = mPassStack.takeLast();
+	pass.executor = executor;
+	for (auto& transient : pass.transients)
+		transient.passIndex = mPasses.size();
+	mPasses << pass;
+}
+
+bool QRenderGraphBuilder::compile()
+{
+	{
+		ZoneScopedN("CullPasses");
+		cullPasses();
+	}
+	bool bPlanChanged = false;
+	{
+		ZoneScopedN("AliasTransientResources");
+		bPlanChanged = aliasTransientResources();
+	}
+	// Setup binds transients from the plan, so a new plan needs one more setup to take effect in this frame
+	if (bPlanChanged && !bAliasPlanSettled) {
+		bAliasPlanSettled = true;
+		return false;
+	}
 	mResourcePool->recreateBuffers();
 	mResourcePool->recreateTextures();
 	mResourcePool->recreateRenderBuffers();
@@ -199,19 +320,250 @@ void QRenderGraphBuilder::compile()
 	mResourcePool->recreateRenderTargets();
 	mResourcePool->recreateGraphicsPipelines();
 	mResourcePool->recreateComputePipelines();
+	mResourcePool->collectGarbage();
+	return true;
 }
 
 void QRenderGraphBuilder::execute(QRhiCommandBuffer* cmdBuffer)
 {
-	for (auto& executor : mExecutors) {
-		executor(cmdBuffer);
+	for (auto& pass : mPasses) {
+		if (!pass.bCulled)
+			pass.executor(cmdBuffer);
 	}
 }
 
-void QRenderGraphBuilder::clear()
+void QRenderGraphBuilder::resetGraph()
 {
-	mExecutors.clear();
+	mPasses.clear();
+	mPassStack.clear();
+	mTransientKeys.clear();
+	mExternalReads.clear();
 	mActivatedRenderTargets.clear();
 	mRenderTargetPipelines.clear();
 }
 
+void QRenderGraphBuilder::clear()
+{
+	resetGraph();
+	bAliasPlanSettled = false;
+	mUniformRing->nextFrame();
+}
+
+QRenderGraphBuilder::PassNode* QRenderGraphBuilder::currentPass()
+{
+	return mPassStack.isEmpty() ? nullptr : &mPassStack.last();
+}
+
+QString QRenderGraphBuilder::transientKey(const QByteArray& name) const
+{
+	if (mPassStack.isEmpty())
+		return QString();
+	return mPassStack.last().builder->getName() + "/" + name;
+}
+
+std::shared_ptr<QRhiResource> QRenderGraphBuilder::findAliasedResource(const QString& key, size_t descHash) const
+{
+	if (!bTransientAliasingEnabled || key.isEmpty() || mTransientKeys.contains(key))
+		return nullptr;
+	auto it = mAliasPlan.constFind(key);
+	if (it == mAliasPlan.constEnd() || it->descHash != descHash)
+		return nullptr;
+	return it->resource;
+}
+
+void QRenderGraphBuilder::registerTransient(const QString& key, std::shared_ptr<QRhiResource> resource, size_t descHash, quint64 byteSize)
+{
+	PassNode* pass = currentPass();
+	if (pass == nullptr || mTransientKeys.contains(key))
+		return;
+	mTransientKeys.insert(key);
+	TransientResource transient;
+	transient.key = key;
+	transient.resource = resource;
+	transient.descHash = descHash;
+	transient.byteSize = byteSize;
+	pass->transients << transient;
+}
+
+void QRenderGraphBuilder::trackBindings(const QVector<QRhiShaderResourceBinding>& binds)
+{
+	for (auto& binding : binds) {
+		const QRhiShaderResourceBinding::Data* data = (const QRhiShaderResourceBinding::Data*)&binding;
+		switch (data->type) {
+		case QRhiShaderResourceBinding::SampledTexture:
+		case QRhiShaderResourceBinding::Texture:
+			for (int i = 0; i < data->u.stex.count; i++)
+				declareRead(data->u.stex.texSamplers[i].tex);
+			break;
+		case QRhiShaderResourceBinding::ImageLoad:
+			declareRead(data->u.simage.tex);
+			break;
+		case QRhiShaderResourceBinding::ImageStore:
+			declareWrite(data->u.simage.tex);
+			break;
+		case QRhiShaderResourceBinding::ImageLoadStore:
+			declareRead(data->u.simage.tex);
+			declareWrite(data->u.simage.tex);
+			break;
+		case QRhiShaderResourceBinding::BufferLoad:
+			declareRead(data->u.sbuf.buf);
+			break;
+		case QRhiShaderResourceBinding::BufferStore:
+			declareWrite(data->u.sbuf.buf);
+			break;
+		case QRhiShaderResourceBinding::BufferLoadStore:
+			declareRead(data->u.sbuf.buf);
+			declareWrite(data->u.sbuf.buf);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void QRenderGraphBuilder::cullPasses()
+{
+	// Passes are recorded in execution order, so every producer of a read precedes its consumer
+	// and a single backward sweep is enough to propagate liveness from the roots.
+	QHash<QRhiResource*, int> lastWriter;
+	QVector<QVector<int>> producers(mPasses.size());
+	for (int i = 0; i < mPasses.size(); i++) {
+		for (QRhiResource* res : mPasses[i].reads) {
+			int producer = lastWriter.value(res, -1);
+			if (producer != -1)
+				producers[i] << producer;
+		}
+		for (QRhiResource* res : mPasses[i].writes)
+			lastWriter[res] = i;
+	}
+
+	QVector<bool> alive(mPasses.size(), false);
+	for (QRhiResource* res : mExternalReads) {
+		int producer = lastWriter.value(res, -1);
+		if (producer != -1)
+			alive[producer] = true;
+	}
+	mCompileStats.passCount = mPasses.size();
+	mCompileStats.culledPassCount = 0;
+	for (int i = mPasses.size() - 1; i >= 0; i--) {
+		PassNode& pass = mPasses[i];
+		if (!bPassCullingEnabled || pass.bHasSideEffect || pass.writes.isEmpty())
+			alive[i] = true;
+		pass.bCulled = !alive[i];
+		if (pass.bCulled) {
+			mCompileStats.culledPassCount++;
+			continue;
+		}
+		for (int producer : producers[i])
+			alive[producer] = true;
+	}
+}
+
+bool QRenderGraphBuilder::aliasTransientResources()
+{
+	QHash<QRhiResource*, QVector<int>> accesses;
+	QHash<QRhiResource*, QVector<int>> creators;
+	QVector<TransientResource> transients;
+	for (int i = 0; i < mPasses.size(); i++) {
+		const PassNode& pass = mPasses[i];
+		if (pass.bCulled)
+			continue;
+		for (QRhiResource* res : pass.reads + pass.writes)
+			accesses[res] << i;
+		for (const auto& transient : pass.transients) {
+			creators[transient.resource.get()] << i;
+			transients << transient;
+		}
+	}
+
+	// The same physical resource can already be shared by several slots (aliased last frame),
+	// so each access is attributed to the slot created most recently before it.
+	struct Lifetime {
+		int first;
+		int last;
+		bool bExternal;
+	};
+	QVector<Lifetime> lifetimes;
+	QVector<TransientResource> candidates;
+	for (const auto& transient : transients) {
+		QRhiResource* res = transient.resource.get();
+		if (!mPasses[transient.passIndex].writes.contains(res))
+			continue;
+		const QVector<int>& owners = creators[res];
+		const QVector<int>& resAccesses = accesses[res];
+		if (owners.first() == transient.passIndex && !resAccesses.isEmpty() && resAccesses.first() < transient.passIndex)
+			continue;
+		int next = mPasses.size();
+		for (int owner : owners) {
+			if (owner > transient.passIndex) {
+				next = owner;
+				break;
+			}
+		}
+		// Read after the graph by someone else, so it keeps a resource of its own for the whole frame
+		Lifetime lifetime = { transient.passIndex, transient.passIndex, mExternalReads.contains(res) };
+		if (lifetime.bExternal)
+			lifetime.last = mPasses.size();
+		for (int index : resAccesses) {
+			if (index >= transient.passIndex && index < next)
+				lifetime.last = qMax(lifetime.last, index);
+		}
+		lifetimes << lifetime;
+		candidates << transient;
+	}
+
+	struct AliasGroup {
+		TransientResource physical;
+		QRhiResource::Type type;
+		int last;
+		QStringList keys;
+	};
+	QVector<AliasGroup> groups;
+	mCompileStats.transientResourceCount = candidates.size();
+	mCompileStats.aliasedResourceCount = 0;
+	mCompileStats.transientBytes = 0;
+	mCompileStats.aliasedTransientBytes = 0;
+	for (int i = 0; i < candidates.size(); i++) {
+		const TransientResource& transient = candidates[i];
+		const QRhiResource::Type type = transient.resource->resourceType();
+		mCompileStats.transientBytes += transient.byteSize;
+		AliasGroup* target = nullptr;
+		if (bTransientAliasingEnabled && !lifetimes[i].bExternal) {
+			for (auto& group : groups) {
+				if (group.type == type && group.physical.descHash == transient.descHash && group.last < lifetimes[i].first) {
+					target = &group;
+					break;
+				}
+			}
+		}
+		if (target) {
+			target->last = lifetimes[i].last;
+			target->keys << transient.key;
+			mCompileStats.aliasedResourceCount++;
+		}
+		else {
+			groups.push_back({ transient, type, lifetimes[i].last, { transient.key } });
+			mCompileStats.aliasedTransientBytes += transient.byteSize;
+		}
+	}
+
+	QHash<QString, TransientResource> aliasPlan;
+	for (const auto& group : groups) {
+		if (group.keys.size() < 2)
+			continue;
+		for (const auto& key : group.keys)
+			aliasPlan[key] = group.physical;
+	}
+	bool bChanged = aliasPlan.size() != mAliasPlan.size();
+	for (auto it = aliasPlan.cbegin(); !bChanged && it != aliasPlan.cend(); ++it) {
+		auto last = mAliasPlan.constFind(it.key());
+		bChanged = last == mAliasPlan.cend() || last->resource != it->resource || last->descHash != it->descHash;
+	}
+	mSharedResources.clear();
+	for (const auto& transient : mAliasPlan)
+		mSharedResources.insert(transient.resource.get());
+	for (const auto& transient : aliasPlan)
+		mSharedResources.insert(transient.resource.get());
+	mAliasPlan = aliasPlan;
+	return bChanged;
+}
@@ -2,6 +2,11 @@
 #include "imgui.h"
 #include "ImGuizmo.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define QENGINE_FRUSTUM_SSE
+#endif
+
 const float ZPI = 3.14159265358979323846f;
 const float RAD2DEG = (180.f / ZPI);
 
@@ -61,3 +66,97 @@ QVector3D MathUtils::getMatScale3D(const QMatrix4x4& mat4) {
 	return scale3D;
 }
 
+
+void MathUtils::AABB::extend(const QVector3D& point) {
+	min = QVector3D(qMin(min.x(), point.x()), qMin(min.y(), point.y()), qMin(min.z(), point.z()));
+	max = QVector3D(qMax(max.x(), point.x()), qMax(max.y(), point.y()), qMax(max.z(), point.z()));
+}
+
+MathUtils::AABB MathUtils::AABB::transformed(const QMatrix4x4& mat4) const {
+	if (!isValid())
+		return *this;
+	QVector3D c = mat4.map(center());
+	QVector3D e = extent();
+	QVector3D newExtent;
+	for (int row = 0; row < 3; row++) {
+		newExtent[row] = qAbs(mat4(row, 0)) * e.x() + qAbs(mat4(row, 1)) * e.y() + qAbs(mat4(row, 2)) * e.z();
+	}
+	AABB box;
+	box.min = c - newExtent;
+	box.max = c + newExtent;
+	return box;
+}
+
+MathUtils::Frustum MathUtils::Frustum::fromMatrix(const QMatrix4x4& viewProjection) {
+	// Gribb-Hartmann extraction for OpenGL style clip space
+	Frustum frustum;
+	QVector4D row0 = viewProjection.row(0);
+	QVector4D row1 = viewProjection.row(1);
+	QVector4D row2 = viewProjection.row(2);
+	QVector4D row3 = viewProjection.row(3);
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+	for (auto& plane : frustum.planes) {
+		plane /= plane.toVector3D().length();
+	}
+	return frustum;
+}
+
+bool MathUtils::Frustum::intersects(const AABB& box) const {
+	bool visible = true;
+	intersects(&box, 1, &visible);
+	return visible;
+}
+
+void MathUtils::Frustum::intersects(const AABB* boxes, int count, bool* outVisible) const {
+#ifdef QENGINE_FRUSTUM_SSE
+	// Planes in SoA layout, two lanes of padding always pass
+	alignas(16) float px[8], py[8], pz[8], pw[8];
+	for (int i = 0; i < 8; i++) {
+		QVector4D plane = i < 6 ? planes[i] : QVector4D(0, 0, 0, 1);
+		px[i] = plane.x(); py[i] = plane.y(); pz[i] = plane.z(); pw[i] = plane.w();
+	}
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 planeX[2] = { _mm_load_ps(px), _mm_load_ps(px + 4) };
+	__m128 planeY[2] = { _mm_load_ps(py), _mm_load_ps(py + 4) };
+	__m128 planeZ[2] = { _mm_load_ps(pz), _mm_load_ps(pz + 4) };
+	__m128 planeW[2] = { _mm_load_ps(pw), _mm_load_ps(pw + 4) };
+	for (int i = 0; i < count; i++) {
+		if (!boxes[i].isValid()) {
+			outVisible[i] = true;
+			continue;
+		}
+		QVector3D c = boxes[i].center();
+		QVector3D e = boxes[i].extent();
+		__m128 cx = _mm_set1_ps(c.x()), cy = _mm_set1_ps(c.y()), cz = _mm_set1_ps(c.z());
+		__m128 ex = _mm_set1_ps(e.x()), ey = _mm_set1_ps(e.y()), ez = _mm_set1_ps(e.z());
+		int outside = 0;
+		for (int j = 0; j < 2; j++) {
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[j], cx), _mm_mul_ps(planeY[j], cy)), _mm_add_ps(_mm_mul_ps(planeZ[j], cz), planeW[j]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, planeX[j]), ex), _mm_mul_ps(_mm_andnot_ps(signMask, planeY[j]), ey)), _mm_mul_ps(_mm_andnot_ps(signMask, planeZ[j]), ez));
+			outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+		}
+		outVisible[i] = outside == 0;
+	}
+#else
+	for (int i = 0; i < count; i++) {
+		outVisible[i] = true;
+		if (!boxes[i].isValid())
+			continue;
+		QVector3D c = boxes[i].center();
+		QVector3D e = boxes[i].extent();
+		for (const auto& plane : planes) {
+			float dist = plane.x() * c.x() + plane.y() * c.y() + plane.z() * c.z() + plane.w();
+			float radius = qAbs(plane.x()) * e.x() + qAbs(plane.y()) * e.y() + qAbs(plane.z()) * e.z();
+			if (dist + radius < 0) {
+				outVisible[i] = false;
+				break;
+			}
+		}
+	}
+#endif
+}
@@ -1,4 +1,5 @@
 #include "QAudioProvider.h"
+#include "QAudioStreamDevice.h"
 #include <QMediaDevices>
 #include <QAudioDecoder>
 #include <QAudioSink>
@@ -10,11 +11,181 @@
 #include <string>
 #include <thread>
 #include <QDebug>
+#include <QMutex>
+#include <QFile>
+#include "tracy/Tracy.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define QENGINE_AUDIO_SSE
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QENGINE_AUDIO_SSE2
+#endif
+
+struct QFftContext {
+	QMutex mutex;
+	QHash<quint32, fftw_plan> plans;					// (log2 size << 8) | batch
+	QHash<quint32, QVector<double>> windows;			// (log2 size << 8) | window function
+	QString wisdomFile;
+};
+
+static QFftContext& fftContext() {
+	static QFftContext ctx;
+	return ctx;
+}
+
+static fftw_plan findOrCreateFftPlan(int inLog2Size, int inBatch) {
+	QFftContext& ctx = fftContext();
+	QMutexLocker locker(&ctx.mutex);		// the FFTW planner is not thread safe
+	const quint32 key = (quint32(inLog2Size) << 8) | quint32(inBatch);
+	if (fftw_plan plan = ctx.plans.value(key))
+		return plan;
+	ZoneScopedN("QAudioProvider::planFft");
+	const int size = 1 << inLog2Size;
+	double* in = (double*)fftw_malloc(sizeof(double) * size * inBatch);
+	double* out = (double*)fftw_malloc(sizeof(double) * size * inBatch);
+	fftw_r2r_kind kind = FFTW_R2HC;
+	// FFTW_MEASURE scribbles over the arrays, providers run the plan on their own fftw_malloc buffers through fftw_execute_r2r
+	fftw_plan plan = fftw_plan_many_r2r(1, &size, inBatch, in, nullptr, 1, size, out, nullptr, 1, size, &kind, FFTW_MEASURE);
+	fftw_free(in);
+	fftw_free(out);
+	ctx.plans.insert(key, plan);
+	if (!ctx.wisdomFile.isEmpty())
+		fftw_export_wisdom_to_filename(QFile::encodeName(ctx.wisdomFile).constData());
+	return plan;
+}
+
+static QVector<double> findOrCreateWindow(QAudioProvider::WindowFunction inType, int inLog2Size) {
+	QFftContext& ctx = fftContext();
+	QMutexLocker locker(&ctx.mutex);
+	const quint32 key = (quint32(inLog2Size) << 8) | quint32(inType);
+	auto iter = ctx.windows.constFind(key);
+	if (iter != ctx.windows.constEnd())
+		return *iter;
+	const int size = 1 << inLog2Size;
+	QVector<double> window(size);
+	for (int n = 0; n < size; ++n) {
+		double x = 1.0;
+		switch (inType) {
+		case QAudioProvider::NoWindow:
+			x = 1.0;
+			break;
+		case QAudioProvider::GuassWindow: {
+			double tmp = (n - (size - 1) / 2.0) / (0.4 * (size - 1) / 2);
+			x = exp(-0.5 * (tmp * tmp));
+			break;
+		}
+		case QAudioProvider::HannWindow:
+			x = 0.5 * (1 - cos((2 * M_PI * n) / (size - 1)));
+			break;
+		case QAudioProvider::HammingWindow:
+			x = 0.53836 - 0.46164 * cos(2 * M_PI * n / (size - 1));
+			break;
+		case QAudioProvider::BartlettWindow:
+			x = 2.0 / (size - 1) * ((size - 1) / 2.0 - abs(n - (size - 1) / 2.0));
+			break;
+		case QAudioProvider::TriangleWindow:
+			x = 2.0 / size * (size / 2.0 - abs(n - (size - 1) / 2.0));
+			break;
+		case QAudioProvider::BlackmanWindow:
+			x = 0.42 - 0.5 * cos(2 * M_PI * n / (size - 1)) + 0.08 * cos(4 * M_PI * n / (size - 1));
+			break;
+		case QAudioProvider::NuttallWindow:
+			x = 0.355768 - 0.487396 * cos(2 * M_PI * n / (size - 1)) + 0.1444232 * cos(4 * M_PI * n / (size - 1)) + 0.012604 * cos(6 * M_PI * n / (size - 1));
+			break;
+		case QAudioProvider::SinWindow:
+			x = sin(M_PI * n / (size - 1));
+			break;
+		}
+		window[n] = x;
+	}
+	ctx.windows.insert(key, window);
+	return window;
+}
+
+// Interleaved float frames to windowed planar rows of inFftSize doubles, one row per analyzed channel
+static void loadWindowedFrames(const float* inSamples, int inChannelCount, int inFrameCount, int inSingleChannel, QAudioProvider::ChannelMode inMode, const double* inWindow, int inFftSize, double* outRows) {
+	int rows = 1;
+	int i = 0;
+	if (inMode == QAudioProvider::PerChannel && inChannelCount > 1) {
+		rows = inChannelCount;
+#ifdef QENGINE_AUDIO_SSE2
+		if (inChannelCount == 2) {
+			double* left = outRows;
+			double* right = outRows + inFftSize;
+			for (; i + 2 <= inFrameCount; i += 2) {
+				const __m128 lr = _mm_loadu_ps(inSamples + i * 2);
+				const __m128d a = _mm_cvtps_pd(lr);
+				const __m128d b = _mm_cvtps_pd(_mm_movehl_ps(lr, lr));
+				const __m128d w = _mm_loadu_pd(inWindow + i);
+				_mm_storeu_pd(left + i, _mm_mul_pd(_mm_unpacklo_pd(a, b), w));
+				_mm_storeu_pd(right + i, _mm_mul_pd(_mm_unpackhi_pd(a, b), w));
+			}
+		}
+#endif
+		for (int c = 0; c < inChannelCount; c++) {
+			double* row = outRows + c * inFftSize;
+			for (int j = i; j < inFrameCount; j++)
+				row[j] = inSamples[j * inChannelCount + c] * inWindow[j];
+		}
+	}
+	else if (inMode == QAudioProvider::MidSide && inChannelCount > 1) {
+		rows = 2;
+		double* mid = outRows;
+		double* side = outRows + inFftSize;
+#ifdef QENGINE_AUDIO_SSE2
+		if (inChannelCount == 2) {
+			const __m128d half = _mm_set1_pd(0.5);
+			for (; i + 2 <= inFrameCount; i += 2) {
+				const __m128 lr = _mm_loadu_ps(inSamples + i * 2);
+				const __m128d a = _mm_cvtps_pd(lr);
+				const __m128d b = _mm_cvtps_pd(_mm_movehl_ps(lr, lr));
+				const __m128d l = _mm_unpacklo_pd(a, b);
+				const __m128d r = _mm_unpackhi_pd(a, b);
+				const __m128d w = _mm_mul_pd(_mm_loadu_pd(inWindow + i), half);
+				_mm_storeu_pd(mid + i, _mm_mul_pd(_mm_add_pd(l, r), w));
+				_mm_storeu_pd(side + i, _mm_mul_pd(_mm_sub_pd(l, r), w));
+			}
+		}
+#endif
+		for (; i < inFrameCount; i++) {
+			const double l = inSamples[i * inChannelCount];
+			const double r = inSamples[i * inChannelCount + 1];
+			mid[i] = (l + r) * 0.5 * inWindow[i];
+			side[i] = (l - r) * 0.5 * inWindow[i];
+		}
+	}
+	else {
+		for (; i < inFrameCount; i++)
+			outRows[i] = inSamples[i * inChannelCount + inSingleChannel] * inWindow[i];
+	}
+	for (int r = 0; r < rows; r++)
+		memset(outRows + r * inFftSize + inFrameCount, 0, sizeof(double) * (inFftSize - inFrameCount));
+}
 
 QAudioProvider::QAudioProvider()
-	: mDecoder(new QAudioDecoder)
+	: mStream(new QAudioStreamDevice)
+	, mDecoder(new QAudioDecoder)
 {
 	mAudioBuffer.setBuffer(&mAudioData);
+	// The sink pulls from its own thread, refilling has to happen where the decoder lives
+	mStream->onConsumed = [this]() {
+		QMetaObject::invokeMethod(this, &QAudioProvider::pumpDecoder, Qt::QueuedConnection);
+	};
+	QObject::connect(mDecoder.get(), &QAudioDecoder::bufferReady, this, [this]() {
+		if (bStreaming)
+			pumpDecoder();
+		else {
+			const QAudioBuffer& frame = mDecoder->read();
+			mAudioBuffer.write(frame.constData<char>(), frame.byteCount());		//向IO设备中写入音频数据
+		}
+	});
+	QObject::connect(mDecoder.get(), &QAudioDecoder::finished, this, [this]() {
+		if (bStreaming)
+			mStream->setFinished();
+	});
 	setWindowFunction(HannWindow);
 	setAudioDevice(QMediaDevices::defaultAudioOutput());
 	setFramesPerBuffer(12);
@@ -30,10 +201,54 @@ void QAudioProvider::setAudioDevice(const QAudioDevice& deviceInfo) {
 }
 
 void QAudioProvider::play() {
-	if (mAudioBuffer.isOpen())
-		mAudioBuffer.close();
-	mAudioBuffer.open(QIODevice::ReadOnly);
-	mSink->start(&mAudioBuffer);
+	QIODevice* device = getPlaybackDevice();
+	if (device->isOpen())
+		device->close();
+	device->open(QIODevice::ReadOnly);
+	mSink->start(device);
+}
+
+void QAudioProvider::seek(qint64 usecs) {
+	if (!mSink)
+		return;
+	const int bytesPerFrame = qMax(1, mCtx.audioFormat.bytesPerFrame());
+	const qint64 target = mCtx.audioFormat.bytesForDuration(qMax<qint64>(0, usecs)) / bytesPerFrame * bytesPerFrame;
+	const bool bActived = mSink->state() == QAudio::State::ActiveState || mSink->state() == QAudio::State::IdleState;
+	mSink->stop();
+	if (bStreaming) {
+		if (!mStream->trySeek(target))
+			restartStream(target);
+	}
+	else {
+		if (!mAudioBuffer.isOpen())
+			mAudioBuffer.open(QIODevice::ReadOnly);
+		mAudioBuffer.seek(qMin<qint64>(target, mAudioData.size()));
+	}
+	mPlayOffset = target;
+	if (bActived)
+		mSink->start(getPlaybackDevice());
+}
+
+void QAudioProvider::setStreaming(bool enabled) {
+	if (bStreaming == enabled)
+		return;
+	bStreaming = enabled;
+	if (!mUrl.isEmpty())
+		rebuildAudioData();
+}
+
+void QAudioProvider::setStreamBufferDuration(int msecs) {
+	mStreamBufferMsecs = qMax(500, msecs);
+}
+
+qint64 QAudioProvider::getStreamCapacity() const {
+	return bStreaming ? mStream->capacity() : mAudioData.size();
+}
+
+QIODevice* QAudioProvider::getPlaybackDevice() {
+	if (bStreaming)
+		return mStream.get();
+	return &mAudioBuffer;
 }
 
 void QAudioProvider::setWindowFunction(WindowFunction inType) {
@@ -44,6 +259,24 @@ void QAudioProvider::setFramesPerBuffer(int size) {
 	mDesiredCtx.framesPerBuffer = qBound(4, size, 14);
 }
 
+void QAudioProvider::setChannelMode(ChannelMode inMode) {
+	mDesiredCtx.channelMode = inMode;
+}
+
+void QAudioProvider::setFftWisdomFile(const QString& inFilePath) {
+	QFftContext& ctx = fftContext();
+	QMutexLocker locker(&ctx.mutex);
+	ctx.wisdomFile = inFilePath;
+	if (!inFilePath.isEmpty() && QFile::exists(inFilePath))
+		fftw_import_wisdom_from_filename(QFile::encodeName(inFilePath).constData());
+}
+
+void QAudioProvider::prepareFftPlans(int inChannelCount) {
+	for (int log2Size = 4; log2Size <= 14; log2Size++) {
+		findOrCreateFftPlan(log2Size, qMax(1, inChannelCount));
+	}
+}
+
 QList<QAudioDevice> QAudioProvider::getAudioOutputDevices() {
 	return QMediaDevices::audioOutputs();
 }
@@ -57,6 +290,21 @@ const QVector<double>& QAudioProvider::getFftCache() {
 	return mFftResultCache;
 }
 
+const QVector<double>& QAudioProvider::getChannelFftCache(int inIndex) {
+	tryExecuteFft();
+	static const QVector<double> empty;
+	return inIndex >= 0 && inIndex < mChannelFftCache.size() ? mChannelFftCache[inIndex] : empty;
+}
+
+int QAudioProvider::getAnalyzedChannelCount(ChannelMode inMode, int inChannelCount) const {
+	const int channelCount = qMax(1, inChannelCount);
+	if (inMode == PerChannel)
+		return channelCount;
+	if (inMode == MidSide)
+		return channelCount > 1 ? 2 : 1;
+	return 1;
+}
+
 QByteArray QAudioProvider::getCurrentAudioData(int inDesiredSize) {
 	int fftSize = 1 << mCtx.framesPerBuffer;
 	int bytesPerSample = mCtx.audioFormat.bytesPerSample();
@@ -64,6 +312,12 @@ QByteArray QAudioProvider::getCurrentAudioData(int inDesiredSize) {
 	return mAudioBuffer.peek(fftSize * mCtx.audioFormat.channelCount() * bytesPerSample);
 }
 
+QByteArray QAudioProvider::getAudioData(qint64 inPos, qint64 inSize) {
+	if (bStreaming)
+		return mStream->peek(inPos, inSize);
+	return mAudioData.sliced(qBound<qint64>(0, inPos, mAudioData.size()), qBound<qint64>(0, inSize, mAudioData.size() - qBound<qint64>(0, inPos, mAudioData.size())));
+}
+
 QSharedPointer<QSpectrumProvider> QAudioProvider::createSpectrumProvider() {
 	return QSharedPointer<QSpectrumProvider>( new QSpectrumProvider(this));
 }
@@ -74,21 +328,57 @@ void QAudioProvider::rebuildAudioData() {
 		mCtx.audioFormat = mDesiredCtx.audioFormat;
 		rebuildAudioSink();
 	}
+	mDecoder->stop();
 	mDecoder->setSource(mUrl);		//设置音频源
+	mPlayOffset = 0;
+	mDesiredCtx.pos = 0;
+	if (bStreaming) {
+		mAudioData = QByteArray();	//流式解码时不保留整段音频
+		restartStream(0);
+		return;
+	}
+	if (mStream->isOpen())
+		mStream->close();
 	if (mAudioBuffer.isOpen())
 		mAudioBuffer.close();
+	mAudioData.clear();
 	mAudioBuffer.open(QIODevice::WriteOnly);
-	QEventLoop loop;				//使用事件循环等待解码器完全解析完成，如果是长期播放则需要考虑流送
+	QEventLoop loop;				//使用事件循环等待解码器完全解析完成
 	QObject::connect(mDecoder.get(), &QAudioDecoder::finished, &loop, &QEventLoop::quit);
-	QObject::connect(mDecoder.get(), &QAudioDecoder::bufferReady, [this]() {
-		const QAudioBuffer& frame = mDecoder->read();
-		mAudioBuffer.write(frame.constData<char>(), frame.byteCount());		//向IO设备中写入音频数据
-	});
 	mDecoder->start();				//开始解码音频
 	qDebug() << mDecoder->errorString();
 	loop.exec();					//等待事件循环结束
 	mAudioBuffer.close();			//关闭IO设备
-	mDesiredCtx.pos = 0;
+}
+
+void QAudioProvider::restartStream(qint64 inStartByte) {
+	const qint64 bytesPerFrame = qMax(1, mCtx.audioFormat.bytesPerFrame());
+	const qint64 history = (qint64(1) << 14) * bytesPerFrame;		//最大FFT窗口
+	const qint64 ahead = mCtx.audioFormat.bytesForDuration(qint64(mStreamBufferMsecs) * 1000) / bytesPerFrame * bytesPerFrame;
+	mDecoder->stop();
+	mStream->reset(ahead + history, history, inStartByte);
+	mDecodedBytes = 0;
+	mSkipBytes = inStartByte;		//QAudioDecoder不支持跳转，从头解码并丢弃目标位置之前的数据
+	mDecoder->start();
+}
+
+void QAudioProvider::pumpDecoder() {
+	if (!bStreaming)
+		return;
+	// The decoder produces its next buffer only after the previous one is read, a full ring throttles decoding
+	while (mDecoder->bufferAvailable()) {
+		if (mSkipBytes <= mDecodedBytes && mStream->writableBytes() < mCtx.audioFormat.bytesForDuration(250 * 1000))
+			break;
+		const QAudioBuffer& frame = mDecoder->read();
+		const char* data = frame.constData<char>();
+		qint64 size = frame.byteCount();
+		const qint64 skip = qBound<qint64>(0, mSkipBytes - mDecodedBytes, size);
+		mDecodedBytes += size;
+		data += skip;
+		size -= skip;
+		if (size > 0)
+			mStream->append(data, size);
+	}
 }
 
 void QAudioProvider::rebuildAudioSink() {
@@ -102,75 +392,45 @@ void QAudioProvider::rebuildAudioSink() {
 	mSink.reset(new QAudioSink(mCtx.audioDevice, mCtx.audioFormat));
 	mDecoder->setAudioFormat(mCtx.audioFormat);
 	if (bActived) {
-		if (mAudioBuffer.isOpen())
-			mAudioBuffer.close();
-		mAudioBuffer.open(QIODevice::ReadOnly);
-		mSink->start(&mAudioBuffer);
+		play();
 	}
 }
 
 void QAudioProvider::rebuildWindowBuffer() {
-	size_t size = mWindow.size();
-	for (int n = 0; n < size; ++n) {
-		float x = 1.0;
-		switch (mCtx.windowType) {
-		case WindowFunction::NoWindow:
-			x = 1.0;
-			break;
-		case WindowFunction::GuassWindow: {
-			float tmp = (n - (size - 1) / 2.0) / (0.4 * (size - 1) / 2);
-			x = exp(-0.5 * (tmp * tmp));
-			break;
-		}
-		case WindowFunction::HannWindow:
-			x = 0.5 * (1 - cos((2 * M_PI * n) / (size - 1)));
-			break;
-		case WindowFunction::HammingWindow:
-			x = 0.53836 - 0.46164 * cos(2 * M_PI * n / (size - 1));
-			break;
-		case WindowFunction::BartlettWindow:
-			x = 2.0 / (size - 1) * ((size - 1) / 2.0 - abs(n - (size - 1) / 2.0));
-			break;
-		case WindowFunction::TriangleWindow:
-			x = 2.0 / size * (size / 2.0 - abs(n - (size - 1) / 2.0));
-			break;
-		case WindowFunction::BlackmanWindow:
-			x = 0.42 - 0.5 * cos(2 * M_PI * n / (size - 1)) + 0.08 * cos(4 * M_PI * n / (size - 1));
-			break;
-		case WindowFunction::NuttallWindow:
-			x = 0.355768 - 0.487396 * cos(2 * M_PI * n / (size - 1)) + 0.1444232 * cos(4 * M_PI * n / (size - 1)) + 0.012604 * cos(6 * M_PI * n / (size - 1));
-			break;
-		case WindowFunction::SinWindow:
-			x = sin(M_PI * n / (size - 1));
-			break;
-		}
-		mWindow[n] = x;
+	mWindow = findOrCreateWindow(mCtx.windowType, mCtx.framesPerBuffer);
+}
+
+void QAudioProvider::rebuildBinWeights(int inSampleRate) {
+	const int fftSize = 1 << mCtx.framesPerBuffer;
+	mBinWeights.resize(fftSize / 2);
+	for (int i = 0; i < fftSize / 2; i++) {
+		mBinWeights[i] = DspCurves::myAWeight(DspCurves::freqd(i, fftSize / 2, inSampleRate));
 	}
+	mCtx.weightSampleRate = inSampleRate;
 }
 
 void QAudioProvider::rebuildFftData() {
-	int fftSize = 1 << mCtx.framesPerBuffer;
-	mFftInput.reset((double*)fftw_malloc(sizeof(double) * fftSize), [](double* data) {
+	const int fftSize = 1 << mCtx.framesPerBuffer;
+	mFftInput.reset((double*)fftw_malloc(sizeof(double) * fftSize * mCtx.analyzedChannels), [](double* data) {
 		fftw_free(data);
 	});
-	mFftOutput.reset((double*)fftw_malloc(sizeof(double) * fftSize), [](double* data) {
+	mFftOutput.reset((double*)fftw_malloc(sizeof(double) * fftSize * mCtx.analyzedChannels), [](double* data) {
 		fftw_free(data);
 	});
-	mFftPlan.reset(fftw_plan_r2r_1d(fftSize, mFftInput.get(), mFftOutput.get(), fftw_r2r_kind::FFTW_R2HC, FFTW_ESTIMATE));
-	mWindow.resize(fftSize);
+	mFftPlan = findOrCreateFftPlan(mCtx.framesPerBuffer, mCtx.analyzedChannels);
+	mChannelFftCache.resize(mCtx.analyzedChannels);
 }
 
-void QAudioProvider::tryExecuteFft() {
-	if (mDesiredCtx.audioDevice != mCtx.audioDevice || mDesiredCtx.audioFormat != mCtx.audioFormat) {
-		mCtx.audioDevice = mDesiredCtx.audioDevice;
-		mCtx.audioFormat = mDesiredCtx.audioFormat;
-		rebuildAudioSink();
-	}
+bool QAudioProvider::updateAnalysisContext(int inChannelCount, int inSampleRate) {
 	bool bNeedRebuildWindowBuffer = false;
-	if (mDesiredCtx.framesPerBuffer != mCtx.framesPerBuffer) {
+	mCtx.channelMode = mDesiredCtx.channelMode;
+	const int analyzedChannels = getAnalyzedChannelCount(mCtx.channelMode, inChannelCount);
+	if (mDesiredCtx.framesPerBuffer != mCtx.framesPerBuffer || analyzedChannels != mCtx.analyzedChannels) {
 		mCtx.framesPerBuffer = mDesiredCtx.framesPerBuffer;
+		mCtx.analyzedChannels = analyzedChannels;
 		bNeedRebuildWindowBuffer = true;
 		rebuildFftData();
+		rebuildBinWeights(inSampleRate);
 	}
 	if (mDesiredCtx.windowType != mCtx.windowType) {
 		mCtx.windowType = mDesiredCtx.windowType;
@@ -179,34 +439,84 @@ void QAudioProvider::tryExecuteFft() {
 	if (bNeedRebuildWindowBuffer) {
 		rebuildWindowBuffer();
 	}
-	int fftSize = 1 << mCtx.framesPerBuffer;
-	int bytesPerSample = mCtx.audioFormat.bytesPerSample();
-	int sampleRate = mCtx.audioFormat.sampleRate();
-	const qint64 spectrumLength = fftSize * mCtx.audioFormat.channelCount() * bytesPerSample;
-	const qint64 playPosition = mCtx.audioFormat.bytesForDuration(mSink->elapsedUSecs());
+	if (mCtx.weightSampleRate != inSampleRate) {
+		rebuildBinWeights(inSampleRate);
+	}
+	return bNeedRebuildWindowBuffer;
+}
+
+void QAudioProvider::analyzeFrames(const float* inSamples, int inFrameCount, int inChannelCount, int inSampleRate) {
+	const int channelCount = qMax(1, inChannelCount);
+	updateAnalysisContext(channelCount, inSampleRate);
+	executeFft(inSamples, channelCount, qBound(0, inFrameCount, 1 << mCtx.framesPerBuffer), qMin(1, channelCount - 1));
+}
+
+void QAudioProvider::tryExecuteFft() {
+	if (mUrl.isEmpty())		// nothing is playing, keep whatever analyzeFrames produced
+		return;
+	if (mDesiredCtx.audioDevice != mCtx.audioDevice || mDesiredCtx.audioFormat != mCtx.audioFormat) {
+		mCtx.audioDevice = mDesiredCtx.audioDevice;
+		mCtx.audioFormat = mDesiredCtx.audioFormat;
+		rebuildAudioSink();
+	}
+	const int channelCount = qMax(1, mCtx.audioFormat.channelCount());
+	const bool bNeedRebuildWindowBuffer = updateAnalysisContext(channelCount, mCtx.audioFormat.sampleRate());
+	const int fftSize = 1 << mCtx.framesPerBuffer;
+	const int bytesPerFrame = qMax(1, mCtx.audioFormat.bytesPerFrame());
+	const qint64 spectrumLength = qint64(fftSize) * bytesPerFrame;
+	const qint64 playPosition = mPlayOffset + mCtx.audioFormat.bytesForDuration(mSink->elapsedUSecs());
 	const qint64 spectrumPosition = playPosition - spectrumLength;
 	mDesiredCtx.pos = spectrumPosition;
-	if (bNeedRebuildWindowBuffer || mDesiredCtx.pos != mCtx.pos) {
-		mCtx.pos = mDesiredCtx.pos;
-		QByteArray audioData = mAudioData.sliced(qMax(0, spectrumPosition), spectrumLength);
-		QAudioBuffer audioFrame(audioData, mCtx.audioFormat);
-		QAudioBuffer::F32S* rawData = audioFrame.data<QAudioBuffer::F32S>();
-		int maxFrameCount = qMin(fftSize, audioFrame.frameCount());
-		for (int i = 0; i < maxFrameCount; i++) {
-			mFftInput.data()[i] = rawData[i].value(QAudioFormat::AudioChannelPosition::FrontRight) * mWindow[i];
+	if (!bNeedRebuildWindowBuffer && mDesiredCtx.pos == mCtx.pos)
+		return;
+	mCtx.pos = mDesiredCtx.pos;
+	const QByteArray audioData = getAudioData(qMax<qint64>(0, spectrumPosition), spectrumLength);
+	const int frameCount = qMin<qint64>(fftSize, audioData.size() / bytesPerFrame);
+
+	// Everything is analyzed as float, other sample formats are normalized once up front
+	const float* samples = reinterpret_cast<const float*>(audioData.constData());
+	QVector<float> converted;
+	if (mCtx.audioFormat.sampleFormat() != QAudioFormat::Float) {
+		converted.resize(frameCount * channelCount);
+		for (int i = 0; i < converted.size(); i++)
+			converted[i] = mCtx.audioFormat.normalizedSampleValue(audioData.constData() + i * mCtx.audioFormat.bytesPerSample());
+		samples = converted.constData();
+	}
+	const int singleChannel = qMax(0, qMin(mCtx.audioFormat.channelOffset(QAudioFormat::AudioChannelPosition::FrontRight), channelCount - 1));
+	executeFft(samples, channelCount, frameCount, singleChannel);
+}
+
+void QAudioProvider::executeFft(const float* inSamples, int inChannelCount, int inFrameCount, int inSingleChannel) {
+	ZoneScopedN("QAudioProvider::executeFft");
+	const int fftSize = 1 << mCtx.framesPerBuffer;
+	loadWindowedFrames(inSamples, inChannelCount, inFrameCount, inSingleChannel, mCtx.channelMode, mWindow.constData(), fftSize, mFftInput.data());
+	fftw_execute_r2r(mFftPlan, mFftInput.data(), mFftOutput.data());
+
+	// Half complex layout: r0 .. r(n/2), i(n/2 - 1) .. i1
+	const int binCount = fftSize / 2;
+	for (int c = 0; c < mCtx.analyzedChannels; c++) {
+		const double* spectrum = mFftOutput.data() + c * fftSize;
+		QVector<double>& result = mChannelFftCache[c];
+		result.resize(binCount);
+		result[0] = qAbs(spectrum[0]) * mBinWeights[0];
+		for (int i = 1; i < binCount; i++) {
+			const double real = spectrum[i];
+			const double imag = spectrum[fftSize - i];
+			result[i] = sqrt(real * real + imag * imag) * mBinWeights[i];
 		}
-		memset(mFftInput.data() + maxFrameCount, 0, fftSize - maxFrameCount);
-		fftw_execute(mFftPlan.get());
-
-		mFftResultCache.resize(fftSize / 2);
-		for (int i = 0; i < fftSize / 2; i++) {
-			const double& real = mFftOutput.data()[i];
-			const double& imag = mFftOutput.data()[fftSize - 1 - (fftSize / 2 + i)];
-			const double& magnitude = sqrt(real * real + imag * imag);
-			const double& freq = DspCurves::freqd(i, fftSize / 2, sampleRate);
-			const double& kernel = DspCurves::myAWeight(freq);
-			mFftResultCache[i] = magnitude * kernel;
+	}
+	if (mCtx.channelMode == PerChannel && mCtx.analyzedChannels > 1) {
+		mFftResultCache.fill(0.0, binCount);
+		for (const QVector<double>& channel : mChannelFftCache) {
+			for (int i = 0; i < binCount; i++)
+				mFftResultCache[i] += channel[i];
 		}
+		const double scale = 1.0 / mCtx.analyzedChannels;
+		for (double& value : mFftResultCache)
+			value *= scale;
+	}
+	else {
+		mFftResultCache = mChannelFftCache.first();
 	}
 }
 
@@ -222,59 +532,72 @@ void QSpectrumProvider::setBarSize(int size) {
 
 void QSpectrumProvider::setLowFreq(int low) {
 	mLowFreq = low;
-	refreshFreq();
+	bNeedRebuildMapping = true;
 }
 
 void QSpectrumProvider::setHighFreq(int high) {
 	mHighFreq = high;
-	refreshFreq();
+	bNeedRebuildMapping = true;
 }
 
 const QVector<float>& QSpectrumProvider::calculateSpectrum() {
 	if (mDesiredSize != mAmp.size()) {
 		mFreq.resize(mDesiredSize);
 		mAmp.resize(mDesiredSize);
-		mSmoothCache.resize(mDesiredSize);
-		mSmoothFallCache.resize(mDesiredSize);
-		refreshFreq();
+		mSmoothCache.fill(0.0f, mDesiredSize);
+		mSmoothFallCache.fill(0.0f, mDesiredSize);
+		bNeedRebuildMapping = true;
 	}
 	const QVector<double>& Fft = mAudioProvider->getFftCache();
+	const int sampleRate = mAudioProvider->getAnalyzedSampleRate();
+	if (bNeedRebuildMapping || mMappedBinCount != Fft.size() || mMappedSampleRate != sampleRate) {
+		refreshFreq();
+		rebuildBinMapping(Fft.size(), sampleRate);
+	}
+	const int barCount = mAmp.size();
+	if (barCount < 2 || Fft.isEmpty()) {
+		publishSpectrum();
+		return mAmp;
+	}
 
-	int sampleRate = mAudioProvider->getAudioFormat().sampleRate();
-	double df = sampleRate / Fft.size() * 2;
-	double valMul = (2.0 / sampleRate) * 200;
-	int fftBinIndex = 0;
-	int barIndex = 0;
-	float freqLast = 0.0f;
-	float freqMultiplier;
-
-	mAmp.fill(0);
-	while (fftBinIndex < Fft.size() && barIndex < mAmp.size()) {
-		float freqLin = ((float)fftBinIndex + 0.5f) * df;
-		float freqLog = mFreq[barIndex];
-		int fftBinI = fftBinIndex;
-		int barI = barIndex;
-		if (freqLin <= freqLog) {
-			freqMultiplier = (freqLin - freqLast);
-			freqLast = freqLin;
-			fftBinIndex += 1;
-		}
-		else {
-			freqMultiplier = (freqLog - freqLast);
-			freqLast = freqLog;
-			barIndex += 1;
-		}
-		mAmp[barI] += freqMultiplier * Fft[fftBinI] * valMul;
+	float* amp = mAmp.data();
+	const int* offsets = mBarBinOffsets.constData();
+	const int* bins = mBarBins.constData();
+	const float* weights = mBarBinWeights.constData();
+	const double* fft = Fft.constData();
+	for (int bar = 0; bar < barCount; bar++) {
+		float sum = 0.0f;
+		for (int k = offsets[bar]; k < offsets[bar + 1]; k++)
+			sum += weights[k] * float(fft[bins[k]]);
+		amp[bar] = sum;
 	}
+	amp[0] = qMin(amp[0], amp[1]);
+	amp[barCount - 1] = qMin(amp[barCount - 1], amp[barCount - 2]);
 
 	float rangeLow = 9999990.0f;
 	float rangeHigh = -9999990.0f;
-	mAmp[0] = qMin(mAmp[0], mAmp[1]);
-	mAmp.back() = qMin(mAmp.back(), mAmp[mAmp.size() - 2]);
-	for (int i = 0; i < mAmp.size(); i++) {
-		mAmp[i] = mAmp[i] * 2.0f;//(float) melSpectrumData[i];
-		rangeLow = qMin(mAmp[i], rangeLow);
-		rangeHigh = qMax(mAmp[i], rangeHigh);
+	int i = 0;
+#ifdef QENGINE_AUDIO_SSE
+	{
+		__m128 low = _mm_set1_ps(rangeLow);
+		__m128 high = _mm_set1_ps(rangeHigh);
+		for (; i + 4 <= barCount; i += 4) {
+			const __m128 v = _mm_loadu_ps(amp + i);
+			low = _mm_min_ps(low, v);
+			high = _mm_max_ps(high, v);
+		}
+		alignas(16) float lows[4], highs[4];
+		_mm_store_ps(lows, low);
+		_mm_store_ps(highs, high);
+		for (int j = 0; j < 4; j++) {
+			rangeLow = qMin(rangeLow, lows[j]);
+			rangeHigh = qMax(rangeHigh, highs[j]);
+		}
+	}
+#endif
+	for (; i < barCount; i++) {
+		rangeLow = qMin(amp[i], rangeLow);
+		rangeHigh = qMax(amp[i], rangeHigh);
 	}
 
 	const float rangeMax = 1000.0f;
@@ -283,31 +606,79 @@ const QVector<float>& QSpectrumProvider::calculateSpectrum() {
 
 	mSmoothRangeLowCache = (mSmoothRangeLowCache * (1.0f - mSmoothRangeFactor)) + (rangeLow * mSmoothRangeFactor);
 	mSmoothRangeHighCache = (mSmoothRangeHighCache * (1.0f - mSmoothRangeFactor)) + (rangeHigh * mSmoothRangeFactor);
-	const double rangeTarget = 0.8f;
+	const float rangeTarget = 0.8f;
 	float rangeMul = mSmoothRangeHighCache - mSmoothRangeLowCache;
 	if (rangeMul < 1.0f)
 		rangeMul = 1.0f;
 	rangeMul = rangeTarget / rangeMul;
-	for (int i = 0; i < mAmp.size(); i++) {
-		double val = mAmp[i];
-		val = (val - mSmoothRangeLowCache) * rangeMul;
-		if (val >= mSmoothCache[i]) {
-			mSmoothCache[i] = (mSmoothCache[i] * (1.0f - mSmoothRiseFactor)) + (val * mSmoothRiseFactor);
-			mSmoothFallCache[i] = 0;
+
+	smoothBars(amp, mSmoothCache.data(), mSmoothFallCache.data(), barCount, mSmoothRangeLowCache, rangeMul, mSmoothRiseFactor, mSmoothFallFactor);
+	publishSpectrum();
+	return mAmp;
+}
+
+void QSpectrumProvider::smoothBars(float* ioAmp, float* ioSmooth, float* ioFall, int inCount, float inLow, float inMul, float inRise, float inFall) {
+	// Rising bars ease towards the new value, falling bars drop with an accelerating step
+	int i = 0;
+#ifdef QENGINE_AUDIO_SSE
+	{
+		const __m128 lowV = _mm_set1_ps(inLow);
+		const __m128 mulV = _mm_set1_ps(inMul);
+		const __m128 riseV = _mm_set1_ps(inRise);
+		const __m128 keepV = _mm_set1_ps(1.0f - inRise);
+		const __m128 fallV = _mm_set1_ps(inFall);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (; i + 4 <= inCount; i += 4) {
+			const __m128 val = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(ioAmp + i), lowV), mulV);
+			const __m128 cache = _mm_loadu_ps(ioSmooth + i);
+			const __m128 fallCache = _mm_loadu_ps(ioFall + i);
+			const __m128 riseMask = _mm_cmpge_ps(val, cache);
+			const __m128 fallMask = _mm_andnot_ps(riseMask, _mm_cmpgt_ps(val, zero));
+			const __m128 risen = _mm_add_ps(_mm_mul_ps(cache, keepV), _mm_mul_ps(val, riseV));
+			const __m128 nextFall = _mm_add_ps(_mm_add_ps(fallCache, fallCache), fallV);
+			const __m128 fallen = _mm_sub_ps(cache, nextFall);
+			const __m128 newCache = _mm_or_ps(_mm_and_ps(riseMask, risen), _mm_or_ps(_mm_and_ps(fallMask, fallen), _mm_andnot_ps(_mm_or_ps(riseMask, fallMask), cache)));
+			const __m128 newFall = _mm_or_ps(_mm_and_ps(fallMask, nextFall), _mm_andnot_ps(_mm_or_ps(riseMask, fallMask), fallCache));
+			_mm_storeu_ps(ioSmooth + i, newCache);
+			_mm_storeu_ps(ioFall + i, newFall);
+			_mm_storeu_ps(ioAmp + i, _mm_min_ps(_mm_max_ps(newCache, zero), one));
+		}
+	}
+#endif
+	for (; i < inCount; i++) {
+		const float val = (ioAmp[i] - inLow) * inMul;
+		if (val >= ioSmooth[i]) {
+			ioSmooth[i] = (ioSmooth[i] * (1.0f - inRise)) + (val * inRise);
+			ioFall[i] = 0;
 		}
 		else if (val > 0) {
-			mSmoothFallCache[i] = mSmoothFallCache[i] * 2 + mSmoothFallFactor;
-			mSmoothCache[i] -= mSmoothFallCache[i];
+			ioFall[i] = ioFall[i] * 2 + inFall;
+			ioSmooth[i] -= ioFall[i];
 		}
-		mAmp[i] = qBound(0.0, mSmoothCache[i], 1.0);
+		ioAmp[i] = qBound(0.0f, ioSmooth[i], 1.0f);
 	}
-	return mAmp;
+}
+
+const QVector<float>& QSpectrumProvider::getLatestSpectrum() {
+	mPublished.acquire();
+	return mPublished.readBuffer();
+}
+
+void QSpectrumProvider::publishSpectrum() {
+	// The slot keeps its capacity, so publishing does not allocate once the bar count is stable
+	QVector<float>& slot = mPublished.writeBuffer();
+	slot.resize(mAmp.size());
+	std::copy(mAmp.cbegin(), mAmp.cend(), slot.begin());
+	mPublished.publish();
 }
 
 void QSpectrumProvider::refreshFreq() {
 	if (mLowFreq > mHighFreq) {
 		qSwap(mLowFreq, mHighFreq);
 	}
+	if (mFreq.isEmpty())
+		return;
 	float freqScaleOff = 800;
 	float step = (float)((log(mHighFreq / (mLowFreq + (freqScaleOff))) / mFreq.size()) / log(2.0));
 	mFreq[0] = mLowFreq + freqScaleOff;
@@ -316,4 +687,44 @@ void QSpectrumProvider::refreshFreq() {
 		mFreq[i] = ((mFreq[i - 1] * stepMul * 1.0f));
 		mFreq[i - 1] += -freqScaleOff;
 	}
-}
\ No newline at end of file
+}
+
+void QSpectrumProvider::rebuildBinMapping(int inBinCount, int inSampleRate) {
+	// Merges linear bin edges with the log bar edges, every overlap adds its width times the bin to the bar
+	mMappedBinCount = inBinCount;
+	mMappedSampleRate = inSampleRate;
+	bNeedRebuildMapping = false;
+	const int barCount = mAmp.size();
+	mBarBinOffsets.fill(0, barCount + 1);
+	mBarBins.clear();
+	mBarBinWeights.clear();
+	if (inBinCount == 0 || barCount == 0 || inSampleRate <= 0)
+		return;
+	double df = inSampleRate / inBinCount * 2;
+	double valMul = (2.0 / inSampleRate) * 200 * 2.0;
+	int fftBinIndex = 0;
+	int barIndex = 0;
+	float freqLast = 0.0f;
+	while (fftBinIndex < inBinCount && barIndex < barCount) {
+		float freqLin = ((float)fftBinIndex + 0.5f) * df;
+		float freqLog = mFreq[barIndex];
+		float freqMultiplier;
+		const int fftBinI = fftBinIndex;
+		const int barI = barIndex;
+		if (freqLin <= freqLog) {
+			freqMultiplier = (freqLin - freqLast);
+			freqLast = freqLin;
+			fftBinIndex += 1;
+		}
+		else {
+			freqMultiplier = (freqLog - freqLast);
+			freqLast = freqLog;
+			barIndex += 1;
+		}
+		mBarBins << fftBinI;
+		mBarBinWeights << float(freqMultiplier * valMul);
+		mBarBinOffsets[barI + 1] = mBarBins.size();
+	}
+	for (int i = 1; i <= barCount; i++)
+		mBarBinOffsets[i] = qMax(mBarBinOffsets[i], mBarBinOffsets[i - 1]);
+}
@@ -0,0 +1,91 @@
+#include "QAudioStreamDevice.h"
+
+void QAudioStreamDevice::reset(qint64 inCapacity, qint64 inHistory, qint64 inStartPos) {
+	QMutexLocker locker(&mMutex);
+	mRing.resize(inCapacity);
+	mHistory = qMin(inHistory, inCapacity / 2);
+	mStartPos = mReadPos = mWritePos = inStartPos;
+	bFinished = false;
+}
+
+qint64 QAudioStreamDevice::capacity() const {
+	QMutexLocker locker(&mMutex);
+	return mRing.size();
+}
+
+qint64 QAudioStreamDevice::writableBytes() const {
+	QMutexLocker locker(&mMutex);
+	return qMax<qint64>(0, mRing.size() - (mWritePos - qMax(mStartPos, mReadPos - mHistory)));
+}
+
+void QAudioStreamDevice::append(const char* inData, qint64 inSize) {
+	QMutexLocker locker(&mMutex);
+	const qint64 cap = mRing.size();
+	qint64 offset = mWritePos % cap;
+	while (inSize > 0) {
+		const qint64 n = qMin(inSize, cap - offset);
+		memcpy(mRing.data() + offset, inData, n);
+		inData += n;
+		inSize -= n;
+		mWritePos += n;
+		offset = 0;
+	}
+}
+
+void QAudioStreamDevice::setFinished() {
+	QMutexLocker locker(&mMutex);
+	bFinished = true;
+}
+
+bool QAudioStreamDevice::trySeek(qint64 inPos) {
+	QMutexLocker locker(&mMutex);
+	if (inPos < oldestPos() || inPos > mWritePos)
+		return false;
+	mReadPos = inPos;
+	return true;
+}
+
+QByteArray QAudioStreamDevice::peek(qint64 inPos, qint64 inSize) const {
+	QByteArray result(inSize, 0);
+	QMutexLocker locker(&mMutex);
+	const qint64 cap = mRing.size();
+	const qint64 begin = qMax(inPos, oldestPos());
+	const qint64 end = qMin(inPos + inSize, mWritePos);
+	for (qint64 pos = begin; pos < end;) {
+		const qint64 offset = pos % cap;
+		const qint64 n = qMin(end - pos, cap - offset);
+		memcpy(result.data() + (pos - inPos), mRing.constData() + offset, n);
+		pos += n;
+	}
+	return result;
+}
+
+qint64 QAudioStreamDevice::bytesAvailable() const {
+	QMutexLocker locker(&mMutex);
+	return mWritePos - mReadPos + QIODevice::bytesAvailable();
+}
+
+bool QAudioStreamDevice::atEnd() const {
+	QMutexLocker locker(&mMutex);
+	return bFinished && mReadPos == mWritePos;
+}
+
+qint64 QAudioStreamDevice::readData(char* data, qint64 maxlen) {
+	qint64 total = 0;
+	{
+		QMutexLocker locker(&mMutex);
+		const qint64 cap = mRing.size();
+		while (total < maxlen && mReadPos < mWritePos) {
+			const qint64 offset = mReadPos % cap;
+			const qint64 n = qMin(qMin(maxlen - total, mWritePos - mReadPos), cap - offset);
+			memcpy(data + total, mRing.constData() + offset, n);
+			total += n;
+			mReadPos += n;
+		}
+		if (total == 0 && bFinished)
+			return -1;
+	}
+	if (total > 0 && onConsumed)
+		onConsumed();
+	return total;
+}
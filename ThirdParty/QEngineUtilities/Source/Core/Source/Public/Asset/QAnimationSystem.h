@@ -0,0 +1,37 @@
+#ifndef QAnimationSystem_h__
+#define QAnimationSystem_h__
+
+#include "QThreadPool"
+#include "QEngineCoreAPI.h"
+
+class QSkeletalMesh;
+
+// Advances every playing skeletal mesh once per rendered frame and evaluates their poses across a job pool
+class QENGINECORE_API QAnimationSystem {
+public:
+	struct Statistics {
+		quint64 frames = 0;
+		quint32 meshes = 0;					// evaluated during the last tick
+		quint32 bones = 0;
+		quint64 evaluateNanoseconds = 0;	// wall time of the last tick
+	};
+
+	static void registerMesh(QSkeletalMesh* inMesh);
+	static void unregisterMesh(QSkeletalMesh* inMesh);
+
+	// Called by every render thread before the frame graph is set up, poses are published when it returns.
+	// Advances by the time since the previous tick from any caller, so several renderers do not speed playback up.
+	static void tick();
+	// Advances by a fixed step, for offline evaluation and tests
+	static void tick(float inDeltaSec);
+
+	static void setEnabled(bool enabled);
+	static bool isEnabled();
+
+	static Statistics getStatistics();
+	static QThreadPool* evaluateThreadPool();
+private:
+	static void tickLocked(float inDeltaSec);
+};
+
+#endif // QAnimationSystem_h__
@@ -4,14 +4,33 @@
 #include "QList"
 #include "QMap"
 #include "QSharedPointer"
+#include "QImage"
+#include "QThreadPool"
 #include "QEngineCoreAPI.h"
 
 struct aiScene;
 
 struct QENGINECORE_API QMaterial {
+	// Where a texture property was loaded from, enough to load it again through the texture cache
+	struct TextureSource {
+		QString key;					// absolute file path, or "<model path>|<embedded name>"
+		QByteArray embeddedData;		// embedded textures only: the encoded file, or raw ARGB32 texels when embeddedSize is valid
+		QByteArray formatHint;
+		QSize embeddedSize;
+	};
+
 	static QVector<QSharedPointer<QMaterial>> CreateFromScene(const aiScene* scene, QString modelPath);
 
+	// Decoded as RGBA8888 and shared process-wide while any image returned for the same file is alive
+	static QImage LoadTexture(const QString& inFilePath);
+
+	// Loads every texture source into mProperties, each distinct key is decoded once and all of them in parallel
+	static void ResolveTextures(const QVector<QSharedPointer<QMaterial>>& inMaterials);
+
+	static QThreadPool* textureDecodeThreadPool();
+
 	QMap<QString, QVariant> mProperties;
+	QMap<QString, TextureSource> mTextureSources;
 };
 
 
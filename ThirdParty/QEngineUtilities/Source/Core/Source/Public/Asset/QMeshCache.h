@@ -0,0 +1,28 @@
+#ifndef QMeshCache_h__
+#define QMeshCache_h__
+
+#include "QSharedPointer"
+#include "QString"
+#include "QEngineCoreAPI.h"
+
+struct QStaticMesh;
+class QSkeletalMesh;
+
+// Binary snapshot of imported meshes, keyed by source path and validated against its size and modification time
+class QENGINECORE_API QMeshCache {
+public:
+	static void setCacheDirectory(const QString& dir);
+	static QString getCacheDirectory();
+	static void setEnabled(bool enabled);
+	static bool isEnabled();
+
+	static QSharedPointer<QStaticMesh> loadStaticMesh(const QString& inSourcePath);
+	static bool saveStaticMesh(const QString& inSourcePath, const QStaticMesh& inMesh);
+
+	static QSharedPointer<QSkeletalMesh> loadSkeletalMesh(const QString& inSourcePath);
+	static bool saveSkeletalMesh(const QString& inSourcePath, const QSkeletalMesh& inMesh);
+
+	static void clear();
+};
+
+#endif // QMeshCache_h__
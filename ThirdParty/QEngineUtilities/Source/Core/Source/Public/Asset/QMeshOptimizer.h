@@ -0,0 +1,59 @@
+#ifndef QMeshOptimizer_h__
+#define QMeshOptimizer_h__
+
+#include "QVector"
+#include "qvectornd.h"
+#include "Asset/QStaticMesh.h"
+#include "QEngineCoreAPI.h"
+
+class QSkeletalMesh;
+
+// Import time reordering of triangle lists for the post transform cache, overdraw and vertex fetch
+class QENGINECORE_API QMeshOptimizer {
+public:
+	struct Statistics {
+		quint64 triangles = 0;
+		quint64 verticesBefore = 0;
+		quint64 verticesAfter = 0;
+		quint64 cacheMissesBefore = 0;
+		quint64 cacheMissesAfter = 0;
+		quint32 bytesPerVertex = 0;
+		quint32 compactBytesPerVertex = 0;
+
+		// Average cache miss ratio, transformed vertices per triangle with a 16 entry FIFO
+		double acmrBefore() const { return triangles ? double(cacheMissesBefore) / triangles : 0.0; }
+		double acmrAfter() const { return triangles ? double(cacheMissesAfter) / triangles : 0.0; }
+	};
+
+	struct LodSettings {
+		int maxLevels = 4;
+		float reduction = 0.5f;
+	};
+
+	static void setEnabled(bool enabled);
+	static bool isEnabled();
+	static void setLodSettings(const LodSettings& inSettings);
+	static LodSettings getLodSettings();
+
+	// Changes with every setting that alters what an import produces, mesh caches written under other settings are ignored
+	static quint64 getSettingsKey();
+
+	static Statistics optimize(QStaticMesh& inMesh);
+	static Statistics optimize(QSkeletalMesh& inMesh);
+
+	static Statistics getStatistics();
+	static void resetStatistics();
+
+	static QVector<QStaticMesh::CompactVertex> buildCompactVertices(const QStaticMesh& inMesh);
+
+	// Appends up to inMaxLevels simplified index ranges per submesh, each aiming at inReduction of the previous level's triangles
+	static void generateLods(QStaticMesh& inMesh, int inMaxLevels = 4, float inReduction = 0.5f);
+
+	// Index lists are local to the vertex range they reference
+	static void optimizeVertexCache(quint32* ioIndices, quint32 inIndexCount, quint32 inVertexCount);
+	static void optimizeOverdraw(quint32* ioIndices, quint32 inIndexCount, const QVector3D* inPositions, quint32 inVertexCount, float inThreshold = 1.05f);
+	static QVector<quint32> simplify(const quint32* inIndices, quint32 inIndexCount, const QVector3D* inPositions, quint32 inVertexCount, quint32 inTargetIndexCount, float* outError = nullptr);
+	static quint32 analyzeVertexCache(const quint32* inIndices, quint32 inIndexCount, quint32 inVertexCount, quint32 inCacheSize = 16);
+};
+
+#endif // QMeshOptimizer_h__
@@ -5,6 +5,7 @@
 #include "Render/RHI/QRhiHelper.h"
 #include "Utils/MathUtils.h"
 #include "Render/RHI/QRhiUniformBlock.h"
+#include "QThreadPool"
 #include "QEngineCoreAPI.h"
 
 class QENGINECORE_API IParticleEmitter: public QObject{
@@ -44,15 +45,61 @@ protected:
 class QENGINECORE_API QCpuParticleEmitter : public IParticleEmitter {
 	Q_OBJECT
 public:
-	inline static const int CPU_PARTICLE_MAX_SIZE = 10000;
+	inline static const int CPU_PARTICLE_MAX_SIZE = 500000;
+
+	// One float stream per particle attribute, rotation is in degrees like QMatrix4x4::rotate
+	enum Stream {
+		PositionX, PositionY, PositionZ,
+		RotationX, RotationY, RotationZ,
+		ScalingX, ScalingY, ScalingZ,
+		VelocityX, VelocityY, VelocityZ,
+		Age,
+		Lifetime,
+		StreamCount
+	};
+
+	// A contiguous slice of the particle store, batches never overlap so they can be processed on different threads
+	struct ParticleBatch {
+		float* streams[StreamCount];
+		int count = 0;
+	};
+
+	struct Statistics {
+		quint32 particles = 0;
+		quint32 threads = 0;
+		quint64 updateNanoseconds = 0;
+		quint64 transformNanoseconds = 0;
+
+		double particlesPerMs() const { return updateNanoseconds + transformNanoseconds ? particles * 1.0e6 / (updateNanoseconds + transformNanoseconds) : 0.0; }
+	};
+
 	QCpuParticleEmitter();
-	uint32_t getNumOfParticle() { return mCurrentParticles.size(); }
+	uint32_t getNumOfParticle() { return mNumOfParticles; }
+	Statistics getStatistics() const { return mStatistics; }
+	static QThreadPool* updateThreadPool();
+
+	// Off by default, so onUpdateBatch and onUpdate run on the ticking thread. Only emitters whose
+	// update is safe to run concurrently on disjoint batches should opt in.
+	void setParallelUpdate(bool inParallel) { bParallelUpdate = inParallel; }
+	bool getParallelUpdate() const { return bParallelUpdate; }
 protected:
 	virtual void onTick(QRhiCommandBuffer* inCmdBuffer) override final;
-	virtual void onSpawn(Particle& newParticle) = 0;
-	virtual void onUpdate(Particle& outParticle) = 0;
+
+	// The defaults forward every particle to onSpawn/onUpdate, override them to process whole streams.
+	// onUpdateBatch gets one batch per worker when parallel update is on, position += velocity and aging are applied after it.
+	virtual void onSpawnBatch(ParticleBatch& ioBatch);
+	virtual void onUpdateBatch(ParticleBatch& ioBatch, float inDeltaSec);
+	virtual void onSpawn(Particle& newParticle) {}
+	virtual void onUpdate(Particle& outParticle) {}
 private:
-	QVector<Particle> mCurrentParticles;
+	ParticleBatch batchAt(int inBegin, int inCount);
+	void resizeStreams(int inSize);
+	QVector<float> mStreams[StreamCount];
+	int mNumOfParticles = 0;
+	int mTransformCapacity = 0;
+	QVector<MathUtils::Mat4> mTransforms;
+	Statistics mStatistics;
+	bool bParallelUpdate = false;
 };
 
 class QENGINECORE_API QGpuParticleEmitter : public IParticleEmitter {
@@ -7,10 +7,24 @@
 #include "QMap"
 #include "QMatrix4x4"
 #include "Utils/MathUtils.h"
-#include "QVariantAnimation"
+#include "QAtomicInt"
+#include "QMutex"
+#include "QQuaternion"
 #include "QMaterial.h"
 #include "QEngineCoreAPI.h"
 
+// Local transforms of every skeleton node, kept apart so layers can blend them before they become matrices
+struct QENGINECORE_API QSkeletalPose {
+	QVector<QVector3D> translations;
+	QVector<QQuaternion> rotations;
+	QVector<QVector3D> scalings;
+
+	int size() const { return translations.size(); }
+	void copyFrom(const QSkeletalPose& inOther);
+	void blend(const QSkeletalPose& inTarget, float inWeight);
+	void toMatrices(QMatrix4x4* outLocalTransforms) const;
+};
+
 struct QENGINECORE_API QSkeleton {
 	struct MeshNode {
 		QString name;
@@ -25,6 +39,19 @@ struct QENGINECORE_API QSkeleton {
 	QSharedPointer<MeshNode> mMeshRoot;
 	QHash<QString, QSharedPointer<BoneNode>> mBoneMap;
 	QVector<MathUtils::Mat4> mBoneOffsetMatrix;
+
+	// Breadth first flattening of mMeshRoot, every parent precedes its children so poses compose in one linear pass
+	void flatten();
+	int findNode(const QString& inName) const;
+	void computePoses(const QMatrix4x4* inLocalTransforms, QMatrix4x4* outGlobalTransforms, MathUtils::Mat4* outPoses) const;
+
+	QVector<QString> mNodeNames;
+	QVector<int> mNodeParents;						// -1 for the root
+	QVector<int> mNodeBones;						// -1 for nodes that do not drive a bone
+	QVector<QMatrix4x4> mNodeLocalTransforms;
+	QVector<QMatrix4x4> mNodeBoneOffsets;			// indexed like mNodeBones, identity when there is no bone
+	QHash<QString, int> mNodeIndexMap;
+	QSkeletalPose mBindPose;						// mNodeLocalTransforms decomposed into translation, rotation and scaling
 };
 
 struct QENGINECORE_API QSkeletalAnimation {
@@ -36,18 +63,102 @@ struct QENGINECORE_API QSkeletalAnimation {
 		QMatrix4x4 getMatrix(const double& timeMs);
 	};
 
+	struct CompressionSettings {
+		float sampleRate = 30.0f;					// keys are resampled on this fixed grid before reduction
+		float translationTolerance = 0.001f;		// relative to the extent the channel moves through
+		float rotationTolerance = 0.0005f;			// distance between unit quaternions
+		float scalingTolerance = 0.001f;
+		bool bReleaseSource = true;					// drops mAnimNode once compressed
+	};
+
+	struct CompressionStatistics {
+		quint32 sourceKeys = 0;
+		quint32 compressedKeys = 0;
+		quint64 sourceBytes = 0;
+		quint64 compressedBytes = 0;
+	};
+
+	struct Channel {
+		quint32 keyOffset = 0;						// into mKeyFrames, three mKeyData words per key
+		quint32 keyCount = 0;
+		QVector3D rangeMin;
+		QVector3D rangeExtent;
+	};
+	struct Track {
+		QString name;
+		Channel translation;
+		Channel rotation;
+		Channel scaling;
+		QVector3D referenceTranslation;				// first frame, the base additive layers are measured against
+		QQuaternion referenceRotation;
+		QVector3D referenceScaling = QVector3D(1, 1, 1);
+	};
+
+	// Fixed rate resampling, error bounded key reduction, 16 bit vectors and smallest three quaternions
+	void compress(const CompressionSettings& inSettings = CompressionSettings());
+	bool isCompressed() const { return mSampleRate > 0.0f; }
+	CompressionStatistics getCompressionStatistics() const { return mCompressionStatistics; }
+
+	// Skeleton node -> track, -1 leaves the node to lower layers. Clips are shared between meshes, so the caller keeps the result.
+	QVector<int> buildNodeTracks(const QSkeleton& inSkeleton) const;
+	double durationSeconds() const { return mTicksPerSecond > 0 ? mDuration / mTicksPerSecond : mDuration; }
+	quint32 cursorCount() const { return mTracks.size() * 3; }
+
+	// Blends the animated nodes of ioPose towards the clip, ioCursors remembers the last key of every channel between calls
+	void sample(const QVector<int>& inNodeTracks, double inTimeSec, quint32* ioCursors, QSkeletalPose& ioPose, float inWeight = 1.0f) const;
+	// Applies the clip's offset from its first frame on top of ioPose
+	void sampleAdditive(const QVector<int>& inNodeTracks, double inTimeSec, quint32* ioCursors, QSkeletalPose& ioPose, float inWeight = 1.0f) const;
+
 	QMap<QString, AnimNode> mAnimNode;
 	double mDuration;
 	double mTicksPerSecond;
+
+	float mSampleRate = 0.0f;
+	QVector<Track> mTracks;
+	QVector<quint16> mKeyFrames;					// frame index on the mSampleRate grid
+	QVector<quint16> mKeyData;
+	CompressionStatistics mCompressionStatistics;
 };
 
 class QENGINECORE_API QSkeletalMesh {
+	friend class QAnimationSystem;
 public:
+	enum class BlendMode {
+		Override,									// blends towards the clip by weight
+		Additive									// adds the clip's motion relative to its first frame, scaled by weight
+	};
+
+	struct AnimationLayer {
+		int animIndex = -1;
+		float weight = 1.0f;
+		float speed = 1.0f;
+		BlendMode mode = BlendMode::Override;
+	};
+
+	~QSkeletalMesh();
 	static QSharedPointer<QSkeletalMesh> CreateFromFile(const QString& inFilePath);
 	void resetPoses();
+	// Resolves every clip's tracks against mSkeleton once, compressing clips that are not yet.
+	// QAnimationSystem calls it on the ticking thread before any job runs, clips are never written during evaluation.
+	void bindAnimations();
+
+	// Layers are evaluated bottom up, layer 0 is the base and the only one that cross-fades.
+	// Requests are picked up by QAnimationSystem on the next rendered frame.
 	void playAnimation(int inAnimIndex);
+	void crossFade(int inAnimIndex, float inDurationSec);
+	void setAnimationLayer(int inLayer, const AnimationLayer& inDesc);
+	void removeAnimationLayer(int inLayer);
+	void stopAnimation();
+	bool isAnimationPlaying() const;
+	void setPlaybackSpeed(float inSpeed);
+	float getPlaybackSpeed() const;
+
+	// A snapshot of the pose set published by the last QAnimationSystem tick, later ticks never write into it
+	QVector<MathUtils::Mat4> getCurrentPoses() const;
 protected:
-	void processBoneTransform(QSkeletalAnimation* inAnim, double inTimeMs);
+	bool advanceAnimation(float inDeltaSec);
+	void publishPoses();
+	void evaluateLayers();
 public:
 	using Index = uint32_t;
 	struct Vertex {
@@ -66,16 +177,62 @@ public:
 		uint32_t indicesOffset;
 		uint32_t indicesRange;
 		uint32_t materialIndex;
+		MathUtils::AABB localBounds;
 	};
 
+	void updateBounds();
+
 	QVector<Vertex> mVertices;
 	QVector<Index> mIndices;
 	QVector<SubMeshData> mSubmeshes;
 	QVector<QSharedPointer<QMaterial>> mMaterials;
-	QSharedPointer<QVariantAnimation> mAnimPlayer;
 	QSharedPointer<QSkeleton> mSkeleton;
-	QVector<MathUtils::Mat4> mCurrentPosesMatrix;
 	QVector<QSharedPointer<QSkeletalAnimation>> mAnimations;
+protected:
+	struct AnimationCommand {
+		enum Type {
+			Play,
+			CrossFade,
+			SetLayer,
+			RemoveLayer,
+			Stop
+		} type;
+		int layer = 0;
+		AnimationLayer desc;
+		float fadeDuration = 0.0f;
+	};
+	struct LayerState {
+		AnimationLayer desc;
+		double time = 0.0;
+		QVector<quint32> cursors;
+		int fadeFromAnimIndex = -1;
+		double fadeFromTime = 0.0;
+		QVector<quint32> fadeFromCursors;
+		float fadeElapsed = 0.0f;
+		float fadeDuration = 0.0f;
+		bool bJustStarted = false;				// shows its first frame before time starts advancing
+	};
+	struct AnimationBinding {
+		const QSkeleton* skeleton = nullptr;
+		const QSkeletalAnimation* animation = nullptr;
+		QVector<int> nodeTracks;
+	};
+	void postAnimationCommand(const AnimationCommand& inCommand);
+	bool isAnimationBound(int inAnimIndex) const;
+
+	QVector<MathUtils::Mat4> mPoseBuffers[2];
+	int mFrontPoseBuffer = 0;
+	mutable QMutex mPoseMutex;						// guards the swap, a snapshot shares the front buffer and detaches the writer if still held
+	mutable QMutex mAnimationCommandMutex;
+	QVector<AnimationCommand> mAnimationCommands;
+	QAtomicInt mActiveLayerCount = 0;
+	float mPlaybackSpeed = 1.0f;
+	QVector<LayerState> mLayers;
+	QVector<AnimationBinding> mAnimationBindings;	// indexed like mAnimations
+	QSkeletalPose mPose;
+	QSkeletalPose mFadePose;
+	QVector<QMatrix4x4> mLocalTransforms;
+	QVector<QMatrix4x4> mGlobalTransforms;
 };
 
 #endif // QSkeletalMesh_h__
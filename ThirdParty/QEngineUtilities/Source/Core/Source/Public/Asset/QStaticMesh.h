@@ -7,6 +7,7 @@
 #include "QMatrix4x4"
 #include "QMaterial.h"
 #include "QFont"
+#include "Utils/MathUtils.h"
 #include "QEngineCoreAPI.h"
 
 struct QENGINECORE_API QStaticMesh {
@@ -42,6 +43,20 @@ struct QENGINECORE_API QStaticMesh {
 		QVector2D uv;
 	};
 
+	// 20 bytes, decoded in the vertex shader: unpackSnorm2x16 for position and octahedral directions, unpackHalf2x16 for uv
+	struct CompactVertex {
+		uint32_t position[2];		// snorm16 xyz inside the submesh bounds, snorm16 bitangent sign
+		uint32_t normal;			// octahedral snorm16x2
+		uint32_t tangent;			// octahedral snorm16x2
+		uint32_t uv;				// half2
+	};
+
+	struct LodData {
+		uint32_t indicesOffset;
+		uint32_t indicesRange;
+		float error;					// object space deviation from the full resolution surface
+	};
+
 	struct SubMeshData {
 		uint32_t verticesOffset;
 		uint32_t verticesRange;
@@ -49,9 +64,13 @@ struct QENGINECORE_API QStaticMesh {
 		uint32_t indicesRange;
 		uint32_t materialIndex = 0;
 		QMatrix4x4 localTransfrom;
+		MathUtils::AABB localBounds;
+		QVector<LodData> lods;			// coarser index ranges into the same vertices, level 0 is the range above
 	};
 	using Index = uint32_t;
 
+	void updateBounds();
+
 	QVector<Vertex> mVertices;
 	QVector<Index> mIndices;
 	QVector<SubMeshData> mSubmeshes;
@@ -55,9 +55,7 @@ protected:
 private:
 	QSharedPointer<QAudioProvider> mAudioProvider;
 	QSharedPointer<QSpectrumProvider> mSpectruomProvider;
-	QVector<float> mSpectrum;
 	QTimer* mTimer;
-	QMutex mMutex;
 };
 
 #endif // QSpectrumRenderComponent_h__
@@ -0,0 +1,62 @@
+#ifndef QInstancedStaticMeshRenderComponent_h__
+#define QInstancedStaticMeshRenderComponent_h__
+
+#include "Render/ISceneRenderComponent.h"
+#include "Render/QPrimitiveRenderProxy.h"
+#include "Render/RHI/QRhiMaterialGroup.h"
+#include "Asset/QStaticMesh.h"
+
+class QENGINECORE_API QInstancedStaticMeshRenderComponent :public ISceneRenderComponent {
+	Q_OBJECT
+	Q_PROPERTY(QSharedPointer<QStaticMesh> StaticMesh READ getStaticMesh WRITE setStaticMesh)
+	Q_PROPERTY(QRhiMaterialGroup* Materials READ getMaterialGroup)
+	Q_PROPERTY(float LodErrorThreshold READ getLodErrorThreshold WRITE setLodErrorThreshold)
+
+	Q_BUILDER_BEGIN_SCENE_RENDER_COMP(QInstancedStaticMeshRenderComponent)
+		Q_BUILDER_ATTRIBUTE(QSharedPointer<QStaticMesh>, StaticMesh)
+		Q_BUILDER_ATTRIBUTE(float, LodErrorThreshold)
+		Q_BUILDER_FUNCTION_BEGIN(addInstance, QMatrix4x4 inTransform)
+			Q_BUILDER_OBJECT_PTR->addInstance(inTransform);
+		Q_BUILDER_FUNCTION_END()
+	Q_BUILDER_END()
+public:
+	QInstancedStaticMeshRenderComponent();
+	void setStaticMesh(QSharedPointer<QStaticMesh> val);
+	QSharedPointer<QStaticMesh> getStaticMesh() const;
+	QRhiMaterialGroup* getMaterialGroup();
+
+	void addInstance(const QMatrix4x4& inTransform);
+	void setInstances(const QVector<QMatrix4x4>& inTransforms);
+	const QVector<QMatrix4x4>& getInstances() const { return mInstances; }
+	int getInstanceCount() const { return mInstances.size(); }
+	void setLodErrorThreshold(float val);
+	float getLodErrorThreshold() const;
+	int getInstanceLod(int submeshIndex, int instanceIndex) const;
+protected:
+	void onRebuildResource() override;
+	void updateInstanceBounds();
+	void updateInstanceLods(QRhiResourceUpdateBatch* batch, int submeshIndex, const QPrimitiveRenderProxy::UpdateContext& ctx);
+	void drawInstanceLods(QRhiCommandBuffer* cmdBuffer, int submeshIndex);
+protected:
+	QSharedPointer<QStaticMesh> mStaticMesh;
+	QScopedPointer<QRhiBuffer> mVertexBuffer;
+	QScopedPointer<QRhiBuffer> mIndexBuffer;
+	QScopedPointer<QRhiBuffer> mInstanceBuffer;
+	QVector<QSharedPointer<QPrimitiveRenderProxy>> mProxies;
+	QScopedPointer<QRhiMaterialGroup> mMaterialGroup;
+	QVector<QMatrix4x4> mInstances;
+	quint64 mInstancesVersion = 0;
+	int mInstanceCapacity = 0;			// instances each submesh region of the instance buffer can hold
+	float mLodErrorThreshold = 1.0f;	// pixels of projected simplification error, <= 0 always draws level 0
+
+	// Each submesh owns a region of mInstanceCapacity instances holding the instances grouped by level, one instanced draw per level
+	struct SubmeshInstanceLods {
+		QVector<int> instanceLods;
+		QVector<int> levelOffsets;		// instance index where each level starts, plus the end
+		int instanceCount = 0;
+		quint64 uploadedVersion = ~0ull;
+	};
+	QVector<SubmeshInstanceLods> mSubmeshInstanceLods;
+};
+
+#endif // QInstancedStaticMeshRenderComponent_h__
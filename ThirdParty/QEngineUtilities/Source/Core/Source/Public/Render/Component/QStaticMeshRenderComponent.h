@@ -10,23 +10,40 @@ class QENGINECORE_API QStaticMeshRenderComponent :public ISceneRenderComponent {
 	Q_OBJECT
 	Q_PROPERTY(QSharedPointer<QStaticMesh> StaticMesh READ getStaticMesh WRITE setStaticMesh)
 	Q_PROPERTY(QRhiMaterialGroup* Materials READ getMaterialGroup)
+	Q_PROPERTY(bool CompactVertexLayout READ getCompactVertexLayout WRITE setCompactVertexLayout)
+	Q_PROPERTY(float LodErrorThreshold READ getLodErrorThreshold WRITE setLodErrorThreshold)
 
 	Q_BUILDER_BEGIN_SCENE_RENDER_COMP(QStaticMeshRenderComponent)
 		Q_BUILDER_ATTRIBUTE(QSharedPointer<QStaticMesh>, StaticMesh)
+		Q_BUILDER_ATTRIBUTE(bool, CompactVertexLayout)
+		Q_BUILDER_ATTRIBUTE(float, LodErrorThreshold)
 	Q_BUILDER_END()
 public:
 	QStaticMeshRenderComponent();
 	void setStaticMesh(QSharedPointer<QStaticMesh> val);
 	QSharedPointer<QStaticMesh> getStaticMesh() const;
 	QRhiMaterialGroup* getMaterialGroup();
+	void setCompactVertexLayout(bool val);
+	bool getCompactVertexLayout() const;
+	void setLodErrorThreshold(float val);
+	float getLodErrorThreshold() const;
+	int getSubmeshLod(int submeshIndex) const;
+
+	// pixelsPerUnit is the projected size of one world unit at distance 1, shared by every mesh drawn through the same view
+	static int selectLod(const QStaticMesh::SubMeshData& subMesh, const QMatrix4x4& M, const QVector3D& cameraPosition, float pixelsPerUnit, float errorThreshold, int currentLod);
 protected:
 	void onRebuildResource() override;
+	int selectLod(const QStaticMesh::SubMeshData& subMesh, const QMatrix4x4& M, const QPrimitiveRenderProxy::UpdateContext& ctx, int currentLod) const;
 protected:
 	QSharedPointer<QStaticMesh> mStaticMesh;
 	QScopedPointer<QRhiBuffer> mVertexBuffer;
 	QScopedPointer<QRhiBuffer> mIndexBuffer;
 	QVector<QSharedPointer<QPrimitiveRenderProxy>> mProxies;
 	QScopedPointer<QRhiMaterialGroup> mMaterialGroup;
+	QVector<QStaticMesh::CompactVertex> mCompactVertices;
+	bool bCompactVertexLayout = false;
+	float mLodErrorThreshold = 1.0f;	// pixels of projected simplification error, <= 0 always draws level 0
+	QVector<int> mSubmeshLods;
 };
 
 #endif // QStaticMeshRenderComponent_h__
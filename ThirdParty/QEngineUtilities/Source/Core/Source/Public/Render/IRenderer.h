@@ -27,6 +27,11 @@ public:
 	IRenderer(QRhiHelper::InitParams params, QSize size = QSize(800, 600), Type type = Type::Window);
 
 	QThread* renderThread();
+	// Queues one frame on the render thread, window surfaces drive themselves, offscreen renderers are driven through this
+	void requestRender();
+	// Renders one frame on the render thread and returns once it was submitted
+	void renderFrame();
+	IRendererSurface* surface();
 	QWindow* maybeWindow();
 	QRhi* rhi();
 	QRhiCamera* getCamera();
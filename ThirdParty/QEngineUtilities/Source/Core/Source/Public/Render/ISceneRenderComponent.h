@@ -26,8 +26,11 @@ public:
 	QVector3D getTranslate();
 	QVector3D getRotation();
 	QVector3D getScale3D();
+
+	quint64 getTransformVersion() const { return mTransformVersion; }
 protected:
 	QMatrix4x4 mTransform;
+	quint64 mTransformVersion = 1;
 };
 
 #endif // ISceneRenderComponent_h__
@@ -4,8 +4,10 @@
 #include <QObject>
 #include "Render/RHI/QRhiUniformBlock.h"
 #include "Render/RHI/QRhiMaterialGroup.h"
+#include "Utils/MathUtils.h"
 
 class IRenderer;
+class QRhiSharedPipelines;
 
 class QENGINECORE_API QRhiVertexInputAttributeEx : public QRhiVertexInputAttribute {
 public:
@@ -48,10 +50,11 @@ public:
 		QMatrix4x4 viewMatrix;
 		QMatrix4x4 projectionMatrix;
 		QMatrix4x4 projectionMatrixWithCorr;
+		QSize viewportSize;
 	};
 
 	struct SubPipeline {
-		QSharedPointer<QRhiGraphicsPipeline> pipeline;
+		std::shared_ptr<QRhiGraphicsPipeline> pipeline;
 		QRhiTextureRenderTarget* renderTarget = nullptr;
 		std::function<void(QRhiGraphicsPipeline*)> postSetup;
 	};
@@ -165,7 +168,15 @@ public:
 	void setTexture(const QString& inName, const QImage& inImage);
 
 	QRhiShaderResourceBindings* getShaderResourceBindings() const;
+	void bindShaderResources(QRhiCommandBuffer* cmdBuffer);
+	const QVector<QRhiCommandBuffer::DynamicOffset>& getDynamicOffsets() const { return mDynamicOffsets; }
 	QRhiGraphicsPipeline* getGraphicsPipeline() const;
+	bool isPipelineReady() const;
+
+	void setLocalBounds(const MathUtils::AABB& bounds, const QMatrix4x4& localTransform = QMatrix4x4());
+	const MathUtils::AABB& getWorldBounds();
+	bool isCulled() const { return bCulled; }
+	void setCulled(bool val) { bCulled = val; }
 	IRenderComponent* getRenderComponent() const;
 
 	void setOnUpload(std::function<void(QRhiResourceUpdateBatch* batch)> callback) { mUploadCallback = callback; }
@@ -186,10 +197,12 @@ private:
 	QByteArray getInputFormatTypeName(QRhiVertexInputAttribute::Format inFormat);
 	QByteArray getOutputFormatTypeName(QRhiTexture::Format inFormat);
 	void recreateShaderBindings(QRhiTextureRenderTarget* inRenderTarget, QRhi *inRhi);
+	QRhiUniformRing* getUniformRing() const;
+	QRhiSharedPipelines* getSharedPipelines() const;
 private:
 	IRenderComponent* mRenderComponent = nullptr;
 	bool bIsUploaded = false;
-	QScopedPointer<QRhiGraphicsPipeline> mPipeline;
+	std::shared_ptr<QRhiGraphicsPipeline> mPipeline;
 	QRhiGraphicsPipeline::Topology mTopology = QRhiGraphicsPipeline::Triangles;
 	QRhiGraphicsPipeline::PolygonMode mPolygonMode = QRhiGraphicsPipeline::Fill;
 	QRhiGraphicsPipeline::CullMode mCullMode = QRhiGraphicsPipeline::None;
@@ -210,7 +223,10 @@ private:
 	QRhiVertexInputLayout mVertexInputLayout;
 	QVector<QRhiVertexInputAttributeEx> mInputAttributes;
 	QVector<QRhiVertexInputBindingEx> mInputBindings;
-	QScopedPointer<QRhiShaderResourceBindings> mShaderBindings;
+	std::shared_ptr<QRhiShaderResourceBindings> mShaderBindings;
+	QVector<QRhiUniformBlock*> mDynamicUniformBlocks;
+	QVector<QRhiCommandBuffer::DynamicOffset> mDynamicOffsets;
+	QList<QPair<QRhiShaderStage::Type, QFuture<QShader>>> mPendingShaders;
 	QHash<QRhiShaderStage::Type, StageInfo> mStageInfos;
 	QMap<QString, QRhiUniformBlock*> mUniformMap;
 	QMap<QString, QRhiTextureDesc*> mTextureMap;
@@ -221,6 +237,12 @@ private:
 	std::function<void(QRhiCommandBuffer* cmdBuffer)> mDrawCallback;
 
 	QMap<QString, SubPipeline> mSubPipelineMap;
+
+	MathUtils::AABB mLocalBounds;
+	QMatrix4x4 mLocalTransform;
+	MathUtils::AABB mWorldBounds;
+	quint64 mWorldBoundsVersion = 0;
+	bool bCulled = false;
 };
 
 Q_DECLARE_METATYPE(QPrimitiveRenderProxy*);
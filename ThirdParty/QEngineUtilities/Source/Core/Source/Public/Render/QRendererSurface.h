@@ -2,6 +2,11 @@
 #define QRendererSurface_h__
 
 #include <QWindow>
+#include <QImage>
+#include <QFuture>
+#include <QQueue>
+#include <QThreadPool>
+#include <functional>
 #include "RenderGraph/QRenderGraphBuilder.h"
 #include "IRenderer.h"
 
@@ -51,25 +56,51 @@ private:
 	void endFrame() override;
 };
 
-class QRendererOffscreenSurface: public IRendererSurface {
+class QENGINECORE_API QRendererOffscreenSurface: public IRendererSurface {
 public:
+	struct Statistics {
+		quint64 framesSubmitted = 0;
+		quint64 framesRetired = 0;		// frames whose readback has been delivered
+		quint64 stalls = 0;				// beginFrame had to wait because the delivery queue was full
+		int maxFramesInFlight = 0;		// frames read back but not yet delivered, at the end of a frame
+	};
+	using FrameCallback = std::function<void(quint64 frameIndex, const QImage& image)>;
+
 	QRendererOffscreenSurface(QSize size);
+
+	// Every finished frame is read back and handed to the callback in frame order on a worker thread. The render thread records
+	// the next frames meanwhile and only waits once getFramesInFlight() frames are queued for delivery
+	void setFrameCallback(FrameCallback inCallback);
+	Statistics getStatistics() const;
+	int getFramesInFlight() const;
 private:
 	QRhi* mRhi = nullptr;
 	QSize mRequestSize;
 	int mRequestSampleCount = 1;
+	int mRequestFramesInFlight = 2;
 	QRhi::BeginFrameFlags mBeginFrameFlags;
 	QRhi::EndFrameFlags mEndFrameFlags;
+	// QRhi finishes an offscreen frame and its readback inside endOffscreenFrame on every backend, so one target serves all frames
 	QScopedPointer<QRhiTexture> mColorAttachment;
 	QScopedPointer<QRhiTexture> mDepthStencilAttachment;
 	QScopedPointer<QRhiTextureRenderTarget> mRenderTarget;
 	QScopedPointer<QRhiRenderPassDescriptor> mRenderPassDesc;
+	QRhiReadbackResult mReadback;
+	QQueue<QFuture<void>> mDeliveries;		// oldest first, at most mRequestFramesInFlight
+	QRhiCommandBuffer* mCmdBuffer = nullptr;
+	quint64 mFrameIndex = 0;
+	FrameCallback mFrameCallback;
+	mutable QMutex mMutex;
+	Statistics mStatistics;
+	QThreadPool mDeliveryThreadPool;		// last, so pending deliveries finish before the members they touch go away
 protected:
 	void resize(const QSize& size) override;
 	void initialize(QRhi* rhi, QRhiHelper::InitParams initParams) override;
 	void destroy() override;
 	bool beginFrame(QRhiCommandBuffer** outCmdBuffer, QRhiRenderTarget** outRenderTarget) override;
 	void endFrame() override;
+
+	void releaseResources();
 };
 
 
@@ -4,6 +4,8 @@
 #include "private/qrhi_p.h"
 #include "private/qrhivulkan_p.h"
 #include <QWindow>
+#include <QFuture>
+#include <QThreadPool>
 #include "QEngineCoreAPI.h"
 
 class QENGINECORE_API QShaderDefinitions {
@@ -33,13 +35,31 @@ struct QENGINECORE_API QRhiHelper {
 		QRhi::BeginFrameFlags beginFrameFlags;
 		QRhi::EndFrameFlags endFrameFlags;
 		int sampleCount = 1;
+		int offscreenFramesInFlight = 2;	// frames an offscreen renderer may queue for delivery before it waits
 		bool enableStat = false;
 	};
 
 	static QSharedPointer<QRhi> create(QRhi::Implementation inBackend = QRhi::Vulkan, QRhi::Flags inFlags = QRhi::Flag(), QWindow* inWindow = nullptr);
 
+	struct QENGINECORE_API ShaderCacheStats {
+		quint64 memoryHits = 0;
+		quint64 diskHits = 0;
+		quint64 misses = 0;
+	};
+
 	static QShader newShaderFromCode(QShader::Stage stage, QByteArray code, QByteArray preamble = QByteArray());
 
+	static QFuture<QShader> newShaderFromCodeAsync(QShader::Stage stage, QByteArray code, QByteArray preamble = QByteArray());
+
+	static QThreadPool* shaderCompileThreadPool();
+
+	static void setShaderCacheDirectory(const QString& dir);
+	static QString getShaderCacheDirectory();
+	// Baked shaders kept in memory are evicted least recently used first once their serialized size exceeds this
+	static void setShaderMemoryCacheLimit(qint64 bytes);
+	static ShaderCacheStats getShaderCacheStats();
+	static void clearShaderCache(bool removeFromDisk = false);
+
 	static QShader newShaderFromQSBFile(const char* filename);
 
 	static QRhiBuffer* newVkBuffer(QRhi* rhi, QRhiBuffer::Type type, VkBufferUsageFlags flags, int size);
@@ -4,9 +4,12 @@
 #include <QObject>
 #include "Asset/QMaterial.h"
 #include "Render/RHI/QRhiUniformBlock.h"
+#include "Render/RHI/QRhiTextureProcessor.h"
 #include "QEngineCoreAPI.h"
 
 struct QENGINECORE_API QRhiTextureDesc {
+	void setImage(const QImage& inImage, const QRhiTextureProcessor::Options& inOptions);
+
 	QString Name;
 	QImage ImageCache;
 	QSize Size;
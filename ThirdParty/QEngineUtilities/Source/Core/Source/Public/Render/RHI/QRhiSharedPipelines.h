@@ -0,0 +1,38 @@
+#ifndef QRhiSharedPipelines_h__
+#define QRhiSharedPipelines_h__
+
+#include <QMutex>
+#include "Render/RenderGraph/QRGRhiResourcePool.h"
+
+// Proxies with identical shaders, states and binding layouts share one pipeline, proxies that sample the same textures share one srb.
+// Owned by the render graph builder, so nothing registered here outlives the QRhi it was created with.
+class QENGINECORE_API QRhiSharedPipelines {
+public:
+	QRhiSharedPipelines(QRhi* inRhi);
+
+	// Takes ownership of the candidate, it is deleted when an equivalent pipeline already exists
+	QRhiGraphicsPipelineRef findOrCreatePipeline(QRhiGraphicsPipeline* candidate, const std::shared_ptr<QRhiShaderResourceBindings>& bindings);
+	std::shared_ptr<QRhiShaderResourceBindings> findOrCreateBindings(const QVector<QRhiShaderResourceBinding>& bindings);
+
+	// Drops the entries no proxy holds any more, together with the srb each dropped pipeline was created against
+	void prune();
+	void clear();
+
+	int getPipelineCount() const;
+	int getBindingsCount() const;
+private:
+	struct SharedPipeline {
+		std::weak_ptr<QRhiGraphicsPipeline> pipeline;
+		QRhiGraphicsPipelineState state;
+		std::shared_ptr<QRhiShaderResourceBindings> layoutBindings;	// the pipeline was created against this srb, it must outlive the pipeline
+	};
+
+	void pruneLocked();
+
+	QRhi* mRhi = nullptr;
+	mutable QMutex mMutex;
+	QMultiHash<size_t, SharedPipeline> mPipelines;
+	QHash<size_t, std::weak_ptr<QRhiShaderResourceBindings>> mBindings;
+};
+
+#endif // QRhiSharedPipelines_h__
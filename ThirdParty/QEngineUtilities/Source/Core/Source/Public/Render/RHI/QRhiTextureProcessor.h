@@ -0,0 +1,68 @@
+#ifndef QRhiTextureProcessor_h__
+#define QRhiTextureProcessor_h__
+
+#include "Render/RHI/QRhiHelper.h"
+#include <QImage>
+
+// Builds mip chains and block compressed levels for sampled textures, results are cached in memory by QImage::cacheKey() and on disk by pixel content
+class QENGINECORE_API QRhiTextureProcessor {
+public:
+	enum class Compression {
+		None,
+		Auto,		// BC1 when opaque, otherwise BC7 at Quality::High and BC3 at Quality::Fast
+		BC1,
+		BC3,
+		BC5,
+		BC7			// mode 6 only: one RGBA subset with 4 bit indices
+	};
+
+	enum class Quality {
+		Fast,		// box filtered mips, bounding box endpoints
+		High		// [1 3 3 1] filtered mips, principal axis endpoints with a least squares refinement
+	};
+
+	struct Options {
+		bool generateMips = false;
+		Compression compression = Compression::None;
+		Quality quality = Quality::Fast;
+	};
+
+	struct Result {
+		QRhiTexture::Format format = QRhiTexture::RGBA8;
+		QSize size;
+		QList<QByteArray> levels;
+
+		bool isValid() const { return !levels.isEmpty(); }
+		QRhiTextureUploadDescription uploadDescription() const;
+	};
+
+	struct Statistics {
+		quint64 processedTextures = 0;
+		quint64 cacheHits = 0;
+		quint64 memoryCacheHits = 0;
+		quint64 encodedBytes = 0;
+		quint64 encodeNanoseconds = 0;
+
+		double encodeThroughputMBs() const;
+	};
+
+	static Result process(const QImage& inImage, const Options& inOptions);
+
+	static void setMaterialOptions(const Options& inOptions);
+	static Options getMaterialOptions();
+
+	static void setCacheDirectory(const QString& dir);
+	static QString getCacheDirectory();
+	static void setMemoryCacheBudget(qsizetype bytes);
+	static qsizetype getMemoryCacheBudget();
+	static void clearMemoryCache();
+	static void setCacheEnabled(bool enabled);
+	static bool isCacheEnabled();
+
+	static Statistics getStatistics();
+	static void resetStatistics();
+
+	static QThreadPool* encodeThreadPool();
+};
+
+#endif // QRhiTextureProcessor_h__
@@ -2,11 +2,13 @@
 #define QRhiUniformBlock_h__
 
 #include <QVariant>
+#include <cstring>
 #include "Render/RHI/QRhiHelper.h"
 #include "QList"
 #include "Type/QColor4D.h"
 
 class IRenderComponent;
+class QRhiUniformRing;
 
 struct QENGINECORE_API UniformParamDescBase {
 	virtual const char* typeName() = 0;
@@ -22,9 +24,9 @@ struct QENGINECORE_API UniformParamDescBase {
 	virtual QString valueName() { return mName; }
 	QString mName;
 	QVariant mValue;
-	uint32_t mOffsetInByte;
-	uint32_t mSizeInByte;
-	uint32_t mSizeInByteAligned;
+	uint32_t mOffsetInByte = 0;
+	uint32_t mSizeInByte = 0;
+	uint32_t mSizeInByteAligned = 0;
 	bool bVisible;
 	QRhiSignal sigUpdate; 
 	QRhiSignal sigRecreate;
@@ -38,6 +40,11 @@ struct UniformParamDesc : public UniformParamDescBase {
 class QENGINECORE_API QRhiUniformBlock : public QObject{
 	Q_OBJECT
 public:
+	struct ParamHandle {
+		UniformParamDescBase* desc = nullptr;
+		bool isValid() const { return desc != nullptr; }
+	};
+
 	QRhiUniformBlock(QObject* inParent = nullptr);
 	template<typename _Ty>
 	QRhiUniformBlock* addParam(const QString& name, _Ty value,bool visible = true) {
@@ -56,11 +63,31 @@ public:
 	}
 
 	void setParamValue(const QString& mName, QVariant mValue);
+
+	// Resolve once, then write without QVariant boxing or name lookups; the handle stays valid until the param is removed
+	ParamHandle getParamHandle(const QString& inName) const;
+
+	template<typename _Ty>
+	void setParamValue(ParamHandle handle, const _Ty& value) {
+		static_assert(std::is_trivially_copyable_v<_Ty>, "typed uniform writes need a trivially copyable value");
+		UniformParamDescBase* desc = handle.desc;
+		if (desc == nullptr)
+			return;
+		Q_ASSERT(desc->dataByteSize() == sizeof(_Ty));
+		void* valuePtr = desc->dataPtr();
+		if (memcmp(valuePtr, &value, sizeof(_Ty)) == 0)
+			return;
+		memcpy(valuePtr, &value, sizeof(_Ty));
+		writeStaging(desc, &value, sizeof(_Ty));
+	}
 	bool renameParma(const QString& src, const QString& dst);
 	void removeParam(const QString& mName);
 	void create(QRhi* inRhi);
+	void create(QRhiUniformRing* inRing);
 	void updateResource(QRhiResourceUpdateBatch* batch);
+	quint32 updateResource(QRhiUniformRing* inRing);
 	QRhiBuffer* getUniformBlock() const { return mUniformBlock.get(); }
+	uint32_t getDataByteSize() const { return mDataByteSize; }
 	bool isEmpty()const { return mParamList.isEmpty(); }
 	const QList<QSharedPointer<UniformParamDescBase>>& getParamList() const { return mParamList; }
 	QSharedPointer<UniformParamDescBase> getParamDesc(const QString& inName);
@@ -68,11 +95,18 @@ public:
 protected:
 	QString getVaildName(QString mName);
 	void updateLayout();
+	void writeStaging(UniformParamDescBase* inDesc, const void* inData, uint32_t inSize);
+	bool stageParamUpdates();
 protected:
 	QList<QSharedPointer<UniformParamDescBase>> mParamList;
 	QHash<QString, QSharedPointer<UniformParamDescBase>> mParamNameMap;
-	uint32_t mDataByteSize;
+	uint32_t mDataByteSize = 0;
 	QScopedPointer<QRhiBuffer> mUniformBlock;
+	QByteArray mStagingData;
+	uint32_t mDirtyBegin = 0;
+	uint32_t mDirtyEnd = 0;
+	quint64 mRingFrameIndex = 0;
+	quint32 mRingOffset = 0;
 public:
 	QRhiSignal sigRecreateBuffer;
 };
@@ -127,7 +161,7 @@ template<>
 struct UniformParamDesc<QGenericMatrix<4, 4, float>> : public UniformParamDescBase {
 	const char* typeName() override { return "mat4"; }
 	int dataByteSize() override { return sizeof(float) * 16; }
-	int dataAlignSize() override { return sizeof(float) * 16; }
+	int dataAlignSize() override { return sizeof(float) * 4; }
 };
 
 template<typename _Ty,size_t _Size>
@@ -0,0 +1,43 @@
+#ifndef QRhiUniformRing_h__
+#define QRhiUniformRing_h__
+
+#include "Render/RHI/QRhiHelper.h"
+
+// Linear per-frame allocator over one dynamic uniform buffer, QRhi keeps a copy of it for every frame in flight.
+// The buffer never changes size while a frame is recorded, it grows in nextFrame() to fit the previous frame's peak.
+class QENGINECORE_API QRhiUniformRing {
+public:
+	static constexpr quint32 InvalidOffset = 0xFFFFFFFF;
+
+	struct Statistics {
+		quint64 bufferAllocations = 0;
+		quint64 frameAllocations = 0;
+		quint64 frameOverflows = 0;
+		quint64 frameUploads = 0;
+		quint64 frameBytes = 0;
+		quint64 capacity = 0;
+	};
+
+	QRhiUniformRing(QRhi* inRhi, quint32 inInitialSize = 256 * 1024);
+
+	QRhiBuffer* getBuffer() const { return mBuffer.get(); }
+	quint64 getFrameIndex() const { return mFrameIndex; }
+	const Statistics& getStatistics() const { return mStatistics; }
+
+	// Returns InvalidOffset when the block does not fit this frame, the caller must not draw with it
+	quint32 allocate(const void* inData, quint32 inSize);
+	void flush(QRhiResourceUpdateBatch* batch);
+	void nextFrame();
+private:
+	QRhi* mRhi = nullptr;
+	QScopedPointer<QRhiBuffer> mBuffer;
+	QByteArray mFrameData;
+	quint32 mCursor = 0;
+	quint32 mFlushedCursor = 0;
+	quint32 mRequestedBytes = 0;
+	quint32 mAlignment = 256;
+	quint64 mFrameIndex = 1;
+	Statistics mStatistics;
+};
+
+#endif // QRhiUniformRing_h__
@@ -20,8 +20,9 @@
 					Output setup() { \
 						ZoneScopedN(#PassBuilderClass); \
 						mPassBuilder->mInput = *this; \
+						mRGBuilder->beginPassSetup(mPassBuilder); \
 						mPassBuilder->setup(*mRGBuilder); \
-						mRGBuilder->addPass([PassBuilder = mPassBuilder](QRhiCommandBuffer* cmdBuffer){ \
+						mRGBuilder->endPassSetup([PassBuilder = mPassBuilder](QRhiCommandBuffer* cmdBuffer){ \
 							ZoneScopedN(#PassBuilderClass); \
 							PassBuilder->execute(cmdBuffer); \
 						}); \
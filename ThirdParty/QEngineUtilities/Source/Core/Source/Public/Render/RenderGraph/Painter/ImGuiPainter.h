@@ -24,6 +24,7 @@ protected:
 	bool eventFilter(QObject* watched, QEvent* event) override;
 	QWindow* getWindow() const { return mWindow; }
 	void tryRebuildFontTexture();
+	void buildFrame();
 protected:
 	struct LocalImage {
 		QImage mImage;
@@ -37,6 +38,8 @@ protected:
 	QShader mImGuiFS;
 	QRhiGraphicsPipelineRef mPipeline;
 	QRhiShaderResourceBindingsRef mDynamicBindings;
+	QSet<QRhiTexture*> mExternalTextures;		// sampled by the draw lists of the frame being built
+	bool bFrameBuilt = false;
 	QRhiBufferRef mVertexBuffer;
 	QRhiBufferRef mIndexBuffer;
 	QRhiBufferRef mUniformBuffer;
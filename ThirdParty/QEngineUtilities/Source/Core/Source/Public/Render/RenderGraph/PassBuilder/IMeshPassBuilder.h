@@ -4,10 +4,27 @@
 #include "Render/RenderGraph/IRenderPassBuilder.h"
 
 class QENGINECORE_API IMeshPassBuilder : public IRenderPassBuilder {
+public:
+	struct DrawStats {
+		int drawCount = 0;
+		int pipelineSwitches = 0;
+		int bindingSwitches = 0;
+		int visibleCount = 0;
+		int culledCount = 0;
+	};
+	const DrawStats& getDrawStats() const { return mDrawStats; }
 protected:
 	virtual QRhiTextureRenderTarget* renderTarget() = 0;
 	void setup(QRenderGraphBuilder& builder) override;
 	void execute(QRhiCommandBuffer* cmdBuffer) override;
+private:
+	struct DrawItem {
+		quint64 sortKey = 0;
+		QPrimitiveRenderProxy* proxy = nullptr;
+	};
+	QVector<DrawItem> mDrawList;
+	QVector<bool> mVisibility;
+	DrawStats mDrawStats;
 };
 
 #endif // IMeshPassBuilder_h__
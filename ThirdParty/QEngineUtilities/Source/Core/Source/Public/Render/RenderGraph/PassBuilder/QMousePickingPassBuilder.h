@@ -1,38 +1,57 @@
 #ifndef QMousePickingPassBuilder_h__
 #define QMousePickingPassBuilder_h__
 
+#include <QPointer>
 #include "Render/RenderGraph/IRenderPassBuilder.h"
 class IRenderComponent;
 
 class QENGINECORE_API QMousePickingPassBuilder: public QObject , public IRenderPassBuilder{
 	Q_OBJECT
 	QRP_INPUT_BEGIN(QMousePickingPassBuilder)
+		QRP_INPUT_ATTR(QRhiTextureRef, SceneDepth);
 	QRP_INPUT_END()
 
 	QRP_OUTPUT_BEGIN(QMousePickingPassBuilder)
 		QRP_OUTPUT_ATTR(QRhiTextureRef,SelectMask)
 	QRP_OUTPUT_END()
 public:
+	// Picks in flight at once, further clicks wait for a free slot and only the newest result is delivered
+	static constexpr int ReadbackRingSize = 3;
+
 	QMousePickingPassBuilder();
 	void requestPick(QPoint point);
 Q_SIGNALS:
 	void componentSelected(IRenderComponent*);
 private:
+	struct PickReadback {
+		QRhiTextureRef texture;
+		QRhiReadbackResult result;
+		quint64 serial = 0;
+		bool bInFlight = false;
+	};
+
 	QRhiSignal mSigPick;
-	QPoint mReadPoint;	
-	QRhiTextureRef mDSTexture;
-	QRhiBufferRef mReadbackBuffer;
+	QPoint mReadPoint;
+	QRhiTextureRef mIdTexture;
+	QRhiRenderBufferRef mIdDepthStencil;
 	QRhiTextureRenderTargetRef mRenderTarget;
-	QRhiReadbackResult mReadbackResult;
+	QRhiTextureRenderTargetRef mIdRenderTarget;
+	PickReadback mReadbacks[ReadbackRingSize];
+	quint64 mPickSerial = 0;
+	bool bMaskDepthTested = false;
+
+	// Ids stay with a component for its lifetime, so in flight picks never see a reordered list
+	QHash<IRenderComponent*, quint32> mPickIds;
+	QHash<quint32, QPointer<IRenderComponent>> mPickComponents;
+	quint32 mNextPickId = 1;
 
 	QShader mSelectMaskFS;
-	QRhiShaderResourceBindingsRef mSelectMaskBindings;
-	QRhiGraphicsPipelineRef mSelectMaskPipeline;
 protected:
 	void setup(QRenderGraphBuilder& builder) override;
 	void execute(QRhiCommandBuffer* cmdBuffer) override;
 
-	void makeCopyTextureToBufferCommand(QRhiCommandBuffer* cmdBuffer);
+	quint32 getPickId(IRenderComponent* component);
+	void resolvePick(PickReadback& readback);
 };
 
 #endif // QMousePickingPassBuilder_h__
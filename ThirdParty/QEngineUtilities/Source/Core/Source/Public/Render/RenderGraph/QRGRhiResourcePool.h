@@ -1,8 +1,11 @@
 #ifndef QRGRhiResourcePool_h__
 #define QRGRhiResourcePool_h__
 
+#include <QMap>
 #include <QMultiHash>
+#include <QSet>
 #include <rhi/qrhi.h>
+#include "QEngineCoreAPI.h"
 
 typedef std::shared_ptr<QRhiBuffer> QRhiBufferRef;
 typedef std::shared_ptr<QRhiTexture> QRhiTextureRef;
@@ -41,6 +44,7 @@ struct QRhiGraphicsPipelineState {
 	QRhiRenderPassDescriptor* renderPassDesc = nullptr;
 	static QRhiGraphicsPipelineState createFrom(QRhiGraphicsPipeline* pipeline);
 	void assignTo(QRhiGraphicsPipeline* pipeline) const;
+	bool operator==(const QRhiGraphicsPipelineState& other) const;
 };
 
 struct QRhiComputePipelineState {
@@ -52,8 +56,16 @@ struct QRhiComputePipelineState {
 	void assignTo(QRhiComputePipeline* pipeline) const;
 };
 
-class QRGRhiResourcePool {
+class QENGINECORE_API QRGRhiResourcePool {
 public:
+	struct Statistics {
+		int liveCount = 0;
+		quint64 bytes = 0;
+		quint64 hits = 0;
+		quint64 misses = 0;
+		quint64 evictions = 0;
+	};
+
 	QRGRhiResourcePool(QRhi* rhi);
 
 	static size_t hash(QRhiBuffer::Type type, QRhiBuffer::UsageFlags usage, quint32 size);
@@ -65,6 +77,9 @@ public:
 	static size_t hash(const QRhiGraphicsPipelineState& state);
 	static size_t hash(const QRhiComputePipelineState& state);
 
+	static quint64 byteSize(QRhiTexture::Format format, const QSize& pixelSize, int sampleCount, QRhiTexture::Flags flags);
+	static quint64 byteSize(QRhiRenderBuffer::Type type, const QSize& pixelSize, int sampleCount, QRhiTexture::Format backingFormatHint);
+
 	QRhiBufferRef findOrNew(QRhiBuffer::Type type, QRhiBuffer::UsageFlags usage, quint32 size);
 	QRhiTextureRef findOrNew(QRhiTexture::Format format, const QSize& pixelSize, int sampleCount, QRhiTexture::Flags flags);
 	QRhiSamplerRef findOrNew(QRhiSampler::Filter magFilter, QRhiSampler::Filter minFilter, QRhiSampler::Filter mipmapMode, QRhiSampler::AddressMode addressU, QRhiSampler::AddressMode addressV, QRhiSampler::AddressMode addressW);
@@ -92,10 +107,31 @@ public:
 	void recreateGraphicsPipelines();
 	void recreateComputePipelines();
 
+	void collectGarbage();
+	Statistics getStatistics(QRhiResource::Type type) const;
+	void setBudget(QRhiResource::Type type, quint64 bytes);
+	void setMaxIdleFrames(int frames) { mMaxIdleFrames = frames; }
+	int getMaxIdleFrames() const { return mMaxIdleFrames; }
 private:
+	struct ResourceInfo {
+		QRhiResource::Type type = QRhiResource::Buffer;
+		size_t hashCode = 0;
+		quint64 byteSize = 0;
+		quint64 lastUsedFrame = 0;
+	};
 	bool fixupResHash(QRhiResource* res, size_t newHashCode);
+	void registerResource(QRhiResource* res, size_t hashCode, quint64 byteSize);
+	void updateByteSize(QRhiResource* res, quint64 byteSize);
+	void markHit(QRhiResource* res);
+	template<typename Ref> void stampUsage(const QMultiHash<size_t, Ref>& pool, int& idleCount, quint64& oldestIdleFrame);
+	template<typename Ref> void collectIdle(const QMultiHash<size_t, Ref>& pool, QSet<QRhiResource*>& idle) const;
+	template<typename Ref> void evictFrom(QMultiHash<size_t, Ref>& pool, const QSet<QRhiResource*>& evictSet);
 protected:
 	QRhi* mRhi = nullptr;
+	quint64 mFrameIndex = 0;
+	int mMaxIdleFrames = 120;
+	QMap<QRhiResource::Type, quint64> mBudgets;
+	QMap<QRhiResource::Type, Statistics> mStatistics;
 	QMultiHash<size_t, QRhiBufferRef> mBufferPool;
 	QMultiHash<size_t, QRhiTextureRef> mTexturePool;
 	QMultiHash<size_t, QRhiSamplerRef> mSamplerPool;
@@ -106,7 +142,7 @@ protected:
 	QMultiHash<size_t, QRhiComputePipelineRef> mComputePipelinePool;
 	QHash<QRhiRenderTarget*, QRhiRenderPassDescriptorRef> mRenderPassDescPool;
 
-	QHash<QRhiResource*, size_t> mRhiHashMap;
+	QHash<QRhiResource*, ResourceInfo> mResourceInfoMap;
 	QList<QRhiBuffer*> mBufferToRecreate;
 	QList<QRhiTexture*> mTextureToRecreate;
 	QList<QRhiSampler*> mSamplerToRecreate;
@@ -1,8 +1,11 @@
 #ifndef QRenderGraphBuilder_h__
 #define QRenderGraphBuilder_h__
 
+#include <QSet>
 #include "Render/RHI/QRhiHelper.h"
 #include "QRGRhiResourcePool.h"
+#include "Render/RHI/QRhiUniformRing.h"
+#include "Render/RHI/QRhiSharedPipelines.h"
 #include "QEngineCoreAPI.h"
 
 class IRenderPassBuilder;
@@ -10,6 +13,15 @@ class IRenderer;
 
 class QENGINECORE_API QRenderGraphBuilder {
 public:
+	struct CompileStats {
+		int passCount = 0;
+		int culledPassCount = 0;
+		int transientResourceCount = 0;
+		int aliasedResourceCount = 0;
+		quint64 transientBytes = 0;
+		quint64 aliasedTransientBytes = 0;
+	};
+
 	QRenderGraphBuilder(IRenderer* renderer);
 
 	void setupBuffer(QRhiBufferRef& buffer, const QByteArray& name, QRhiBuffer::Type type, QRhiBuffer::UsageFlags usages, int size);
@@ -51,6 +63,12 @@ public:
 
 	void addPass(std::function<void(QRhiCommandBuffer*)> executor);
 
+	void declareRead(QRhiResource* resource);
+	void declareWrite(QRhiResource* resource);
+	void declareSideEffect();
+	// For resources consumed after the graph ran (UI images, readbacks), keeps their producers alive and their memory unaliased
+	void declareExternalRead(QRhiResource* resource);
+
 	template<typename RGPassBuilder>
 	typename RGPassBuilder::Input& addPassBuilder(const QString& uniqueName) {
 		RGPassBuilder* passBuilder = (RGPassBuilder*) mPassBuilderMap.value(uniqueName).get();
@@ -83,17 +101,66 @@ public:
 	const QMap<QRhiTextureRenderTarget*, QList<QRhiGraphicsPipeline*>>& getRenderTargetPipelines() const;
 	QRhiRenderTarget* getMainRenderTarget() const;
 	void setMainRenderTarget(QRhiRenderTarget* renderTarget);
+	const CompileStats& getCompileStats() const;
+	QRGRhiResourcePool* getResourcePool() const;
+	QRhiUniformRing* getUniformRing() const;
+	QRhiSharedPipelines* getSharedPipelines() const;
+	bool isPassCullingEnabled() const { return bPassCullingEnabled; }
+	void setPassCullingEnabled(bool enabled) { bPassCullingEnabled = enabled; }
+	bool isTransientAliasingEnabled() const { return bTransientAliasingEnabled; }
+	void setTransientAliasingEnabled(bool enabled) { bTransientAliasingEnabled = enabled; }
 public:
-	void compile();
+	void beginPassSetup(IRenderPassBuilder* passBuilder);
+	void endPassSetup(std::function<void(QRhiCommandBuffer*)> executor);
+	// Returns false when the transient alias plan changed, the graph has to be reset and set up again so the plan applies this frame
+	bool compile();
 	void execute(QRhiCommandBuffer* cmdBuffer);
+	void resetGraph();
 	void clear();
+private:
+	struct TransientResource {
+		QString key;
+		std::shared_ptr<QRhiResource> resource;
+		size_t descHash = 0;
+		quint64 byteSize = 0;
+		int passIndex = -1;
+	};
+
+	struct PassNode {
+		IRenderPassBuilder* builder = nullptr;
+		std::function<void(QRhiCommandBuffer*)> executor;
+		QSet<QRhiResource*> reads;
+		QSet<QRhiResource*> writes;
+		QList<TransientResource> transients;
+		bool bHasSideEffect = false;
+		bool bCulled = false;
+	};
+
+	PassNode* currentPass();
+	QString transientKey(const QByteArray& name) const;
+	std::shared_ptr<QRhiResource> findAliasedResource(const QString& key, size_t descHash) const;
+	void registerTransient(const QString& key, std::shared_ptr<QRhiResource> resource, size_t descHash, quint64 byteSize);
+	void trackBindings(const QVector<QRhiShaderResourceBinding>& binds);
+	void cullPasses();
+	bool aliasTransientResources();
 private:
 	QRhi* mRhi;
 	IRenderer* mRenderer = nullptr;
 	QRhiRenderTarget* mMainRenderTarget = nullptr;
 	QShader mFullScreenVertexShader;
 	QScopedPointer<QRGRhiResourcePool> mResourcePool;
-	QVector<std::function<void(QRhiCommandBuffer*)>> mExecutors;
+	QScopedPointer<QRhiUniformRing> mUniformRing;
+	QScopedPointer<QRhiSharedPipelines> mSharedPipelines;
+	QVector<PassNode> mPasses;
+	QVector<PassNode> mPassStack;
+	QSet<QString> mTransientKeys;
+	QHash<QString, TransientResource> mAliasPlan;
+	QSet<QRhiResource*> mSharedResources;
+	QSet<QRhiResource*> mExternalReads;
+	CompileStats mCompileStats;
+	bool bPassCullingEnabled = true;
+	bool bTransientAliasingEnabled = true;
+	bool bAliasPlanSettled = false;
 	QHash<QString, QSharedPointer<IRenderPassBuilder>> mPassBuilderMap;
 	QList<QRhiTextureRenderTarget*> mActivatedRenderTargets;
 	QMap<QRhiTextureRenderTarget*, QList<QRhiGraphicsPipeline*>> mRenderTargetPipelines;
@@ -1,6 +1,7 @@
 #ifndef MathUtils_h__
 #define MathUtils_h__
 
+#include <cfloat>
 #include "QGenericMatrix"
 #include "qvectornd.h"
 #include "QMatrix4x4"
@@ -10,6 +11,26 @@ class QENGINECORE_API MathUtils {
 public:
 	using Mat4 = QGenericMatrix<4, 4, float>;
 
+	struct QENGINECORE_API AABB {
+		QVector3D min = QVector3D(FLT_MAX, FLT_MAX, FLT_MAX);
+		QVector3D max = QVector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		bool isValid() const { return min.x() <= max.x() && min.y() <= max.y() && min.z() <= max.z(); }
+		void extend(const QVector3D& point);
+		QVector3D center() const { return (min + max) * 0.5f; }
+		QVector3D extent() const { return (max - min) * 0.5f; }
+		float radius() const { return extent().length(); }
+		AABB transformed(const QMatrix4x4& mat4) const;
+	};
+
+	struct QENGINECORE_API Frustum {
+		QVector4D planes[6];
+
+		static Frustum fromMatrix(const QMatrix4x4& viewProjection);
+		bool intersects(const AABB& box) const;
+		void intersects(const AABB* boxes, int count, bool* outVisible) const;
+	};
+
 	static void setMatTranslate(QMatrix4x4& mat4, QVector3D translate);
 	static void setMatRotation(QMatrix4x4& mat4, QVector3D rotation);
 	static void setMatScale3D(QMatrix4x4& mat4, QVector3D scale3D);
@@ -8,12 +8,14 @@
 #include <QSharedPointer>
 #include <QAudioDevice>
 #include "QEngineCoreAPI.h"
+#include "Utils/QTripleBuffer.h"
 
 class QBuffer;
 class QMediaDevices;
 class QAudioDecoder;
 class QAudioSink;
 class QSpectrumProvider;
+class QAudioStreamDevice;
 struct fftw_plan_s;
 
 class QENGINECORE_API QAudioProvider: public QObject {
@@ -31,48 +33,92 @@ public:
 		SinWindow
 	};
 	Q_ENUM(WindowFunction)
+
+	enum ChannelMode {
+		SingleChannel,		//	只分析一个声道
+		PerChannel,			//	每个声道一份频谱
+		MidSide				//	中置(L+R)/2 与侧向(L-R)/2
+	};
+	Q_ENUM(ChannelMode)
 public:
 	QAudioProvider();
 	void setSource(QUrl inUrl);
 	void setAudioDevice(const QAudioDevice& deviceInfo);
 	void setWindowFunction(WindowFunction inType);
 	void setFramesPerBuffer(int size);
+	void setChannelMode(ChannelMode inMode);
+	void setStreaming(bool enabled);
+	void setStreamBufferDuration(int msecs);
 	void play();
+	void seek(qint64 usecs);
 
 	QUrl getSource() const { return mUrl; }
 	WindowFunction getWindowFunction() const { return mCtx.windowType; }
 	int getFramesPerBuffer() const { return mCtx.framesPerBuffer; }
+	ChannelMode getChannelMode() const { return mDesiredCtx.channelMode; }
+	bool isStreaming() const { return bStreaming; }
+	int getStreamBufferDuration() const { return mStreamBufferMsecs; }
+	qint64 getStreamCapacity() const;
 	QList<QAudioDevice> getAudioOutputDevices();
 	QAudioFormat getAudioFormat();
 	const QVector<double>& getFftCache();
+	const QVector<double>& getChannelFftCache(int inIndex);
+	int getAnalyzedChannelCount() const { return mChannelFftCache.size(); }
+	int getAnalyzedSampleRate() const { return mCtx.weightSampleRate; }
 	QSharedPointer<QSpectrumProvider> createSpectrumProvider();
+
+	// Analyzes interleaved float frames directly instead of the playback position, no source or output device needed
+	void analyzeFrames(const float* inSamples, int inFrameCount, int inChannelCount, int inSampleRate);
+
+	// FFTW plans are shared by every provider, one per size and batch, wisdom is imported now and exported whenever a new plan is made
+	static void setFftWisdomFile(const QString& inFilePath);
+	static void prepareFftPlans(int inChannelCount = 1);
 protected:
 	void tryExecuteFft();
+	bool updateAnalysisContext(int inChannelCount, int inSampleRate);
+	void executeFft(const float* inSamples, int inChannelCount, int inFrameCount, int inSingleChannel);
 	void rebuildAudioData();
 	void rebuildAudioSink();
 	void rebuildFftData();
 	void rebuildWindowBuffer();
+	void rebuildBinWeights(int inSampleRate);
+	int getAnalyzedChannelCount(ChannelMode inMode, int inChannelCount) const;
+	void restartStream(qint64 inStartByte);
+	void pumpDecoder();
+	QIODevice* getPlaybackDevice();
 	QByteArray getCurrentAudioData(int inDesiredSize);
+	QByteArray getAudioData(qint64 inPos, qint64 inSize);
 private:
 	QUrl mUrl;
 	QByteArray mAudioData;
 	QBuffer mAudioBuffer;
+	QSharedPointer<QAudioStreamDevice> mStream;		//流式解码时的有界环形缓冲
+	bool bStreaming = true;
+	int mStreamBufferMsecs = 2000;
+	qint64 mDecodedBytes = 0;						//当前解码会话已产出的字节数
+	qint64 mSkipBytes = 0;							//跳转后需要丢弃的解码数据
+	qint64 mPlayOffset = 0;
 	QSharedPointer<QAudioDecoder> mDecoder;			//音频解码器
 	QSharedPointer<QAudioSink> mSink;				//音频输出设备
 
 	QVector<double> mWindow;
-	QSharedPointer<fftw_plan_s> mFftPlan;
+	QVector<double> mBinWeights;
+	fftw_plan_s* mFftPlan = nullptr;
 	QSharedPointer<double> mFftInput;
 	QSharedPointer<double> mFftOutput;
 
 	QVector<double> mFftResultCache;
+	QVector<QVector<double>> mChannelFftCache;
 
 	struct Context {
 		QAudioDevice audioDevice;
 		QAudioFormat audioFormat;
 		WindowFunction windowType;
-		int framesPerBuffer;
-		int pos = 0;
+		int framesPerBuffer = 0;
+		ChannelMode channelMode = SingleChannel;
+		int analyzedChannels = 0;
+		int weightSampleRate = 0;
+		qint64 pos = 0;
 	};
 	Context mDesiredCtx;
 	Context mCtx;
@@ -89,15 +135,30 @@ public:
 	int getLowFreq()const { return mLowFreq; }
 	int getHighFreq()const { return mHighFreq; }
 
+	// Producer side, every result is also published for getLatestSpectrum
 	const QVector<float>& calculateSpectrum();
+
+	// Consumer side for one other thread, the newest complete spectrum without waiting on the producer
+	const QVector<float>& getLatestSpectrum();
+
+	// Smoothing step of calculateSpectrum, ioAmp holds the binned bars and receives the clamped result. Four bars at a time where SSE is available
+	static void smoothBars(float* ioAmp, float* ioSmooth, float* ioFall, int inCount, float inLow, float inMul, float inRise, float inFall);
 protected:
 	QSpectrumProvider(QAudioProvider* inProvider);
 	void refreshFreq();
+	void rebuildBinMapping(int inBinCount, int inSampleRate);
+	void publishSpectrum();
 private:
 	QAudioProvider* mAudioProvider = nullptr;
 	int mDesiredSize;
 	QVector<float> mFreq;
 	QVector<float> mAmp;
+	QVector<int> mBarBinOffsets;		//	每个柱子在 mBarBins 中的起始位置，共 柱子数+1 项
+	QVector<int> mBarBins;				//	柱子覆盖的FFT频点
+	QVector<float> mBarBinWeights;		//	频点对柱子的贡献，已包含频宽与增益
+	int mMappedBinCount = 0;
+	int mMappedSampleRate = 0;
+	bool bNeedRebuildMapping = true;
 	QVector<float> mSmoothCache;
 	QVector<float> mSmoothFallCache;
 	int mLowFreq = 0;					//	最低频
@@ -108,6 +169,7 @@ private:
 	float mSmoothRangeHighCache = 0.0f;
 	float mSmoothRiseFactor = 1.0f;		//	单个柱子上升时的平滑因子
 	float mSmoothFallFactor = 0.005f;   //  1.0f = no smooth
+	QTripleBuffer<QVector<float>> mPublished;	//	分析线程写入，渲染线程读取最新的完整频谱
 };
 
 
@@ -0,0 +1,47 @@
+#ifndef QAudioStreamDevice_h__
+#define QAudioStreamDevice_h__
+
+#include <QIODevice>
+#include <QMutex>
+#include <functional>
+#include "QEngineCoreAPI.h"
+
+// Bounded ring of decoded PCM: keeps inHistory bytes behind the read cursor for analysis and decodes at most the rest ahead of it.
+// Positions are absolute byte offsets into the track, a session started at inStartPos holds nothing before it.
+class QENGINECORE_API QAudioStreamDevice : public QIODevice {
+public:
+	void reset(qint64 inCapacity, qint64 inHistory, qint64 inStartPos);
+
+	qint64 capacity() const;
+	qint64 writableBytes() const;
+	void append(const char* inData, qint64 inSize);
+	void setFinished();
+
+	// Moves the read cursor if inPos is still inside the ring
+	bool trySeek(qint64 inPos);
+
+	// Copies [inPos, inPos + inSize), bytes no longer or not yet in the ring are zero
+	QByteArray peek(qint64 inPos, qint64 inSize) const;
+
+	bool isSequential() const override { return true; }
+	qint64 bytesAvailable() const override;
+	bool atEnd() const override;
+
+	std::function<void()> onConsumed;
+protected:
+	qint64 readData(char* data, qint64 maxlen) override;
+	qint64 writeData(const char*, qint64) override { return -1; }
+private:
+	// Oldest position the ring still holds
+	qint64 oldestPos() const { return qMax(mStartPos, mWritePos - mRing.size()); }
+private:
+	mutable QMutex mMutex;
+	QByteArray mRing;
+	qint64 mHistory = 0;
+	qint64 mStartPos = 0;
+	qint64 mReadPos = 0;
+	qint64 mWritePos = 0;
+	bool bFinished = false;
+};
+
+#endif // QAudioStreamDevice_h__
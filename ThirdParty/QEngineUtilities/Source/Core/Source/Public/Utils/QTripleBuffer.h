@@ -0,0 +1,39 @@
+#ifndef QTripleBuffer_h__
+#define QTripleBuffer_h__
+
+#include <QAtomicInt>
+
+// Single producer / single consumer snapshot: the writer fills its own slot and publishes it, the reader swaps in the newest published slot.
+// Neither side ever waits on the other and a slot is never visible while it is being written.
+template<typename T>
+class QTripleBuffer {
+public:
+	// Producer side
+	T& writeBuffer() { return mSlots[mWriteIndex]; }
+
+	void publish() {
+		const int previous = mMiddle.fetchAndStoreOrdered(mWriteIndex | DirtyBit);
+		mWriteIndex = previous & IndexMask;
+	}
+
+	// Consumer side, returns false when nothing new was published since the last call
+	bool acquire() {
+		if (!(mMiddle.loadAcquire() & DirtyBit))
+			return false;
+		const int previous = mMiddle.fetchAndStoreOrdered(mReadIndex);
+		mReadIndex = previous & IndexMask;
+		return true;
+	}
+
+	const T& readBuffer() const { return mSlots[mReadIndex]; }
+private:
+	static constexpr int IndexMask = 0x3;
+	static constexpr int DirtyBit = 0x4;
+
+	T mSlots[3];
+	int mWriteIndex = 0;
+	int mReadIndex = 1;
+	QAtomicInt mMiddle = 2;
+};
+
+#endif // QTripleBuffer_h__
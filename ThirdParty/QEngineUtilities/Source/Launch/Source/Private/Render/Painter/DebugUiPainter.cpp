@@ -8,6 +8,7 @@
 #include <QFile>
 #include <QTime>
 #include "Render/IRenderer.h"
+#include "Render/RenderGraph/QRenderGraphBuilder.h"
 #include "Utils/QRhiCamera.h"
 #include "DetailView/QPropertyHandle.h"
 
@@ -171,12 +172,18 @@ QDebugUIPainter::QDebugUIPainter(IRenderer* inRenderer)
 			}
 			if (bShowStats) {
 				if (QRhiWindow* Window = qobject_cast<QRhiWindow*>(mRenderer->maybeWindow())) {
-					ImGui::SetNextWindowPos(ImVec2(viewport->WorkSize.x - 180 * dpr, viewport->WorkSize.y - 100 * dpr));
+					ImGui::SetNextWindowPos(ImVec2(viewport->WorkSize.x - 180 * dpr, viewport->WorkSize.y - 160 * dpr));
 					ImGui::SetNextWindowSize(ImVec2(200, 200));
 					ImGui::Begin("Stats", 0, mViewportBarFlags);
 					ImGui::TextColored(ImColor(0, 255, 0), "FPS          \t%d", Window->getFps());
 					ImGui::TextColored(ImColor(0, 255, 0), "CPU Time\t%.2f ms", Window->getCpuFrameTime());
 					ImGui::TextColored(ImColor(0, 255, 0), "GPU Time\t%.2f ms", Window->getGpuFrameTime());
+					const QRenderGraphBuilder::CompileStats& graphStats = mRenderer->getRenderGraphBuilder()->getCompileStats();
+					ImGui::TextColored(ImColor(0, 255, 0), "Passes      \t%d/%d", graphStats.passCount - graphStats.culledPassCount, graphStats.passCount);
+					ImGui::TextColored(ImColor(0, 255, 0), "Transient\t%.1f/%.1f MB", graphStats.aliasedTransientBytes / (1024.0 * 1024.0), graphStats.transientBytes / (1024.0 * 1024.0));
+					QRGRhiResourcePool* pool = mRenderer->getRenderGraphBuilder()->getResourcePool();
+					const QRGRhiResourcePool::Statistics textureStats = pool->getStatistics(QRhiResource::Texture);
+					ImGui::TextColored(ImColor(0, 255, 0), "Pool Tex\t%d / %.1f MB", textureStats.liveCount, textureStats.bytes / (1024.0 * 1024.0));
 					ImGui::End();
 				}
 			}
@@ -187,6 +194,8 @@ QDebugUIPainter::QDebugUIPainter(IRenderer* inRenderer)
 
 void QDebugUIPainter::setup(QRenderGraphBuilder& builder, QRhiRenderTarget* rt)
 {
+	if (bShowFrameGraph)
+		mRenderGraphView->DeclareExternalReads(builder);
 	ImGuiPainter::setup(builder, rt);
 }
 
@@ -248,6 +248,16 @@ QRhiTexture* RenderGraphView::GetCurrentTexture() {
 	return nullptr;
 }
 
+void RenderGraphView::DeclareExternalReads(QRenderGraphBuilder& builder) {
+	// Every node previews its attachments, they must hold their own pass's output instead of an aliased later one
+	for (const auto& textures : mNodeTexutes) {
+		for (QRhiTexture* texture : textures)
+			builder.declareExternalRead(texture);
+	}
+	builder.declareExternalRead(mCompLeft);
+	builder.declareExternalRead(mCompRight);
+}
+
 void RenderGraphView::SelectNode(GraphEditor::NodeIndex nodeIndex, bool selected , int slotIndex) {
 	if (mCurrentNodeIndex >= 0) {
 		mNodes[mCurrentNodeIndex].mSelected = false;
@@ -2,6 +2,7 @@
 #define RenderGraphView_h__
 
 class IRenderer;
+class QRenderGraphBuilder;
 
 #ifdef QENGINE_WITH_EDITOR
 
@@ -15,6 +16,7 @@ public:
 	void Show();
 	void RequestFitScreen();
 	QRhiTexture* GetCurrentTexture();
+	void DeclareExternalReads(QRenderGraphBuilder& builder);
 protected:
 	void ShowFrameComparer(float thickness, float leftMinWidth, float rightMinWidth, float splitterLongAxisSize = -1.0f);
 	bool AllowedLink(GraphEditor::NodeIndex from, GraphEditor::NodeIndex to) override { return false; }
@@ -58,7 +58,8 @@ void QOutputPassBuilder::setup(QRenderGraphBuilder& builder)
 	mRenderTarget = builder.getMainRenderTarget();
 
 #ifdef QENGINE_WITH_EDITOR
-	QMousePickingPassBuilder::Output mousePickingOut = builder.addPassBuilder<QMousePickingPassBuilder>("MousePickingPass");
+	QMousePickingPassBuilder::Output mousePickingOut = builder.addPassBuilder<QMousePickingPassBuilder>("MousePickingPass")
+		.setSceneDepth(mInput._SceneDepth);
 
 	builder.setupShaderResourceBindings(mOutliningBindings, "OutliningBindings", {
 		QRhiShaderResourceBinding::sampledTexture(0, QRhiShaderResourceBinding::FragmentStage,mousePickingOut.SelectMask.get() ,mSampler.get()),
@@ -10,6 +10,7 @@
 class QENGINELAUNCH_API QOutputPassBuilder : public IRenderPassBuilder {
 	QRP_INPUT_BEGIN(QOutputPassBuilder)
 		QRP_INPUT_ATTR(QRhiTextureRef, InitialTexture);
+		QRP_INPUT_ATTR(QRhiTextureRef, SceneDepth);
 	QRP_INPUT_END()
 
 	QRP_OUTPUT_BEGIN(QOutputPassBuilder)
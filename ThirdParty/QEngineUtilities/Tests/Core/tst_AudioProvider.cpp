@@ -0,0 +1,217 @@
+#include <QtTest>
+#include "Utils/QAudioProvider.h"
+#include "Utils/QTripleBuffer.h"
+
+Q_DECLARE_METATYPE(QAudioProvider::ChannelMode)
+
+class tst_AudioProvider : public QObject {
+	Q_OBJECT
+private:
+	static constexpr int SampleRate = 48000;
+
+	// Interleaved stereo float frames, each channel a sine centred on an FFT bin of inFftSize
+	static QVector<float> stereoSine(int inFrameCount, int inFftSize, int inLeftBin, int inRightBin) {
+		QVector<float> frames(inFrameCount * 2);
+		for (int i = 0; i < inFrameCount; i++) {
+			frames[i * 2 + 0] = 0.5f * qSin(2.0 * M_PI * inLeftBin * i / inFftSize);
+			frames[i * 2 + 1] = 0.5f * qSin(2.0 * M_PI * inRightBin * i / inFftSize);
+		}
+		return frames;
+	}
+
+	// Same operations in both paths, the tolerance only covers a compiler contracting the scalar side into FMA
+	static bool nearlyEqual(float inValue, float inReference) {
+		return qAbs(inValue - inReference) <= 1e-6f * qMax(1.0f, qAbs(inReference));
+	}
+
+	static int peakBin(const QVector<double>& inSpectrum) {
+		return int(std::max_element(inSpectrum.cbegin(), inSpectrum.cend()) - inSpectrum.cbegin());
+	}
+private Q_SLOTS:
+	void perChannelPeaks() {
+		QAudioProvider provider;
+		provider.setFramesPerBuffer(12);
+		provider.setChannelMode(QAudioProvider::PerChannel);
+		const QVector<float> frames = stereoSine(4096, 4096, 64, 512);
+		provider.analyzeFrames(frames.constData(), 4096, 2, SampleRate);
+		QCOMPARE(provider.getAnalyzedChannelCount(), 2);
+		QCOMPARE(provider.getChannelFftCache(0).size(), 2048);
+		QCOMPARE(peakBin(provider.getChannelFftCache(0)), 64);
+		QCOMPARE(peakBin(provider.getChannelFftCache(1)), 512);
+	}
+
+	void midSideOfMonoSignal() {
+		QAudioProvider provider;
+		provider.setFramesPerBuffer(10);
+		provider.setChannelMode(QAudioProvider::MidSide);
+		const QVector<float> frames = stereoSine(1024, 1024, 100, 100);
+		provider.analyzeFrames(frames.constData(), 1024, 2, SampleRate);
+		QCOMPARE(provider.getAnalyzedChannelCount(), 2);
+		const QVector<double>& mid = provider.getChannelFftCache(0);
+		const QVector<double>& side = provider.getChannelFftCache(1);
+		QCOMPARE(peakBin(mid), 100);
+		QVERIFY(*std::max_element(side.cbegin(), side.cend()) < mid[100] * 1e-9);
+	}
+
+	void tripleBufferStress_data() {
+		QTest::addColumn<int>("producerSleepUs");
+		QTest::addColumn<int>("consumerSleepUs");
+		QTest::newRow("fast producer") << 0 << 200;
+		QTest::newRow("fast consumer") << 200 << 0;
+		QTest::newRow("both spinning") << 0 << 0;
+	}
+
+	// Every published frame is filled with its serial and sized from it, a torn read shows up as a mixed or mis-sized frame
+	void tripleBufferStress() {
+		QFETCH(int, producerSleepUs);
+		QFETCH(int, consumerSleepUs);
+		QVERIFY(QAtomicInt::isFetchAndStoreNativeAlwaysFree());
+		QTripleBuffer<QVector<int>> buffer;
+		QAtomicInt bStop = 0;
+		int published = 0;
+		QScopedPointer<QThread> producer(QThread::create([&]() {
+			while (!bStop.loadAcquire()) {
+				QVector<int>& slot = buffer.writeBuffer();
+				published++;
+				slot.resize(1 + published % 257);
+				std::fill(slot.begin(), slot.end(), published);
+				buffer.publish();
+				if (producerSleepUs)
+					QThread::usleep(producerSleepUs);
+			}
+		}));
+		producer->start();
+		QElapsedTimer timer;
+		timer.start();
+		int acquired = 0;
+		int torn = 0;
+		int lastSerial = 0;
+		while (timer.elapsed() < 300) {
+			if (buffer.acquire()) {
+				const QVector<int>& frame = buffer.readBuffer();
+				const int serial = frame.value(0);
+				if (serial <= lastSerial || frame.size() != 1 + serial % 257 || std::count(frame.cbegin(), frame.cend(), serial) != frame.size())
+					torn++;
+				lastSerial = serial;
+				acquired++;
+			}
+			if (consumerSleepUs)
+				QThread::usleep(consumerSleepUs);
+		}
+		bStop.storeRelease(1);
+		producer->wait();
+		qInfo("%s: %d published, %d acquired", QTest::currentDataTag(), published, acquired);
+		QCOMPARE(torn, 0);
+		QVERIFY(acquired > 0);
+		QVERIFY(acquired <= published);
+	}
+
+	void spectrumIsPublished() {
+		QAudioProvider provider;
+		provider.setFramesPerBuffer(10);
+		QSharedPointer<QSpectrumProvider> spectrum = provider.createSpectrumProvider();
+		spectrum->setBarSize(64);
+		QVERIFY(spectrum->getLatestSpectrum().isEmpty());
+		const QVector<float> frames = stereoSine(1024, 1024, 32, 32);
+		provider.analyzeFrames(frames.constData(), 1024, 2, SampleRate);
+		const QVector<float> bars = spectrum->calculateSpectrum();
+		QCOMPARE(spectrum->getLatestSpectrum(), bars);
+		QCOMPARE(spectrum->getLatestSpectrum().size(), 64);
+	}
+
+	void barBinning_data() {
+		QTest::addColumn<int>("barCount");
+		QTest::newRow("512 bars") << 512;
+		QTest::newRow("1000 bars") << 1000;
+	}
+
+	// Binning, weighting and smoothing of one 4096 point spectrum, the mapping is built by the warm up call
+	void barBinning() {
+		QFETCH(int, barCount);
+		QAudioProvider provider;
+		provider.setFramesPerBuffer(12);
+		QSharedPointer<QSpectrumProvider> spectrum = provider.createSpectrumProvider();
+		spectrum->setBarSize(barCount);
+		const QVector<float> frames = stereoSine(4096, 4096, 200, 200);
+		provider.analyzeFrames(frames.constData(), 4096, 2, SampleRate);
+		const QVector<float>& bars = spectrum->calculateSpectrum();
+		QCOMPARE(bars.size(), barCount);
+		QVERIFY(*std::max_element(bars.cbegin(), bars.cend()) > 0.0f);
+
+		const int frameCount = 1000;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < frameCount; i++)
+			spectrum->calculateSpectrum();
+		const double usPerFrame = timer.nsecsElapsed() / 1000.0 / frameCount;
+		qInfo("%s: %.2f us per frame, %.2f%% of a 144 Hz frame", QTest::currentDataTag(), usPerFrame, usPerFrame / (1.0e6 / 144.0) * 100.0);
+		QVERIFY2(usPerFrame < 100.0, "bar binning exceeds its 0.1 ms per frame budget");
+		QBENCHMARK {
+			spectrum->calculateSpectrum();
+		}
+	}
+
+	// The SIMD smoothing against the per bar reference, 1001 bars so the scalar tail runs as well
+	void smoothingMatchesScalar() {
+		const int barCount = 1001;
+		const float low = 0.1f;
+		const float mul = 0.8f;
+		const float rise = 0.3f;
+		const float fall = 0.005f;
+		QVector<float> smooth(barCount, 0.0f), fallCache(barCount, 0.0f);
+		QVector<float> refSmooth(barCount, 0.0f), refFall(barCount, 0.0f);
+		QRandomGenerator random(42);
+		for (int frame = 0; frame < 64; frame++) {
+			QVector<float> amp(barCount);
+			for (float& value : amp)
+				value = float(random.bounded(1.5));
+			QVector<float> refAmp = amp;
+			QSpectrumProvider::smoothBars(amp.data(), smooth.data(), fallCache.data(), barCount, low, mul, rise, fall);
+			for (int i = 0; i < barCount; i++) {
+				const float val = (refAmp[i] - low) * mul;
+				if (val >= refSmooth[i]) {
+					refSmooth[i] = refSmooth[i] * (1.0f - rise) + val * rise;
+					refFall[i] = 0.0f;
+				}
+				else if (val > 0.0f) {
+					refFall[i] = refFall[i] * 2.0f + fall;
+					refSmooth[i] -= refFall[i];
+				}
+				refAmp[i] = qBound(0.0f, refSmooth[i], 1.0f);
+			}
+			for (int i = 0; i < barCount; i++) {
+				QVERIFY2(nearlyEqual(amp[i], refAmp[i]), qPrintable(QString("frame %1 bar %2").arg(frame).arg(i)));
+				QVERIFY2(nearlyEqual(smooth[i], refSmooth[i]), qPrintable(QString("frame %1 bar %2").arg(frame).arg(i)));
+				QVERIFY2(nearlyEqual(fallCache[i], refFall[i]), qPrintable(QString("frame %1 bar %2").arg(frame).arg(i)));
+			}
+		}
+	}
+
+	void analysisCost_data() {
+		QTest::addColumn<int>("log2Size");
+		QTest::addColumn<QAudioProvider::ChannelMode>("mode");
+		for (int log2Size = 4; log2Size <= 14; log2Size++) {
+			QTest::addRow("%d single", 1 << log2Size) << log2Size << QAudioProvider::SingleChannel;
+			QTest::addRow("%d per channel", 1 << log2Size) << log2Size << QAudioProvider::PerChannel;
+		}
+	}
+
+	// One analysis step per iteration on stereo input, plans and windows are made by the warm up call so only the per frame work is timed
+	void analysisCost() {
+		QFETCH(int, log2Size);
+		QFETCH(QAudioProvider::ChannelMode, mode);
+		const int fftSize = 1 << log2Size;
+		QAudioProvider provider;
+		provider.setFramesPerBuffer(log2Size);
+		provider.setChannelMode(mode);
+		const QVector<float> frames = stereoSine(fftSize, fftSize, fftSize / 8, fftSize / 4);
+		provider.analyzeFrames(frames.constData(), fftSize, 2, SampleRate);
+		QCOMPARE(provider.getFftCache().size(), fftSize / 2);
+		QBENCHMARK {
+			provider.analyzeFrames(frames.constData(), fftSize, 2, SampleRate);
+		}
+	}
+};
+
+QTEST_MAIN(tst_AudioProvider)
+#include "tst_AudioProvider.moc"
@@ -0,0 +1,116 @@
+#include <QtTest>
+#include "Utils/QAudioStreamDevice.h"
+
+class tst_AudioStreamDevice : public QObject {
+	Q_OBJECT
+private:
+	// Byte i of the track is i % 251, so any misplaced copy shows up in the comparison
+	static QByteArray trackBytes(qint64 inPos, qint64 inSize) {
+		QByteArray bytes(inSize, 0);
+		for (qint64 i = 0; i < inSize; i++)
+			bytes[i] = char((inPos + i) % 251);
+		return bytes;
+	}
+
+	// Feeds the device like the decoder does: only while it reports room. Devices are opened unbuffered so the test sees the read cursor itself
+	static qint64 fill(QAudioStreamDevice& inDevice, qint64 inPos, qint64 inEnd, qint64 inChunk) {
+		while (inPos < inEnd) {
+			const qint64 n = qMin(qMin(inChunk, inEnd - inPos), inDevice.writableBytes());
+			if (n <= 0)
+				break;
+			inDevice.append(trackBytes(inPos, n).constData(), n);
+			inPos += n;
+		}
+		return inPos;
+	}
+private Q_SLOTS:
+	void wrapsAround() {
+		QAudioStreamDevice device;
+		device.reset(1000, 200, 0);
+		QVERIFY(device.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+		qint64 writePos = 0;
+		qint64 readPos = 0;
+		while (readPos < 10000) {
+			writePos = fill(device, writePos, 10000, 333);
+			const QByteArray read = device.read(137);
+			QVERIFY(!read.isEmpty());
+			QCOMPARE(read, trackBytes(readPos, read.size()));
+			readPos += read.size();
+		}
+		QCOMPARE(device.bytesAvailable(), qint64(0));
+		device.setFinished();
+		QVERIFY(device.atEnd());
+	}
+
+	void peekClampsToRing() {
+		QAudioStreamDevice device;
+		device.reset(1000, 200, 0);
+		QVERIFY(device.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+		device.append(trackBytes(0, 1000).constData(), 1000);
+		QCOMPARE(device.read(900).size(), 900);
+		device.append(trackBytes(1000, 500).constData(), 500);
+
+		// [500, 1500) is in the ring, everything before it has been overwritten
+		QCOMPARE(device.peek(500, 1000), trackBytes(500, 1000));
+		const QByteArray straddling = device.peek(400, 200);
+		QCOMPARE(straddling.left(100), QByteArray(100, 0));
+		QCOMPARE(straddling.mid(100), trackBytes(500, 100));
+		QCOMPARE(device.peek(1400, 200).mid(100), QByteArray(100, 0));
+	}
+
+	void seeksInsideRing() {
+		QAudioStreamDevice device;
+		device.reset(1000, 200, 0);
+		QVERIFY(device.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+		device.append(trackBytes(0, 1000).constData(), 1000);
+		QCOMPARE(device.read(900).size(), 900);
+		device.append(trackBytes(1000, 500).constData(), 500);
+
+		QVERIFY(!device.trySeek(499));
+		QVERIFY(!device.trySeek(1501));
+		QVERIFY(device.trySeek(500));
+		QCOMPARE(device.read(100), trackBytes(500, 100));
+		QVERIFY(device.trySeek(1500));
+		QCOMPARE(device.bytesAvailable(), qint64(0));
+	}
+
+	// A restarted session holds nothing before its start, even while the ring is far from full
+	void seekBelowRestartFails() {
+		QAudioStreamDevice device;
+		device.reset(1000, 200, 5000);
+		QVERIFY(device.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+		QCOMPARE(device.writableBytes(), qint64(1000));
+		device.append(trackBytes(5000, 300).constData(), 300);
+
+		QVERIFY(!device.trySeek(4999));
+		QVERIFY(!device.trySeek(4800));
+		QCOMPARE(device.peek(4900, 200).left(100), QByteArray(100, 0));
+		QCOMPARE(device.peek(4900, 200).mid(100), trackBytes(5000, 100));
+		QVERIFY(device.trySeek(5100));
+		QCOMPARE(device.read(50), trackBytes(5100, 50));
+	}
+
+	// However long the track, the ring stays at its capacity and the writer is held back once the history is reached
+	void boundedMemory() {
+		QAudioStreamDevice device;
+		device.reset(4096, 1024, 0);
+		QVERIFY(device.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+		qint64 writePos = fill(device, 0, 1 << 20, 512);
+		QCOMPARE(writePos, qint64(4096));
+		QCOMPARE(device.writableBytes(), qint64(0));
+		QCOMPARE(fill(device, writePos, 1 << 20, 512), writePos);
+
+		qint64 readPos = 0;
+		while (readPos < (1 << 20)) {
+			writePos = fill(device, writePos, 1 << 20, 512);
+			QVERIFY(writePos - qMax<qint64>(0, readPos - 1024) <= device.capacity());
+			const QByteArray read = device.read(700);
+			QCOMPARE(read, trackBytes(readPos, read.size()));
+			readPos += read.size();
+		}
+		QCOMPARE(device.capacity(), qint64(4096));
+	}
+};
+
+QTEST_MAIN(tst_AudioStreamDevice)
+#include "tst_AudioStreamDevice.moc"
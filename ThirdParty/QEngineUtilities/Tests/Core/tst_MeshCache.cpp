@@ -0,0 +1,163 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include "Asset/QMeshCache.h"
+#include "Asset/QStaticMesh.h"
+#include "Asset/QMeshOptimizer.h"
+
+class tst_MeshCache : public QObject {
+	Q_OBJECT
+private:
+	// Wavefront grid of (size x size) quads, large enough for the import to dominate the benchmark
+	static bool writeGrid(const QString& inFilePath, int size) {
+		QFile file(inFilePath);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			return false;
+		QTextStream stream(&file);
+		for (int y = 0; y <= size; y++) {
+			for (int x = 0; x <= size; x++)
+				stream << "v " << x << " " << qSin(x * 0.1f) * qCos(y * 0.1f) << " " << y << "\n";
+		}
+		for (int y = 0; y <= size; y++) {
+			for (int x = 0; x <= size; x++)
+				stream << "vt " << float(x) / size << " " << float(y) / size << "\n";
+		}
+		const int stride = size + 1;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				const int a = y * stride + x + 1;
+				const int b = a + 1;
+				const int c = a + stride;
+				const int d = c + 1;
+				stream << "f " << a << "/" << a << " " << c << "/" << c << " " << d << "/" << d << " " << b << "/" << b << "\n";
+			}
+		}
+		return true;
+	}
+private Q_SLOTS:
+	void initTestCase() {
+		QVERIFY(mDir.isValid());
+		mSourcePath = mDir.filePath("grid.obj");
+		QVERIFY(writeGrid(mSourcePath, 256));
+	}
+
+	void init() {
+		QMeshOptimizer::setEnabled(true);
+		QMeshOptimizer::setLodSettings(QMeshOptimizer::LodSettings());
+		QMeshCache::setEnabled(true);
+		QMeshCache::setCacheDirectory(mDir.filePath("MeshCache"));
+		QMeshCache::clear();
+	}
+
+	void roundTripMatchesImport() {
+		QSharedPointer<QStaticMesh> imported = QStaticMesh::CreateFromFile(mSourcePath);
+		QVERIFY(imported);
+		QSharedPointer<QStaticMesh> cached = QMeshCache::loadStaticMesh(mSourcePath);
+		QVERIFY(cached);
+		QCOMPARE(cached->mVertices.size(), imported->mVertices.size());
+		QCOMPARE(cached->mIndices, imported->mIndices);
+		QVERIFY(memcmp(cached->mVertices.constData(), imported->mVertices.constData(), imported->mVertices.size() * sizeof(QStaticMesh::Vertex)) == 0);
+		QCOMPARE(cached->mSubmeshes.size(), imported->mSubmeshes.size());
+		for (int i = 0; i < imported->mSubmeshes.size(); i++) {
+			QCOMPARE(cached->mSubmeshes[i].indicesOffset, imported->mSubmeshes[i].indicesOffset);
+			QCOMPARE(cached->mSubmeshes[i].indicesRange, imported->mSubmeshes[i].indicesRange);
+			QCOMPARE(cached->mSubmeshes[i].lods.size(), imported->mSubmeshes[i].lods.size());
+		}
+	}
+
+	void staleSourceIsIgnored() {
+		QVERIFY(QStaticMesh::CreateFromFile(mSourcePath));
+		QVERIFY(QMeshCache::loadStaticMesh(mSourcePath));
+		const QString changedPath = mDir.filePath("changed.obj");
+		QVERIFY(writeGrid(changedPath, 4));
+		QVERIFY(QStaticMesh::CreateFromFile(changedPath));
+		QVERIFY(writeGrid(changedPath, 5));
+		QVERIFY(!QMeshCache::loadStaticMesh(changedPath));
+	}
+
+	void optimizerSettingsAreKeyed() {
+		const QString path = mDir.filePath("optimized.obj");
+		QVERIFY(writeGrid(path, 32));
+		QSharedPointer<QStaticMesh> optimized = QStaticMesh::CreateFromFile(path);
+		QVERIFY(optimized);
+		QVERIFY(!optimized->mSubmeshes[0].lods.isEmpty());
+		QVERIFY(QMeshCache::loadStaticMesh(path));
+
+		QMeshOptimizer::setEnabled(false);
+		QVERIFY(!QMeshCache::loadStaticMesh(path));
+		QSharedPointer<QStaticMesh> plain = QStaticMesh::CreateFromFile(path);
+		QVERIFY(plain);
+		QVERIFY(plain->mSubmeshes[0].lods.isEmpty());
+
+		QMeshOptimizer::setEnabled(true);
+		QVERIFY(!QMeshCache::loadStaticMesh(path));
+		QMeshOptimizer::LodSettings lodSettings;
+		lodSettings.maxLevels = 1;
+		QMeshOptimizer::setLodSettings(lodSettings);
+		QSharedPointer<QStaticMesh> singleLod = QStaticMesh::CreateFromFile(path);
+		QVERIFY(singleLod);
+		QCOMPARE(singleLod->mSubmeshes[0].lods.size(), 1);
+		QMeshOptimizer::setLodSettings(QMeshOptimizer::LodSettings());
+		QVERIFY(!QMeshCache::loadStaticMesh(path));
+	}
+
+	void texturesAreStoredAsSources() {
+		const QString texturePath = mDir.filePath("checker.png");
+		QImage texture(64, 64, QImage::Format_RGBA8888);
+		for (int y = 0; y < texture.height(); y++) {
+			for (int x = 0; x < texture.width(); x++)
+				texture.setPixelColor(x, y, ((x / 8 + y / 8) & 1) ? Qt::white : Qt::red);
+		}
+		QVERIFY(texture.save(texturePath));
+		QFile material(mDir.filePath("textured.mtl"));
+		QVERIFY(material.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		material.write("newmtl checker\nmap_Kd checker.png\n");
+		material.close();
+		QFile model(mDir.filePath("textured.obj"));
+		QVERIFY(model.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		model.write("mtllib textured.mtl\nv 0 0 0\nv 1 0 0\nv 1 1 0\nvt 0 0\nvt 1 0\nvt 1 1\nusemtl checker\nf 1/1 2/2 3/3\n");
+		model.close();
+
+		QSharedPointer<QStaticMesh> imported = QStaticMesh::CreateFromFile(model.fileName());
+		QVERIFY(imported);
+		QCOMPARE(imported->mMaterials.size(), 1);
+		const QImage importedImage = imported->mMaterials[0]->mProperties.value("Diffuse").value<QImage>();
+		QVERIFY(!importedImage.isNull());
+
+		QSharedPointer<QStaticMesh> cached = QMeshCache::loadStaticMesh(model.fileName());
+		QVERIFY(cached);
+		QCOMPARE(cached->mMaterials.size(), 1);
+		QCOMPARE(cached->mMaterials[0]->mTextureSources.value("Diffuse").key, QFileInfo(texturePath).absoluteFilePath());
+		const QImage cachedImage = cached->mMaterials[0]->mProperties.value("Diffuse").value<QImage>();
+		QCOMPARE(cachedImage, importedImage);
+		// Resolved through the texture cache, both meshes sample the same pixels
+		QCOMPARE(cachedImage.constBits(), importedImage.constBits());
+
+		QFile cacheFile(QDir(QMeshCache::getCacheDirectory()).entryInfoList({ "*.qmesh" }, QDir::Files).value(0).absoluteFilePath());
+		QVERIFY(cacheFile.open(QIODevice::ReadOnly));
+		QVERIFY(cacheFile.size() < texture.sizeInBytes());
+	}
+
+	void loadMesh_data() {
+		QTest::addColumn<bool>("cached");
+		QTest::newRow("cold import") << false;
+		QTest::newRow("cache load") << true;
+	}
+
+	void loadMesh() {
+		QFETCH(bool, cached);
+		QVERIFY(QStaticMesh::CreateFromFile(mSourcePath));
+		QMeshCache::setEnabled(cached);
+		QSharedPointer<QStaticMesh> mesh;
+		QBENCHMARK {
+			mesh = cached ? QMeshCache::loadStaticMesh(mSourcePath) : QStaticMesh::CreateFromFile(mSourcePath);
+		}
+		QVERIFY(mesh);
+		QMeshCache::setEnabled(true);
+	}
+private:
+	QTemporaryDir mDir;
+	QString mSourcePath;
+};
+
+QTEST_MAIN(tst_MeshCache)
+#include "tst_MeshCache.moc"
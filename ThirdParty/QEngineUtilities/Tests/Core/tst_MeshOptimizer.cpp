@@ -0,0 +1,159 @@
+#include <QtTest>
+#include <random>
+#include "Asset/QMeshOptimizer.h"
+#include "Asset/QStaticMesh.h"
+#include "Render/IRenderer.h"
+#include "Render/QPrimitiveRenderProxy.h"
+#include "Render/Component/QStaticMeshRenderComponent.h"
+#include "Render/RenderGraph/QRenderGraphBuilder.h"
+#include "Render/RenderGraph/PassBuilder/QMeshPassBuilder.h"
+
+// Draws the scene into the mesh pass only, the output is declared external so culling keeps the pass
+class TestMeshRenderer : public IRenderer {
+public:
+	TestMeshRenderer(QRhiHelper::InitParams params)
+		: IRenderer(params, QSize(1280, 720), IRenderer::Type::Offscreen) {
+	}
+	IMeshPassBuilder::DrawStats mDrawStats;
+protected:
+	void setupGraph(QRenderGraphBuilder& graphBuilder) override {
+		QMeshPassBuilder::Output meshPassOut = graphBuilder.addPassBuilder<QMeshPassBuilder>("MeshPass");
+		graphBuilder.declareExternalRead(meshPassOut.BaseColor.get());
+		mMeshPass = meshPassOut.Pass;
+	}
+	void endFrame() override {
+		if (mMeshPass)
+			mDrawStats = mMeshPass->getDrawStats();
+	}
+private:
+	QMeshPassBuilder* mMeshPass = nullptr;
+};
+
+class tst_MeshOptimizer : public QObject {
+	Q_OBJECT
+private:
+	// Unit grid in the xy plane, triangles shuffled so the input has no locality at all
+	static QSharedPointer<QStaticMesh> createGrid(int size, bool shuffled) {
+		QSharedPointer<QStaticMesh> mesh = QSharedPointer<QStaticMesh>::create();
+		for (int y = 0; y <= size; y++) {
+			for (int x = 0; x <= size; x++) {
+				QStaticMesh::Vertex vertex;
+				vertex.position = QVector3D(float(x) / size - 0.5f, float(y) / size - 0.5f, 0.0f);
+				vertex.normal = QVector3D(0, 0, 1);
+				vertex.tangent = QVector3D(1, 0, 0);
+				vertex.bitangent = QVector3D(0, 1, 0);
+				vertex.uv = QVector2D(float(x) / size, float(y) / size);
+				mesh->mVertices << vertex;
+			}
+		}
+		QVector<std::array<quint32, 3>> triangles;
+		const quint32 stride = size + 1;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				const quint32 a = y * stride + x;
+				triangles.append({ a, a + 1, a + stride });
+				triangles.append({ a + 1, a + stride + 1, a + stride });
+			}
+		}
+		if (shuffled)
+			std::shuffle(triangles.begin(), triangles.end(), std::mt19937(7));
+		for (const auto& triangle : triangles)
+			mesh->mIndices << triangle[0] << triangle[1] << triangle[2];
+		QStaticMesh::SubMeshData submesh;
+		submesh.verticesOffset = 0;
+		submesh.verticesRange = mesh->mVertices.size();
+		submesh.indicesOffset = 0;
+		submesh.indicesRange = mesh->mIndices.size();
+		mesh->mSubmeshes << submesh;
+		mesh->mMaterials << QSharedPointer<QMaterial>::create();
+		mesh->updateBounds();
+		return mesh;
+	}
+
+	static float decodeSnorm(quint32 inPacked, int inHalf) {
+		return qMax(float(qint16(inPacked >> (16 * inHalf))) / 32767.0f, -1.0f);
+	}
+private Q_SLOTS:
+	void reducesAcmrOnShuffledGrid() {
+		QSharedPointer<QStaticMesh> mesh = createGrid(100, true);
+		const QMeshOptimizer::Statistics stats = QMeshOptimizer::optimize(*mesh);
+		qInfo("ACMR %.2f -> %.2f", stats.acmrBefore(), stats.acmrAfter());
+		QCOMPARE(stats.triangles, quint64(100 * 100 * 2));
+		QCOMPARE(stats.verticesAfter, stats.verticesBefore);
+		QVERIFY(stats.acmrBefore() > 2.0);
+		QVERIFY(stats.acmrAfter() < 0.8);
+		QCOMPARE(QMeshOptimizer::analyzeVertexCache(mesh->mIndices.constData(), mesh->mIndices.size(), mesh->mVertices.size()), quint32(stats.cacheMissesAfter));
+	}
+
+	void compactVertexIs20Bytes() {
+		QSharedPointer<QStaticMesh> mesh = createGrid(16, false);
+		const QMeshOptimizer::Statistics stats = QMeshOptimizer::optimize(*mesh);
+		QCOMPARE(stats.bytesPerVertex, quint32(sizeof(QStaticMesh::Vertex)));
+		QCOMPARE(stats.compactBytesPerVertex, quint32(20));
+		QCOMPARE(sizeof(QStaticMesh::CompactVertex), size_t(20));
+		qInfo("bytes per vertex %u -> %u", stats.bytesPerVertex, stats.compactBytesPerVertex);
+
+		// Positions come back within one snorm16 step of the submesh bounds
+		const QVector<QStaticMesh::CompactVertex> compact = QMeshOptimizer::buildCompactVertices(*mesh);
+		const MathUtils::AABB& bounds = mesh->mSubmeshes[0].localBounds;
+		const QVector3D extent = bounds.extent();
+		for (int i = 0; i < compact.size(); i++) {
+			const QVector3D decoded = bounds.center() + extent * QVector3D(decodeSnorm(compact[i].position[0], 0), decodeSnorm(compact[i].position[0], 1), decodeSnorm(compact[i].position[1], 0));
+			const QVector3D error = decoded - mesh->mVertices[i].position;
+			QVERIFY(qAbs(error.x()) <= extent.x() / 32767.0f + 1e-6f);
+			QVERIFY(qAbs(error.y()) <= extent.y() / 32767.0f + 1e-6f);
+			QVERIFY(decodeSnorm(compact[i].position[1], 1) > 0.0f);
+		}
+	}
+
+	void drawFrame_data() {
+		QTest::addColumn<bool>("compact");
+		QTest::newRow("full layout") << false;
+		QTest::newRow("compact layout") << true;
+	}
+
+	// CPU cost of a frame of 64 optimized grids on the Null backend, the frame is recorded and submitted but nothing executes
+	void drawFrame() {
+		QFETCH(bool, compact);
+		QRhiHelper::InitParams params;
+		params.backend = QRhi::Null;
+		TestMeshRenderer renderer(params);
+		QSharedPointer<QStaticMesh> mesh = createGrid(64, true);
+		QMeshOptimizer::optimize(*mesh);
+		QVector<QStaticMeshRenderComponent*> components;
+		// Proxies unregister from the renderer, so they have to go before it does
+		auto cleanup = qScopeGuard([&renderer, &components]() {
+			for (QStaticMeshRenderComponent* component : components)
+				renderer.removeComponent(component);
+			qDeleteAll(components);
+		});
+		for (int i = 0; i < 64; i++) {
+			QStaticMeshRenderComponent* component = new QStaticMeshRenderComponent();
+			components << component;
+			component->setStaticMesh(mesh);
+			component->setCompactVertexLayout(compact);
+			component->setTranslate(QVector3D((i % 8 - 3.5f) * 0.1f, (i / 8 - 3.5f) * 0.1f, 0.0f));
+			component->setScale3D(QVector3D(0.1f, 0.1f, 0.1f));
+			renderer.addComponent(component);
+		}
+		// Shaders bake on the compile pool, wait until every proxy has its pipeline
+		QElapsedTimer timer;
+		timer.start();
+		bool bReady = false;
+		while (!bReady && timer.elapsed() < 30000) {
+			renderer.renderFrame();
+			bReady = !renderer.getRenderProxies().isEmpty();
+			for (QPrimitiveRenderProxy* proxy : renderer.getRenderProxies())
+				bReady = bReady && proxy->isPipelineReady();
+		}
+		QVERIFY(bReady);
+		renderer.renderFrame();
+		QCOMPARE(renderer.mDrawStats.drawCount, 64);
+		QBENCHMARK {
+			renderer.renderFrame();
+		}
+	}
+};
+
+QTEST_MAIN(tst_MeshOptimizer)
+#include "tst_MeshOptimizer.moc"
@@ -0,0 +1,90 @@
+#include <QtTest>
+#include "Render/IRenderer.h"
+#include "Render/QRendererSurface.h"
+
+class tst_OffscreenRenderer : public QObject {
+	Q_OBJECT
+private:
+	static QRhiHelper::InitParams nullParams(int framesInFlight) {
+		QRhiHelper::InitParams params;
+		params.backend = QRhi::Null;
+		params.offscreenFramesInFlight = framesInFlight;
+		return params;
+	}
+private Q_SLOTS:
+	// The callback of the first frame is held back, the render thread still records until the delivery queue is full
+	void recordsWhileFramesAreDelivered() {
+		IRenderer renderer(nullParams(3), QSize(64, 64), IRenderer::Type::Offscreen);
+		QRendererOffscreenSurface* surface = static_cast<QRendererOffscreenSurface*>(renderer.surface());
+		QSemaphore gate;
+		QMutex mutex;
+		QVector<quint64> delivered;
+		QVector<QImage> images;
+		bool bOffRenderThread = true;
+		QThread* renderThread = renderer.renderThread();
+		surface->setFrameCallback([&](quint64 frameIndex, const QImage& image) {
+			gate.acquire();
+			QMutexLocker locker(&mutex);
+			delivered << frameIndex;
+			images << image;
+			bOffRenderThread = bOffRenderThread && QThread::currentThread() != renderThread;
+		});
+		auto openGate = qScopeGuard([&gate]() {
+			gate.release(1000);
+		});
+
+		for (int i = 0; i < 3; i++)
+			renderer.renderFrame();
+		QRendererOffscreenSurface::Statistics statistics = surface->getStatistics();
+		QCOMPARE(statistics.framesSubmitted, quint64(3));
+		QCOMPARE(statistics.framesRetired, quint64(0));
+		QCOMPARE(statistics.stalls, quint64(0));
+		QCOMPARE(statistics.maxFramesInFlight, 3);
+
+		gate.release(3);
+		QTRY_COMPARE(surface->getStatistics().framesRetired, quint64(3));
+		for (int i = 0; i < 3; i++) {
+			gate.release();
+			renderer.renderFrame();
+		}
+		QTRY_COMPARE(surface->getStatistics().framesRetired, quint64(6));
+		QMutexLocker locker(&mutex);
+		QCOMPARE(delivered, QVector<quint64>({ 0, 1, 2, 3, 4, 5 }));
+		// Images outlive the callback, each one still owns its own readback
+		QCOMPARE(images.size(), 6);
+		for (const QImage& image : images) {
+			QCOMPARE(image.size(), QSize(64, 64));
+			QCOMPARE(image.format(), QImage::Format_RGBA32FPx4);
+		}
+		QVERIFY(images[0].constBits() != images[1].constBits());
+		QVERIFY(bOffRenderThread);
+	}
+
+	// A full delivery queue blocks the next frame until the oldest frame is delivered, and only that frame
+	void stallsOnFullDeliveryQueue() {
+		IRenderer renderer(nullParams(2), QSize(64, 64), IRenderer::Type::Offscreen);
+		QRendererOffscreenSurface* surface = static_cast<QRendererOffscreenSurface*>(renderer.surface());
+		QSemaphore gate;
+		surface->setFrameCallback([&gate](quint64, const QImage&) {
+			gate.acquire();
+		});
+		auto openGate = qScopeGuard([&gate]() {
+			gate.release(1000);
+		});
+
+		renderer.renderFrame();
+		renderer.renderFrame();
+		renderer.requestRender();
+		QTest::qWait(100);
+		QCOMPARE(surface->getStatistics().framesSubmitted, quint64(2));
+
+		gate.release();
+		QTRY_COMPARE(surface->getStatistics().framesSubmitted, quint64(3));
+		QCOMPARE(surface->getStatistics().stalls, quint64(1));
+		gate.release(2);
+		QTRY_COMPARE(surface->getStatistics().framesRetired, quint64(3));
+	}
+};
+
+QTEST_MAIN(tst_OffscreenRenderer)
+#include "tst_OffscreenRenderer.moc"
@@ -0,0 +1,121 @@
+#include <QtTest>
+#include "Asset/QParticleEmitter.h"
+#include "Render/RHI/QRhiHelper.h"
+
+// Ticks outside of a renderer, the Null backend still hands out a command buffer for the transform upload
+class TestParticleEmitter : public QCpuParticleEmitter {
+public:
+	TestParticleEmitter(QRhi* inRhi) {
+		setupRhi(inRhi);
+		setNumOfSpawnPerFrame(CPU_PARTICLE_MAX_SIZE);
+	}
+	void tick() {
+		QRhiCommandBuffer* cmdBuffer = nullptr;
+		if (mRhi->beginOffscreenFrame(&cmdBuffer) != QRhi::FrameOpSuccess)
+			return;
+		onTick(cmdBuffer);
+		mRhi->endOffscreenFrame();
+	}
+};
+
+// Only overrides the per particle hook, the way emitters written before batching do
+class LegacyParticleEmitter : public TestParticleEmitter {
+public:
+	using TestParticleEmitter::TestParticleEmitter;
+	QThread* mTickThread = QThread::currentThread();
+	QAtomicInt mOffThreadUpdates = 0;
+	int mUpdates = 0;
+protected:
+	void onSpawn(Particle& newParticle) override {
+		newParticle.lifetime = 1.0e6f;
+	}
+	void onUpdate(Particle& outParticle) override {
+		if (QThread::currentThread() != mTickThread)
+			mOffThreadUpdates.fetchAndAddRelaxed(1);
+		mUpdates++;
+		outParticle.velocity.setY(outParticle.velocity.y() - 0.01f);
+	}
+};
+
+// Stream wise spawn and update that is safe on disjoint batches, so it opts in to the parallel update
+class StreamParticleEmitter : public TestParticleEmitter {
+public:
+	StreamParticleEmitter(QRhi* inRhi) : TestParticleEmitter(inRhi) {
+		setParallelUpdate(true);
+	}
+protected:
+	void onSpawnBatch(ParticleBatch& ioBatch) override {
+		for (int stream = 0; stream < StreamCount; stream++)
+			std::fill_n(ioBatch.streams[stream], ioBatch.count, 0.0f);
+		for (int i = 0; i < ioBatch.count; i++) {
+			ioBatch.streams[ScalingX][i] = ioBatch.streams[ScalingY][i] = ioBatch.streams[ScalingZ][i] = 0.1f;
+			ioBatch.streams[RotationZ][i] = float(i % 360);
+			ioBatch.streams[VelocityX][i] = (i % 200 - 100) * 1e-4f;
+			ioBatch.streams[Lifetime][i] = 1.0e6f;
+		}
+	}
+	void onUpdateBatch(ParticleBatch& ioBatch, float inDeltaSec) override {
+		float* velocityY = ioBatch.streams[VelocityY];
+		for (int i = 0; i < ioBatch.count; i++)
+			velocityY[i] -= 9.8f * inDeltaSec * 1e-3f;
+	}
+};
+
+class tst_ParticleEmitter : public QObject {
+	Q_OBJECT
+private Q_SLOTS:
+	void initTestCase() {
+		mRhi = QRhiHelper::create(QRhi::Null);
+		QVERIFY(mRhi);
+		mPreviousWorkers = QCpuParticleEmitter::updateThreadPool()->maxThreadCount();
+	}
+
+	void cleanup() {
+		QCpuParticleEmitter::updateThreadPool()->setMaxThreadCount(mPreviousWorkers);
+	}
+
+	void cleanupTestCase() {
+		mRhi.reset();
+	}
+
+	void legacyUpdateStaysOnCallingThread() {
+		QCpuParticleEmitter::updateThreadPool()->setMaxThreadCount(qMax(4, QThread::idealThreadCount()));
+		LegacyParticleEmitter emitter(mRhi.get());
+		QVERIFY(!emitter.getParallelUpdate());
+		emitter.setNumOfSpawnPerFrame(200000);
+		emitter.tick();
+		emitter.tick();
+		QCOMPARE(emitter.getNumOfParticle(), 400000u);
+		QCOMPARE(emitter.mUpdates, 200000 + 400000);
+		QCOMPARE(emitter.mOffThreadUpdates.loadRelaxed(), 0);
+	}
+
+	void updateScaling_data() {
+		QTest::addColumn<int>("threads");
+		const int idealThreads = QThread::idealThreadCount();
+		for (int threads = 1; threads < idealThreads; threads *= 2)
+			QTest::addRow("%d threads", threads) << threads;
+		QTest::addRow("%d threads", idealThreads) << idealThreads;
+	}
+
+	// Update and transform build of a full emitter, read particles/ms per row to see how it scales with cores
+	void updateScaling() {
+		QFETCH(int, threads);
+		QCpuParticleEmitter::updateThreadPool()->setMaxThreadCount(threads);
+		StreamParticleEmitter emitter(mRhi.get());
+		emitter.tick();
+		QCOMPARE(emitter.getNumOfParticle(), quint32(QCpuParticleEmitter::CPU_PARTICLE_MAX_SIZE));
+		QBENCHMARK {
+			emitter.tick();
+		}
+		const QCpuParticleEmitter::Statistics statistics = emitter.getStatistics();
+		QCOMPARE(statistics.particles, quint32(QCpuParticleEmitter::CPU_PARTICLE_MAX_SIZE));
+		qInfo("%s: %.0f particles/ms on %u chunks", QTest::currentDataTag(), statistics.particlesPerMs(), statistics.threads);
+	}
+private:
+	QSharedPointer<QRhi> mRhi;
+	int mPreviousWorkers = 0;
+};
+
+QTEST_MAIN(tst_ParticleEmitter)
+#include "tst_ParticleEmitter.moc"
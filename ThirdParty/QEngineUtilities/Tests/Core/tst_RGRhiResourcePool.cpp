@@ -0,0 +1,149 @@
+#include <QtTest>
+#include "Render/RHI/QRhiHelper.h"
+#include "Render/RenderGraph/QRGRhiResourcePool.h"
+#include "Render/RHI/QRhiSharedPipelines.h"
+
+class tst_RGRhiResourcePool : public QObject {
+	Q_OBJECT
+private:
+	static constexpr QSize TextureSize = QSize(256, 256);
+
+	QRhiTextureRef newTexture(QRGRhiResourcePool& pool) {
+		return pool.findOrNew(QRhiTexture::RGBA8, TextureSize, 1, QRhiTexture::RenderTarget);
+	}
+
+	quint64 textureBytes() const {
+		return QRGRhiResourcePool::byteSize(QRhiTexture::RGBA8, TextureSize, 1, QRhiTexture::RenderTarget);
+	}
+
+	QRhiGraphicsPipeline* newPipeline(QRhiRenderPassDescriptor* renderPassDesc) {
+		QRhiGraphicsPipeline* pipeline = mRhi->newGraphicsPipeline();
+		pipeline->setShaderStages({
+			{ QRhiShaderStage::Vertex, QRhiHelper::newShaderFromCode(QShader::VertexStage, "#version 450\nvoid main() { gl_Position = vec4(0.0); }") },
+			{ QRhiShaderStage::Fragment, QRhiHelper::newShaderFromCode(QShader::FragmentStage, "#version 450\nlayout(location = 0) out vec4 outColor;\nvoid main() { outColor = vec4(1.0); }") }
+		});
+		pipeline->setRenderPassDescriptor(renderPassDesc);
+		return pipeline;
+	}
+private Q_SLOTS:
+	void initTestCase() {
+		mRhi = QRhiHelper::create(QRhi::Null);
+		QVERIFY(mRhi);
+	}
+
+	void cleanupTestCase() {
+		mRhi.reset();
+	}
+
+	void agesOutIdleResources() {
+		QRGRhiResourcePool pool(mRhi.get());
+		pool.setMaxIdleFrames(2);
+		QRhiTextureRef texture = newTexture(pool);
+		for (int i = 0; i < 5; i++)
+			pool.collectGarbage();
+		QCOMPARE(pool.getStatistics(QRhiResource::Texture).liveCount, 1);
+
+		texture.reset();
+		pool.collectGarbage();
+		pool.collectGarbage();
+		QCOMPARE(pool.getStatistics(QRhiResource::Texture).liveCount, 1);
+		pool.collectGarbage();
+		const QRGRhiResourcePool::Statistics stats = pool.getStatistics(QRhiResource::Texture);
+		QCOMPARE(stats.liveCount, 0);
+		QCOMPARE(stats.bytes, quint64(0));
+		QCOMPARE(stats.evictions, quint64(1));
+	}
+
+	void trimsLeastRecentlyUsedToBudget() {
+		QRGRhiResourcePool pool(mRhi.get());
+		pool.setMaxIdleFrames(-1);
+		pool.setBudget(QRhiResource::Texture, 2 * textureBytes());
+		QVector<QRhiTextureRef> textures;
+		for (int i = 0; i < 4; i++) {
+			textures << newTexture(pool);
+			pool.collectGarbage();
+		}
+		// Over budget but everything is in use, nothing may go
+		QCOMPARE(pool.getStatistics(QRhiResource::Texture).liveCount, 4);
+		QCOMPARE(pool.getStatistics(QRhiResource::Texture).bytes, 4 * textureBytes());
+
+		// Release in age order so each texture keeps a distinct last used frame
+		QSet<QRhiTexture*> newest;
+		for (int i = 0; i < 4; i++) {
+			if (i >= 2)
+				newest << textures[i].get();
+			textures[i].reset();
+			pool.collectGarbage();
+		}
+		const QRGRhiResourcePool::Statistics stats = pool.getStatistics(QRhiResource::Texture);
+		QCOMPARE(stats.liveCount, 2);
+		QCOMPARE(stats.bytes, 2 * textureBytes());
+		QCOMPARE(stats.evictions, quint64(2));
+
+		QRhiTextureRef first = newTexture(pool);
+		QRhiTextureRef second = newTexture(pool);
+		QVERIFY(newest.contains(first.get()));
+		QVERIFY(newest.contains(second.get()));
+	}
+
+	void keepsResourcesReferencedByLiveTargets() {
+		QRGRhiResourcePool pool(mRhi.get());
+		pool.setMaxIdleFrames(0);
+		QRhiTextureRef texture = newTexture(pool);
+		QRhiTextureRenderTargetRef renderTarget = pool.findOrNew(QRhiTextureRenderTargetDescription(texture.get()), {});
+		texture.reset();
+		for (int i = 0; i < 3; i++)
+			pool.collectGarbage();
+		QCOMPARE(pool.getStatistics(QRhiResource::Texture).liveCount, 1);
+
+		renderTarget.reset();
+		pool.collectGarbage();
+		pool.collectGarbage();
+		QCOMPARE(pool.getStatistics(QRhiResource::Texture).liveCount, 0);
+		QCOMPARE(pool.getStatistics(QRhiResource::TextureRenderTarget).liveCount, 0);
+	}
+
+	void sharesAndPrunesPipelines() {
+		QRGRhiResourcePool pool(mRhi.get());
+		QRhiTextureRef texture = newTexture(pool);
+		QRhiTextureRenderTargetRef renderTarget = pool.findOrNew(QRhiTextureRenderTargetDescription(texture.get()), {});
+		QRhiSharedPipelines shared(mRhi.get());
+
+		std::shared_ptr<QRhiShaderResourceBindings> firstBindings = shared.findOrCreateBindings({});
+		std::shared_ptr<QRhiShaderResourceBindings> secondBindings = shared.findOrCreateBindings({});
+		QCOMPARE(firstBindings, secondBindings);
+		QCOMPARE(shared.getBindingsCount(), 1);
+
+		QRhiGraphicsPipelineRef first = shared.findOrCreatePipeline(newPipeline(renderTarget->renderPassDescriptor()), firstBindings);
+		QRhiGraphicsPipelineRef second = shared.findOrCreatePipeline(newPipeline(renderTarget->renderPassDescriptor()), secondBindings);
+		QCOMPARE(first, second);
+		QCOMPARE(shared.getPipelineCount(), 1);
+
+		// The registry alone must not keep the pipeline or the srb it was created against alive
+		std::weak_ptr<QRhiShaderResourceBindings> weakBindings = firstBindings;
+		firstBindings.reset();
+		secondBindings.reset();
+		first.reset();
+		second.reset();
+		shared.prune();
+		QCOMPARE(shared.getPipelineCount(), 0);
+		QCOMPARE(shared.getBindingsCount(), 0);
+		QVERIFY(weakBindings.expired());
+	}
+
+	void collectGarbageSteadyState() {
+		QRGRhiResourcePool pool(mRhi.get());
+		QVector<QRhiBufferRef> buffers;
+		for (int i = 0; i < 2000; i++)
+			buffers << pool.findOrNew(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, 256);
+		QBENCHMARK {
+			pool.collectGarbage();
+		}
+		QCOMPARE(pool.getStatistics(QRhiResource::Buffer).liveCount, 2000);
+	}
+private:
+	QSharedPointer<QRhi> mRhi;
+};
+
+QTEST_MAIN(tst_RGRhiResourcePool)
+#include "tst_RGRhiResourcePool.moc"
@@ -0,0 +1,143 @@
+#include <QtTest>
+#include "Render/IRenderer.h"
+#include "Render/RenderGraph/IRenderPassBuilder.h"
+
+// Full screen color pass that samples the previous one, the chain gives every output a lifetime of exactly two passes
+class TestColorPassBuilder : public IRenderPassBuilder {
+	QRP_INPUT_BEGIN(TestColorPassBuilder)
+		QRP_INPUT_ATTR(QRhiTextureRef, Source);
+		QRP_INPUT_ATTR(bool, ExternalRead) = false;
+	QRP_INPUT_END()
+
+	QRP_OUTPUT_BEGIN(TestColorPassBuilder)
+		QRP_OUTPUT_ATTR(QRhiTextureRef, Color);
+	QRP_OUTPUT_END()
+protected:
+	void setup(QRenderGraphBuilder& builder) override {
+		builder.setupTexture(mOutput.Color, "Color", QRhiTexture::RGBA8, QSize(1920, 1080), 1, QRhiTexture::RenderTarget);
+		builder.setupRenderTarget(mRenderTarget, "ColorTarget", QRhiTextureRenderTargetDescription(mOutput.Color.get()));
+		if (mInput._Source) {
+			builder.setupSampler(mSampler, "ColorSampler", QRhiSampler::Linear, QRhiSampler::Linear, QRhiSampler::None, QRhiSampler::ClampToEdge, QRhiSampler::ClampToEdge);
+			builder.setupShaderResourceBindings(mBindings, "ColorBindings", {
+				QRhiShaderResourceBinding::sampledTexture(0, QRhiShaderResourceBinding::FragmentStage, mInput._Source.get(), mSampler.get())
+			});
+		}
+		if (mInput._ExternalRead)
+			builder.declareExternalRead(mOutput.Color.get());
+	}
+	void execute(QRhiCommandBuffer* cmdBuffer) override {}
+private:
+	QRhiTextureRenderTargetRef mRenderTarget;
+	QRhiSamplerRef mSampler;
+	QRhiShaderResourceBindingsRef mBindings;
+};
+
+class tst_RenderGraph : public QObject {
+	Q_OBJECT
+private:
+	struct Frame {
+		QVector<QRhiTextureRef> outputs;
+		int setupCount = 0;
+		QRenderGraphBuilder::CompileStats stats;
+	};
+
+	// Mirrors the render thread: set up, compile, and set up once more when the alias plan moved
+	Frame buildChain(int length, QSet<int> externalReads, bool bWithUnusedPass = false, bool bReadUnusedPass = false) {
+		QRenderGraphBuilder* builder = mRenderer->getRenderGraphBuilder();
+		Frame frame;
+		auto setupGraph = [&]() {
+			frame.setupCount++;
+			frame.outputs.clear();
+			QRhiTextureRef source;
+			for (int i = 0; i < length; i++) {
+				auto output = builder->addPassBuilder<TestColorPassBuilder>("Pass" + QString::number(i))
+					.setSource(source)
+					.setExternalRead(externalReads.contains(i))
+					.setup();
+				source = output.Color;
+				frame.outputs << output.Color;
+			}
+			if (bWithUnusedPass) {
+				auto output = builder->addPassBuilder<TestColorPassBuilder>("Unused")
+					.setExternalRead(bReadUnusedPass)
+					.setup();
+				frame.outputs << output.Color;
+			}
+		};
+		setupGraph();
+		if (!builder->compile()) {
+			builder->resetGraph();
+			setupGraph();
+			builder->compile();
+		}
+		frame.stats = builder->getCompileStats();
+		builder->clear();
+		return frame;
+	}
+private Q_SLOTS:
+	void initTestCase() {
+		QRhiHelper::InitParams params;
+		params.backend = QRhi::Null;
+		mRenderer.reset(new IRenderer(params, QSize(1920, 1080), IRenderer::Type::Offscreen));
+		QVERIFY(mRenderer->rhi());
+		QVERIFY(mRenderer->getRenderGraphBuilder());
+	}
+
+	void cleanupTestCase() {
+		mRenderer.reset();
+	}
+
+	void aliasesOnFirstFrame() {
+		const Frame frame = buildChain(6, { 5 });
+		QCOMPARE(frame.setupCount, 2);
+		QCOMPARE(frame.stats.culledPassCount, 0);
+		QCOMPARE(frame.stats.transientResourceCount, 6);
+		QCOMPARE(frame.outputs[2].get(), frame.outputs[0].get());
+		QCOMPARE(frame.outputs[4].get(), frame.outputs[0].get());
+		QCOMPARE(frame.outputs[3].get(), frame.outputs[1].get());
+		QVERIFY(frame.outputs[1].get() != frame.outputs[0].get());
+		const quint64 textureBytes = QRGRhiResourcePool::byteSize(QRhiTexture::RGBA8, QSize(1920, 1080), 1, QRhiTexture::RenderTarget);
+		QCOMPARE(frame.stats.transientBytes, 6 * textureBytes);
+		QCOMPARE(frame.stats.aliasedTransientBytes, 3 * textureBytes);
+		qInfo("peak transient bytes: %llu before aliasing, %llu after", frame.stats.transientBytes, frame.stats.aliasedTransientBytes);
+
+		// Same graph again: the plan is stable, so setup runs once
+		const Frame next = buildChain(6, { 5 });
+		QCOMPARE(next.setupCount, 1);
+		QCOMPARE(next.stats.aliasedTransientBytes, frame.stats.aliasedTransientBytes);
+	}
+
+	void externalReadIsNeverAliased() {
+		const Frame frame = buildChain(6, { 0, 5 });
+		QVERIFY(frame.outputs[2].get() != frame.outputs[0].get());
+		QVERIFY(frame.outputs[4].get() != frame.outputs[0].get());
+		QVERIFY(frame.outputs[5].get() != frame.outputs[0].get());
+		const quint64 textureBytes = QRGRhiResourcePool::byteSize(QRhiTexture::RGBA8, QSize(1920, 1080), 1, QRhiTexture::RenderTarget);
+		QCOMPARE(frame.stats.aliasedTransientBytes, 4 * textureBytes);
+	}
+
+	void externalReadKeepsProducerAlive() {
+		const Frame culled = buildChain(3, { 2 }, true, false);
+		QCOMPARE(culled.stats.passCount, 4);
+		QCOMPARE(culled.stats.culledPassCount, 1);
+
+		const Frame kept = buildChain(3, { 2 }, true, true);
+		QCOMPARE(kept.stats.culledPassCount, 0);
+		for (int i = 0; i < 3; i++)
+			QVERIFY(kept.outputs[3].get() != kept.outputs[i].get());
+	}
+
+	void unaliasedWhenDisabled() {
+		QRenderGraphBuilder* builder = mRenderer->getRenderGraphBuilder();
+		builder->setTransientAliasingEnabled(false);
+		const Frame frame = buildChain(6, { 5 });
+		builder->setTransientAliasingEnabled(true);
+		QCOMPARE(frame.stats.aliasedTransientBytes, frame.stats.transientBytes);
+		QCOMPARE(frame.stats.aliasedResourceCount, 0);
+	}
+private:
+	QScopedPointer<IRenderer> mRenderer;
+};
+
+QTEST_MAIN(tst_RenderGraph)
+#include "tst_RenderGraph.moc"
@@ -0,0 +1,95 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include "Render/RHI/QRhiHelper.h"
+
+class tst_ShaderCache : public QObject {
+	Q_OBJECT
+private:
+	static QByteArray fragmentCode(int seed) {
+		return QString(R"(#version 450
+			layout (location = 0) out vec4 outFragColor;
+			void main() {
+				outFragColor = vec4(%1);
+			}
+		)").arg(seed / 1000.0, 0, 'f', 3).toLocal8Bit();
+	}
+private Q_SLOTS:
+	void init() {
+		QRhiHelper::setShaderCacheDirectory(QString());
+		QRhiHelper::setShaderMemoryCacheLimit(64 * 1024 * 1024);
+		QRhiHelper::clearShaderCache();
+	}
+
+	void bakesEveryTarget() {
+		const QShader shader = QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(1));
+		QVERIFY(shader.isValid());
+		QVERIFY(!shader.shader(QShaderKey(QShader::Source::SpirvShader, QShaderVersion(100))).shader().isEmpty());
+		QVERIFY(!shader.shader(QShaderKey(QShader::Source::GlslShader, QShaderVersion(450))).shader().isEmpty());
+		QVERIFY(!shader.shader(QShaderKey(QShader::Source::MslShader, QShaderVersion(20))).shader().isEmpty());
+		QVERIFY(!shader.shader(QShaderKey(QShader::Source::HlslShader, QShaderVersion(50))).shader().isEmpty());
+	}
+
+	void persistsOnlyValidShaders() {
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QRhiHelper::setShaderCacheDirectory(dir.path());
+		QVERIFY(QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(2)).isValid());
+		QVERIFY(!QRhiHelper::newShaderFromCode(QShader::FragmentStage, "#version 450\nvoid main() { undefined(); }").isValid());
+		QCOMPARE(QDir(dir.path()).entryList({ "*.qsb" }, QDir::Files).size(), 1);
+
+		QRhiHelper::clearShaderCache();
+		const quint64 diskHits = QRhiHelper::getShaderCacheStats().diskHits;
+		QVERIFY(QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(2)).isValid());
+		QCOMPARE(QRhiHelper::getShaderCacheStats().diskHits, diskHits + 1);
+	}
+
+	void evictsLeastRecentlyUsed() {
+		const QShader first = QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(3));
+		QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(4));
+		const qint64 shaderBytes = first.serialized().size();
+		QRhiHelper::setShaderMemoryCacheLimit(shaderBytes * 2 + shaderBytes / 2);
+
+		QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(3));		// 4 is now the oldest
+		QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(5));
+		const QRhiHelper::ShaderCacheStats before = QRhiHelper::getShaderCacheStats();
+		QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(3));
+		QCOMPARE(QRhiHelper::getShaderCacheStats().memoryHits, before.memoryHits + 1);
+		QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(4));
+		QCOMPARE(QRhiHelper::getShaderCacheStats().misses, before.misses + 1);
+	}
+
+	void asyncMemoryHitIsReady() {
+		QVERIFY(QRhiHelper::newShaderFromCode(QShader::FragmentStage, fragmentCode(6)).isValid());
+		QFuture<QShader> future = QRhiHelper::newShaderFromCodeAsync(QShader::FragmentStage, fragmentCode(6));
+		QVERIFY(future.isFinished());
+		QVERIFY(future.result().isValid());
+	}
+
+	void bakeMaterials_data() {
+		QTest::addColumn<int>("workers");
+		QTest::newRow("1 worker") << 1;
+		QTest::newRow("all cores") << QThread::idealThreadCount();
+	}
+
+	// Cold bakes of N distinct materials, compares one worker against the whole pool
+	void bakeMaterials() {
+		QFETCH(int, workers);
+		const int materialCount = 32;
+		static int seedBase = 1000;
+		QThreadPool* pool = QRhiHelper::shaderCompileThreadPool();
+		const int previousWorkers = pool->maxThreadCount();
+		pool->setMaxThreadCount(workers);
+		QBENCHMARK_ONCE {
+			QList<QFuture<QShader>> futures;
+			for (int i = 0; i < materialCount; i++)
+				futures << QRhiHelper::newShaderFromCodeAsync(QShader::FragmentStage, fragmentCode(seedBase + i));
+			for (auto& future : futures)
+				QVERIFY(future.result().isValid());
+		}
+		seedBase += materialCount;
+		pool->setMaxThreadCount(previousWorkers);
+	}
+};
+
+QTEST_MAIN(tst_ShaderCache)
+#include "tst_ShaderCache.moc"
@@ -0,0 +1,356 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include "Asset/QAnimationSystem.h"
+#include "Asset/QMeshCache.h"
+#include "Asset/QSkeletalMesh.h"
+
+class tst_SkeletalAnimation : public QObject {
+	Q_OBJECT
+private:
+	// Ten chains of ten bones hanging off the root, every node drives a bone with an identity offset
+	static QSharedPointer<QSkeleton> createSkeleton(int boneCount) {
+		QSharedPointer<QSkeleton> skeleton = QSharedPointer<QSkeleton>::create();
+		QVector<QSharedPointer<QSkeleton::MeshNode>> nodes;
+		for (int i = 0; i < boneCount; i++) {
+			QSharedPointer<QSkeleton::MeshNode> node = QSharedPointer<QSkeleton::MeshNode>::create();
+			node->name = QString("Bone%1").arg(i);
+			node->localTransform.translate(0.0f, i == 0 ? 0.0f : 0.1f, 0.0f);
+			if (i > 0)
+				nodes[i % 10 == 1 ? 0 : i - 1]->children << node;
+			nodes << node;
+			QSharedPointer<QSkeleton::BoneNode> bone = QSharedPointer<QSkeleton::BoneNode>::create();
+			bone->index = i;
+			bone->name = node->name;
+			skeleton->mBoneMap.insert(bone->name, bone);
+			skeleton->mBoneOffsetMatrix << MathUtils::Mat4();
+		}
+		skeleton->mMeshRoot = nodes.first();
+		skeleton->flatten();
+		return skeleton;
+	}
+
+	// Two seconds of swinging bones, the default keys land every 0.1s so they line up with the 30Hz compression grid
+	static QSharedPointer<QSkeletalAnimation> createAnimation(int boneCount, float phase = 0.0f, int keysPerSecond = 10, bool releaseSource = false) {
+		QSharedPointer<QSkeletalAnimation> animation = QSharedPointer<QSkeletalAnimation>::create();
+		animation->mTicksPerSecond = 30.0;
+		animation->mDuration = 60.0;
+		for (int i = 0; i < boneCount; i++) {
+			QSkeletalAnimation::AnimNode& node = animation->mAnimNode[QString("Bone%1").arg(i)];
+			for (int key = 0; key <= 2 * keysPerSecond; key++) {
+				const double time = double(key) / keysPerSecond;
+				const float angle = float(time) * 3.0f + i * 0.37f + phase;
+				node.translation[time] = QVector3D(0.0f, i == 0 ? 0.0f : 0.1f, 0.02f * qSin(angle));
+				node.rotation[time] = QQuaternion::fromEulerAngles(20.0f * qSin(angle), 10.0f * qCos(angle), 0.0f);
+				node.scaling[time] = QVector3D(1, 1, 1);
+			}
+		}
+		QSkeletalAnimation::CompressionSettings settings;
+		settings.bReleaseSource = releaseSource;
+		animation->compress(settings);
+		return animation;
+	}
+
+	template<typename ValueType>
+	static ValueType sampleKeys(const QMap<double, ValueType>& keys, double time) {
+		auto end = keys.upperBound(time);
+		if (end == keys.cbegin())
+			return end.value();
+		auto start = std::prev(end);
+		if (end == keys.cend())
+			return start.value();
+		const float factor = float((time - start.key()) / (end.key() - start.key()));
+		if constexpr (std::is_same_v<ValueType, QQuaternion>)
+			return QQuaternion::nlerp(start.value(), end.value(), factor);
+		else
+			return start.value() + (end.value() - start.value()) * factor;
+	}
+
+	static QMatrix4x4 composeLocal(const QVector3D& translation, const QQuaternion& rotation, const QVector3D& scaling) {
+		QMatrix4x4 local;
+		local.translate(translation);
+		local.rotate(rotation);
+		local.scale(scaling);
+		return local;
+	}
+
+	// Composes reference local transforms down the chains of createSkeleton and returns the largest element difference
+	static float maxPoseError(const QVector<MathUtils::Mat4>& poses, const QVector<QMatrix4x4>& locals) {
+		QVector<QMatrix4x4> globals(locals.size());
+		float maxError = poses.size() == locals.size() ? 0.0f : std::numeric_limits<float>::max();
+		for (int i = 0; i < locals.size() && i < poses.size(); i++) {
+			globals[i] = i == 0 ? locals[i] : globals[i % 10 == 1 ? 0 : i - 1] * locals[i];
+			const QMatrix4x4 pose(poses[i]);
+			for (int element = 0; element < 16; element++)
+				maxError = qMax(maxError, qAbs(pose.constData()[element] - globals[i].constData()[element]));
+		}
+		return maxError;
+	}
+
+	static QSharedPointer<QSkeletalMesh> createCharacter(const QSharedPointer<QSkeleton>& skeleton, const QSharedPointer<QSkeletalAnimation>& animation) {
+		QSharedPointer<QSkeletalMesh> mesh = QSharedPointer<QSkeletalMesh>::create();
+		mesh->mSkeleton = skeleton;
+		mesh->mAnimations << animation;
+		mesh->resetPoses();
+		mesh->playAnimation(0);
+		return mesh;
+	}
+private Q_SLOTS:
+	void matchesTreeEvaluation() {
+		const int boneCount = 20;
+		QSharedPointer<QSkeleton> skeleton = createSkeleton(boneCount);
+		QSharedPointer<QSkeletalAnimation> animation = createAnimation(boneCount);
+		QSharedPointer<QSkeletalMesh> mesh = createCharacter(skeleton, animation);
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.55f);
+
+		// The uncompressed tracks composed parent to child, the way the tree walk used to do it
+		QVector<QMatrix4x4> reference(boneCount);
+		for (int i = 0; i < boneCount; i++) {
+			const QMatrix4x4 local = animation->mAnimNode[QString("Bone%1").arg(i)].getMatrix(0.55);
+			reference[i] = i == 0 ? local : reference[i % 10 == 1 ? 0 : i - 1] * local;
+		}
+		const QVector<MathUtils::Mat4> poses = mesh->getCurrentPoses();
+		QCOMPARE(poses.size(), boneCount);
+		float maxError = 0.0f;
+		for (int i = 0; i < boneCount; i++) {
+			const QMatrix4x4 pose(poses[i]);
+			for (int element = 0; element < 16; element++)
+				maxError = qMax(maxError, qAbs(pose.constData()[element] - reference[i].constData()[element]));
+		}
+		qInfo("max pose error %g", maxError);
+		QVERIFY(maxError < 5e-3f);
+	}
+
+	// One clip on two skeletons of different sizes, each mesh keeps its own node to track mapping
+	void sharedClipBindsPerMesh() {
+		QSharedPointer<QSkeletalAnimation> animation = createAnimation(20);
+		QSharedPointer<QSkeletalMesh> large = createCharacter(createSkeleton(20), animation);
+		QSharedPointer<QSkeletalMesh> small = createCharacter(createSkeleton(10), animation);
+		const QVector<QSkeletalAnimation::Track> tracks = animation->mTracks;
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.3f);
+		QAnimationSystem::tick(0.3f);
+		QCOMPARE(animation->mTracks.size(), tracks.size());
+
+		for (const auto& mesh : { large, small }) {
+			const int boneCount = mesh->mSkeleton->mNodeNames.size();
+			QVector<QMatrix4x4> locals;
+			for (int i = 0; i < boneCount; i++)
+				locals << animation->mAnimNode[QString("Bone%1").arg(i)].getMatrix(0.6);
+			const float error = maxPoseError(mesh->getCurrentPoses(), locals);
+			qInfo("%d bones: max pose error %g", boneCount, error);
+			QVERIFY(error < 5e-3f);
+		}
+	}
+
+	// Characters on two skeletons share one clip across the evaluation pool, and a snapshot taken between ticks stays put
+	void sharedClipAcrossJobs() {
+		QSharedPointer<QSkeletalAnimation> animation = createAnimation(20);
+		QSharedPointer<QSkeleton> large = createSkeleton(20);
+		QSharedPointer<QSkeleton> small = createSkeleton(10);
+		QVector<QSharedPointer<QSkeletalMesh>> characters;
+		for (int i = 0; i < 64; i++)
+			characters << createCharacter(i % 2 ? small : large, animation);
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.25f);
+		const QVector<MathUtils::Mat4> snapshot = characters[0]->getCurrentPoses();
+		const QVector<MathUtils::Mat4> expected = QVector<MathUtils::Mat4>(snapshot.cbegin(), snapshot.cend());
+		QAnimationSystem::tick(0.25f);
+		QAnimationSystem::tick(0.25f);
+		QVERIFY(memcmp(snapshot.constData(), expected.constData(), expected.size() * sizeof(MathUtils::Mat4)) == 0);
+
+		for (const auto& mesh : characters) {
+			const int boneCount = mesh->mSkeleton->mNodeNames.size();
+			QVector<QMatrix4x4> locals;
+			for (int i = 0; i < boneCount; i++)
+				locals << animation->mAnimNode[QString("Bone%1").arg(i)].getMatrix(0.75);
+			QVERIFY(maxPoseError(mesh->getCurrentPoses(), locals) < 5e-3f);
+		}
+	}
+
+	void blendedLayerMatchesReference() {
+		const int boneCount = 20;
+		QSharedPointer<QSkeleton> skeleton = createSkeleton(boneCount);
+		QSharedPointer<QSkeletalAnimation> walk = createAnimation(boneCount);
+		QSharedPointer<QSkeletalAnimation> wave = createAnimation(boneCount, 1.3f);
+		QSharedPointer<QSkeletalMesh> mesh = createCharacter(skeleton, walk);
+		mesh->mAnimations << wave;
+		QSkeletalMesh::AnimationLayer layer;
+		layer.animIndex = 1;
+		layer.weight = 0.5f;
+		mesh->setAnimationLayer(1, layer);
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.4f);
+
+		QVector<QMatrix4x4> locals;
+		for (int i = 0; i < boneCount; i++) {
+			const QString name = QString("Bone%1").arg(i);
+			const QSkeletalAnimation::AnimNode& a = walk->mAnimNode[name];
+			const QSkeletalAnimation::AnimNode& b = wave->mAnimNode[name];
+			const QVector3D translation = sampleKeys(a.translation, 0.4) + (sampleKeys(b.translation, 0.4) - sampleKeys(a.translation, 0.4)) * 0.5f;
+			const QQuaternion rotation = QQuaternion::nlerp(sampleKeys(a.rotation, 0.4), sampleKeys(b.rotation, 0.4), 0.5f);
+			locals << composeLocal(translation, rotation, QVector3D(1, 1, 1));
+		}
+		const float error = maxPoseError(mesh->getCurrentPoses(), locals);
+		qInfo("max pose error %g", error);
+		QVERIFY(error < 5e-3f);
+	}
+
+	void additiveLayerMatchesReference() {
+		const int boneCount = 20;
+		QSharedPointer<QSkeleton> skeleton = createSkeleton(boneCount);
+		QSharedPointer<QSkeletalAnimation> walk = createAnimation(boneCount);
+		QSharedPointer<QSkeletalAnimation> lean = createAnimation(boneCount, 2.1f);
+		QSharedPointer<QSkeletalMesh> mesh = createCharacter(skeleton, walk);
+		mesh->mAnimations << lean;
+		QSkeletalMesh::AnimationLayer layer;
+		layer.animIndex = 1;
+		layer.mode = QSkeletalMesh::BlendMode::Additive;
+		mesh->setAnimationLayer(1, layer);
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.7f);
+
+		// The additive clip contributes its motion relative to its own first frame
+		QVector<QMatrix4x4> locals;
+		for (int i = 0; i < boneCount; i++) {
+			const QString name = QString("Bone%1").arg(i);
+			const QSkeletalAnimation::AnimNode& base = walk->mAnimNode[name];
+			const QSkeletalAnimation::AnimNode& additive = lean->mAnimNode[name];
+			const QVector3D translation = sampleKeys(base.translation, 0.7) + sampleKeys(additive.translation, 0.7) - sampleKeys(additive.translation, 0.0);
+			const QQuaternion delta = sampleKeys(additive.rotation, 0.7) * sampleKeys(additive.rotation, 0.0).conjugated();
+			locals << composeLocal(translation, (delta * sampleKeys(base.rotation, 0.7)).normalized(), QVector3D(1, 1, 1));
+		}
+		const float error = maxPoseError(mesh->getCurrentPoses(), locals);
+		qInfo("max pose error %g", error);
+		QVERIFY(error < 5e-3f);
+	}
+
+	void crossFadeMatchesReference() {
+		const int boneCount = 20;
+		QSharedPointer<QSkeleton> skeleton = createSkeleton(boneCount);
+		QSharedPointer<QSkeletalAnimation> walk = createAnimation(boneCount);
+		QSharedPointer<QSkeletalAnimation> run = createAnimation(boneCount, 0.8f);
+		QSharedPointer<QSkeletalMesh> mesh = createCharacter(skeleton, walk);
+		mesh->mAnimations << run;
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.2f);
+		mesh->crossFade(1, 1.0f);
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.5f);
+
+		// Halfway through the fade, the outgoing clip kept running underneath the incoming one
+		QVector<QMatrix4x4> locals;
+		for (int i = 0; i < boneCount; i++) {
+			const QString name = QString("Bone%1").arg(i);
+			const QSkeletalAnimation::AnimNode& from = walk->mAnimNode[name];
+			const QSkeletalAnimation::AnimNode& to = run->mAnimNode[name];
+			const QVector3D translation = sampleKeys(from.translation, 0.7) + (sampleKeys(to.translation, 0.5) - sampleKeys(from.translation, 0.7)) * 0.5f;
+			const QQuaternion rotation = QQuaternion::nlerp(sampleKeys(from.rotation, 0.7), sampleKeys(to.rotation, 0.5), 0.5f);
+			locals << composeLocal(translation, rotation, QVector3D(1, 1, 1));
+		}
+		const float error = maxPoseError(mesh->getCurrentPoses(), locals);
+		qInfo("max pose error %g", error);
+		QVERIFY(error < 5e-3f);
+	}
+
+	void memoryPerClip_data() {
+		QTest::addColumn<int>("keysPerSecond");
+		QTest::newRow("10 keys/s") << 10;
+		QTest::newRow("30 keys/s") << 30;
+		QTest::newRow("60 keys/s") << 60;
+	}
+
+	// A 100 bone, two second clip, source keys against what stays resident once the source is released
+	void memoryPerClip() {
+		QFETCH(int, keysPerSecond);
+		QSharedPointer<QSkeletalAnimation> animation = createAnimation(100, 0.0f, keysPerSecond, true);
+		const QSkeletalAnimation::CompressionStatistics statistics = animation->getCompressionStatistics();
+		qInfo("%s: %u -> %u keys, %llu -> %llu bytes (%.1fx)", QTest::currentDataTag(), statistics.sourceKeys, statistics.compressedKeys,
+			statistics.sourceBytes, statistics.compressedBytes, double(statistics.sourceBytes) / qMax<quint64>(statistics.compressedBytes, 1));
+		QVERIFY(animation->mAnimNode.isEmpty());
+		QCOMPARE(statistics.compressedBytes, quint64(animation->mKeyFrames.size() * sizeof(quint16) + animation->mKeyData.size() * sizeof(quint16) + animation->mTracks.size() * sizeof(QSkeletalAnimation::Track)));
+		QVERIFY(statistics.compressedBytes * 2 < statistics.sourceBytes);
+	}
+
+	void cacheKeepsCompressedClips() {
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString sourcePath = dir.filePath("character.fbx");
+		QFile source(sourcePath);
+		QVERIFY(source.open(QIODevice::WriteOnly));
+		source.write("placeholder");
+		source.close();
+		QMeshCache::setEnabled(true);
+		QMeshCache::setCacheDirectory(dir.filePath("MeshCache"));
+
+		QSkeletalMesh mesh;
+		mesh.mSkeleton = createSkeleton(20);
+		mesh.mAnimations << createAnimation(20, 0.0f, 30, true);
+		QVERIFY(QMeshCache::saveSkeletalMesh(sourcePath, mesh));
+		QSharedPointer<QSkeletalMesh> cached = QMeshCache::loadSkeletalMesh(sourcePath);
+		QVERIFY(cached);
+		QCOMPARE(cached->mAnimations.size(), 1);
+		const QSkeletalAnimation& original = *mesh.mAnimations[0];
+		const QSkeletalAnimation& loaded = *cached->mAnimations[0];
+		QVERIFY(loaded.isCompressed());
+		QVERIFY(loaded.mAnimNode.isEmpty());
+		QCOMPARE(loaded.mSampleRate, original.mSampleRate);
+		QCOMPARE(loaded.mTracks.size(), original.mTracks.size());
+		QCOMPARE(loaded.mKeyFrames, original.mKeyFrames);
+		QCOMPARE(loaded.mKeyData, original.mKeyData);
+		QCOMPARE(loaded.getCompressionStatistics().compressedBytes, original.getCompressionStatistics().compressedBytes);
+		QMeshCache::clear();
+	}
+
+	void stopIsPickedUpByNextTick() {
+		const int boneCount = 20;
+		QSharedPointer<QSkeleton> skeleton = createSkeleton(boneCount);
+		QSharedPointer<QSkeletalAnimation> animation = createAnimation(boneCount);
+		QSharedPointer<QSkeletalMesh> mesh = createCharacter(skeleton, animation);
+		QAnimationSystem::tick(0.0f);
+		QAnimationSystem::tick(0.5f);
+		QVERIFY(mesh->isAnimationPlaying());
+
+		// A pending stop still counts as playing so the next tick consumes it instead of dropping the mesh
+		mesh->stopAnimation();
+		QVERIFY(mesh->isAnimationPlaying());
+		QAnimationSystem::tick(0.1f);
+		QVERIFY(!mesh->isAnimationPlaying());
+		QAnimationSystem::tick(0.1f);
+		QVERIFY(!mesh->isAnimationPlaying());
+
+		// Playing again starts from the first frame, nothing of the stopped playback is left behind
+		mesh->playAnimation(0);
+		QAnimationSystem::tick(0.3f);
+		const QMatrix4x4 reference = animation->mAnimNode["Bone0"].getMatrix(0.0);
+		const QMatrix4x4 pose(mesh->getCurrentPoses()[0]);
+		for (int element = 0; element < 16; element++)
+			QVERIFY(qAbs(pose.constData()[element] - reference.constData()[element]) < 1e-3f);
+	}
+
+	// 1000 characters x 100 bones on one core, the evaluation pool is emptied so the tick runs on this thread only
+	void evaluateCrowd() {
+		const int characterCount = 1000;
+		const int boneCount = 100;
+		QSharedPointer<QSkeleton> skeleton = createSkeleton(boneCount);
+		QSharedPointer<QSkeletalAnimation> animation = createAnimation(boneCount);
+		QVector<QSharedPointer<QSkeletalMesh>> characters;
+		for (int i = 0; i < characterCount; i++)
+			characters << createCharacter(skeleton, animation);
+		QThreadPool* pool = QAnimationSystem::evaluateThreadPool();
+		const int previousWorkers = pool->maxThreadCount();
+		pool->setMaxThreadCount(0);
+		QAnimationSystem::tick(0.0f);
+		QBENCHMARK {
+			QAnimationSystem::tick(1.0f / 60.0f);
+		}
+		const QAnimationSystem::Statistics statistics = QAnimationSystem::getStatistics();
+		pool->setMaxThreadCount(previousWorkers);
+		QCOMPARE(statistics.meshes, quint32(characterCount));
+		QCOMPARE(statistics.bones, quint32(characterCount * boneCount));
+		qInfo("%u bones in %.3f ms", statistics.bones, statistics.evaluateNanoseconds / 1e6);
+	}
+};
+
+QTEST_MAIN(tst_SkeletalAnimation)
+#include "tst_SkeletalAnimation.moc"
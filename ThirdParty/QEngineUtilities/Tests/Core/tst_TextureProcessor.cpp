@@ -0,0 +1,299 @@
+#include <QtTest>
+#include "Render/RHI/QRhiTextureProcessor.h"
+
+using Compression = QRhiTextureProcessor::Compression;
+using Quality = QRhiTextureProcessor::Quality;
+
+Q_DECLARE_METATYPE(QRhiTextureProcessor::Compression)
+Q_DECLARE_METATYPE(QRhiTextureProcessor::Quality)
+Q_DECLARE_METATYPE(QRhiTexture::Format)
+
+class tst_TextureProcessor : public QObject {
+	Q_OBJECT
+private:
+	// Smooth colour and alpha gradients with a little deterministic noise
+	static QImage testImage(int size, bool translucent) {
+		QImage image(size, size, QImage::Format_RGBA8888);
+		QRandomGenerator random(42);
+		for (int y = 0; y < size; y++) {
+			uchar* row = image.scanLine(y);
+			for (int x = 0; x < size; x++) {
+				const int noise = random.bounded(-6, 7);
+				row[x * 4 + 0] = qBound(0, x * 255 / size + noise, 255);
+				row[x * 4 + 1] = qBound(0, y * 255 / size - noise, 255);
+				row[x * 4 + 2] = qBound(0, int(127.5f + 127.5f * qSin((x + y) * 0.05f)), 255);
+				row[x * 4 + 3] = translucent ? qBound(0, int(127.5f + 127.5f * qCos(x * 0.03f)), 255) : 255;
+			}
+		}
+		return image;
+	}
+
+	// Reference decoder for the only BC7 mode the encoder emits
+	static bool decodeBC7Mode6(const uchar* inData, uchar outBlock[16][4]) {
+		quint64 bits[2] = { 0, 0 };
+		memcpy(bits, inData, 16);
+		int position = 0;
+		auto readBits = [&bits, &position](int count) {
+			quint32 value = 0;
+			for (int i = 0; i < count; i++, position++) {
+				value |= quint32((bits[position >> 6] >> (position & 63)) & 1) << i;
+			}
+			return value;
+		};
+		if (readBits(7) != (1 << 6))
+			return false;
+		int endpoints[2][4];
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] = readBits(7) << 1;
+			endpoints[1][c] = readBits(7) << 1;
+		}
+		const int pbit0 = readBits(1);
+		const int pbit1 = readBits(1);
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] |= pbit0;
+			endpoints[1][c] |= pbit1;
+		}
+		static const int kWeights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		for (int i = 0; i < 16; i++) {
+			const int weight = kWeights[readBits(i == 0 ? 3 : 4)];
+			for (int c = 0; c < 4; c++) {
+				outBlock[i][c] = ((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6;
+			}
+		}
+		return true;
+	}
+
+	static void unpackRgb565(quint16 inColor, int outColor[4]) {
+		const int r = (inColor >> 11) & 31;
+		const int g = (inColor >> 5) & 63;
+		const int b = inColor & 31;
+		outColor[0] = (r << 3) | (r >> 2);
+		outColor[1] = (g << 2) | (g >> 4);
+		outColor[2] = (b << 3) | (b >> 2);
+		outColor[3] = 255;
+	}
+
+	// Reference decoder for the BC1 layout, also the colour half of BC3
+	static void decodeColorBlock(const uchar* inData, uchar outBlock[16][4]) {
+		const quint16 color0 = inData[0] | (inData[1] << 8);
+		const quint16 color1 = inData[2] | (inData[3] << 8);
+		int palette[4][4];
+		unpackRgb565(color0, palette[0]);
+		unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 4; c++) {
+			if (color0 > color1) {
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else {
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		const quint32 indices = inData[4] | (inData[5] << 8) | (inData[6] << 16) | (quint32(inData[7]) << 24);
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 4; c++) {
+				outBlock[i][c] = palette[(indices >> (2 * i)) & 3][c];
+			}
+		}
+	}
+
+	// Reference decoder for the BC4 layout, the BC3 alpha half and both BC5 channels
+	static void decodeChannelBlock(const uchar* inData, int inChannel, uchar outBlock[16][4]) {
+		int palette[8];
+		palette[0] = inData[0];
+		palette[1] = inData[1];
+		if (palette[0] > palette[1]) {
+			for (int i = 2; i < 8; i++) {
+				palette[i] = ((8 - i) * palette[0] + (i - 1) * palette[1]) / 7;
+			}
+		}
+		else {
+			for (int i = 2; i < 6; i++) {
+				palette[i] = ((6 - i) * palette[0] + (i - 1) * palette[1]) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+		quint64 indices = 0;
+		for (int i = 0; i < 6; i++) {
+			indices |= quint64(inData[2 + i]) << (8 * i);
+		}
+		for (int i = 0; i < 16; i++) {
+			outBlock[i][inChannel] = palette[(indices >> (3 * i)) & 7];
+		}
+	}
+
+	static bool decodeBlock(Compression inCompression, const uchar* inData, uchar outBlock[16][4]) {
+		switch (inCompression) {
+		case Compression::BC1:
+			decodeColorBlock(inData, outBlock);
+			return true;
+		case Compression::BC3:
+			decodeColorBlock(inData + 8, outBlock);
+			decodeChannelBlock(inData, 3, outBlock);
+			return true;
+		case Compression::BC5:
+			decodeChannelBlock(inData, 0, outBlock);
+			decodeChannelBlock(inData + 8, 1, outBlock);
+			return true;
+		case Compression::BC7:
+			return decodeBC7Mode6(inData, outBlock);
+		default:
+			break;
+		}
+		return false;
+	}
+
+	// Over the first channelCount channels, BC1 carries no alpha and BC5 only red and green
+	static double psnr(const QImage& inImage, const QByteArray& inLevel, Compression inCompression, int inChannelCount) {
+		const int blockBytes = inCompression == Compression::BC1 ? 8 : 16;
+		const int blocksX = inImage.width() / 4;
+		double squaredError = 0.0;
+		for (int by = 0; by < inImage.height() / 4; by++) {
+			for (int bx = 0; bx < blocksX; bx++) {
+				uchar block[16][4] = {};
+				if (!decodeBlock(inCompression, reinterpret_cast<const uchar*>(inLevel.constData()) + (by * blocksX + bx) * blockBytes, block))
+					return 0.0;
+				for (int i = 0; i < 16; i++) {
+					const uchar* texel = inImage.constScanLine(by * 4 + i / 4) + (bx * 4 + i % 4) * 4;
+					for (int c = 0; c < inChannelCount; c++) {
+						const double d = double(texel[c]) - block[i][c];
+						squaredError += d * d;
+					}
+				}
+			}
+		}
+		const double mse = squaredError / (double(inImage.width()) * inImage.height() * inChannelCount);
+		return mse == 0.0 ? 100.0 : 10.0 * std::log10(255.0 * 255.0 / mse);
+	}
+private Q_SLOTS:
+	void initTestCase() {
+		QRhiTextureProcessor::setCacheEnabled(false);
+	}
+
+	void autoPicksFormat() {
+		QRhiTextureProcessor::Options options;
+		options.compression = Compression::Auto;
+		QCOMPARE(QRhiTextureProcessor::process(testImage(64, false), options).format, QRhiTexture::BC1);
+		QCOMPARE(QRhiTextureProcessor::process(testImage(64, true), options).format, QRhiTexture::BC3);
+		options.quality = Quality::High;
+		QCOMPARE(QRhiTextureProcessor::process(testImage(64, true), options).format, QRhiTexture::BC7);
+	}
+
+	void bc7RoundTrip_data() {
+		QTest::addColumn<Quality>("quality");
+		QTest::addColumn<double>("minimumPsnr");
+		QTest::newRow("fast") << Quality::Fast << 28.0;
+		QTest::newRow("high") << Quality::High << 32.0;
+	}
+
+	void bc7RoundTrip() {
+		QFETCH(Quality, quality);
+		QFETCH(double, minimumPsnr);
+		const QImage image = testImage(256, true);
+		QRhiTextureProcessor::Options options;
+		options.compression = Compression::BC7;
+		options.quality = quality;
+		options.generateMips = true;
+		const QRhiTextureProcessor::Result result = QRhiTextureProcessor::process(image, options);
+		QCOMPARE(result.format, QRhiTexture::BC7);
+		QCOMPARE(result.levels.size(), 9);
+		QCOMPARE(result.levels[0].size(), qsizetype(64 * 64 * 16));
+		const double decodedPsnr = psnr(image, result.levels[0], Compression::BC7, 4);
+		qInfo("BC7 %s PSNR: %.2f dB", QTest::currentDataTag(), decodedPsnr);
+		QVERIFY(decodedPsnr >= minimumPsnr);
+	}
+
+	void bcRoundTrip_data() {
+		QTest::addColumn<Compression>("compression");
+		QTest::addColumn<QRhiTexture::Format>("format");
+		QTest::addColumn<bool>("translucent");
+		QTest::addColumn<int>("channelCount");
+		QTest::addColumn<int>("blockBytes");
+		QTest::addColumn<double>("minimumPsnr");
+		QTest::newRow("BC1") << Compression::BC1 << QRhiTexture::BC1 << false << 3 << 8 << 30.0;
+		QTest::newRow("BC3") << Compression::BC3 << QRhiTexture::BC3 << true << 4 << 16 << 30.0;
+		QTest::newRow("BC5") << Compression::BC5 << QRhiTexture::BC5 << false << 2 << 16 << 36.0;
+	}
+
+	void bcRoundTrip() {
+		QFETCH(Compression, compression);
+		QFETCH(QRhiTexture::Format, format);
+		QFETCH(bool, translucent);
+		QFETCH(int, channelCount);
+		QFETCH(int, blockBytes);
+		QFETCH(double, minimumPsnr);
+		const QImage image = testImage(256, translucent);
+		for (Quality quality : { Quality::Fast, Quality::High }) {
+			QRhiTextureProcessor::Options options;
+			options.compression = compression;
+			options.quality = quality;
+			const QRhiTextureProcessor::Result result = QRhiTextureProcessor::process(image, options);
+			QCOMPARE(result.format, format);
+			QCOMPARE(result.levels.size(), 1);
+			QCOMPARE(result.levels[0].size(), qsizetype(64 * 64 * blockBytes));
+			const double decodedPsnr = psnr(image, result.levels[0], compression, channelCount);
+			qInfo("%s %s PSNR: %.2f dB", QTest::currentDataTag(), quality == Quality::High ? "high" : "fast", decodedPsnr);
+			QVERIFY(decodedPsnr >= minimumPsnr);
+		}
+	}
+
+	void memoryCacheSharesResults() {
+		QRhiTextureProcessor::clearMemoryCache();
+		QRhiTextureProcessor::resetStatistics();
+		QImage image = testImage(128, false);
+		QRhiTextureProcessor::Options options;
+		options.compression = Compression::BC1;
+		options.generateMips = true;
+		const QRhiTextureProcessor::Result first = QRhiTextureProcessor::process(image, options);
+		const QRhiTextureProcessor::Result second = QRhiTextureProcessor::process(image, options);
+		QCOMPARE(QRhiTextureProcessor::getStatistics().memoryCacheHits, quint64(1));
+		QCOMPARE(second.levels.size(), first.levels.size());
+		QCOMPARE(second.levels[0].constData(), first.levels[0].constData());
+
+		// Other options and written pixels are different entries
+		options.quality = Quality::High;
+		QRhiTextureProcessor::process(image, options);
+		image.setPixel(0, 0, 0xFF000000);
+		QRhiTextureProcessor::process(image, options);
+		QCOMPARE(QRhiTextureProcessor::getStatistics().memoryCacheHits, quint64(1));
+		QCOMPARE(QRhiTextureProcessor::getStatistics().processedTextures, quint64(4));
+	}
+
+	void encodeThroughput_data() {
+		QTest::addColumn<Compression>("compression");
+		QTest::addColumn<Quality>("quality");
+		const QList<QPair<const char*, Compression>> formats = {
+			{ "BC1", Compression::BC1 },
+			{ "BC3", Compression::BC3 },
+			{ "BC5", Compression::BC5 },
+			{ "BC7", Compression::BC7 },
+		};
+		for (const auto& format : formats) {
+			QTest::addRow("%s fast", format.first) << format.second << Quality::Fast;
+			QTest::addRow("%s high", format.first) << format.second << Quality::High;
+		}
+	}
+
+	// Reported as source bytes per second over a 2048x2048 top level, the figure the processor also plots to Tracy
+	void encodeThroughput() {
+		QFETCH(Compression, compression);
+		QFETCH(Quality, quality);
+		const QImage image = testImage(2048, true);
+		QRhiTextureProcessor::Options options;
+		options.compression = compression;
+		options.quality = quality;
+		QRhiTextureProcessor::resetStatistics();
+		for (int i = 0; i < 3; i++) {
+			QRhiTextureProcessor::clearMemoryCache();
+			QVERIFY(QRhiTextureProcessor::process(image, options).isValid());
+		}
+		const QRhiTextureProcessor::Statistics statistics = QRhiTextureProcessor::getStatistics();
+		qInfo("%s: %.1f MB/s", QTest::currentDataTag(), statistics.encodeThroughputMBs());
+		QTest::setBenchmarkResult(statistics.encodeThroughputMBs() * 1024.0 * 1024.0, QTest::BytesPerSecond);
+	}
+};
+
+QTEST_MAIN(tst_TextureProcessor)
+#include "tst_TextureProcessor.moc"
@@ -0,0 +1,126 @@
+#include <QtTest>
+#include "Render/RHI/QRhiHelper.h"
+#include "Render/RHI/QRhiUniformBlock.h"
+#include "Render/RHI/QRhiUniformRing.h"
+
+class TestUniformBlock : public QRhiUniformBlock {
+public:
+	const QByteArray& stagingData() const { return mStagingData; }
+};
+
+class tst_UniformBlock : public QObject {
+	Q_OBJECT
+private:
+	using Mat4 = QGenericMatrix<4, 4, float>;
+
+	static Mat4 translation(float x) {
+		QMatrix4x4 matrix;
+		matrix.translate(x, 0.0f, 0.0f);
+		return matrix.toGenericMatrix<4, 4>();
+	}
+private Q_SLOTS:
+	void initTestCase() {
+		mRhi = QRhiHelper::create(QRhi::Null);
+		QVERIFY(mRhi);
+	}
+
+	void cleanupTestCase() {
+		mRhi.reset();
+	}
+
+	void layoutIsStd140() {
+		TestUniformBlock block;
+		block.addParam("Scale", 1.0f)
+			->addParam("Direction", QVector3D())
+			->addParam("MVP", Mat4());
+		QRhiUniformRing ring(mRhi.get());
+		block.create(&ring);
+		QCOMPARE(block.getParamDesc("Scale")->mOffsetInByte, 0u);
+		QCOMPARE(block.getParamDesc("Direction")->mOffsetInByte, 16u);
+		QCOMPARE(block.getParamDesc("MVP")->mOffsetInByte, 32u);
+		QCOMPARE(block.getDataByteSize(), 96u);
+	}
+
+	void typedWriteMatchesVariant() {
+		TestUniformBlock variantBlock;
+		TestUniformBlock typedBlock;
+		for (TestUniformBlock* block : { &variantBlock, &typedBlock })
+			block->addParam("Scale", 0.0f)->addParam("MVP", Mat4());
+		QRhiUniformRing ring(mRhi.get());
+		variantBlock.create(&ring);
+		typedBlock.create(&ring);
+		variantBlock.setParamValue("Scale", 2.0f);
+		variantBlock.setParamValue("MVP", translation(3.0f));
+		variantBlock.updateResource(&ring);
+		typedBlock.setParamValue(typedBlock.getParamHandle("Scale"), 2.0f);
+		typedBlock.setParamValue(typedBlock.getParamHandle("MVP"), translation(3.0f));
+		typedBlock.updateResource(&ring);
+		QCOMPARE(typedBlock.stagingData(), variantBlock.stagingData());
+	}
+
+	void ringGrowsBetweenFrames() {
+		QRhiUniformRing ring(mRhi.get(), 1024);
+		const QByteArray block(256, 0);
+		QRhiBuffer* buffer = ring.getBuffer();
+		for (int i = 0; i < 4; i++)
+			QVERIFY(ring.allocate(block.constData(), block.size()) != QRhiUniformRing::InvalidOffset);
+		// Bound draws may already reference the buffer, so a full ring refuses instead of resizing mid-frame
+		QCOMPARE(ring.allocate(block.constData(), block.size()), QRhiUniformRing::InvalidOffset);
+		QCOMPARE(ring.getStatistics().frameOverflows, quint64(1));
+		QCOMPARE(ring.getBuffer()->size(), 1024u);
+
+		ring.nextFrame();
+		QCOMPARE(ring.getBuffer(), buffer);
+		QVERIFY(ring.getBuffer()->size() >= 5 * 256u);
+		for (int i = 0; i < 5; i++)
+			QVERIFY(ring.allocate(block.constData(), block.size()) != QRhiUniformRing::InvalidOffset);
+		QCOMPARE(ring.getStatistics().frameOverflows, quint64(0));
+	}
+
+	void stageTransforms_data() {
+		QTest::addColumn<bool>("typed");
+		QTest::newRow("variant") << false;
+		QTest::newRow("handle") << true;
+	}
+
+	// 10k blocks of MVP + M written and staged into the ring per frame, the shape of a large static mesh scene
+	void stageTransforms() {
+		QFETCH(bool, typed);
+		const int blockCount = 10000;
+		QRhiUniformRing ring(mRhi.get());
+		QVector<QSharedPointer<QRhiUniformBlock>> blocks;
+		QVector<QRhiUniformBlock::ParamHandle> handles;
+		for (int i = 0; i < blockCount; i++) {
+			QSharedPointer<QRhiUniformBlock> block = QSharedPointer<QRhiUniformBlock>::create();
+			block->addParam("MVP", Mat4())->addParam("M", Mat4());
+			block->create(&ring);
+			handles << block->getParamHandle("MVP") << block->getParamHandle("M");
+			blocks << block;
+		}
+		float frame = 0.0f;
+		QBENCHMARK {
+			frame += 1.0f;
+			for (int i = 0; i < blockCount; i++) {
+				const Mat4 m = translation(frame + i);
+				if (typed) {
+					blocks[i]->setParamValue(handles[i * 2], m);
+					blocks[i]->setParamValue(handles[i * 2 + 1], m);
+				}
+				else {
+					blocks[i]->setParamValue("MVP", QVariant::fromValue(m));
+					blocks[i]->setParamValue("M", QVariant::fromValue(m));
+				}
+				blocks[i]->updateResource(&ring);
+			}
+			QRhiResourceUpdateBatch* batch = mRhi->nextResourceUpdateBatch();
+			ring.flush(batch);
+			batch->release();
+			ring.nextFrame();
+		}
+	}
+private:
+	QSharedPointer<QRhi> mRhi;
+};
+
+QTEST_MAIN(tst_UniformBlock)
+#include "tst_UniformBlock.moc"